@@ -42,6 +42,7 @@ authd_cmd_handler authd_cmd_handlers[256] = {
 
 authd_stat_handler authd_stat_handlers[256] = {
 	['D'] = enumerate_nameservers,
+	['P'] = provider_stats,
 };
 
 authd_reload_handler authd_reload_handlers[256] = {
@@ -127,6 +127,8 @@ handle_lookup_ip_reply(void *data, struct DNSReply *reply)
 	if(reply == NULL)
 		goto end;
 
+	query->ttl = reply->ttl;
+
 	switch(query->type)
 	{
 	case QUERY_A:
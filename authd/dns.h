@@ -45,6 +45,7 @@ struct dns_query
 	query_type type;
 	struct rb_sockaddr_storage addr;
 	uint64_t id;
+	time_t ttl;			/* of the answer, valid in the callback */
 
 	DNSCB callback;
 	void *data;
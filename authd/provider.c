@@ -44,6 +44,11 @@
  * have to talk to bandb directly first.
  *
  * --Elizafox, 9 March 2016
+ *
+ * The ircd can mark providers advisory. Once only advisory providers are
+ * still running, the client is admitted: the ircd lets it register, and an
+ * advisory provider that rejects it later has it killed. The ircd can also
+ * give each provider a deadline counted from when the client connected.
  */
 
 #include "stdinc.h"
@@ -54,6 +59,7 @@
 #include "notice.h"
 
 static EVH provider_timeout_event;
+static void set_admission_policy(const char *key, int parc, const char **parv);
 
 rb_dictionary *auth_clients;
 rb_dlink_list auth_providers;
@@ -62,6 +68,9 @@ static rb_dlink_list free_pids;
 static uint32_t allocated_pids;
 static struct ev_entry *timeout_ev;
 
+static struct auth_opts_handler admission_handler =
+	{ "admission", 3, set_admission_policy };
+
 /* Set a provider's raw status */
 static inline void
 set_provider_status(struct auth_client *auth, uint32_t provider, provider_status_t status)
@@ -81,8 +90,23 @@ set_provider_running(struct auth_client *auth, uint32_t provider)
 static inline void
 set_provider_done(struct auth_client *auth, uint32_t provider)
 {
+	const struct timeval *now = rb_current_time_tv();
+	long ms;
+
+	/* A provider that rejected the client is done already */
+	if(!is_provider_running(auth, provider))
+		return;
+
 	set_provider_status(auth, provider, PROVIDER_STATUS_DONE);
 	auth->providers_active--;
+
+	/* Cut short by cancel_providers(), it never got its answer */
+	if(auth->providers_cancelled)
+		return;
+
+	ms = (now->tv_sec - auth->started.tv_sec) * 1000 +
+		(now->tv_usec - auth->started.tv_usec) / 1000;
+	rb_histogram_add(&auth->data[provider].provider->latency, ms > 0 ? ms : 0);
 }
 
 /* Initalise all providers */
@@ -91,6 +115,7 @@ init_providers(void)
 {
 	auth_clients = rb_dictionary_create("pending auth clients", rb_uint32cmp);
 	timeout_ev = rb_event_addish("provider_timeout_event", provider_timeout_event, NULL, 1);
+	rb_dictionary_add(authd_option_handlers, admission_handler.option, &admission_handler);
 
 	/* FIXME must be started before rdns/ident to receive completion notification from them */
 	load_provider(&dnsbl_provider);
@@ -229,6 +254,35 @@ cancel_providers(struct auth_client *auth)
 	}
 }
 
+/* Let the client register if only advisory providers are left */
+static void
+admit_client(struct auth_client *auth)
+{
+	char pending[MAX_PROVIDERS + 1];
+	size_t len = 0;
+	rb_dlink_node *ptr;
+
+	if(auth->admitted || auth->providers_cancelled)
+		return;
+
+	RB_DLINK_FOREACH(ptr, auth_providers.head)
+	{
+		struct auth_provider *provider = ptr->data;
+
+		if(!is_provider_running(auth, provider->id))
+			continue;
+
+		if(!provider->advisory)
+			return;
+
+		pending[len++] = provider->letter;
+	}
+	pending[len] = '\0';
+
+	auth->admitted = true;
+	rb_helper_write(authd_helper, "A %x %s %s %s", auth->cid, auth->username, auth->hostname, pending);
+}
+
 /* Provider is done */
 void
 provider_done(struct auth_client *auth, uint32_t id)
@@ -248,6 +302,9 @@ provider_done(struct auth_client *auth, uint32_t id)
 		return;
 	}
 
+	if(!auth->providers_starting)
+		admit_client(auth);
+
 	RB_DLINK_FOREACH(ptr, auth_providers.head)
 	{
 		struct auth_provider *provider = ptr->data;
@@ -330,6 +387,8 @@ start_auth(const char *cid, const char *l_ip, const char *l_port, const char *c_
 	rb_strlcpy(auth->hostname, "*", sizeof(auth->hostname));
 	rb_strlcpy(auth->username, "*", sizeof(auth->username));
 
+	auth->started = *rb_current_time_tv();
+
 	auth->data = rb_malloc(allocated_pids * sizeof(struct auth_client_data));
 
 	auth->providers_starting = true;
@@ -355,6 +414,8 @@ start_auth(const char *cid, const char *l_ip, const char *l_port, const char *c_
 	/* If no providers are running, accept the client */
 	if(auth->providers_active == 0)
 		accept_client(auth);
+	else
+		admit_client(auth);
 
 done:
 	auth_client_unref(auth);
@@ -420,9 +481,12 @@ provider_timeout_event(void *notused __unused)
 		{
 			struct auth_provider *provider = ptr->data;
 			const time_t timeout = get_provider_timeout(auth, provider->id);
+			bool expired = timeout > 0 && timeout < curtime;
 
-			if(is_provider_running(auth, provider->id) && provider->timeout != NULL &&
-				timeout > 0 && timeout < curtime)
+			if(provider->deadline > 0 && auth->started.tv_sec + provider->deadline <= curtime)
+				expired = true;
+
+			if(is_provider_running(auth, provider->id) && provider->timeout != NULL && expired)
 			{
 				provider->timeout(auth);
 			}
@@ -431,3 +495,49 @@ provider_timeout_event(void *notused __unused)
 		auth_client_unref(auth);
 	}
 }
+
+/* O admission <provider> <required|advisory> <deadline> */
+static void
+set_admission_policy(const char *key, int parc, const char **parv)
+{
+	struct auth_provider *provider = find_provider(parv[0]);
+	int deadline = atoi(parv[2]);
+
+	if(provider == NULL)
+	{
+		warn_opers(L_WARN, "provider: admission policy for unknown provider %s", parv[0]);
+		return;
+	}
+
+	if(deadline < 0)
+	{
+		warn_opers(L_CRIT, "provider: admission deadline < 0 (provider %s, value: %d)", parv[0], deadline);
+		exit(EX_PROVIDER_ERROR);
+	}
+
+	provider->advisory = (strcasecmp(parv[1], "advisory") == 0);
+	provider->deadline = deadline;
+}
+
+/* One line per provider: name policy deadline count p50 p90 p99 max, in ms */
+void
+provider_stats(uint32_t rid, char letter)
+{
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, auth_providers.head)
+	{
+		struct auth_provider *provider = ptr->data;
+		const struct rb_histogram *hist = &provider->latency;
+
+		stats_result(rid, letter, "%s %s %ld %llu %llu %llu %llu %llu",
+				provider->name, provider->advisory ? "advisory" : "required",
+				(long)provider->deadline, hist->count,
+				rb_histogram_percentile(hist, 50),
+				rb_histogram_percentile(hist, 90),
+				rb_histogram_percentile(hist, 99),
+				hist->max);
+	}
+
+	stats_done(rid, letter);
+}
@@ -59,6 +59,9 @@ struct auth_client
 	char hostname[HOSTLEN + 1];		/* Used for DNS lookup */
 	char username[USERLEN + 1];		/* Used for ident lookup */
 
+	struct timeval started;			/* When we got the client, deadlines count from here */
+	bool admitted;				/* ircd may register it, advisory providers still running */
+
 	bool providers_starting;		/* Providers are still warming up */
 	bool providers_cancelled;		/* Providers are being cancelled */
 	unsigned int providers_active;		/* Number of active providers */
@@ -101,6 +104,12 @@ struct auth_provider
 	struct auth_stats_handler stats_handler;
 
 	struct auth_opts_handler *opt_handlers;
+
+	/* Admission policy, set by the ircd */
+	bool advisory;			/* Client may register before we finish */
+	time_t deadline;		/* Seconds after connection to give up, 0 for none */
+
+	struct rb_histogram latency;	/* Milliseconds from connection until done */
 };
 
 extern struct auth_provider rdns_provider;
@@ -122,6 +131,8 @@ void provider_done(struct auth_client *auth, uint32_t id);
 void accept_client(struct auth_client *auth);
 void reject_client(struct auth_client *auth, uint32_t id, const char *data, const char *fmt, ...);
 
+void provider_stats(uint32_t rid, char letter);
+
 void handle_new_connection(int parc, char *parv[]);
 void handle_cancel_connection(int parc, char *parv[]);
 void auth_client_free(struct auth_client *auth);
@@ -67,18 +67,32 @@ struct dnsbl
 	bool delete;			/* If true delete when no clients */
 	int refcount;			/* When 0 and delete is set, remove this dnsbl */
 	unsigned int hits;
+	unsigned int cache_hits;	/* Lookups answered from the cache */
+	unsigned int coalesced;		/* Lookups that joined a query in flight */
+	unsigned int queries;		/* Queries sent to the resolver */
 
 	time_t lastwarning;		/* Last warning about garbage replies sent */
 };
 
+/* The answer for one address from one DNSBL, shared by every client asking */
+struct dnsbl_cache
+{
+	char *name;			/* Reversed IP and dnsbl host */
+	struct dns_query *query;	/* DNS query pointer, NULL once answered */
+	rb_dlink_list waiters;		/* Lookups waiting for the query */
+	char result[HOSTIPLEN];		/* Answer, empty if not listed */
+	time_t expires;			/* When the answer must be asked for again */
+};
+
 /* A lookup in progress for a particular DNSBL for a particular client */
 struct dnsbl_lookup
 {
 	struct dnsbl *bl;		/* dnsbl we're checking */
 	struct auth_client *auth;	/* Client */
-	struct dns_query *query;	/* DNS query pointer */
+	struct dnsbl_cache *cache;	/* Answer we're waiting for */
 
 	rb_dlink_node node;
+	rb_dlink_node cnode;		/* Node in cache->waiters */
 };
 
 /* A dnsbl filter */
@@ -98,6 +112,7 @@ struct dnsbl_user
 };
 
 /* public interfaces */
+static bool dnsbls_init(void);
 static void dnsbls_destroy(void);
 
 static bool dnsbls_start(struct auth_client *);
@@ -110,13 +125,17 @@ static void dnsbls_cancel_none(struct auth_client *);
 static void unref_dnsbl(struct dnsbl *);
 static struct dnsbl *new_dnsbl(const char *, const char *, uint8_t, rb_dlink_list *);
 static struct dnsbl *find_dnsbl(const char *);
-static bool dnsbl_check_reply(struct dnsbl_lookup *, const char *);
+static bool dnsbl_check_reply(struct dnsbl *, const char *);
 static void dnsbl_dns_callback(const char *, bool, query_type, void *);
-static void initiate_dnsbl_dnsquery(struct dnsbl *, struct auth_client *);
+static bool initiate_dnsbl_dnsquery(struct dnsbl *, struct auth_client *);
+static void free_dnsbl_lookup(struct dnsbl_user *, struct dnsbl_lookup *);
+static void dnsbl_cache_expire(void *);
 
 /* Variables */
 static rb_dlink_list dnsbl_list = { NULL, NULL, 0 };
 static int dnsbl_timeout = DNSBL_TIMEOUT_DEFAULT;
+static rb_dictionary *dnsbl_cache;
+static struct ev_entry *dnsbl_cache_ev;
 
 /* private interfaces */
 
@@ -183,9 +202,8 @@ find_dnsbl(const char *name)
 }
 
 static inline bool
-dnsbl_check_reply(struct dnsbl_lookup *bllookup, const char *ipaddr)
+dnsbl_check_reply(struct dnsbl *bl, const char *ipaddr)
 {
-	struct dnsbl *bl = bllookup->bl;
 	const char *lastoctet;
 	rb_dlink_node *ptr;
 
@@ -231,14 +249,51 @@ blwarn:
 }
 
 static void
-dnsbl_dns_callback(const char *result, bool status, query_type type, void *data)
+free_cache_entry(struct dnsbl_cache *entry)
+{
+	rb_dictionary_delete(dnsbl_cache, entry->name);
+	rb_free(entry->name);
+	rb_free(entry);
+}
+
+static void
+free_dnsbl_lookup(struct dnsbl_user *bluser, struct dnsbl_lookup *bllookup)
+{
+	struct dnsbl_cache *entry = bllookup->cache;
+
+	rb_dlinkDelete(&bllookup->cnode, &entry->waiters);
+	if(entry->query != NULL && !rb_dlink_list_length(&entry->waiters))
+	{
+		/* Nobody else wants the answer */
+		cancel_query(entry->query);
+		free_cache_entry(entry);
+	}
+
+	unref_dnsbl(bllookup->bl);
+	rb_dlinkDelete(&bllookup->node, &bluser->queries);
+	rb_free(bllookup);
+}
+
+static void
+dnsbls_done(struct auth_client *auth)
+{
+	notice_client(auth->cid, "*** No DNSBL entry found for this IP");
+	rb_free(get_provider_data(auth, SELF_PID));
+	set_provider_data(auth, SELF_PID, NULL);
+	set_provider_timeout_absolute(auth, SELF_PID, 0);
+	provider_done(auth, SELF_PID);
+
+	auth_client_unref(auth);
+}
+
+static void
+dnsbl_lookup_result(struct dnsbl_lookup *bllookup)
 {
-	struct dnsbl_lookup *bllookup = (struct dnsbl_lookup *)data;
 	struct dnsbl_user *bluser;
 	struct dnsbl *bl;
 	struct auth_client *auth;
+	const char *result = bllookup->cache->result;
 
-	lrb_assert(bllookup != NULL);
 	lrb_assert(bllookup->auth != NULL);
 
 	bl = bllookup->bl;
@@ -247,7 +302,7 @@ dnsbl_dns_callback(const char *result, bool status, query_type type, void *data)
 	if((bluser = get_provider_data(auth, SELF_PID)) == NULL)
 		return;
 
-	if (result != NULL && status && dnsbl_check_reply(bllookup, result))
+	if (*result != '\0' && dnsbl_check_reply(bl, result))
 	{
 		/* Match found, so proceed no further */
 		bl->hits++;
@@ -256,49 +311,91 @@ dnsbl_dns_callback(const char *result, bool status, query_type type, void *data)
 		return;
 	}
 
-	unref_dnsbl(bl);
-	cancel_query(bllookup->query);	/* Ignore future responses */
-	rb_dlinkDelete(&bllookup->node, &bluser->queries);
-	rb_free(bllookup);
+	free_dnsbl_lookup(bluser, bllookup);
 
 	if(!rb_dlink_list_length(&bluser->queries))
-	{
 		/* Done here */
-		notice_client(auth->cid, "*** No DNSBL entry found for this IP");
-		rb_free(bluser);
-		set_provider_data(auth, SELF_PID, NULL);
-		set_provider_timeout_absolute(auth, SELF_PID, 0);
-		provider_done(auth, SELF_PID);
+		dnsbls_done(auth);
+}
+
+static void
+dnsbl_dns_callback(const char *result, bool status, query_type type, void *data)
+{
+	struct dnsbl_cache *entry = data;
+	rb_dlink_node *ptr, *nptr;
+	time_t ttl = DNSBL_CACHE_NEGATIVE;
+
+	lrb_assert(entry != NULL);
+
+	entry->result[0] = '\0';
+	if (result != NULL && status)
+	{
+		rb_strlcpy(entry->result, result, sizeof(entry->result));
+		ttl = entry->query->ttl < DNSBL_CACHE_MAX ? entry->query->ttl : DNSBL_CACHE_MAX;
+	}
+
+	/* The query is freed when we return */
+	entry->query = NULL;
+	entry->expires = rb_current_time() + ttl;
 
-		auth_client_unref(auth);
+	/* Each waiter belongs to a different client, so rejecting one
+	 * leaves the rest of the list alone.
+	 */
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, entry->waiters.head)
+	{
+		dnsbl_lookup_result(ptr->data);
 	}
 }
 
-static void
+/* Returns true if a cached answer already lists the client */
+static bool
 initiate_dnsbl_dnsquery(struct dnsbl *bl, struct auth_client *auth)
 {
-	struct dnsbl_lookup *bllookup = rb_malloc(sizeof(struct dnsbl_lookup));
+	struct dnsbl_lookup *bllookup;
 	struct dnsbl_user *bluser = get_provider_data(auth, SELF_PID);
+	struct dnsbl_cache *entry;
 	char buf[IRCD_RES_HOSTLEN + 1];
 	int aftype;
 
-	bllookup->bl = bl;
-	bllookup->auth = auth;
-
 	aftype = GET_SS_FAMILY(&auth->c_addr);
 	if((aftype == AF_INET && (bl->iptype & IPTYPE_IPV4) == 0) ||
 		(aftype == AF_INET6 && (bl->iptype & IPTYPE_IPV6) == 0))
 		/* Incorrect dnsbl type for this IP... */
+		return false;
+
+	build_rdns(buf, sizeof(buf), &auth->c_addr, bl->host);
+
+	if((entry = rb_dictionary_retrieve(dnsbl_cache, buf)) == NULL)
 	{
-		rb_free(bllookup);
-		return;
+		entry = rb_malloc(sizeof(struct dnsbl_cache));
+		entry->name = rb_strdup(buf);
+		rb_dictionary_add(dnsbl_cache, entry->name, entry);
+	}
+	else if(entry->query != NULL)
+		/* Someone else is already asking */
+		bl->coalesced++;
+	else if(entry->expires > rb_current_time())
+	{
+		bl->cache_hits++;
+		return *entry->result != '\0' && dnsbl_check_reply(bl, entry->result);
 	}
 
-	build_rdns(buf, sizeof(buf), &auth->c_addr, bl->host);
-	bllookup->query = lookup_ip(buf, AF_INET, dnsbl_dns_callback, bllookup);
+	if(entry->query == NULL)
+	{
+		entry->query = lookup_ip(buf, AF_INET, dnsbl_dns_callback, entry);
+		bl->queries++;
+	}
+
+	bllookup = rb_malloc(sizeof(struct dnsbl_lookup));
+	bllookup->bl = bl;
+	bllookup->auth = auth;
+	bllookup->cache = entry;
 
 	rb_dlinkAdd(bllookup, &bllookup->node, &bluser->queries);
+	rb_dlinkAdd(bllookup, &bllookup->cnode, &entry->waiters);
 	bl->refcount++;
+
+	return false;
 }
 
 static inline bool
@@ -306,6 +403,7 @@ lookup_all_dnsbls(struct auth_client *auth)
 {
 	struct dnsbl_user *bluser = get_provider_data(auth, SELF_PID);
 	rb_dlink_node *ptr;
+	bool checked = false;
 	int iptype;
 
 	if(GET_SS_FAMILY(&auth->c_addr) == AF_INET)
@@ -322,19 +420,50 @@ lookup_all_dnsbls(struct auth_client *auth)
 	{
 		struct dnsbl *bl = (struct dnsbl *)ptr->data;
 
-		if (!bl->delete && (bl->iptype & iptype))
-			initiate_dnsbl_dnsquery(bl, auth);
+		if (bl->delete || !(bl->iptype & iptype))
+			continue;
+
+		checked = true;
+		if (initiate_dnsbl_dnsquery(bl, auth))
+		{
+			/* Listed, no need to wait for the others */
+			bl->hits++;
+			reject_client(auth, SELF_PID, bl->host, bl->reason);
+			dnsbls_cancel(auth);
+			return true;
+		}
 	}
 
-	if(!rb_dlink_list_length(&bluser->queries))
+	if(!checked)
 		/* None checked. */
 		return false;
 
+	if(!rb_dlink_list_length(&bluser->queries))
+	{
+		/* Every answer was cached */
+		dnsbls_done(auth);
+		return true;
+	}
+
 	set_provider_timeout_relative(auth, SELF_PID, dnsbl_timeout);
 
 	return true;
 }
 
+static void
+dnsbl_cache_expire(void *unused)
+{
+	rb_dictionary_iter iter;
+	struct dnsbl_cache *entry;
+
+	RB_DICTIONARY_FOREACH(entry, &iter, dnsbl_cache)
+	{
+		/* Entries still being asked for have no expiry yet */
+		if(entry->query == NULL && entry->expires <= rb_current_time())
+			free_cache_entry(entry);
+	}
+}
+
 static inline void
 delete_dnsbl(struct dnsbl *bl)
 {
@@ -359,6 +488,14 @@ delete_all_dnsbls(void)
 }
 
 /* public interfaces */
+static bool
+dnsbls_init(void)
+{
+	dnsbl_cache = rb_dictionary_create("dnsbl cache", rb_strcasecmp);
+	dnsbl_cache_ev = rb_event_addish("dnsbl_cache_expire", dnsbl_cache_expire, NULL, 60);
+	return true;
+}
+
 static bool
 dnsbls_start(struct auth_client *auth)
 {
@@ -380,6 +517,10 @@ dnsbls_start(struct auth_client *auth)
 			dnsbls_cancel_none(auth);
 			return true;
 		}
+
+		/* A cached listing rejected them already */
+		if (auth->providers_cancelled)
+			return false;
 	}
 
 	return true;
@@ -421,13 +562,7 @@ dnsbls_generic_cancel(struct auth_client *auth, const char *message)
 
 		RB_DLINK_FOREACH_SAFE(ptr, nptr, bluser->queries.head)
 		{
-			struct dnsbl_lookup *bllookup = ptr->data;
-
-			cancel_query(bllookup->query);
-			unref_dnsbl(bllookup->bl);
-
-			rb_dlinkDelete(&bllookup->node, &bluser->queries);
-			rb_free(bllookup);
+			free_dnsbl_lookup(bluser, ptr->data);
 		}
 	}
 
@@ -457,6 +592,15 @@ dnsbls_cancel_none(struct auth_client *auth)
 	dnsbls_generic_cancel(auth, "*** Could not check DNSBLs");
 }
 
+static void
+dnsbl_cache_free(rb_dictionary_element *delem, void *unused)
+{
+	struct dnsbl_cache *entry = delem->data;
+
+	rb_free(entry->name);
+	rb_free(entry);
+}
+
 static void
 dnsbls_destroy(void)
 {
@@ -470,6 +614,9 @@ dnsbls_destroy(void)
 	}
 
 	delete_all_dnsbls();
+
+	rb_event_delete(dnsbl_cache_ev);
+	rb_dictionary_destroy(dnsbl_cache, dnsbl_cache_free, NULL);
 }
 
 static void
@@ -565,7 +712,6 @@ add_conf_dnsbl_timeout(const char *key, int parc, const char **parv)
 	dnsbl_timeout = timeout;
 }
 
-#if 0
 static void
 dnsbl_stats(uint32_t rid, char letter)
 {
@@ -578,12 +724,12 @@ dnsbl_stats(uint32_t rid, char letter)
 		if(bl->delete)
 			continue;
 
-		stats_result(rid, letter, "%s %hhu %u", bl->host, bl->iptype, bl->hits);
+		stats_result(rid, letter, "%s %hhu %u %u %u %u", bl->host, bl->iptype,
+				bl->hits, bl->cache_hits, bl->coalesced, bl->queries);
 	}
 
 	stats_done(rid, letter);
 }
-#endif
 
 struct auth_opts_handler dnsbl_options[] =
 {
@@ -598,11 +744,12 @@ struct auth_provider dnsbl_provider =
 {
 	.name = "dnsbl",
 	.letter = 'B',
+	.init = dnsbls_init,
 	.destroy = dnsbls_destroy,
 	.start = dnsbls_start,
 	.cancel = dnsbls_cancel,
 	.timeout = dnsbls_timeout,
 	.completed = dnsbls_initiate,
 	.opt_handlers = dnsbl_options,
-	/* .stats_handler = { 'B', dnsbl_stats }, */
+	.stats_handler = { 'B', dnsbl_stats },
 };
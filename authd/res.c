@@ -881,5 +881,6 @@ make_dnsreply(struct reslist *request)
 
 	cp->h_name = request->name;
 	memcpy(&cp->addr, &request->addr, sizeof(cp->addr));
+	cp->ttl = request->ttl;
 	return (cp);
 }
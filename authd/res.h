@@ -17,6 +17,7 @@ struct DNSReply
 {
   char *h_name;
   struct rb_sockaddr_storage addr;
+  time_t ttl;
 };
 
 struct DNSQuery
@@ -37,6 +37,8 @@
 #define MAXPARA 10
 
 #define COMMIT_INTERVAL 3 /* seconds */
+#define COMMIT_ROWS 5000 /* commit early once this many rows are pending */
+#define LIST_BATCH 1000 /* bans per write to the ircd during a list */
 
 typedef enum
 {
@@ -58,14 +60,50 @@ static const char *bandb_table[LAST_BANDB_TYPE] = {
 
 static rb_helper *bandb_helper;
 static int in_transaction;
+static int transaction_rows;
+static struct ev_entry *commit_ev;
+
+/* statements are prepared once at startup and reused for every request */
+static struct rsdb_stmt *insert_stmt[LAST_BANDB_TYPE];
+static struct rsdb_stmt *delete_stmt[LAST_BANDB_TYPE];
+static struct rsdb_stmt *list_stmt[LAST_BANDB_TYPE];
 
 static void check_schema(void);
+static void prepare_statements(void);
 
 static void
 bandb_commit(void *unused)
 {
 	rsdb_transaction(RSDB_TRANS_END);
 	in_transaction = 0;
+	transaction_rows = 0;
+	commit_ev = NULL;
+}
+
+/* group writes into one transaction, committed on a timer or once it
+ * has grown large enough, whichever comes first
+ */
+static void
+bandb_begin(void)
+{
+	if(!in_transaction)
+	{
+		rsdb_transaction(RSDB_TRANS_START);
+		in_transaction = 1;
+		commit_ev = rb_event_addonce("bandb_commit", bandb_commit, NULL,
+				COMMIT_INTERVAL);
+	}
+}
+
+static void
+bandb_row_done(void)
+{
+	if(++transaction_rows < COMMIT_ROWS)
+		return;
+
+	if(commit_ev != NULL)
+		rb_event_delete(commit_ev);
+	bandb_commit(NULL);
 }
 
 static void
@@ -77,6 +115,7 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	const char *curtime = NULL;
 	const char *reason = NULL;
 	const char *perm = NULL;
+	const char *args[6];
 	int para = 1;
 
 	if(type == BANDB_KLINE)
@@ -97,17 +136,16 @@ parse_ban(bandb_type type, char *parv[], int parc)
 	perm = parv[para++];
 	reason = parv[para++];
 
-	if(!in_transaction)
-	{
-		rsdb_transaction(RSDB_TRANS_START);
-		in_transaction = 1;
-		rb_event_addonce("bandb_commit", bandb_commit, NULL,
-				COMMIT_INTERVAL);
-	}
+	args[0] = mask1;
+	args[1] = mask2 ? mask2 : "";
+	args[2] = oper;
+	args[3] = curtime;
+	args[4] = perm;
+	args[5] = reason;
 
-	rsdb_exec(NULL,
-		  "INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES('%Q', '%Q', '%Q', %s, %s, '%Q')",
-		  bandb_table[type], mask1, mask2 ? mask2 : "", oper, curtime, perm, reason);
+	bandb_begin();
+	rsdb_stmt_exec(insert_stmt[type], 6, args);
+	bandb_row_done();
 }
 
 static void
@@ -115,6 +153,7 @@ parse_unban(bandb_type type, char *parv[], int parc)
 {
 	const char *mask1 = NULL;
 	const char *mask2 = NULL;
+	const char *args[2];
 
 	if(type == BANDB_KLINE)
 	{
@@ -129,48 +168,44 @@ parse_unban(bandb_type type, char *parv[], int parc)
 	if(type == BANDB_KLINE)
 		mask2 = parv[2];
 
-	if(!in_transaction)
-	{
-		rsdb_transaction(RSDB_TRANS_START);
-		in_transaction = 1;
-		rb_event_addonce("bandb_commit", bandb_commit, NULL,
-				COMMIT_INTERVAL);
-	}
+	args[0] = mask1;
+	args[1] = mask2 ? mask2 : "";
 
-	rsdb_exec(NULL, "DELETE FROM %s WHERE mask1='%Q' AND mask2='%Q'",
-		  bandb_table[type], mask1, mask2 ? mask2 : "");
+	bandb_begin();
+	rsdb_stmt_exec(delete_stmt[type], 2, args);
+	bandb_row_done();
 }
 
 static void
 list_bans(void)
 {
-	static char buf[512];
-	struct rsdb_table table;
-	int i, j;
+	const char *row[4];
+	int i, count = 0;
 
 	/* schedule a clear of anything already pending */
 	rb_helper_write_queue(bandb_helper, "C");
 
+	/* rows are streamed straight from sqlite rather than materialised
+	 * as a table, and handed to the ircd in batches so a large ban list
+	 * neither sits entirely in our sendq nor trickles out a line at a
+	 * time.
+	 */
 	for(i = 0; i < LAST_BANDB_TYPE; i++)
 	{
-		rsdb_exec_fetch(&table, "SELECT mask1,mask2,oper,reason FROM %s WHERE 1",
-				bandb_table[i]);
+		rsdb_stmt_bind(list_stmt[i], 0, NULL);
 
-		for(j = 0; j < table.row_count; j++)
+		while(rsdb_stmt_step(list_stmt[i], row, 4))
 		{
 			if(i == BANDB_KLINE)
-				snprintf(buf, sizeof(buf), "%c %s %s %s :%s",
-					    bandb_letter[i], table.row[j][0],
-					    table.row[j][1], table.row[j][2], table.row[j][3]);
+				rb_helper_write_queue(bandb_helper, "%c %s %s %s :%s",
+						bandb_letter[i], row[0], row[1], row[2], row[3]);
 			else
-				snprintf(buf, sizeof(buf), "%c %s %s :%s",
-					    bandb_letter[i], table.row[j][0],
-					    table.row[j][2], table.row[j][3]);
+				rb_helper_write_queue(bandb_helper, "%c %s %s :%s",
+						bandb_letter[i], row[0], row[2], row[3]);
 
-			rb_helper_write_queue(bandb_helper, "%s", buf);
+			if(++count % LIST_BATCH == 0)
+				rb_helper_write_flush(bandb_helper);
 		}
-
-		rsdb_exec_fetch_end(&table);
 	}
 
 	rb_helper_write(bandb_helper, "F");
@@ -244,6 +279,7 @@ error_cb(rb_helper *helper)
 {
 	if(in_transaction)
 		rsdb_transaction(RSDB_TRANS_END);
+	rsdb_shutdown();
 	exit(1);
 }
 
@@ -309,6 +345,7 @@ main(int argc, char *argv[])
 	}
 	rsdb_init(db_error_cb);
 	check_schema();
+	prepare_statements();
 	rb_helper_loop(bandb_helper, 0);
 
 	return 0;
@@ -334,3 +371,22 @@ check_schema(void)
 				  bandb_table[i]);
 	}
 }
+
+static void
+prepare_statements(void)
+{
+	int i;
+
+	for(i = 0; i < LAST_BANDB_TYPE; i++)
+	{
+		insert_stmt[i] = rsdb_prepare("INSERT INTO %s (mask1, mask2, oper, time, perm, reason) VALUES(?, ?, ?, ?, ?, ?)",
+					      bandb_table[i]);
+		delete_stmt[i] = rsdb_prepare("DELETE FROM %s WHERE mask1=? AND mask2=?",
+					      bandb_table[i]);
+		list_stmt[i] = rsdb_prepare("SELECT mask1,mask2,oper,reason FROM %s",
+					    bandb_table[i]);
+
+		if(insert_stmt[i] == NULL || delete_stmt[i] == NULL || list_stmt[i] == NULL)
+			db_error_cb("unable to prepare ban statements");
+	}
+}
@@ -21,6 +21,9 @@ struct rsdb_table
 	void *arg;
 };
 
+/* opaque handle for a prepared (and cached by the caller) statement */
+struct rsdb_stmt;
+
 int rsdb_init(rsdb_error_cb *);
 void rsdb_shutdown(void);
 
@@ -32,6 +35,13 @@ void rsdb_exec_fetch(struct rsdb_table *data, const char *format, ...);
 void rsdb_exec_fetch_end(struct rsdb_table *data);
 
 void rsdb_transaction(rsdb_transtype type);
+
+struct rsdb_stmt *rsdb_prepare(const char *format, ...);
+void rsdb_stmt_bind(struct rsdb_stmt *stmt, int argc, const char **argv);
+int rsdb_stmt_step(struct rsdb_stmt *stmt, const char **row, int ncol);
+void rsdb_stmt_exec(struct rsdb_stmt *stmt, int argc, const char **argv);
+void rsdb_stmt_finalize(struct rsdb_stmt *stmt);
+
 /* rsdb_snprintf.c */
 
 int rs_vsnprintf(char *dest, const size_t bytes, const char *format, va_list args);
@@ -82,14 +82,36 @@ rsdb_init(rsdb_error_cb * ecb)
 		mlog(errbuf);
 		return -1;
 	}
+
+	/* WAL lets bantool and the ircd's bandb read while we are
+	 * writing, and turns each commit into a sequential append.
+	 * NORMAL sync is durable across application crashes, which is
+	 * all that matters for ban storage.
+	 */
+	rsdb_exec(NULL, "PRAGMA journal_mode=WAL");
+	rsdb_exec(NULL, "PRAGMA synchronous=NORMAL");
+
+	/* prepared statements wait out a locked database inside sqlite;
+	 * resetting one to retry would restart a SELECT from its first row
+	 */
+	sqlite3_busy_timeout(rb_bandb, 2500);
 	return 0;
 }
 
 void
 rsdb_shutdown(void)
 {
-	if(rb_bandb)
-		sqlite3_close(rb_bandb);
+	sqlite3_stmt *stmt;
+
+	if(rb_bandb == NULL)
+		return;
+
+	/* sqlite3_close() refuses while any statement is left */
+	while((stmt = sqlite3_next_stmt(rb_bandb, NULL)) != NULL)
+		sqlite3_finalize(stmt);
+
+	sqlite3_close(rb_bandb);
+	rb_bandb = NULL;
 }
 
 const char *
@@ -261,3 +283,102 @@ rsdb_transaction(rsdb_transtype type)
 	else if(type == RSDB_TRANS_END)
 		rsdb_exec(NULL, "COMMIT TRANSACTION");
 }
+
+struct rsdb_stmt *
+rsdb_prepare(const char *format, ...)
+{
+	static char buf[BUFSIZE * 4];
+	sqlite3_stmt *stmt;
+	va_list args;
+	unsigned int i;
+
+	va_start(args, format);
+	i = rs_vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+
+	if(i >= sizeof(buf))
+	{
+		mlog("fatal error: length problem with compiling sql");
+	}
+
+	if(sqlite3_prepare_v2(rb_bandb, buf, -1, &stmt, NULL) != SQLITE_OK)
+	{
+		mlog("fatal error: problem preparing sql: %s", sqlite3_errmsg(rb_bandb));
+		return NULL;
+	}
+
+	return (struct rsdb_stmt *)stmt;
+}
+
+/*
+ * rsdb_stmt_bind
+ *
+ * Resets a prepared statement and binds argv as its text parameters,
+ * in order.  The strings must stay valid until the statement has been
+ * stepped to completion.
+ */
+void
+rsdb_stmt_bind(struct rsdb_stmt *stmt, int argc, const char **argv)
+{
+	sqlite3_stmt *st = (sqlite3_stmt *)stmt;
+	int i;
+
+	sqlite3_reset(st);
+	sqlite3_clear_bindings(st);
+
+	for(i = 0; i < argc; i++)
+		sqlite3_bind_text(st, i + 1, argv[i], -1, SQLITE_STATIC);
+}
+
+/*
+ * rsdb_stmt_step
+ *
+ * Fetches the next row of a prepared statement into row[0..ncol-1].
+ * The column pointers are only valid until the next step.  Returns 1
+ * if a row was fetched and 0 once the statement is done.
+ */
+int
+rsdb_stmt_step(struct rsdb_stmt *stmt, const char **row, int ncol)
+{
+	sqlite3_stmt *st = (sqlite3_stmt *)stmt;
+	int retval;
+	int i;
+
+	retval = sqlite3_step(st);
+
+	switch (retval)
+	{
+	case SQLITE_ROW:
+		for(i = 0; i < ncol; i++)
+		{
+			row[i] = (const char *)sqlite3_column_text(st, i);
+			if(row[i] == NULL)
+				row[i] = "";
+		}
+		return 1;
+
+	case SQLITE_DONE:
+		return 0;
+
+	default:
+		mlog("fatal error: problem with db file: %s", sqlite3_errmsg(rb_bandb));
+		return 0;
+	}
+}
+
+void
+rsdb_stmt_exec(struct rsdb_stmt *stmt, int argc, const char **argv)
+{
+	rsdb_stmt_bind(stmt, argc, argv);
+
+	while(rsdb_stmt_step(stmt, NULL, 0))
+		;
+
+	sqlite3_reset((sqlite3_stmt *)stmt);
+}
+
+void
+rsdb_stmt_finalize(struct rsdb_stmt *stmt)
+{
+	sqlite3_finalize((sqlite3_stmt *)stmt);
+}
@@ -64,7 +64,38 @@ static void me_setfilter(struct MsgBuf *, struct Client *, struct Client *, int,
 static char *filter_data = NULL;
 static size_t filter_data_len = 0;
 static hs_database_t *filter_db;
-static hs_scratch_t *filter_scratch;
+static bool filter_vectored;	/* filter_db was compiled for hs_scan_vector() */
+
+/* everything a scan writes to; filtering happens in the main thread,
+ * but anything filtering elsewhere needs a worker of its own, with its
+ * scratch from hs_clone_scratch() */
+struct filter_worker {
+	hs_scratch_t *scratch;
+	char header[NICKLEN + USERLEN + HOSTLEN + CHANNELLEN + 32];
+	char clean_buffer[BUFSIZE];
+	char check_buffer[2000];	/* header and text, for databases that aren't vectored */
+	unsigned long long scans;
+	unsigned long long matches;
+	struct rb_histogram latency;	/* usec per message, both variants */
+};
+
+static struct filter_worker main_worker;
+
+/* rules are only known by their IDs, which are counted as they match */
+struct filter_rule {
+	unsigned id;
+	unsigned long long hits;
+};
+
+static rb_dictionary *filter_rules;
+
+#define FILTER_MAX_IDS 16
+
+struct filter_match {
+	unsigned actions;
+	unsigned n_ids;
+	unsigned ids[FILTER_MAX_IDS];
+};
 
 static int filter_enable = 1;
 
@@ -110,9 +141,16 @@ modinit(void)
 	filter_umode = user_modes['u'] = find_umode_slot();
 	construct_umodebuf();
 	filter_chmode = cflag_add('u', chm_simple);
+	filter_rules = rb_dictionary_create("filter rules", rb_uint32cmp);
 	return 0;
 }
 
+static void
+free_rule(rb_dictionary_element *delem, void *unused)
+{
+	rb_free(delem->data);
+}
+
 static void
 moddeinit(void)
 {
@@ -122,8 +160,9 @@ moddeinit(void)
 	}
 	if (filter_chmode)
 		cflag_orphan('u');
-	if (filter_scratch)
-		hs_free_scratch(filter_scratch);
+	if (main_worker.scratch)
+		hs_free_scratch(main_worker.scratch);
+	rb_dictionary_destroy(filter_rules, free_rule, NULL);
 	if (filter_db)
 		hs_free_database(filter_db);
 	if (filter_data)
@@ -135,6 +174,20 @@ mapi_clist_av1 filter_clist[] = { &setfilter_msgtab, NULL };
 
 DECLARE_MODULE_AV2(filter, modinit, moddeinit, filter_clist, NULL, filter_hfnlist, NULL, "0.4", filter_desc);
 
+/* the mode a database was compiled for is only in its description */
+static bool
+database_is_vectored(const hs_database_t *db)
+{
+	char *info;
+	bool vectored;
+
+	if (hs_database_info(db, &info) != HS_SUCCESS)
+		return false;
+	vectored = strstr(info, "Mode: VECTORED") != NULL;
+	free(info);
+	return vectored;
+}
+
 static int
 setfilter(const char *check, const char *data, const char **error)
 {
@@ -207,7 +260,7 @@ setfilter(const char *check, const char *data, const char **error)
 			if (error) *error = "couldn't deserialize db";
 			return -1;
 		}
-		r = hs_alloc_scratch(db, &filter_scratch);
+		r = hs_alloc_scratch(db, &main_worker.scratch);
 		if (r != HS_SUCCESS) {
 			if (error) *error = "couldn't allocate scratch";
 			hs_free_database(db);
@@ -218,6 +271,10 @@ setfilter(const char *check, const char *data, const char **error)
 		}
 		state = FILTER_LOADED;
 		filter_db = db;
+		filter_vectored = database_is_vectored(db);
+		/* the IDs may mean different rules now */
+		rb_dictionary_destroy(filter_rules, free_rule, NULL);
+		filter_rules = rb_dictionary_create("filter rules", rb_uint32cmp);
 		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
 			"New filters loaded.");
 		rb_free(filter_data);
@@ -256,6 +313,29 @@ setfilter(const char *check, const char *data, const char **error)
 	return 0;
 }
 
+static void
+filter_report(struct Client *source_p)
+{
+	const struct filter_worker *worker = &main_worker;
+	const struct rb_histogram *latency = &worker->latency;
+	struct filter_rule *rule;
+	rb_dictionary_iter iter;
+
+	sendto_one_notice(source_p, ":Filtering %s, %s, %llu messages scanned, %llu matched",
+		filter_enable ? "enabled" : "disabled",
+		filter_db == NULL ? "no database" : filter_vectored ? "vectored database" : "block database",
+		worker->scans, worker->matches);
+	sendto_one_notice(source_p, ":Scan usec: avg %llu, p50 %llu, p90 %llu, p99 %llu, max %llu",
+		latency->count ? latency->sum / latency->count : 0,
+		rb_histogram_percentile(latency, 50),
+		rb_histogram_percentile(latency, 90),
+		rb_histogram_percentile(latency, 99),
+		latency->max);
+	RB_DICTIONARY_FOREACH(rule, &iter, filter_rules) {
+		sendto_one_notice(source_p, ":Rule %u: %llu hits", rule->id, rule->hits);
+	}
+}
+
 /* /SETFILTER [server-mask] <check> { NEW | APPLY | <data> }
  * <check> must be the same for the entirety of a new...data...apply run,
  *   and exists just to ensure runs don't mix
@@ -263,7 +343,8 @@ setfilter(const char *check, const char *data, const char **error)
  * <data> is base64 encoded chunks of hyperscan database, which are decoded
  *   and appended to the buffer
  * APPLY deserialises the buffer and sets the resulting hyperscan database
- *   as the one to use for filtering */
+ *   as the one to use for filtering
+ * STATS reports scan times and how often each rule has matched */
 static void
 mo_setfilter(struct MsgBuf *msgbuf, struct Client *client_p, struct Client *source_p, int parc, const char **parv)
 {
@@ -291,7 +372,9 @@ mo_setfilter(struct MsgBuf *msgbuf, struct Client *client_p, struct Client *sour
 		sendto_one_notice(source_p, ":SETFILTER needs 2 or 3 params, have %d", parc - 1);
 		return;
 	}
-	if (for_me) {
+	if (for_me && !strcasecmp(data, "stats")) {
+		filter_report(source_p);
+	} else if (for_me) {
 		const char *error;
 		int r = setfilter(check, data, &error);
 		if (r) {
@@ -308,6 +391,11 @@ me_setfilter(struct MsgBuf *msgbuf, struct Client *client_p, struct Client *sour
 	if(!IsPerson(source_p))
 		return;
 
+	if (!strcasecmp(parv[2], "stats")) {
+		filter_report(source_p);
+		return;
+	}
+
 	const char *error;
 	int r = setfilter(parv[1], parv[2], &error);
 	if (r) {
@@ -321,60 +409,171 @@ me_setfilter(struct MsgBuf *msgbuf, struct Client *client_p, struct Client *sour
  * hyperscan provides us one piece of information about the expression
  * matched, an integer ID. we're co-opting the lowest 3 bits of this
  * as a flag set. conveniently, this means all we really need to do
- * here is or the IDs together. */
-int match_callback(unsigned id,
-                   unsigned long long from,
-                   unsigned long long to,
-                   unsigned flags,
-                   void *context_)
+ * here is or the IDs together. the IDs are also kept, once each, so
+ * the rules' hit counters can be updated after the scan. */
+static int
+match_callback(unsigned id,
+               unsigned long long from,
+               unsigned long long to,
+               unsigned flags,
+               void *context_)
 {
-	unsigned *context = context_;
-	*context |= id;
+	struct filter_match *context = context_;
+	context->actions |= id;
+	for (unsigned i = 0; i < context->n_ids; i++)
+		if (context->ids[i] == id)
+			return 0;
+	if (context->n_ids < FILTER_MAX_IDS)
+		context->ids[context->n_ids++] = id;
 	return 0;
 }
 
-static char check_buffer[2000];
-static char clean_buffer[BUFSIZE];
+static char *
+append_str(char *p, const char *end, const char *str)
+{
+	size_t len = strlen(str);
 
-unsigned match_message(const char *prefix,
-                       struct Client *source,
-                       const char *command,
-                       const char *target,
-                       const char *msg)
+	if (len > (size_t)(end - p))
+		len = end - p;
+	memcpy(p, str, len);
+	return p + len;
+}
+
+/* build_header - everything before the text, as
+ * "<variant>:nick!user@host#<logged in> COMMAND[ target] :"
+ * the variant goes in the first byte, which the caller fills in */
+static size_t
+build_header(char *buf, size_t size, struct Client *source, const char *command, const char *target)
 {
-	unsigned state = 0;
-	if (!filter_enable)
-		return 0;
-	if (!filter_db)
-		return 0;
-	if (!command)
-		return 0;
-	snprintf(check_buffer, sizeof check_buffer, "%s:%s!%s@%s#%c %s%s%s :%s",
-	         prefix,
+	char *p = buf + 1, *end = buf + size;
+
+	p = append_str(p, end, ":");
 #if FILTER_NICK
-	         source->name,
+	p = append_str(p, end, source->name);
 #else
-	         "*",
+	p = append_str(p, end, "*");
 #endif
+	p = append_str(p, end, "!");
 #if FILTER_USER
-	         source->username,
+	p = append_str(p, end, source->username);
 #else
-	         "*",
+	p = append_str(p, end, "*");
 #endif
+	p = append_str(p, end, "@");
 #if FILTER_HOST
-	         source->host,
+	p = append_str(p, end, source->host);
 #else
-	         "*",
+	p = append_str(p, end, "*");
 #endif
-	         source->user && source->user->suser[0] != '\0' ? '1' : '0',
-	         command,
-	         target ? " " : "",
-	         target ? target : "",
-	         msg);
-	hs_error_t r = hs_scan(filter_db, check_buffer, strlen(check_buffer), 0, filter_scratch, match_callback, &state);
+	p = append_str(p, end, source->user && source->user->suser[0] != '\0' ? "#1 " : "#0 ");
+	p = append_str(p, end, command);
+	if (target) {
+		p = append_str(p, end, " ");
+		p = append_str(p, end, target);
+	}
+	p = append_str(p, end, " :");
+	return p - buf;
+}
+
+/* scan_variant - scan header and text as one string; a vectored
+ * database takes them as they are, anything else needs them copied
+ * together first */
+static hs_error_t
+scan_variant(struct filter_worker *worker, const char *header, size_t header_len,
+             const char *text, size_t text_len, struct filter_match *match)
+{
+	if (filter_vectored) {
+		const char *data[2] = { header, text };
+		unsigned int length[2] = { header_len, text_len };
+		return hs_scan_vector(filter_db, data, length, 2, 0, worker->scratch, match_callback, match);
+	}
+
+	if (text_len > sizeof worker->check_buffer - header_len)
+		text_len = sizeof worker->check_buffer - header_len;
+	memcpy(worker->check_buffer, header, header_len);
+	memcpy(worker->check_buffer + header_len, text, text_len);
+	return hs_scan(filter_db, worker->check_buffer, header_len + text_len, 0, worker->scratch, match_callback, match);
+}
+
+static void
+count_hits(const struct filter_match *match)
+{
+	struct filter_rule *rule;
+
+	for (unsigned i = 0; i < match->n_ids; i++) {
+		rule = rb_dictionary_retrieve(filter_rules, RB_UINT_TO_POINTER(match->ids[i]));
+		if (rule == NULL) {
+			rule = rb_malloc(sizeof *rule);
+			rule->id = match->ids[i];
+			rb_dictionary_add(filter_rules, RB_UINT_TO_POINTER(rule->id), rule);
+		}
+		rule->hits++;
+	}
+}
+
+/* match_message - check the text as sent (variant 0) and with colours
+ * and unprintables stripped (variant 1), returning the actions of any
+ * rules that matched either */
+static unsigned
+match_message(struct filter_worker *worker,
+              struct Client *source,
+              const char *command,
+              const char *target,
+              const char *msg)
+{
+	struct filter_match match = { 0 };
+	struct timespec start, end;
+	const char *clean;
+	size_t header_len, msg_len, clean_len;
+	hs_error_t r;
+
+	if (!filter_enable)
+		return 0;
+	if (!filter_db)
+		return 0;
+	if (!command)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	msg_len = strlen(msg);
+	if (has_control_chars(msg, msg_len)) {
+		rb_strlcpy(worker->clean_buffer, msg, sizeof worker->clean_buffer);
+		clean = strip_unprintable(strip_colour(worker->clean_buffer));
+		clean_len = strlen(clean);
+	} else {
+		/* nothing to strip but trailing spaces, as strip_colour()
+		 * does when there is anything else */
+		clean = msg;
+		clean_len = msg_len;
+		while (clean_len > 0 && clean[clean_len - 1] == ' ')
+			clean_len--;
+		if (clean_len == 0)
+			clean_len = msg_len;
+	}
+
+	header_len = build_header(worker->header, sizeof worker->header, source, command, target);
+
+	worker->header[0] = '0';
+	r = scan_variant(worker, worker->header, header_len, msg, msg_len, &match);
+	if (r == HS_SUCCESS || r == HS_SCAN_TERMINATED) {
+		worker->header[0] = '1';
+		r = scan_variant(worker, worker->header, header_len, clean, clean_len, &match);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	worker->scans++;
+	rb_histogram_add(&worker->latency, (end.tv_sec - start.tv_sec) * 1000000 +
+			(end.tv_nsec - start.tv_nsec) / 1000);
+
 	if (r != HS_SUCCESS && r != HS_SCAN_TERMINATED)
 		return 0;
-	return state;
+
+	if (match.n_ids > 0) {
+		worker->matches++;
+		count_hits(&match);
+	}
+	return match.actions;
 }
 
 void
@@ -395,11 +594,7 @@ filter_msg_user(void *data_)
 	if (data->target_p->umodes & filter_umode) {
 		return;
 	}
-	char *text = strcpy(clean_buffer, data->text);
-	strip_colour(text);
-	strip_unprintable(text);
-	unsigned r = match_message("0", s, cmdname[data->msgtype], "0", data->text) |
-	             match_message("1", s, cmdname[data->msgtype], "0", text);
+	unsigned r = match_message(&main_worker, s, cmdname[data->msgtype], "0", data->text);
 	if (r & ACT_DROP) {
 		if (data->msgtype == MESSAGE_TYPE_PRIVMSG) {
 			sendto_one_numeric(s, ERR_CANNOTSENDTOCHAN,
@@ -436,11 +631,7 @@ filter_msg_channel(void *data_)
 	if (data->chptr->mode.mode & filter_chmode) {
 		return;
 	}
-	char *text = strcpy(clean_buffer, data->text);
-	strip_colour(text);
-	strip_unprintable(text);
-	unsigned r = match_message("0", s, cmdname[data->msgtype], data->chptr->chname, data->text) |
-	             match_message("1", s, cmdname[data->msgtype], data->chptr->chname, text);
+	unsigned r = match_message(&main_worker, s, cmdname[data->msgtype], data->chptr->chname, data->text);
 	if (r & ACT_DROP) {
 		if (data->msgtype == MESSAGE_TYPE_PRIVMSG) {
 			sendto_one_numeric(s, ERR_CANNOTSENDTOCHAN,
@@ -468,11 +659,7 @@ filter_client_quit(void *data_)
 	if (IsOper(s)) {
 		return;
 	}
-	char *text = strcpy(clean_buffer, data->orig_reason);
-	strip_colour(text);
-	strip_unprintable(text);
-	unsigned r = match_message("0", s, "QUIT", NULL, data->orig_reason) |
-	             match_message("1", s, "QUIT", NULL, text);
+	unsigned r = match_message(&main_worker, s, "QUIT", NULL, data->orig_reason);
 	if (r & ACT_DROP) {
 		data->reason = NULL;
 	}
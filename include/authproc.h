@@ -37,6 +37,20 @@ struct DNSBLEntry
 	char *filters;
 	uint8_t iptype;
 	unsigned int hits;
+
+	/* how authd answered lookups, updated every minute */
+	unsigned int cache_hits;
+	unsigned int coalesced;
+	unsigned int queries;
+};
+
+/* admission "provider" {} */
+struct AdmissionPolicy
+{
+	const char *provider;
+	bool may_advise;	/* false if it decides the client's user@host */
+	bool advisory;		/* client may register before it finishes */
+	int deadline;		/* seconds after connecting, 0 for none */
 };
 
 struct OPMScanner
@@ -63,6 +77,7 @@ enum
 extern rb_helper *authd_helper;
 
 extern rb_dictionary *dnsbl_stats;
+extern rb_dlink_list authd_timings;
 extern rb_dlink_list opm_list;
 extern struct OPMListener opm_listeners[LISTEN_LAST];
 
@@ -77,12 +92,16 @@ void authd_deferred_client(struct Client *);
 void authd_accept_client(struct Client *client_p, const char *ident, const char *host);
 void authd_reject_client(struct Client *client_p, const char *ident, const char *host, char cause, const char *data, const char *reason);
 void authd_abort_client(struct Client *);
+void authd_parse_line(char *line);
 
 void add_dnsbl_entry(const char *host, const char *reason, uint8_t iptype, rb_dlink_list *filters);
 void del_dnsbl_entry(const char *host);
 void del_dnsbl_entry_all(void);
 
 bool set_authd_timeout(const char *key, int timeout);
+struct AdmissionPolicy *find_admission_policy(const char *provider);
+void set_authd_admission(struct AdmissionPolicy *policy);
+void reset_authd_admission(void);
 void ident_check_enable(bool enabled);
 
 void conf_create_opm_listener(const char *ip, uint16_t port);
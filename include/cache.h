@@ -13,12 +13,14 @@
 #define HELP_OPER	0x002
 
 struct Client;
+struct cacherender;
 
 struct cachefile
 {
 	char name[CACHEFILELEN];
 	rb_dlink_list contents;
 	int flags;
+	struct cacherender *render;	/* replies built from contents */
 };
 
 struct cacheline
@@ -43,6 +45,7 @@ void load_help(void);
 
 void send_user_motd(struct Client *);
 void send_oper_motd(struct Client *);
+void send_help(struct Client *, struct cachefile *, const char *);
 void cache_user_motd(void);
 
 extern rb_dictionary *help_dict_oper;
@@ -46,7 +46,10 @@ struct Class
 	int cidr_ipv4_bitlen;
 	int cidr_ipv6_bitlen;
 	int cidr_amount;
-
+	int rcvbuf;
+	int sndbuf;
+	int notsent_lowat;
+	bool cork_burst;
 };
 
 extern rb_dlink_list class_list;
@@ -66,6 +69,10 @@ extern struct Class *default_class;
 #define CidrIpv4Bitlen(x)   ((x)->cidr_ipv4_bitlen)
 #define CidrIpv6Bitlen(x)   ((x)->cidr_ipv6_bitlen)
 #define CidrAmount(x)	((x)->cidr_amount)
+#define RcvBuf(x)	((x)->rcvbuf)
+#define SndBuf(x)	((x)->sndbuf)
+#define NotsentLowat(x)	((x)->notsent_lowat)
+#define CorkBurst(x)	((x)->cork_burst)
 #define ClassPtr(x)      ((x)->c_class)
 
 #define ConfClassName(x) (ClassPtr(x)->class_name)
@@ -88,6 +95,7 @@ struct Class *make_class(void);
 
 extern long get_sendq(struct Client *);
 extern int get_con_freq(struct Class *);
+extern void set_class_sockopts(struct Client *, struct Class *);
 extern struct Class *find_class(const char *);
 extern const char *get_client_class(struct Client *);
 extern int get_client_ping(struct Client *);
@@ -62,6 +62,7 @@ struct LocalUser;
 struct PreClient;
 struct ListClient;
 struct scache_entry;
+struct zlink;
 
 typedef int SSL_OPEN_CB(struct Client *, int status);
 
@@ -71,6 +72,7 @@ typedef int SSL_OPEN_CB(struct Client *, int status);
 struct User
 {
 	rb_dlink_list channel;	/* chain of channel pointer blocks */
+	bool channel_unsorted;	/* channel is not in name order, see sort_user_channels() */
 	rb_dlink_list invited;	/* chain of invite pointer blocks */
 	char *away;		/* pointer to away message */
 	int refcnt;		/* Number of times this block is referenced */
@@ -176,31 +178,41 @@ struct LocalUser
 	time_t lasttime;	/* last time we parsed something */
 	time_t firsttime;	/* time client was created */
 
-	/* Send and receive linebuf queues .. */
+	/* Send linebuf queues.  Clients only use buf_sendq; on a server
+	 * link it holds state changes, keepalives go ahead of it and
+	 * messages behind it.  See sendq_classify().
+	 */
 	buf_head_t buf_sendq;
-	buf_head_t buf_recvq;
+	buf_head_t buf_sendq_control;
+	buf_head_t buf_sendq_bulk;
+	unsigned int sendq_bulk_wait;	/* bytes sent ahead of waiting messages */
+	bool sendq_barrier;		/* everything waits for the messages queued */
+
+	/* Receive queue: unparsed input, lines are parsed in place.  Holds
+	 * complete lines held back by flood control and then at most one
+	 * partial line.  recvq points at the shared read buffer while that
+	 * is being parsed, and at our own recvq_size bytes otherwise.
+	 */
+	char *recvq;
+	unsigned int recvq_size;
+	unsigned int recvq_start;	/* first unparsed byte */
+	unsigned int recvq_end;		/* end of the data read */
+	unsigned int recvq_scanned;	/* end of the data counted in recvq_lines */
+	unsigned int recvq_lines;	/* complete lines before recvq_scanned */
+	bool recvq_overflow;		/* discarding the rest of an overlong line */
 
 	/*
-	 * we want to use unsigned int here so the sizes have a better chance of
-	 * staying the same on 64 bit machines. The current trend is to use
-	 * I32LP64, (32 bit ints, 64 bit longs and pointers) and since ircd
-	 * will NEVER run on an operating system where ints are less than 32 bits,
-	 * it's a relatively safe bet to use ints. Since right shift operations are
-	 * performed on these, it's not safe to allow them to become negative,
-	 * which is possible for long running server connections. Unsigned values
-	 * generally overflow gracefully. --Bleep
-	 *
-	 * We have modern conveniences. Let's use uint32_t. --Elizafox
+	 * Whole totals, so nothing has to carry bytes into kilobytes as they
+	 * are counted and a long running server link cannot wrap them.
 	 */
-	uint32_t sendM;		/* Statistics: protocol messages send */
-	uint32_t sendK;		/* Statistics: total k-bytes send */
-	uint32_t receiveM;	/* Statistics: protocol messages received */
-	uint32_t receiveK;	/* Statistics: total k-bytes received */
-	uint16_t sendB;		/* counters to count upto 1-k lots of bytes */
-	uint16_t receiveB;	/* sent and received. */
+	uint64_t sendM;		/* Statistics: protocol messages sent */
+	uint64_t sendB;		/* Statistics: total bytes sent */
+	uint64_t receiveM;	/* Statistics: protocol messages received */
+	uint64_t receiveB;	/* Statistics: total bytes received */
 	struct Listener *listener;	/* listener accepted from */
 	struct ConfItem *att_conf;	/* attached conf */
 	struct server_conf *att_sconf;
+	uint32_t authd_cid;		/* authd admitted us, but advisory checks are still running */
 
 	struct rb_sockaddr_storage ip;
 	time_t last_nick_change;
@@ -243,12 +255,17 @@ struct LocalUser
 	time_t last_knock;	/* time of last knock */
 	uint32_t random_ping;
 
+	/* server links: lines of burst parsed and the time it took */
+	unsigned int burst_lines;
+	unsigned long burst_usec;
+
 	/* target change stuff */
 	/* targets we're aware of (fnv32(use_id(target_p))):
 	 * 0..TGCHANGE_NUM-1 regular slots
 	 * TGCHANGE_NUM..TGCHANGE_NUM+TGCHANGE_REPLY-1 reply slots
 	 */
 	uint32_t targets[TGCHANGE_NUM + TGCHANGE_REPLY];
+	uint64_t targets_filter;	/* bit (hash % 64) of each target above */
 	unsigned int targets_free;	/* free targets */
 	time_t target_last;		/* last time we cleared a slot */
 
@@ -262,7 +279,7 @@ struct LocalUser
 			      applicable to this client */
 
 	struct _ssl_ctl *ssl_ctl;		/* which ssl daemon we're associate with */
-	struct _ssl_ctl *z_ctl;			/* second ctl for ssl+zlib */
+	struct zlink *zlink;			/* compressed server link */
 	SSL_OPEN_CB *ssl_callback;		/* ssl connection is now open */
 	uint32_t localflags;
 	uint16_t cork_count;			/* used for corking/uncorking connections */
@@ -423,11 +440,13 @@ struct ListClient
 /* flags for local clients, this needs stuff moved from above to here at some point */
 #define LFLAGS_SSL		0x00000001
 #define LFLAGS_FLUSH		0x00000002
-#define LFLAGS_CORK		0x00000004
+#define LFLAGS_CORK		0x00000004	/* socket corked until the sendq is written */
 #define LFLAGS_SCTP		0x00000008
 #define LFLAGS_SECURE		0x00000010	/* for marking SSL clients as secure before registration */
 /* LFLAGS_FAKE: client may not have the usually expected machinery plugged in; don't assert on it. For tests only. */
 #define LFLAGS_FAKE		0x00000020
+#define LFLAGS_DEFERRED		0x00000040	/* waiting for send_defer_end() to flush */
+#define LFLAGS_READWRITE	0x00000080	/* a TLS read is waiting for the socket to be writable */
 
 /* umodes, settable flags */
 /* lots of this moved to snomask -- jilles */
@@ -499,6 +518,14 @@ struct ListClient
 #define SetFlush(x)		((x)->localClient->localflags |= LFLAGS_FLUSH)
 #define ClearFlush(x)		((x)->localClient->localflags &= ~LFLAGS_FLUSH)
 
+#define IsDeferredFlush(x)	((x)->localClient->localflags & LFLAGS_DEFERRED)
+#define SetDeferredFlush(x)	((x)->localClient->localflags |= LFLAGS_DEFERRED)
+#define ClearDeferredFlush(x)	((x)->localClient->localflags &= ~LFLAGS_DEFERRED)
+
+#define IsReadWantsWrite(x)	((x)->localClient->localflags & LFLAGS_READWRITE)
+#define SetReadWantsWrite(x)	((x)->localClient->localflags |= LFLAGS_READWRITE)
+#define ClearReadWantsWrite(x)	((x)->localClient->localflags &= ~LFLAGS_READWRITE)
+
 #define IsSCTP(x)		((x)->localClient->localflags & LFLAGS_SCTP)
 #define SetSCTP(x)		((x)->localClient->localflags |= LFLAGS_SCTP)
 #define ClearSCTP(x)		((x)->localClient->localflags &= ~LFLAGS_SCTP)
@@ -587,6 +614,7 @@ extern void free_pre_client(struct Client *client);
 
 extern void notify_banned_client(struct Client *, struct ConfItem *, int ban);
 extern int exit_client(struct Client *, struct Client *, struct Client *, const char *);
+extern void exit_aborted_clients(void *unused);
 
 extern void error_exit_client(struct Client *, int);
 
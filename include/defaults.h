@@ -78,6 +78,8 @@ extern const char *ircd_paths[IRCD_PATH_COUNT];
 #define MAX_TARGETS_DEFAULT		4		/* default for max_targets */
 #define IDENT_TIMEOUT_DEFAULT		5
 #define DNSBL_TIMEOUT_DEFAULT		10
+#define DNSBL_CACHE_NEGATIVE		300		/* how long an unlisted IP is remembered */
+#define DNSBL_CACHE_MAX			3600		/* cap on the TTL of a listing */
 #define OPM_TIMEOUT_DEFAULT		10
 #define RDNS_TIMEOUT_DEFAULT		5
 #define MIN_JOIN_LEAVE_TIME		60
@@ -50,6 +50,9 @@ extern rb_radixtree *channel_tree;
 #define HOST_MAX_BITS 17
 #define HOST_MAX 131072 /* 2^17 */
 
+/* Initial membership hash table size; it grows and shrinks with use */
+#define MEMBERSHIP_MIN_BITS 10
+
 /* RESV/XLINE hash table size, used in hash.c */
 #define R_MAX_BITS 10
 #define R_MAX 1024 /* 2^10 */
@@ -64,6 +67,7 @@ struct Channel;
 struct ConfItem;
 struct cachefile;
 struct nd_entry;
+struct membership;
 
 extern uint32_t fnv_hash_upper(const unsigned char *s, int bits);
 extern uint32_t fnv_hash(const unsigned char *s, int bits);
@@ -99,4 +103,10 @@ void add_to_cli_connid_hash(struct Client *client_p, uint32_t id);
 void del_from_cli_connid_hash(uint32_t id);
 struct Client *find_cli_connid_hash(uint32_t connid);
 
+extern void add_to_membership_hash(struct membership *msptr);
+extern void del_from_membership_hash(struct membership *msptr);
+extern void reserve_membership_hash(unsigned int count);
+extern struct membership *find_membership_hash(struct Channel *chptr, struct Client *client_p);
+extern void membership_hash_stats(void (*cb)(const char *, void *), void *privdata);
+
 #endif /* INCLUDED_hash_h */
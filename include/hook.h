@@ -5,10 +5,19 @@
 #ifndef INCLUDED_HOOK_H
 #define INCLUDED_HOOK_H
 
+typedef void (*hookfn) (void *data);
+
 typedef struct
 {
 	char *name;
 	rb_dlink_list hooks;
+	hookfn *fns;		/* priority sorted copy of hooks, for dispatch */
+	int nfns;
+	int running;		/* nesting depth of call_hook() on this hook */
+	rb_dlink_list stale;	/* old fns arrays, freed once nothing is running */
+	unsigned long calls;
+	unsigned long timed;		/* calls made with command_profiling on */
+	unsigned long long nsec;	/* time spent in those calls */
 } hook;
 
 enum hook_priority
@@ -40,7 +49,8 @@ enum message_tag_approval
 	MESSAGE_TAG_DROP = 2,
 };
 
-typedef void (*hookfn) (void *data);
+extern hook *hooks;
+extern int max_hooks;
 
 extern int h_iosend_id;
 extern int h_iorecv_id;
@@ -75,6 +85,16 @@ void add_hook_prio(const char *name, hookfn fn, enum hook_priority priority);
 void remove_hook(const char *name, hookfn fn);
 void call_hook(int id, void *arg);
 
+/* hook_has_listeners()
+ *   Whether anything is registered on a hook.  Hot paths use this to skip
+ *   filling in hook data that nobody would look at.
+ */
+static inline bool
+hook_has_listeners(int id)
+{
+	return hooks[id].nfns != 0;
+}
+
 typedef struct
 {
 	struct Client *client;
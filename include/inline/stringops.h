@@ -23,6 +23,34 @@
 #ifndef __INLINE_STRINGOPS_H
 #define __INLINE_STRINGOPS_H
 
+/*
+ * has_control_chars - whether a string has any bytes below 32, which
+ * strip_colour() and strip_unprintable() might remove; checks eight
+ * bytes at a time
+ */
+static inline bool
+has_control_chars(const char *string, size_t len)
+{
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	uint64_t word;
+	size_t i = 0;
+
+	for(; i + sizeof(word) <= len; i += sizeof(word))
+	{
+		memcpy(&word, string + i, sizeof(word));
+		/* sets a high bit if any byte is below 32 */
+		if((word - ones * 32) & ~word & highs)
+			return true;
+	}
+
+	for(; i < len; i++)
+		if((unsigned char)string[i] < 32)
+			return true;
+
+	return false;
+}
+
 /*
  * strip_colour - remove colour and formatting codes from a string
  * -asuffield (?)
@@ -36,13 +36,17 @@ struct Listener
 	rb_fde_t *F;		/* file descriptor */
 	int ref_count;		/* number of connection references */
 	int active;		/* current state of listener */
-	int ssl;		/* ssl listener */
+	int ssl;		/* ssl listener, one of LISTENER_SSL_* */
 	int defer_accept;	/* use TCP_DEFER_ACCEPT */
 	bool sctp;		/* use SCTP */
 	struct rb_sockaddr_storage addr[2];
 	char vhost[(HOSTLEN * 2) + 1];	/* virtual name of listener */
 };
 
+/* how an ssl listener's connections are handled */
+#define LISTENER_SSL_SSLD	1	/* TLS is done by an ssld process */
+#define LISTENER_SSL_INLINE	2	/* TLS is done by the ircd itself */
+
 extern void add_tcp_listener(int port, const char *vaddr_ip, int family, int ssl, int defer_accept);
 extern void add_sctp_listener(int port, const char *vaddr_ip1, const char *vaddr_ip2, int ssl);
 extern void close_listener(struct Listener *listener);
@@ -50,5 +54,8 @@ extern void close_listeners(void);
 extern const char *get_listener_name(const struct Listener *listener);
 extern void show_ports(struct Client *client);
 extern void free_listener(struct Listener *);
+extern void listener_foreach(void (*func)(void *data, struct Listener *), void *data);
+extern struct Listener *adopt_listener(int fd, uint8_t type, struct rb_sockaddr_storage *addr,
+		int ssl, int defer_accept, bool sctp);
 
 #endif /* INCLUDED_listener_h */
@@ -0,0 +1,125 @@
+/*
+ * Comet: a slightly advanced ircd
+ * metrics.h: event loop and queue metrics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#ifndef INCLUDED_metrics_h
+#define INCLUDED_metrics_h
+
+enum metrics_conn_type
+{
+	METRICS_CONN_CLIENT,
+	METRICS_CONN_SERVER,
+	METRICS_CONN_UNKNOWN,
+	METRICS_CONN_LAST
+};
+
+extern const char *metrics_conn_type_name[METRICS_CONN_LAST];
+
+/* sizes of the local connections' queues, in bytes */
+struct metrics_queues
+{
+	unsigned int conns[METRICS_CONN_LAST];
+	unsigned int flushing[METRICS_CONN_LAST];	/* blocked waiting for a write */
+	struct rb_histogram sendq[METRICS_CONN_LAST];
+	struct rb_histogram recvq[METRICS_CONN_LAST];
+};
+
+void metrics_collect_queues(struct metrics_queues *);
+
+struct ServerStatistics;
+void metrics_collect_stats(struct ServerStatistics *);
+
+/*
+ * The binary snapshot written by the metrics_snapshot_socket: one
+ * struct metrics_snapshot in host byte order, then the socket closes.
+ * New fields are only ever added at the end, growing size; version
+ * changes only if existing fields change meaning.  A reader checks
+ * magic (which also shows the byte order) and uses the fields that
+ * fit in size.
+ */
+#define METRICS_SNAPSHOT_MAGIC		0x434d5453	/* "CMTS" */
+#define METRICS_SNAPSHOT_VERSION	1
+
+struct metrics_snapshot
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;			/* bytes in the snapshot */
+	uint64_t time;			/* when it was taken, unix time */
+	uint64_t start_time;		/* when the server started */
+
+	/* local connections now: clients, servers and unknowns.  The
+	 * count is fixed so the layout can't move with the enum; a new
+	 * type of connection gets a field at the end.
+	 */
+	uint64_t conns[3];
+
+	/* over all local connections since startup */
+	uint64_t sent_msgs;
+	uint64_t sent_bytes;
+	uint64_t recv_msgs;
+	uint64_t recv_bytes;
+
+	/* by clients and servers since startup, open connections included */
+	uint64_t client_conns;
+	uint64_t client_sent_bytes;
+	uint64_t client_recv_bytes;
+	uint64_t client_conn_seconds;
+	uint64_t server_conns;
+	uint64_t server_sent_bytes;
+	uint64_t server_recv_bytes;
+	uint64_t server_conn_seconds;
+	uint64_t unknown_closes;
+
+	/* the rest of STATS t */
+	uint64_t accepts;
+	uint64_t refused;
+	uint64_t rejected;
+	uint64_t throttled;
+	uint64_t unknown_commands;
+	uint64_t unknown_prefixes;
+	uint64_t wrong_direction;
+	uint64_t empty_messages;
+	uint64_t numerics_seen;
+	uint64_t nick_collisions;
+	uint64_t nick_saves;
+	uint64_t auth_successes;
+	uint64_t auth_fails;
+	uint64_t sasl_successes;
+	uint64_t sasl_fails;
+	uint64_t tgchange_blocked;
+	uint64_t ratelimit_blocked;
+	uint64_t sendq_blocked;
+	uint64_t sendq_shed;
+
+	uint64_t sendq_total;
+	uint64_t sendq_peak;
+
+	uint64_t loop_iterations;
+	uint64_t loop_wakeups;
+	uint64_t loop_wait_us;
+	uint64_t open_fds;
+	uint64_t max_fds;
+};
+
+void metrics_take_snapshot(struct metrics_snapshot *);
+
+void metrics_update_config(void);
+
+#endif /* INCLUDED_metrics_h */
@@ -57,6 +57,19 @@ struct MessageEntry
 	size_t min_para;
 };
 
+/* latency histogram buckets, in powers of two microseconds:
+ * [0] < 1us, [1] < 2us, [2] < 4us, ... [MSG_PROFILE_BUCKETS - 1] everything else
+ */
+#define MSG_PROFILE_BUCKETS 20
+
+struct MessageProfile
+{
+	unsigned long calls;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long hist[MSG_PROFILE_BUCKETS];
+};
+
 /* Message table structure */
 struct Message
 {
@@ -70,6 +83,11 @@ struct Message
 	 * UNREGISTERED, CLIENT, RCLIENT, SERVER, ENCAP, OPER
 	 */
 	struct MessageEntry handlers[LAST_HANDLER_TYPE];
+
+	/* timings per handler type, allocated on first use when
+	 * general::command_profiling is enabled
+	 */
+	struct MessageProfile *profile;
 };
 
 /* generic handlers */
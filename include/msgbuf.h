@@ -24,6 +24,19 @@
 
 #define MAXPARA		(15)
 #define MAXTAGS (30)
+#define MAXTAGNAMES (64)
+
+/* interned tag names; tags appended by index are found without
+ * comparing strings.  MSGTAG_NONE is a tag only known by its key.
+ */
+enum msgtag_builtin
+{
+	MSGTAG_NONE = 0,
+	MSGTAG_TIME,
+	MSGTAG_MSGID,
+	MSGTAG_ACCOUNT,
+	MSGTAG_BUILTIN_COUNT,
+};
 
 enum parse_result
 {
@@ -39,6 +52,7 @@ struct MsgTag {
 	const char *key;		/* the key of the tag (must be set) */
 	const char *value;		/* the value of the tag or NULL */
 	unsigned int capmask;		/* the capability mask this tag belongs to (used only when sending) */
+	int idx;			/* the interned name of the key, or MSGTAG_NONE */
 };
 
 struct MsgBuf {
@@ -126,6 +140,14 @@ int msgbuf_unparse_prefix(char *buf, size_t *buflen, const struct MsgBuf *msgbuf
 int msgbuf_unparse_para(char *buf, size_t buflen, const struct MsgBuf *msgbuf);
 
 const char *msgbuf_get_tag(const struct MsgBuf *buf, const char *name);
+const char *msgbuf_get_tag_idx(const struct MsgBuf *buf, int idx);
+
+/*
+ * intern a tag name, returning its index; the same name always gets the
+ * same index.  returns MSGTAG_NONE if the table is full.
+ */
+int msgtag_intern(const char *name);
+extern const char *msgtag_names[MAXTAGNAMES];
 
 void msgbuf_cache_init(struct MsgBuf_cache *cache, struct MsgBuf *msgbuf, const char *local_source, const char *remote_source);
 buf_head_t *msgbuf_cache_get(struct MsgBuf_cache *cache, unsigned int caps, bool is_remote);
@@ -144,6 +166,19 @@ msgbuf_append_tag(struct MsgBuf *msgbuf, const char *key, const char *value, uns
 		msgbuf->tags[msgbuf->n_tags].key = key;
 		msgbuf->tags[msgbuf->n_tags].value = value;
 		msgbuf->tags[msgbuf->n_tags].capmask = capmask;
+		msgbuf->tags[msgbuf->n_tags].idx = MSGTAG_NONE;
+		msgbuf->n_tags++;
+	}
+}
+
+static inline void
+msgbuf_append_tag_idx(struct MsgBuf *msgbuf, int idx, const char *value, unsigned int capmask)
+{
+	if (msgbuf->n_tags < MAXTAGS) {
+		msgbuf->tags[msgbuf->n_tags].key = msgtag_names[idx];
+		msgbuf->tags[msgbuf->n_tags].value = value;
+		msgbuf->tags[msgbuf->n_tags].capmask = capmask;
+		msgbuf->tags[msgbuf->n_tags].idx = idx;
 		msgbuf->n_tags++;
 	}
 }
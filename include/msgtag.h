@@ -0,0 +1,43 @@
+/*
+ * Comet: a slightly advanced ircd
+ * msgtag.h: values for tags added to outgoing messages
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#ifndef INCLUDED_msgtag_h
+#define INCLUDED_msgtag_h
+
+struct Client;
+
+/* YYYY-MM-DDThh:mm:ss.sssZ */
+#define MSGTAG_TIME_LEN		24
+
+/* format version for message ids, increment if the representation changes
+ * in a meaningful way, e.g. if we start encoding information in the ID
+ * that we or other servers can later extract
+ */
+#define MSGTAG_MSGID_FORMAT	1
+
+/*
+ * The values only change with the clock, so they are formatted once
+ * per millisecond of the event loop's time rather than per message, and
+ * stay valid until the event loop runs again.
+ */
+extern const char *msgtag_server_time(void);
+extern const char *msgtag_msgid(const struct Client *source, const char *target);
+
+#endif /* INCLUDED_msgtag_h */
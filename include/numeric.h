@@ -386,4 +386,7 @@
 
 #define ERR_LAST_ERR_MSG     999
 
+extern void init_numerics(void);
+extern size_t format_numeric(char *, size_t, int, const char *, va_list);
+
 #endif /* INCLUDED_numeric_h */
@@ -28,5 +28,12 @@
 extern PF read_packet;
 extern EVH flood_recalc;
 extern void flood_endgrace(struct Client *);
+extern void discard_recvq(struct LocalUser *);
+
+/* the recvq line parser behind read_packet() */
+extern char *recvq_next_line(struct LocalUser *, int *len);
+extern unsigned int recvq_count_lines(struct LocalUser *);
+extern void recvq_retain(struct LocalUser *);
+extern char *recvq_reserve(struct LocalUser *);
 
 #endif /* INCLUDED_packet_h */
@@ -25,6 +25,7 @@
 
 int ratelimit_client(struct Client *client_p, unsigned int penalty);
 int ratelimit_client_who(struct Client *client_p, unsigned int penalty);
+int ratelimit_client_bulk(struct Client *client_p);
 void credit_client_join(struct Client *client_p);
 
 #endif /* INCLUDED_ratelimit_h */
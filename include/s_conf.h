@@ -243,6 +243,12 @@ struct config_file_entry
 	int away_interval;
 	int tls_ciphers_oper_only;
 	int oper_secure_only;
+	int command_profiling;
+	char *metrics_socket;
+	char *metrics_snapshot_socket;
+	int sendq_soft_limit;
+	int sendq_hard_limit;
+	int write_combine;
 
 	char **hidden_caps;
 
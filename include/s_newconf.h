@@ -192,6 +192,7 @@ struct server_conf
 	int flags;
 	int servers;
 	time_t hold;
+	int compression_level;
 
 	int aftype;
 	char *bind_host;
@@ -212,6 +213,7 @@ struct server_conf
 #define SERVER_SSL		0x0040
 #define SERVER_NO_EXPORT	0x0080
 #define SERVER_SCTP		0x0100
+#define SERVER_COMPRESSED	0x0200
 
 #define ServerConfIllegal(x)	((x)->flags & SERVER_ILLEGAL)
 #define ServerConfEncrypted(x)	((x)->flags & SERVER_ENCRYPTED)
@@ -220,6 +222,7 @@ struct server_conf
 #define ServerConfSCTP(x)	((x)->flags & SERVER_SCTP)
 #define ServerConfSSL(x)	((x)->flags & SERVER_SSL)
 #define ServerConfNoExport(x)	((x)->flags & SERVER_NO_EXPORT)
+#define ServerConfCompressed(x)	((x)->flags & SERVER_COMPRESSED)
 
 extern struct server_conf *make_server_conf(void);
 extern void free_server_conf(struct server_conf *);
@@ -69,6 +69,7 @@ extern unsigned int CLICAP_CAP_NOTIFY;
 extern unsigned int CLICAP_CHGHOST;
 extern unsigned int CLICAP_ECHO_MESSAGE;
 extern unsigned int CLICAP_MESSAGE_TAGS;
+extern unsigned int CLICAP_BATCH;
 
 /*
  * XXX: this is kind of ugly, but this allows us to have backwards
@@ -95,9 +96,10 @@ extern unsigned int CAP_BAN;			/* supports propagated bans */
 extern unsigned int CAP_MLOCK;			/* supports MLOCK messages */
 extern unsigned int CAP_EBMASK;			/* supports sending BMASK set by/at metadata */
 extern unsigned int CAP_STAG;			/* supports s2s tags and TAGMSG */
+extern unsigned int CAP_ZIP;			/* compressed link, if configured */
 
 /* XXX: added for backwards compatibility. --nenolod */
-#define CAP_MASK	(capability_index_mask(serv_capindex) & ~(CAP_TS6 | CAP_CAP))
+#define CAP_MASK	(capability_index_mask(serv_capindex) & ~(CAP_TS6 | CAP_CAP | CAP_ZIP))
 
 /*
  * Capability macros.
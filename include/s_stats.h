@@ -66,6 +66,8 @@ struct ServerStatistics
 	unsigned int is_sbad;	/* failed sasl authentications */
 	unsigned int is_tgch;	/* messages blocked due to target change */
 	unsigned int is_rl;     /* commands blocked due to ratelimit */
+	unsigned int is_sqthr;	/* commands blocked due to sendq memory */
+	unsigned int is_sqshed;	/* clients dropped due to sendq memory */
 };
 
 extern struct ServerStatistics ServerStats;
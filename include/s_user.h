@@ -40,6 +40,8 @@ extern void send_umode(struct Client *, struct Client *, int, char *);
 extern void send_umode_out(struct Client *, struct Client *, int);
 extern void show_lusers(struct Client *source_p);
 extern int register_local_user(struct Client *, struct Client *);
+extern bool authd_check_reject(struct Client *client_p, struct Client *source_p,
+			       char cause, char *data, const char *reason_template);
 
 extern void introduce_client(struct Client *client_p, struct Client *source_p,
 			    struct User *user, const char *nick, int use_euid);
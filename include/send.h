@@ -30,6 +30,7 @@
 #include "msgbuf.h"
 
 struct Client;
+struct LocalUser;
 struct Channel;
 struct monitor;
 
@@ -38,9 +39,28 @@ extern unsigned long current_serial;
 
 extern struct Client *remote_rehash_oper_p;
 
+/* most bytes of keepalives and state changes sent to a server while
+ * messages wait, before further state changes queue behind them
+ */
+#define SENDQ_BULK_WAIT	(64 * 1024)
+
+extern unsigned long sendq_total;
+extern unsigned long sendq_peak;
+
 extern void send_pop_queue(struct Client *);
 
 extern void send_queued(struct Client *to);
+extern void send_cork(struct Client *);
+extern bool send_start_zlink(struct Client *, int level);
+extern void discard_sendq(struct Client *);
+extern unsigned int sendq_length(struct Client *);
+extern buf_head_t *sendq_next(struct LocalUser *);
+extern bool sendq_pressure(void);
+extern int sendq_largest(struct Client **, int);
+
+extern void send_defer_begin(void);
+extern void send_defer_end(void);
+extern void send_defer_forget(struct Client *);
 
 extern void sendto_one(struct Client *target_p, const char *, ...) AFP(2, 3);
 extern void sendto_one_notice(struct Client *target_p,const char *, ...) AFP(2, 3);
@@ -50,6 +70,8 @@ extern void sendto_one_numeric(struct Client *target_p,
 			       int numeric, const char *, ...) AFP(3, 4);
 extern void sendto_one_tags(struct Client *target_p, int serv_cap, int serv_negcap,
 	size_t n_tags, const struct MsgTag tags[], const char *, ...) AFP(6, 7);
+extern bool send_untagged(struct Client *target_p, const char *line);
+extern void sendto_one_linebuf(struct Client *target_p, buf_head_t *linebuf, unsigned int lines);
 
 extern void sendto_server(struct Client *one, struct Channel *chptr,
 			  unsigned long caps, unsigned long nocaps,
@@ -80,6 +102,7 @@ extern void sendto_channel_local_with_capability_butone_tags(struct Client *, in
 
 extern void sendto_common_channels_local(struct Client *, int cap, int negcap, const char *, ...) AFP(4, 5);
 extern void sendto_common_channels_local_butone(struct Client *, int cap, int negcap, const char *, ...) AFP(4, 5);
+extern void sendto_netsplit_quits(rb_dlink_list *users, const char *servers, const char *reason);
 
 
 extern void sendto_match_butone(struct Client *one, struct Client *source_p,
@@ -24,6 +24,7 @@
 
 struct _ssl_ctl;
 typedef struct _ssl_ctl ssl_ctl_t;
+struct Client;
 
 enum ssld_status {
 	SSLD_ACTIVE,
@@ -40,7 +41,15 @@ void start_zlib_session(void *data);
 void ssld_update_config(void);
 void ssld_decrement_clicount(ssl_ctl_t *ctl);
 int get_ssld_count(void);
+void set_client_certfp(struct Client *client_p, uint32_t certfp_method, const uint8_t *certfp, uint32_t len);
 void ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_status status, const char *version), void *data);
 
+/* handing ssld processes over across an upgrade, see upgrade.c */
+void ssld_foreach_handoff(void (*func)(void *data, rb_fde_t *F, rb_fde_t *P, pid_t pid, bool shutdown, const char *version), void *data);
+bool ssld_handoff_ready(void);
+pid_t ssld_handoff_pid(ssl_ctl_t *ctl);
+void adopt_ssld(rb_fde_t *F, rb_fde_t *P, pid_t pid, bool shutdown, const char *version);
+ssl_ctl_t *ssld_adopt_client(pid_t pid);
+
 #endif
 
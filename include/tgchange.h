@@ -28,6 +28,28 @@
 #include "client.h"
 #include "channel.h"
 
+/* a set of target pointers that is emptied in constant time: an entry is
+ * only in the set while it has the set's generation.  A zeroed set must
+ * be cleared before it is first used, and is never to be more than half
+ * full.
+ */
+#define TARGET_SET_SIZE 1024	/* a power of two */
+
+struct target_set
+{
+	struct
+	{
+		void *ptr;
+		unsigned int gen;
+	} slot[TARGET_SET_SIZE];
+	unsigned int gen;
+};
+
+/* empties the set */
+void target_set_clear(struct target_set *set);
+/* adds ptr to the set, false if it already was in it */
+bool target_set_add(struct target_set *set, void *ptr);
+
 /* finds a channel where source_p has op or voice and target_p is a member */
 struct Channel *find_allowing_channel(struct Client *source_p, struct Client *target_p);
 /* checks if source_p is allowed to send to target_p */
@@ -36,5 +58,7 @@ int add_target(struct Client *source_p, struct Client *target_p);
 int add_channel_target(struct Client *source_p, struct Channel *chptr);
 /* allows source_p to send to target_p */
 void add_reply_target(struct Client *source_p, struct Client *target_p);
+/* recomputes targets_filter after targets[] was set directly */
+void rebuild_target_filter(struct Client *source_p);
 
 #endif /* INCLUDED_tgchange_h */
@@ -0,0 +1,37 @@
+/*
+ * Comet: a slightly advanced ircd
+ * upgrade.h: restarting into a new binary without dropping connections
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#ifndef INCLUDED_upgrade_h
+#define INCLUDED_upgrade_h
+
+/* the snapshot's fd is passed to the new process in this variable */
+#define UPGRADE_FD_ENV	"IRCD_UPGRADE_FD"
+
+/* in the old process: only returns if the upgrade failed, saying why */
+extern const char *upgrade(void);
+/* the part of it that writes the snapshot, for the tests */
+extern bool upgrade_save(FILE *);
+
+/* in the new process, in the order comet_main() calls them */
+extern bool upgrade_pending(void);
+extern void upgrade_restore_helpers(void);
+extern void upgrade_restore(void);
+
+#endif /* INCLUDED_upgrade_h */
@@ -0,0 +1,61 @@
+/*
+ * Comet: a slightly advanced ircd
+ * zlink.h: compressed server links
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#ifndef INCLUDED_zlink_h
+#define INCLUDED_zlink_h
+
+/* most compressed data kept waiting to be written; the rest of the
+ * sendq stays uncompressed, where the sendq limits can see it
+ */
+#define ZLINK_BACKLOG	(64 * 1024)
+
+#define ZLINK_DEFAULT_LEVEL	6
+
+struct zlink;
+
+struct zlink_stats
+{
+	unsigned long long in;		/* bytes read from the socket */
+	unsigned long long in_plain;	/* what they inflated to */
+	unsigned long long out;		/* bytes compressed for the socket */
+	unsigned long long out_plain;	/* what they were before */
+	int level;
+};
+
+struct zlink *zlink_new(int level);
+void zlink_free(struct zlink *);
+
+bool zlink_inflating(struct zlink *);
+void zlink_set_inflating(struct zlink *);
+void zlink_set_pending(struct zlink *, const char *buf, unsigned int len);
+bool zlink_input_pending(struct zlink *);
+
+void zlink_input(struct zlink *, const char *buf, unsigned int len);
+int zlink_inflate(struct zlink *, char *buf, unsigned int len);
+const char *zlink_error(struct zlink *);
+
+void zlink_append(struct zlink *, const char *buf, unsigned int len);
+void zlink_deflate(struct zlink *, const char *buf, unsigned int len);
+void zlink_deflate_flush(struct zlink *);
+rawbuf_head_t *zlink_sendq(struct zlink *);
+
+void zlink_get_stats(struct zlink *, struct zlink_stats *);
+
+#endif /* INCLUDED_zlink_h */
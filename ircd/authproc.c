@@ -39,6 +39,7 @@
 #include "numeric.h"
 #include "msg.h"
 #include "dns.h"
+#include "s_user.h"
 
 typedef void (*authd_cb_t)(int, char **);
 
@@ -52,6 +53,7 @@ static int start_authd(void);
 static void parse_authd_reply(rb_helper * helper);
 static void restart_authd_cb(rb_helper * helper);
 static EVH timeout_dead_authd_clients;
+static EVH refresh_dnsbl_stats;
 
 static void cmd_accept_client(int parc, char **parv);
 static void cmd_reject_client(int parc, char **parv);
@@ -59,16 +61,31 @@ static void cmd_dns_result(int parc, char **parv);
 static void cmd_notice_client(int parc, char **parv);
 static void cmd_oper_warn(int parc, char **parv);
 static void cmd_stats_results(int parc, char **parv);
+static void authd_late_reject(struct Client *client_p, char cause, char *data, const char *reason);
 
 rb_helper *authd_helper;
 static char *authd_path;
 
 uint32_t cid;
 static rb_dictionary *cid_clients;
+static rb_dictionary *admitted_clients;	/* cid -> client, advisory checks pending */
 static struct ev_entry *timeout_ev;
+static struct ev_entry *dnsbl_stats_ev;
 
 rb_dictionary *dnsbl_stats = NULL;
 
+rb_dlink_list authd_timings;
+static rb_dlink_list authd_timings_new;
+
+static struct AdmissionPolicy admission_policy[] =
+{
+	{ "ident",	false },
+	{ "rdns",	false },
+	{ "dnsbl",	true },
+	{ "opm",	true },
+	{ NULL }
+};
+
 rb_dlink_list opm_list;
 struct OPMListener opm_listeners[LISTEN_LAST];
 
@@ -114,9 +131,15 @@ start_authd(void)
 	if(cid_clients == NULL)
 		cid_clients = rb_dictionary_create("authd cid to uid mapping", rb_uint32cmp);
 
+	if(admitted_clients == NULL)
+		admitted_clients = rb_dictionary_create("authd admitted clients", rb_uint32cmp);
+
 	if(timeout_ev == NULL)
 		timeout_ev = rb_event_addish("timeout_dead_authd_clients", timeout_dead_authd_clients, NULL, 1);
 
+	if(dnsbl_stats_ev == NULL)
+		dnsbl_stats_ev = rb_event_addish("refresh_dnsbl_stats", refresh_dnsbl_stats, NULL, 60);
+
 	authd_helper = rb_helper_start("authd", authd_path, parse_authd_reply, restart_authd_cb);
 
 	if(authd_helper == NULL)
@@ -174,14 +197,54 @@ str_cid_to_client(const char *str, bool del)
 	return cid_to_client(ncid, del);
 }
 
+/* An admitted client authd has now finished with */
+static struct Client *
+str_cid_to_admitted(const char *str)
+{
+	struct Client *client_p;
+	uint32_t ncid = str_to_cid(str);
+
+	if(ncid == 0)
+		return NULL;
+
+	if((client_p = rb_dictionary_delete(admitted_clients, RB_UINT_TO_POINTER(ncid))) != NULL)
+		client_p->localClient->authd_cid = 0;
+
+	return client_p;
+}
+
+/* If parv[4] is present, the client is admitted while the providers it
+ * lists are still running; they may reject it later.  A plain accept
+ * for an admitted client means they have finished.
+ */
 static void
 cmd_accept_client(int parc, char **parv)
 {
 	struct Client *client_p;
+	uint32_t ncid;
 
 	/* cid to uid (retrieve and delete) */
 	if((client_p = str_cid_to_client(parv[1], true)) == NULL)
+	{
+		(void)str_cid_to_admitted(parv[1]);
 		return;
+	}
+
+	/* Admit it before authd_accept_client() starts reading from it;
+	 * what it reads may exit the client, and the exit must find the
+	 * admission to undo it.  A client already dying isn't admitted.
+	 */
+	ncid = client_p->preClient->auth.cid;
+	if(parc > 4)
+	{
+		if(IsAnyDead(client_p))
+			rb_helper_write(authd_helper, "E %x", ncid);
+		else
+		{
+			client_p->localClient->authd_cid = ncid;
+			rb_dictionary_add(admitted_clients, RB_UINT_TO_POINTER(ncid), client_p);
+		}
+	}
 
 	authd_accept_client(client_p, parv[2], parv[3]);
 }
@@ -213,7 +276,12 @@ cmd_reject_client(int parc, char **parv)
 
 	/* cid to uid (retrieve and delete) */
 	if((client_p = str_cid_to_client(parv[1], true)) == NULL)
+	{
+		/* An advisory check rejected a client we already admitted */
+		if((client_p = str_cid_to_admitted(parv[1])) != NULL)
+			authd_late_reject(client_p, toupper(*parv[2]), parv[5], parv[6]);
 		return;
+	}
 
 	authd_reject_client(client_p, parv[3], parv[4], toupper(*parv[2]), parv[5], parv[6]);
 }
@@ -246,6 +314,52 @@ cmd_oper_warn(int parc, char **parv)
 	}
 }
 
+/* One line per DNSBL: host iptype hits cache_hits coalesced queries */
+static void
+dnsbl_stats_result(int parc, char **parv)
+{
+	struct DNSBLEntry *entry;
+
+	if(*parv[0] != 'Y' || parc < 9 || dnsbl_stats == NULL)
+		return;
+
+	if((entry = rb_dictionary_retrieve(dnsbl_stats, parv[3])) == NULL)
+		return;
+
+	entry->cache_hits = strtoul(parv[6], NULL, 10);
+	entry->coalesced = strtoul(parv[7], NULL, 10);
+	entry->queries = strtoul(parv[8], NULL, 10);
+}
+
+/* One line per provider: name policy deadline count p50 p90 p99 max,
+ * then a done line, after which the new lines replace authd_timings.
+ */
+static void
+provider_stats_result(int parc, char **parv)
+{
+	rb_dlink_node *ptr, *nptr;
+	char buf[BUFSIZE];
+
+	if(*parv[0] == 'Y' && parc >= 11)
+	{
+		snprintf(buf, sizeof(buf), "%s %s, deadline %ss: %s clients, p50 %sms p90 %sms p99 %sms max %sms",
+				parv[3], parv[4], parv[5], parv[6], parv[7], parv[8], parv[9], parv[10]);
+		rb_dlinkAddTailAlloc(rb_strdup(buf), &authd_timings_new);
+		return;
+	}
+
+	if(*parv[0] != 'Z')
+		return;
+
+	RB_DLINK_FOREACH_SAFE(ptr, nptr, authd_timings.head)
+	{
+		rb_free(ptr->data);
+		rb_dlinkDestroy(ptr, &authd_timings);
+	}
+
+	rb_dlinkMoveList(&authd_timings_new, &authd_timings);
+}
+
 static void
 cmd_stats_results(int parc, char **parv)
 {
@@ -262,6 +376,12 @@ cmd_stats_results(int parc, char **parv)
 		}
 		dns_stats_results_callback(parv[1], parv[0], parc - 3, (const char **)&parv[3]);
 		break;
+	case 'B':
+		dnsbl_stats_result(parc, parv);
+		break;
+	case 'P':
+		provider_stats_result(parc, parv);
+		break;
 	default:
 		break;
 	}
@@ -271,35 +391,38 @@ static void
 parse_authd_reply(rb_helper * helper)
 {
 	ssize_t len;
-	int parc;
 	char buf[READBUF_SIZE];
-	char *parv[MAXPARA];
 
 	while((len = rb_helper_read(helper, buf, sizeof(buf))) > 0)
-	{
-		struct authd_cb *cmd;
+		authd_parse_line(buf);
+}
 
-		parc = rb_string_to_array(buf, parv, sizeof(parv));
-		cmd = &authd_cmd_tab[(unsigned char)*parv[0]];
-		if(cmd->fn != NULL)
-		{
-			if(cmd->min_parc > parc)
-			{
-				iwarn("authd sent a result with wrong number of arguments: expected %d, got %d",
-					cmd->min_parc, parc);
-				restart_authd();
-				continue;
-			}
+/* Act on one line from authd */
+void
+authd_parse_line(char *line)
+{
+	int parc;
+	char *parv[MAXPARA];
+	struct authd_cb *cmd;
 
-			cmd->fn(parc, parv);
-		}
-		else
-		{
-			iwarn("authd sent us a bad command type: %c", *parv[0]);
-			restart_authd();
-			continue;
-		}
+	parc = rb_string_to_array(line, parv, sizeof(parv));
+	cmd = &authd_cmd_tab[(unsigned char)*parv[0]];
+	if(cmd->fn == NULL)
+	{
+		iwarn("authd sent us a bad command type: %c", *parv[0]);
+		restart_authd();
+		return;
 	}
+
+	if(cmd->min_parc > parc)
+	{
+		iwarn("authd sent a result with wrong number of arguments: expected %d, got %d",
+			cmd->min_parc, parc);
+		restart_authd();
+		return;
+	}
+
+	cmd->fn(parc, parv);
 }
 
 void
@@ -322,6 +445,9 @@ configure_authd(void)
 
 	ident_check_enable(!ConfigFileEntry.disable_auth);
 
+	for(struct AdmissionPolicy *policy = admission_policy; policy->provider != NULL; policy++)
+		set_authd_admission(policy);
+
 	/* Configure OPM */
 	if(rb_dlink_list_length(&opm_list) > 0 &&
 		(opm_listeners[LISTEN_IPV4].ipaddr[0] != '\0' ||
@@ -385,11 +511,29 @@ authd_free_client_cb(rb_dictionary_element *delem, void *unused)
 	authd_free_client(client_p);
 }
 
+static void
+authd_unadmit_client_cb(rb_dictionary_element *delem, void *unused)
+{
+	struct Client *client_p = delem->data;
+	client_p->localClient->authd_cid = 0;
+}
+
 void
 authd_abort_client(struct Client *client_p)
 {
-	rb_dictionary_delete(cid_clients, RB_UINT_TO_POINTER(client_p->preClient->auth.cid));
-	authd_free_client(client_p);
+	if(client_p->preClient != NULL)
+	{
+		rb_dictionary_delete(cid_clients, RB_UINT_TO_POINTER(client_p->preClient->auth.cid));
+		authd_free_client(client_p);
+	}
+
+	if(client_p->localClient != NULL && client_p->localClient->authd_cid != 0)
+	{
+		rb_dictionary_delete(admitted_clients, RB_UINT_TO_POINTER(client_p->localClient->authd_cid));
+		if(authd_helper != NULL)
+			rb_helper_write(authd_helper, "E %x", client_p->localClient->authd_cid);
+		client_p->localClient->authd_cid = 0;
+	}
 }
 
 static void
@@ -406,6 +550,8 @@ restart_authd_cb(rb_helper * helper)
 
 	rb_dictionary_destroy(cid_clients, authd_free_client_cb, NULL);
 	cid_clients = NULL;
+	rb_dictionary_destroy(admitted_clients, authd_unadmit_client_cb, NULL);
+	admitted_clients = NULL;
 
 	start_authd();
 	configure_authd();
@@ -566,6 +712,28 @@ authd_reject_client(struct Client *client_p, const char *ident, const char *host
 	authd_decide_client(client_p, ident, host, false, cause, data, reason);
 }
 
+/* An advisory check rejected a client after it was admitted */
+static void
+authd_late_reject(struct Client *client_p, char cause, char *data, const char *reason)
+{
+	if(IsAnyDead(client_p))
+		return;
+
+	if(client_p->preClient != NULL)
+	{
+		/* Not registered yet, register_local_user() will see this */
+		client_p->preClient->auth.accepted = false;
+		client_p->preClient->auth.cause = cause;
+		rb_free(client_p->preClient->auth.data);
+		client_p->preClient->auth.data = rb_strdup(data);
+		rb_free(client_p->preClient->auth.reason);
+		client_p->preClient->auth.reason = rb_strdup(reason);
+		return;
+	}
+
+	authd_check_reject(client_p, client_p, cause, data, reason);
+}
+
 static void
 timeout_dead_authd_clients(void *notused __unused)
 {
@@ -591,6 +759,23 @@ timeout_dead_authd_clients(void *notused __unused)
 	}
 }
 
+/* Ask authd how its DNSBL lookups are being answered, for STATS n,
+ * and how long its providers take, for STATS A
+ */
+static void
+refresh_dnsbl_stats(void *notused)
+{
+	if(authd_helper == NULL)
+		return;
+
+	rb_helper_write(authd_helper, "S 0 P");
+
+	if(dnsbl_stats == NULL || !rb_dictionary_size(dnsbl_stats))
+		return;
+
+	rb_helper_write(authd_helper, "S 0 B");
+}
+
 /* Send a new DNSBL entry to authd */
 void
 add_dnsbl_entry(const char *host, const char *reason, uint8_t iptype, rb_dlink_list *filters)
@@ -683,6 +868,42 @@ set_authd_timeout(const char *key, int timeout)
 	return true;
 }
 
+struct AdmissionPolicy *
+find_admission_policy(const char *provider)
+{
+	struct AdmissionPolicy *policy;
+
+	for(policy = admission_policy; policy->provider != NULL; policy++)
+	{
+		if(!rb_strcasecmp(policy->provider, provider))
+			return policy;
+	}
+
+	return NULL;
+}
+
+/* Send an admission policy to authd */
+void
+set_authd_admission(struct AdmissionPolicy *policy)
+{
+	rb_helper_write(authd_helper, "O admission %s %s %d", policy->provider,
+			policy->advisory ? "advisory" : "required", policy->deadline);
+}
+
+/* Back to waiting for every provider, with no deadlines */
+void
+reset_authd_admission(void)
+{
+	struct AdmissionPolicy *policy;
+
+	for(policy = admission_policy; policy->provider != NULL; policy++)
+	{
+		policy->advisory = false;
+		policy->deadline = 0;
+		set_authd_admission(policy);
+	}
+}
+
 /* Enable identd checks */
 void
 ident_check_enable(bool enabled)
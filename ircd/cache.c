@@ -49,6 +49,41 @@ char user_motd_changed[MAX_DATE_STRING];
 rb_dictionary *help_dict_oper = NULL;
 rb_dictionary *help_dict_user = NULL;
 
+/*
+ * A cached file goes out the same way to everyone except for the nick
+ * in each reply, so the replies are built once into a render holding,
+ * for every line, the text before the nick (":me.name NNN ") and the
+ * text after it.  A client is sent a copy of the render with its nick
+ * put in, packed many lines to a linebuf line, instead of having each
+ * line formatted, parsed and queued on its own.  The render goes with
+ * the cachefile, so a rehash or cache_user_motd() builds a new one on
+ * the next send.
+ */
+struct cacherender_line
+{
+	size_t offset;
+	unsigned short headlen;
+	unsigned short taillen;
+};
+
+struct cacherender
+{
+	char *text;
+	size_t textlen;
+	size_t textsize;
+	struct cacherender_line *line;
+	unsigned int count;
+	unsigned int size;
+};
+
+struct cacherender_args
+{
+	const struct cacherender *render;
+	unsigned int next;
+	const char *nick;
+	size_t nicklen;
+};
+
 /* init_cache()
  *
  * inputs	-
@@ -194,6 +229,171 @@ cache_links(void *unused)
 	}
 }
 
+static struct cacherender *
+new_render(struct cachefile *cacheptr)
+{
+	struct cacherender *render = rb_malloc(sizeof(struct cacherender));
+
+	render->size = rb_dlink_list_length(&cacheptr->contents) + 2;
+	render->line = rb_malloc(sizeof(struct cacherender_line) * render->size);
+	render->textsize = render->size * 64;
+	render->text = rb_malloc(render->textsize);
+
+	return render;
+}
+
+static void
+free_render(struct cacherender *render)
+{
+	if(render == NULL)
+		return;
+
+	rb_free(render->text);
+	rb_free(render->line);
+	rb_free(render);
+}
+
+/* render_line()
+ *
+ * inputs	- render, reply format of the form ":%s NNN %s ..." and
+ *		  the arguments after the nick
+ * outputs	-
+ * side effects - the reply is added to the render, split at the nick
+ */
+static void
+render_line(struct cacherender *render, const char *pattern, ...)
+{
+	struct cacherender_line *line;
+	char head[HOSTLEN + 7];
+	char tail[BUFSIZE];
+	int headlen, taillen;
+	va_list args;
+
+	if(render->count == render->size)
+		return;
+
+	headlen = snprintf(head, sizeof(head), ":%s %.3s ", me.name, pattern + 4);
+
+	va_start(args, pattern);
+	taillen = vsnprintf(tail, sizeof(tail), pattern + 10, args);
+	va_end(args);
+
+	if(headlen < 0 || taillen < 0)
+		return;
+	if((size_t)taillen >= sizeof(tail))
+		taillen = sizeof(tail) - 1;
+
+	while(render->textlen + headlen + taillen > render->textsize)
+	{
+		render->textsize *= 2;
+		render->text = rb_realloc(render->text, render->textsize);
+	}
+
+	line = &render->line[render->count++];
+	line->offset = render->textlen;
+	line->headlen = headlen;
+	line->taillen = taillen;
+
+	memcpy(render->text + render->textlen, head, headlen);
+	memcpy(render->text + render->textlen + headlen, tail, taillen);
+	render->textlen += headlen + taillen;
+}
+
+static size_t
+render_copy(char *buf, const struct cacherender *render, unsigned int n,
+		const char *nick, size_t nicklen)
+{
+	const struct cacherender_line *line = &render->line[n];
+	const char *text = render->text + line->offset;
+	size_t len = line->headlen, part;
+
+	/* sendto_one() cuts lines down to DATALEN */
+	memcpy(buf, text, len);
+
+	part = nicklen < DATALEN - len ? nicklen : DATALEN - len;
+	memcpy(buf + len, nick, part);
+	len += part;
+
+	part = line->taillen < DATALEN - len ? line->taillen : DATALEN - len;
+	memcpy(buf + len, text + line->headlen, part);
+	len += part;
+
+	return len;
+}
+
+/* fills a linebuf line with as many whole replies as fit, leaving the
+ * CRLF after the last one to rb_linebuf_put()
+ */
+static int
+render_linebuf(char *buf, size_t buflen, void *data)
+{
+	struct cacherender_args *args = data;
+	const struct cacherender *render = args->render;
+	char *p = buf;
+	char *end = buf + buflen - 1;
+
+	for(; args->next < render->count; args->next++)
+	{
+		const struct cacherender_line *line = &render->line[args->next];
+		size_t len = line->headlen + args->nicklen + line->taillen;
+
+		if(len > DATALEN)
+			len = DATALEN;
+		if(p != buf)
+			len += 2;
+		if(len > (size_t)(end - p))
+			break;
+
+		if(p != buf)
+		{
+			*p++ = '\r';
+			*p++ = '\n';
+		}
+		p += render_copy(p, render, args->next, args->nick, args->nicklen);
+	}
+
+	*p = '\0';
+	return p - buf;
+}
+
+/* send_render()
+ *
+ * inputs	- client to send to, render
+ * outputs	- true if the client was sent the render, false if it has
+ *		  to be sent the lines one by one
+ * side effects -
+ */
+static bool
+send_render(struct Client *source_p, const struct cacherender *render)
+{
+	struct cacherender_args args = {
+		.render = render,
+		.nick = source_p->name,
+		.nicklen = strlen(source_p->name),
+	};
+	rb_strf_t strings = { .func = render_linebuf, .func_args = &args, .next = NULL };
+	buf_head_t linebuf;
+	char line[DATALEN + 1];
+
+	if(!MyClient(source_p) || render->count == 0)
+		return false;
+
+	/* the first reply stands for the rest: message tags are added
+	 * for the client, not for the numeric
+	 */
+	line[render_copy(line, render, 0, args.nick, args.nicklen)] = '\0';
+	if(!send_untagged(source_p, line))
+		return false;
+
+	rb_linebuf_newbuf(&linebuf);
+	while(args.next < render->count)
+		rb_linebuf_put(&linebuf, &strings);
+
+	sendto_one_linebuf(source_p, &linebuf, render->count);
+	rb_linebuf_donebuf(&linebuf);
+	return true;
+}
+
 /* free_cachefile()
  *
  * inputs	- cachefile to free
@@ -223,6 +423,7 @@ free_cachefile(struct cachefile *cacheptr)
 		}
 	}
 
+	free_render(cacheptr->render);
 	rb_free(cacheptr);
 }
 
@@ -328,6 +529,22 @@ send_user_motd(struct Client *source_p)
 		return;
 	}
 
+	if(user_motd->render == NULL)
+	{
+		struct cacherender *render = user_motd->render = new_render(user_motd);
+
+		render_line(render, form_str(RPL_MOTDSTART), me.name);
+		RB_DLINK_FOREACH(ptr, user_motd->contents.head)
+		{
+			lineptr = ptr->data;
+			render_line(render, form_str(RPL_MOTD), lineptr->data);
+		}
+		render_line(render, form_str(RPL_ENDOFMOTD));
+	}
+
+	if(send_render(source_p, user_motd->render))
+		return;
+
 	sendto_one(source_p, form_str(RPL_MOTDSTART), myname, nick, me.name);
 
 	RB_DLINK_FOREACH(ptr, user_motd->contents.head)
@@ -378,6 +595,22 @@ send_oper_motd(struct Client *source_p)
 	if(oper_motd == NULL || rb_dlink_list_length(&oper_motd->contents) == 0)
 		return;
 
+	if(oper_motd->render == NULL)
+	{
+		struct cacherender *render = oper_motd->render = new_render(oper_motd);
+
+		render_line(render, form_str(RPL_OMOTDSTART));
+		RB_DLINK_FOREACH(ptr, oper_motd->contents.head)
+		{
+			lineptr = ptr->data;
+			render_line(render, form_str(RPL_OMOTD), lineptr->data);
+		}
+		render_line(render, form_str(RPL_ENDOFOMOTD));
+	}
+
+	if(send_render(source_p, oper_motd->render))
+		return;
+
 	sendto_one(source_p, form_str(RPL_OMOTDSTART),
 		   me.name, source_p->name);
 
@@ -391,3 +624,54 @@ send_oper_motd(struct Client *source_p)
 	sendto_one(source_p, form_str(RPL_ENDOFOMOTD),
 		   me.name, source_p->name);
 }
+
+/* send_help()
+ *
+ * inputs	- client to send help to, help file, topic as asked for
+ * outputs	- client is sent the help file
+ * side effects -
+ */
+void
+send_help(struct Client *source_p, struct cachefile *hptr, const char *topic)
+{
+	struct cacheline *lineptr;
+	rb_dlink_node *ptr;
+	rb_dlink_node *fptr;
+
+	fptr = hptr->contents.head;
+
+	if(hptr->render == NULL)
+	{
+		struct cacherender *render = hptr->render = new_render(hptr);
+
+		lineptr = fptr->data;
+		render_line(render, form_str(RPL_HELPSTART), hptr->name, lineptr->data);
+		RB_DLINK_FOREACH(ptr, fptr->next)
+		{
+			lineptr = ptr->data;
+			render_line(render, form_str(RPL_HELPTXT), hptr->name, lineptr->data);
+		}
+		render_line(render, form_str(RPL_ENDOFHELP), hptr->name);
+	}
+
+	/* the replies echo the topic as it was asked for */
+	if(!strcmp(topic, hptr->name) && send_render(source_p, hptr->render))
+		return;
+
+	lineptr = fptr->data;
+
+	/* first line cant be empty */
+	sendto_one(source_p, form_str(RPL_HELPSTART),
+		   me.name, source_p->name, topic, lineptr->data);
+
+	RB_DLINK_FOREACH(ptr, fptr->next)
+	{
+		lineptr = ptr->data;
+
+		sendto_one(source_p, form_str(RPL_HELPTXT),
+			   me.name, source_p->name, topic, lineptr->data);
+	}
+
+	sendto_one(source_p, form_str(RPL_ENDOFHELP),
+		   me.name, source_p->name, topic);
+}
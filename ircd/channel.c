@@ -150,37 +150,10 @@ send_channel_join(struct Channel *chptr, struct Client *client_p)
 struct membership *
 find_channel_membership(struct Channel *chptr, struct Client *client_p)
 {
-	struct membership *msptr;
-	rb_dlink_node *ptr;
-
 	if(!IsClient(client_p))
 		return NULL;
 
-	/* Pick the most efficient list to use to be nice to things like
-	 * CHANSERV which could be in a large number of channels
-	 */
-	if(rb_dlink_list_length(&chptr->members) < rb_dlink_list_length(&client_p->user->channel))
-	{
-		RB_DLINK_FOREACH(ptr, chptr->members.head)
-		{
-			msptr = ptr->data;
-
-			if(msptr->client_p == client_p)
-				return msptr;
-		}
-	}
-	else
-	{
-		RB_DLINK_FOREACH(ptr, client_p->user->channel.head)
-		{
-			msptr = ptr->data;
-
-			if(msptr->chptr == chptr)
-				return msptr;
-		}
-	}
-
-	return NULL;
+	return find_membership_hash(chptr, client_p);
 }
 
 /* find_channel_status()
@@ -221,7 +194,7 @@ void
 add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 {
 	struct membership *msptr;
-	rb_dlink_node *p;
+	rb_dlink_node *tail;
 
 	s_assert(client_p->user != NULL);
 	if(client_p->user == NULL)
@@ -233,21 +206,22 @@ add_user_to_channel(struct Channel *chptr, struct Client *client_p, int flags)
 	msptr->client_p = client_p;
 	msptr->flags = flags;
 
-	RB_DLINK_FOREACH(p, client_p->user->channel.head)
-	{
-		struct membership *ms2 = p->data;
-		if (irccmp(chptr->chname, ms2->chptr->chname) < 0)
-			break;
-	}
-	if (p == NULL)
-		rb_dlinkAddTail(msptr, &msptr->usernode, &client_p->user->channel);
-	else
-		rb_dlinkAddBefore(p, msptr, &msptr->usernode, &client_p->user->channel);
+	/* the channel list is only sorted when someone needs it in order,
+	 * see sort_user_channels()
+	 */
+	tail = client_p->user->channel.tail;
+	if(tail != NULL && !client_p->user->channel_unsorted &&
+			irccmp(chptr->chname, ((struct membership *)tail->data)->chptr->chname) < 0)
+		client_p->user->channel_unsorted = true;
+
+	rb_dlinkAddTail(msptr, &msptr->usernode, &client_p->user->channel);
 
 	rb_dlinkAdd(msptr, &msptr->channode, &chptr->members);
 
 	if(MyClient(client_p))
 		rb_dlinkAdd(msptr, &msptr->locchannode, &chptr->locmembers);
+
+	add_to_membership_hash(msptr);
 }
 
 /* remove_user_from_channel()
@@ -268,6 +242,7 @@ remove_user_from_channel(struct membership *msptr)
 	client_p = msptr->client_p;
 	chptr = msptr->chptr;
 
+	del_from_membership_hash(msptr);
 	rb_dlinkDelete(&msptr->usernode, &client_p->user->channel);
 	rb_dlinkDelete(&msptr->channode, &chptr->members);
 
@@ -304,6 +279,7 @@ remove_user_from_channels(struct Client *client_p)
 		msptr = ptr->data;
 		chptr = msptr->chptr;
 
+		del_from_membership_hash(msptr);
 		rb_dlinkDelete(&msptr->channode, &chptr->members);
 
 		if(client_p->servptr == &me)
@@ -317,6 +293,51 @@ remove_user_from_channels(struct Client *client_p)
 
 	client_p->user->channel.head = client_p->user->channel.tail = NULL;
 	client_p->user->channel.length = 0;
+	client_p->user->channel_unsorted = false;
+}
+
+static int
+membership_name_cmp(const void *a, const void *b)
+{
+	const struct membership *ms1 = *(struct membership * const *)a;
+	const struct membership *ms2 = *(struct membership * const *)b;
+
+	return irccmp(ms1->chptr->chname, ms2->chptr->chname);
+}
+
+/* sort_user_channels()
+ *
+ * input	- user whose channel list should be put in order
+ * output	-
+ * side effects - user's channel list is sorted by channel name
+ */
+void
+sort_user_channels(struct Client *client_p)
+{
+	struct membership **sorted;
+	rb_dlink_list *list = &client_p->user->channel;
+	rb_dlink_node *ptr, *next_ptr;
+	unsigned long i, n = rb_dlink_list_length(list);
+
+	if(!client_p->user->channel_unsorted)
+		return;
+
+	sorted = rb_malloc(sizeof(struct membership *) * n);
+
+	i = 0;
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, list->head)
+	{
+		sorted[i++] = ptr->data;
+		rb_dlinkDelete(ptr, list);
+	}
+
+	qsort(sorted, n, sizeof(struct membership *), membership_name_cmp);
+
+	for(i = 0; i < n; i++)
+		rb_dlinkAddTail(sorted[i], &sorted[i]->usernode, list);
+
+	rb_free(sorted);
+	client_p->user->channel_unsorted = false;
 }
 
 /* invalidate_bancache_user()
@@ -434,47 +455,6 @@ channel_pub_or_secret(struct Channel *chptr)
 	return ("*");
 }
 
-int
-iter_comm_channels_step(rb_dlink_node *pos1, rb_dlink_node *pos2,
-		struct membership **ms1, struct membership **ms2,
-		struct Channel **chptr)
-{
-	*ms1 = pos1 ? pos1->data : NULL;
-	*ms2 = pos2 ? pos2->data : NULL;
-
-	/* we're at the end */
-	if (*ms1 == NULL && *ms2 == NULL)
-		return 0;
-
-	/* one side is at the end, keep stepping the other one */
-	if (*ms1 == NULL || *ms2 == NULL)
-	{
-		*chptr = *ms1 != NULL ? (*ms1)->chptr : (*ms2)->chptr;
-		return 1;
-	}
-
-	/* common channel */
-	if ((*ms1)->chptr == (*ms2)->chptr)
-	{
-		*chptr = (*ms1)->chptr;
-		return 1;
-	}
-
-	/* null out the channel that's further ahead; we'll get to it later */
-	if (irccmp((*ms1)->chptr->chname, (*ms2)->chptr->chname) > 0)
-	{
-		*ms1 = NULL;
-		*chptr = (*ms2)->chptr;
-		return 1;
-	}
-	else
-	{
-		*ms2 = NULL;
-		*chptr = (*ms1)->chptr;
-		return 1;
-	}
-}
-
 /* channel_member_names()
  *
  * input	- channel to list, client to list to, show endofnames
@@ -840,6 +820,9 @@ can_send(struct Channel *chptr, struct Client *source_p, struct membership *mspt
 	if(is_chanop_voiced(msptr))
 		moduledata.approved = CAN_SEND_OPV;
 
+	if(!hook_has_listeners(h_can_send))
+		return moduledata.approved;
+
 	moduledata.client = source_p;
 	moduledata.chptr = msptr->chptr;
 	moduledata.msptr = msptr;
@@ -28,6 +28,7 @@
 #include "class.h"
 #include "client.h"
 #include "ircd.h"
+#include "logger.h"
 #include "numeric.h"
 #include "s_conf.h"
 #include "s_newconf.h"
@@ -166,6 +167,30 @@ get_con_freq(struct Class *clptr)
 	return (DEFAULT_CONNECTFREQUENCY);
 }
 
+/*
+ * set_class_sockopts
+ *
+ * inputs	- pointer to local client, its class
+ * output	- NONE
+ * side effects - socket buffers and TCP_NOTSENT_LOWAT are set from
+ *		  the class; whatever the class leaves at 0 stays with
+ *		  the kernel, which autotunes buffers that are not set
+ */
+void
+set_class_sockopts(struct Client *client_p, struct Class *clptr)
+{
+	rb_fde_t *F = client_p->localClient->F;
+
+	if(F == NULL || clptr == NULL)
+		return;
+
+	if(!rb_set_sockbufs(F, RcvBuf(clptr), SndBuf(clptr)))
+		ilog_error("setting socket buffers from class");
+
+	if(NotsentLowat(clptr) > 0)
+		rb_set_notsent_lowat(F, NotsentLowat(clptr));
+}
+
 /* add_class()
  *
  * input	- class to add
@@ -197,6 +222,10 @@ add_class(struct Class *classptr)
 		CidrIpv4Bitlen(tmpptr) = CidrIpv4Bitlen(classptr);
 		CidrIpv6Bitlen(tmpptr) = CidrIpv6Bitlen(classptr);
 		CidrAmount(tmpptr) = CidrAmount(classptr);
+		RcvBuf(tmpptr) = RcvBuf(classptr);
+		SndBuf(tmpptr) = SndBuf(classptr);
+		NotsentLowat(tmpptr) = NotsentLowat(classptr);
+		CorkBurst(tmpptr) = CorkBurst(classptr);
 
 		free_class(classptr);
 	}
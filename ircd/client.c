@@ -52,15 +52,15 @@
 #include "rb_dictionary.h"
 #include "sslproc.h"
 #include "s_assert.h"
+#include "zlink.h"
 
 #define DEBUG_EXITED_CLIENTS
 
 static void check_pings_list(rb_dlink_list * list);
 static void check_unknowns_list(rb_dlink_list * list);
 static void free_exited_clients(void *unused);
-static void exit_aborted_clients(void *unused);
 
-static int exit_remote_client(struct Client *, struct Client *, struct Client *,const char *);
+static int exit_remote_client(struct Client *, struct Client *, struct Client *,const char *, bool);
 static int exit_remote_server(struct Client *, struct Client *, struct Client *,const char *);
 static int exit_local_client(struct Client *, struct Client *, struct Client *,const char *);
 static int exit_unknown_client(struct Client *, struct Client *, struct Client *,const char *);
@@ -226,6 +226,9 @@ make_client(struct Client *from)
 		client_p->localClient->lasttime = client_p->localClient->firsttime = rb_current_time();
 
 		client_p->localClient->F = NULL;
+		rb_linebuf_set_combine(&client_p->localClient->buf_sendq, ConfigFileEntry.write_combine);
+		rb_linebuf_set_combine(&client_p->localClient->buf_sendq_control, ConfigFileEntry.write_combine);
+		rb_linebuf_set_combine(&client_p->localClient->buf_sendq_bulk, ConfigFileEntry.write_combine);
 
 		client_p->preClient = rb_bh_alloc(pclient_heap);
 
@@ -284,6 +287,7 @@ free_local_client(struct Client *client_p)
 	}
 
 	client_release_connids(client_p);
+	send_defer_forget(client_p);
 	if(client_p->localClient->F != NULL)
 	{
 		rb_close(client_p->localClient->F);
@@ -305,6 +309,8 @@ free_local_client(struct Client *client_p)
 		ssld_decrement_clicount(client_p->localClient->ssl_ctl);
 
 	rb_free(client_p->localClient->cipher_string);
+	discard_recvq(client_p->localClient);
+	zlink_free(client_p->localClient->zlink);
 
 	rb_bh_free(lclient_heap, client_p->localClient);
 	client_p->localClient = NULL;
@@ -1205,9 +1211,33 @@ free_exited_clients(void *unused)
 
 }
 
+/*
+** Collect the users behind source_p, for sending their QUITs in one go
+ */
+static void
+collect_split_users(struct Client *source_p, rb_dlink_list *users)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr;
+
+	if(IsMe(source_p) || source_p->serv == NULL)
+		return;
+
+	RB_DLINK_FOREACH(ptr, source_p->serv->users.head)
+	{
+		target_p = ptr->data;
+
+		if(!IsDead(target_p) && !IsClosing(target_p))
+			rb_dlinkAddAlloc(target_p, users);
+	}
+
+	RB_DLINK_FOREACH(ptr, source_p->serv->servers.head)
+		collect_split_users(ptr->data, users);
+}
+
 /*
 ** Remove all clients that depend on source_p; assumes all (S)QUITs have
-** already been sent.  we make sure to exit a server's dependent clients
+** already been sent, including the local users' QUITs.  we make sure to exit a server's dependent clients
 ** and servers before the server itself; exit_one_client takes care of
 ** actually removing things off llists.   tweaked from +CSr31  -orabidoo
  */
@@ -1236,7 +1266,7 @@ recurse_remove_clients(struct Client *source_p, const char *comment)
 			add_nd_entry(target_p->name);
 
 			if(!IsDead(target_p) && !IsClosing(target_p))
-				exit_remote_client(NULL, target_p, &me, comment);
+				exit_remote_client(NULL, target_p, &me, comment, false);
 		}
 	}
 	else
@@ -1247,7 +1277,7 @@ recurse_remove_clients(struct Client *source_p, const char *comment)
 			target_p->flags |= FLAGS_KILLED;
 
 			if(!IsDead(target_p) && !IsClosing(target_p))
-				exit_remote_client(NULL, target_p, &me, comment);
+				exit_remote_client(NULL, target_p, &me, comment, false);
 		}
 	}
 
@@ -1270,6 +1300,7 @@ remove_dependents(struct Client *client_p,
 		  struct Client *from, const char *comment, const char *comment1)
 {
 	struct Client *to;
+	rb_dlink_list users = { NULL, NULL, 0 };
 	rb_dlink_node *ptr, *next;
 
 	RB_DLINK_FOREACH_SAFE(ptr, next, serv_list.head)
@@ -1282,6 +1313,15 @@ remove_dependents(struct Client *client_p,
 		sendto_one(to, "SQUIT %s :%s", get_id(source_p, to), comment);
 	}
 
+	/* tell local clients about everyone who is leaving at once, rather
+	 * than one exit_remote_client() at a time
+	 */
+	collect_split_users(source_p, &users);
+	sendto_netsplit_quits(&users, comment1, comment1);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, users.head)
+		rb_dlinkDestroy(ptr, &users);
+
 	recurse_remove_clients(source_p, comment1);
 }
 
@@ -1358,16 +1398,17 @@ dead_link(struct Client *client_p, int sendqex)
 /* This does the remove of the user from channels..local or remote */
 static inline void
 exit_generic_client(struct Client *client_p, struct Client *source_p, struct Client *from,
-		   const char *comment)
+		   const char *comment, bool send_quit)
 {
 	rb_dlink_node *ptr, *next_ptr;
 
 	if(IsOper(source_p))
 		rb_dlinkFindDestroy(source_p, &oper_list);
 
-	sendto_common_channels_local(source_p, NOCAPS, NOCAPS, ":%s!%s@%s QUIT :%s",
-				     source_p->name,
-				     source_p->username, source_p->host, comment);
+	if(send_quit)
+		sendto_common_channels_local(source_p, NOCAPS, NOCAPS, ":%s!%s@%s QUIT :%s",
+					     source_p->name,
+					     source_p->username, source_p->host, comment);
 
 	remove_user_from_channels(source_p);
 
@@ -1398,13 +1439,15 @@ exit_generic_client(struct Client *client_p, struct Client *source_p, struct Cli
 
 /*
  * Assumes IsPerson(source_p) && !MyConnect(source_p)
+ * send_quit is false when local clients have already seen the QUIT
+ * (netsplits, see remove_dependents())
  */
 
 static int
 exit_remote_client(struct Client *client_p, struct Client *source_p, struct Client *from,
-		   const char *comment)
+		   const char *comment, bool send_quit)
 {
-	exit_generic_client(client_p, source_p, from, comment);
+	exit_generic_client(client_p, source_p, from, comment, send_quit);
 
 	if(source_p->servptr && source_p->servptr->serv)
 	{
@@ -1547,13 +1590,13 @@ exit_local_server(struct Client *client_p, struct Client *source_p, struct Clien
 {
 	static char comment1[(HOSTLEN*2)+2];
 	static char newcomment[BUFSIZE];
-	unsigned int sendk, recvk;
+	unsigned long long sendk, recvk;
 
 	rb_dlinkDelete(&source_p->localClient->tnode, &serv_list);
 	rb_dlinkFindDestroy(source_p, &global_serv_list);
 
-	sendk = source_p->localClient->sendK;
-	recvk = source_p->localClient->receiveK;
+	sendk = source_p->localClient->sendB >> 10;
+	recvk = source_p->localClient->receiveB >> 10;
 
 	/* Always show source here, so the server notices show
 	 * which side initiated the split -- jilles
@@ -1590,10 +1633,10 @@ exit_local_server(struct Client *client_p, struct Client *source_p, struct Clien
 		remove_dependents(client_p, source_p, from, IsPerson(from) ? newcomment : comment, comment1);
 
 	sendto_realops_snomask(SNO_GENERAL, L_ALL, "%s was connected"
-			     " for %lld seconds.  %d/%d sendK/recvK.",
+			     " for %lld seconds.  %llu/%llu sendK/recvK.",
 			     source_p->name, (long long)(rb_current_time() - source_p->localClient->firsttime), sendk, recvk);
 
-	ilog(L_SERVER, "%s was connected for %lld seconds.  %d/%d sendK/recvK.",
+	ilog(L_SERVER, "%s was connected for %lld seconds.  %llu/%llu sendK/recvK.",
 	     source_p->name, (long long)(rb_current_time() - source_p->localClient->firsttime), sendk, recvk);
 
 	if(has_id(source_p))
@@ -1620,7 +1663,8 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 	unsigned long on_for;
 	char tbuf[26];
 
-	exit_generic_client(client_p, source_p, from, comment);
+	authd_abort_client(source_p);
+	exit_generic_client(client_p, source_p, from, comment, true);
 	clear_monitor(source_p);
 
 	s_assert(IsPerson(source_p));
@@ -1644,12 +1688,13 @@ exit_local_client(struct Client *client_p, struct Client *source_p, struct Clien
 
 	on_for = rb_current_time() - source_p->localClient->firsttime;
 
-	ilog(L_USER, "%s (%3lu:%02lu:%02lu): %s!%s@%s %s %d/%d",
+	ilog(L_USER, "%s (%3lu:%02lu:%02lu): %s!%s@%s %s %llu/%llu",
 		rb_ctime(rb_current_time(), tbuf, sizeof(tbuf)), on_for / 3600,
 		(on_for % 3600) / 60, on_for % 60,
 		source_p->name, source_p->username, source_p->host,
 		source_p->sockhost,
-		source_p->localClient->sendK, source_p->localClient->receiveK);
+		(unsigned long long)(source_p->localClient->sendB >> 10),
+		(unsigned long long)(source_p->localClient->receiveB >> 10));
 
 	sendto_one(source_p, "ERROR :Closing Link: %s (%s)", source_p->host, comment);
 	close_connection(source_p);
@@ -1732,7 +1777,7 @@ exit_client(struct Client *client_p,	/* The local client originating the
 	{
 		/* Remotes */
 		if(IsPerson(source_p))
-			ret = exit_remote_client(client_p, source_p, from, comment);
+			ret = exit_remote_client(client_p, source_p, from, comment, true);
 		else if(IsServer(source_p))
 			ret = exit_remote_server(client_p, source_p, from, comment);
 	}
@@ -2121,8 +2166,10 @@ close_connection(struct Client *client_p)
 		client_p->localClient->F = NULL;
 	}
 
-	rb_linebuf_donebuf(&client_p->localClient->buf_sendq);
-	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
+	/* the recvq is left for free_local_client(): the handler that got
+	 * us here may still be using parv[] from it
+	 */
+	discard_sendq(client_p);
 	detach_conf(client_p);
 
 	/* XXX shouldnt really be done here. */
@@ -2175,6 +2222,9 @@ error_exit_client(struct Client *client_p, int error)
 
 	if(error == 0)
 		rb_strlcpy(errmsg, "Remote host closed the connection", sizeof(errmsg));
+	else if(error == RB_RW_SSL_ERROR)
+		snprintf(errmsg, sizeof(errmsg), "Read error: %s",
+				rb_get_ssl_strerror(client_p->localClient->F));
 	else
 		snprintf(errmsg, sizeof(errmsg), "Read error: %s", strerror(current_error));
 
@@ -507,3 +507,179 @@ find_cli_connid_hash(uint32_t connid)
 {
 	return rb_dictionary_retrieve(client_connid_tree, RB_UINT_TO_POINTER(connid));
 }
+
+/*
+ * The membership hash maps (channel, client) pairs to their membership.
+ * It is an open addressing table with linear probing, kept between a
+ * quarter and half full; deletion shifts later entries back instead of
+ * leaving tombstones.
+ */
+static struct membership **membership_table;
+static unsigned int membership_bits;
+static unsigned int membership_count;
+
+static inline unsigned int
+hash_membership(const struct Channel *chptr, const struct Client *client_p, unsigned int bits)
+{
+	uint64_t h = (uint64_t)(uintptr_t)chptr ^ ((uint64_t)(uintptr_t)client_p << 7 | (uint64_t)(uintptr_t)client_p >> 57);
+
+	/* fibonacci hashing: the top bits of the product are well mixed */
+	return (unsigned int)((h * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static void
+resize_membership_hash(unsigned int bits)
+{
+	struct membership **old_table = membership_table;
+	unsigned int old_size = old_table != NULL ? 1U << membership_bits : 0;
+	unsigned int mask = (1U << bits) - 1;
+	unsigned int i, j;
+
+	membership_table = rb_malloc(sizeof(struct membership *) << bits);
+	membership_bits = bits;
+
+	for(i = 0; i < old_size; i++)
+	{
+		struct membership *msptr = old_table[i];
+
+		if(msptr == NULL)
+			continue;
+
+		j = hash_membership(msptr->chptr, msptr->client_p, bits);
+		while(membership_table[j] != NULL)
+			j = (j + 1) & mask;
+		membership_table[j] = msptr;
+	}
+
+	rb_free(old_table);
+}
+
+void
+add_to_membership_hash(struct membership *msptr)
+{
+	unsigned int mask, i;
+
+	if(membership_table == NULL)
+		resize_membership_hash(MEMBERSHIP_MIN_BITS);
+	else if((membership_count + 1) * 2 > 1U << membership_bits)
+		resize_membership_hash(membership_bits + 1);
+
+	mask = (1U << membership_bits) - 1;
+	i = hash_membership(msptr->chptr, msptr->client_p, membership_bits);
+	while(membership_table[i] != NULL)
+		i = (i + 1) & mask;
+
+	membership_table[i] = msptr;
+	membership_count++;
+}
+
+/* make room for count more memberships without growing one step at a time */
+void
+reserve_membership_hash(unsigned int count)
+{
+	unsigned int bits = membership_table != NULL ? membership_bits : MEMBERSHIP_MIN_BITS;
+
+	while((membership_count + count) * 2 > 1U << bits)
+		bits++;
+
+	if(membership_table == NULL || bits != membership_bits)
+		resize_membership_hash(bits);
+}
+
+void
+del_from_membership_hash(struct membership *msptr)
+{
+	unsigned int mask, i, j, home;
+
+	if(membership_table == NULL)
+		return;
+
+	mask = (1U << membership_bits) - 1;
+	i = hash_membership(msptr->chptr, msptr->client_p, membership_bits);
+	while(membership_table[i] != msptr)
+	{
+		if(membership_table[i] == NULL)
+		{
+			s_assert(0);
+			return;
+		}
+		i = (i + 1) & mask;
+	}
+
+	/* shift back any following entry whose probe sequence passes
+	 * through the slot being emptied
+	 */
+	for(j = (i + 1) & mask; membership_table[j] != NULL; j = (j + 1) & mask)
+	{
+		home = hash_membership(membership_table[j]->chptr, membership_table[j]->client_p,
+				membership_bits);
+
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			membership_table[i] = membership_table[j];
+			i = j;
+		}
+	}
+	membership_table[i] = NULL;
+	membership_count--;
+
+	if(membership_bits > MEMBERSHIP_MIN_BITS && membership_count * 8 < 1U << membership_bits)
+		resize_membership_hash(membership_bits - 1);
+}
+
+struct membership *
+find_membership_hash(struct Channel *chptr, struct Client *client_p)
+{
+	struct membership *msptr;
+	unsigned int mask, i;
+
+	if(membership_table == NULL)
+		return NULL;
+
+	mask = (1U << membership_bits) - 1;
+	for(i = hash_membership(chptr, client_p, membership_bits);
+			(msptr = membership_table[i]) != NULL; i = (i + 1) & mask)
+	{
+		if(msptr->chptr == chptr && msptr->client_p == client_p)
+			return msptr;
+	}
+
+	return NULL;
+}
+
+/* depth is the number of probes a lookup of an entry takes */
+void
+membership_hash_stats(void (*cb)(const char *, void *), void *privdata)
+{
+	char str[256];
+	unsigned int size, mask, i, depth, maxdepth = 0;
+	unsigned long sum = 0;
+
+	if(membership_count == 0)
+	{
+		snprintf(str, sizeof str, "%-30s %-15s %-10s %-10s %-10s %-10s",
+				"membership", "OPEN ADDRESS", "0", "0", "0", "0");
+		cb(str, privdata);
+		return;
+	}
+
+	size = 1U << membership_bits;
+	mask = size - 1;
+	for(i = 0; i < size; i++)
+	{
+		struct membership *msptr = membership_table[i];
+
+		if(msptr == NULL)
+			continue;
+
+		depth = ((i - hash_membership(msptr->chptr, msptr->client_p, membership_bits)) & mask) + 1;
+		sum += depth;
+		if(depth > maxdepth)
+			maxdepth = depth;
+	}
+
+	snprintf(str, sizeof str, "%-30s %-15s %-10u %-10lu %-10lu %-10u",
+			"membership", "OPEN ADDRESS", membership_count, sum,
+			sum / membership_count, maxdepth);
+	cb(str, privdata);
+}
@@ -37,6 +37,7 @@
 #include "stdinc.h"
 #include "hook.h"
 #include "match.h"
+#include "s_conf.h"
 
 hook *hooks;
 
@@ -180,6 +181,39 @@ register_hook(const char *name)
 	return i;
 }
 
+/* rebuild_hook()
+ *   Regenerates the flat dispatch array for a hook from its list.  If
+ *   the hook is being called right now, the old array is kept alive
+ *   until the outermost call returns, as nested calls may each be
+ *   walking a different one.
+ */
+static void
+rebuild_hook(hook *h)
+{
+	rb_dlink_node *ptr;
+	hookfn *fns = NULL;
+	int i = 0;
+
+	if(rb_dlink_list_length(&h->hooks) > 0)
+	{
+		fns = rb_malloc(sizeof(hookfn) * rb_dlink_list_length(&h->hooks));
+
+		RB_DLINK_FOREACH(ptr, h->hooks.head)
+		{
+			struct hook_entry *entry = ptr->data;
+			fns[i++] = entry->fn;
+		}
+	}
+
+	if(h->running && h->fns != NULL)
+		rb_dlinkAddAlloc(h->fns, &h->stale);
+	else
+		rb_free(h->fns);
+
+	h->fns = fns;
+	h->nfns = i;
+}
+
 /* add_hook()
  *   Adds a hook to an event in the hook table, creating event first if
  *   needed.
@@ -210,11 +244,13 @@ add_hook_prio(const char *name, hookfn fn, enum hook_priority priority)
 		if (entry->priority <= o->priority)
 		{
 			rb_dlinkAddBefore(ptr, entry, &entry->node, &hooks[i].hooks);
+			rebuild_hook(&hooks[i]);
 			return;
 		}
 	}
 
 	rb_dlinkAddTail(entry, &entry->node, &hooks[i].hooks);
+	rebuild_hook(&hooks[i]);
 }
 
 /* remove_hook()
@@ -235,6 +271,8 @@ remove_hook(const char *name, hookfn fn)
 		if (entry->fn == fn)
 		{
 			rb_dlinkDelete(ptr, &hooks[i].hooks);
+			rb_free(entry);
+			rebuild_hook(&hooks[i]);
 			return;
 		}
 	}
@@ -246,15 +284,45 @@ remove_hook(const char *name, hookfn fn)
 void
 call_hook(int id, void *arg)
 {
-	rb_dlink_node *ptr;
-
 	/* The ID we were passed is the position in the hook table of this
 	 * hook
 	 */
-	RB_DLINK_FOREACH(ptr, hooks[id].hooks.head)
+	hook *h = &hooks[id];
+	hookfn *fns = h->fns;
+	int nfns = h->nfns;
+	struct timespec start, end;
+	bool profile = ConfigFileEntry.command_profiling;
+	rb_dlink_node *ptr, *next;
+	int i;
+
+	if(nfns == 0)
+		return;
+
+	if(profile)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	h->running++;
+
+	for(i = 0; i < nfns; i++)
+		fns[i](arg);
+
+	/* the table may have grown underneath us */
+	h = &hooks[id];
+
+	if(--h->running == 0)
 	{
-		struct hook_entry *entry = ptr->data;
-		entry->fn(arg);
+		RB_DLINK_FOREACH_SAFE(ptr, next, h->stale.head)
+		{
+			rb_free(ptr->data);
+			rb_dlinkDestroy(ptr, &h->stale);
+		}
+	}
+
+	h->calls++;
+	if(profile)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		h->timed++;
+		h->nsec += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
 	}
 }
 
@@ -64,6 +64,7 @@
 #include "bandbi.h"
 #include "authproc.h"
 #include "operhash.h"
+#include "upgrade.h"
 
 static void
 ircd_die_cb(const char *str) __attribute__((noreturn));
@@ -525,6 +526,7 @@ int
 comet_main(int argc, char * const argv[])
 {
 	int fd;
+	bool upgrading;
 
 	/* Check to see if the user is running us as root, which is a nono */
 	if(geteuid() == 0)
@@ -608,8 +610,13 @@ comet_main(int argc, char * const argv[])
 	else if (fd == -1)
 		exit(1);
 
+	/* started by UPGRADE: we are already the daemon, and the fds we
+	 * were handed must stay open
+	 */
+	upgrading = upgrade_pending();
+
 	/* Check if there is pidfile and daemon already running */
-	if(!testing_conf)
+	if(!testing_conf && !upgrading)
 	{
 		check_pidfile(pidFileName);
 
@@ -621,14 +628,16 @@ comet_main(int argc, char * const argv[])
 	}
 
 	/* Init the event subsystem */
-	rb_lib_init(ircd_log_cb, ircd_restart_cb, ircd_die_cb, !server_state_foreground, maxconnections, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_lib_init(ircd_log_cb, ircd_restart_cb, ircd_die_cb, !server_state_foreground && !upgrading, maxconnections, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
 	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+	rb_init_rawbuffers(RAWBUF_HEAP_SIZE);
 
 	rb_init_prng(NULL, RB_PRNG_DEFAULT);
 
 	seed_random(NULL);
 
 	init_builtin_capabs();
+	init_numerics();
 	default_server_capabs = CAP_MASK;
 
 	init_main_logfile();
@@ -656,6 +665,9 @@ comet_main(int argc, char * const argv[])
 
 	privilegeset_set_new("default", "", 0);
 
+	if (upgrading)
+		upgrade_restore_helpers();
+
 	if (testing_conf)
 		fprintf(stderr, "\nBeginning config test\n");
 	read_conf_files(true);	/* cold start init conf files */
@@ -727,6 +739,9 @@ comet_main(int argc, char * const argv[])
 		return 0;	/* Why? We want the launcher to exit out. */
 	}
 
+	if (upgrading)
+		upgrade_restore();
+
 	check_class();
 	write_pidfile(pidFileName);
 	load_help();
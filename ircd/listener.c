@@ -47,6 +47,7 @@ static rb_dlink_list listener_list = {};
 static int accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, void *data);
 static void accept_callback(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t addrlen, void *data);
 static SSL_OPEN_CB accept_sslcallback;
+static ACCB accept_tls_callback;
 
 static struct Listener *
 make_listener(struct rb_sockaddr_storage *addr)
@@ -116,6 +117,7 @@ show_ports(struct Client *source_p)
 			   IsOperAdmin(source_p) ? listener->name : me.name,
 			   listener->ref_count, (listener->active) ? "active" : "disabled",
 			   listener->sctp ? " sctp" : " tcp",
+			   listener->ssl == LISTENER_SSL_INLINE ? " ssl inline" :
 			   listener->ssl ? " ssl" : "");
 	}
 }
@@ -126,24 +128,12 @@ show_ports(struct Client *source_p)
  * returns true (1) if successful false (0) on error.
  */
 
-static int
-inetport(struct Listener *listener)
+/*
+ * set_listener_name - name a listener after the addresses it is bound to
+ */
+static void
+set_listener_name(struct Listener *listener)
 {
-	rb_fde_t *F;
-	const char *errstr;
-	int ret;
-
-	if (listener->sctp) {
-#ifdef HAVE_LIBSCTP
-		/* only AF_INET6 sockets can have both AF_INET and AF_INET6 addresses */
-		F = rb_socket(AF_INET6, SOCK_STREAM, IPPROTO_SCTP, "Listener socket");
-#else
-		F = NULL;
-#endif
-	} else {
-		F = rb_socket(GET_SS_FAMILY(&listener->addr[0]), SOCK_STREAM, IPPROTO_TCP, "Listener socket");
-	}
-
 	memset(listener->vhost, 0, sizeof(listener->vhost));
 
 	if (GET_SS_FAMILY(&listener->addr[0]) == AF_INET6) {
@@ -167,6 +157,27 @@ inetport(struct Listener *listener)
 	if (listener->vhost[0] != '\0') {
 		listener->name = listener->vhost;
 	}
+}
+
+static int
+inetport(struct Listener *listener)
+{
+	rb_fde_t *F;
+	const char *errstr;
+	int ret;
+
+	if (listener->sctp) {
+#ifdef HAVE_LIBSCTP
+		/* only AF_INET6 sockets can have both AF_INET and AF_INET6 addresses */
+		F = rb_socket(AF_INET6, SOCK_STREAM, IPPROTO_SCTP, "Listener socket");
+#else
+		F = NULL;
+#endif
+	} else {
+		F = rb_socket(GET_SS_FAMILY(&listener->addr[0]), SOCK_STREAM, IPPROTO_TCP, "Listener socket");
+	}
+
+	set_listener_name(listener);
 
 	if (F == NULL) {
 		sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
@@ -335,8 +346,12 @@ add_tcp_listener(int port, const char *vhost_ip, int family, int ssl, int defer_
 			break;
 	}
 	if ((listener = find_listener(vaddr, 0))) {
-		if (listener->F != NULL)
+		if (listener->F != NULL) {
+			/* new connections can switch between ssld and inline TLS */
+			if (listener->ssl && ssl)
+				listener->ssl = ssl;
 			return;
+		}
 	} else {
 		listener = make_listener(vaddr);
 		rb_dlinkAdd(listener, &listener->lnode, &listener_list);
@@ -467,6 +482,54 @@ close_listeners(void)
 	rb_close_pending_fds();
 }
 
+/*
+ * listener_foreach - call func for each open listener
+ */
+void
+listener_foreach(void (*func)(void *data, struct Listener *listener), void *data)
+{
+	rb_dlink_node *n;
+
+	RB_DLINK_FOREACH(n, listener_list.head)
+	{
+		struct Listener *listener = n->data;
+
+		if(listener->F != NULL)
+			func(data, listener);
+	}
+}
+
+/*
+ * adopt_listener - start accepting on a socket that was already
+ * listening when it was handed to us by the process we replaced
+ * (see upgrade.c).  The conf's listen{} blocks find it by address.
+ */
+struct Listener *
+adopt_listener(int fd, uint8_t type, struct rb_sockaddr_storage *addr, int ssl, int defer_accept, bool sctp)
+{
+	struct Listener *listener;
+	rb_fde_t *F;
+
+	F = rb_open(fd, type, "Listener socket");
+	if(F == NULL)
+		return NULL;
+	rb_set_nb(F);
+
+	listener = make_listener(addr);
+	rb_dlinkAdd(listener, &listener->lnode, &listener_list);
+
+	listener->ssl = ssl;
+	listener->defer_accept = defer_accept;
+	listener->sctp = sctp;
+	set_listener_name(listener);
+
+	listener->F = F;
+	listener->active = 1;
+
+	rb_accept_tcp(listener->F, accept_precallback, accept_callback, listener);
+	return listener;
+}
+
 /*
  * add_connection - creates a client which has just connected to us on
  * the given fd. The sockhost field is initialized with the ip# of the host.
@@ -503,7 +566,14 @@ add_connection(struct Listener *listener, rb_fde_t *F, struct sockaddr *sai, str
 		SetSCTP(new_client);
 	}
 
-	if (listener->ssl)
+	if (listener->ssl == LISTENER_SSL_INLINE)
+	{
+		/* the handshake starts once authd knows about the client */
+		defer = true;
+		SetSSL(new_client);
+		SetSecure(new_client);
+	}
+	else if (listener->ssl)
 	{
 		rb_fde_t *xF[2];
 		if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &xF[0], &xF[1], "Incoming ssld Connection") == -1)
@@ -540,6 +610,9 @@ add_connection(struct Listener *listener, rb_fde_t *F, struct sockaddr *sai, str
 	++listener->ref_count;
 
 	authd_initiate_client(new_client, defer);
+
+	if (listener->ssl == LISTENER_SSL_INLINE)
+		rb_ssl_start_accepted(F, accept_tls_callback, new_client, 10);
 }
 
 static int
@@ -549,6 +622,45 @@ accept_sslcallback(struct Client *client_p, int status)
 	return 0; /* use default handler if status != RB_OK */
 }
 
+/*
+ * accept_tls_callback - the TLS handshake on an inline_tls listener's
+ * connection has finished, do what ssld would have told us about
+ */
+static void
+accept_tls_callback(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t len, void *data)
+{
+	struct Client *client_p = data;
+	uint8_t certfp[RB_SSL_CERTFP_LEN];
+	const char *cipher;
+	int certfp_len;
+
+	if(status != RB_OK)
+	{
+		/* don't try to send an ERROR over a broken session */
+		SetIOError(client_p);
+		if(status == RB_ERR_TIMEOUT)
+			exit_client(client_p, client_p, &me, "SSL handshake timed out");
+		else if(status == RB_ERROR_SSL)
+			exit_client(client_p, client_p, &me, rb_get_ssl_strerror(F));
+		else
+			exit_client(client_p, client_p, &me, "SSL handshake failed");
+		return;
+	}
+
+	cipher = rb_ssl_get_cipher(F);
+	if(!EmptyString(cipher))
+	{
+		rb_free(client_p->localClient->cipher_string);
+		client_p->localClient->cipher_string = rb_strdup(cipher);
+	}
+
+	certfp_len = rb_get_ssl_certfp(F, certfp, ConfigFileEntry.certfp_method);
+	if(certfp_len > 0)
+		set_client_certfp(client_p, ConfigFileEntry.certfp_method, certfp, certfp_len);
+
+	authd_deferred_client(client_p);
+}
+
 static int
 accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, void *data)
 {
@@ -571,7 +683,8 @@ accept_precallback(rb_fde_t *F, struct sockaddr *addr, rb_socklen_t addrlen, voi
 		0x15, 0x03, 0x00, 0x00, 0x02, 0x02, 0x50
 	};
 
-	if(listener->ssl && (!ircd_ssl_ok || !get_ssld_count()))
+	if(listener->ssl && (!ircd_ssl_ok ||
+			(listener->ssl == LISTENER_SSL_SSLD && !get_ssld_count())))
 	{
 		rb_close(F);
 		return 0;
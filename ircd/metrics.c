@@ -0,0 +1,504 @@
+/*
+ * Comet: a slightly advanced ircd
+ * metrics.c: event loop and queue metrics, a Prometheus text dump and
+ *            a binary snapshot
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "client.h"
+#include "ircd.h"
+#include "logger.h"
+#include "s_conf.h"
+#include "s_stats.h"
+#include "send.h"
+#include "metrics.h"
+
+#include <sys/un.h>
+
+#define METRICS_TIMEOUT	10
+
+const char *metrics_conn_type_name[METRICS_CONN_LAST] = {
+	"client", "server", "unknown"
+};
+
+struct metrics_buf
+{
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct metrics_conn
+{
+	rb_fde_t *F;
+	struct metrics_buf buf;
+	size_t written;
+};
+
+struct metrics_socket
+{
+	const char *name;
+	void (*render)(struct metrics_buf *);
+	rb_fde_t *F;
+	char *path;
+};
+
+static void metrics_render(struct metrics_buf *);
+static void metrics_snapshot_render(struct metrics_buf *);
+
+static struct metrics_socket metrics_text = { "metrics_socket", metrics_render };
+static struct metrics_socket metrics_binary = { "metrics_snapshot_socket", metrics_snapshot_render };
+
+static void
+collect_list(struct metrics_queues *mq, rb_dlink_list *list, enum metrics_conn_type type)
+{
+	struct Client *client_p;
+	rb_dlink_node *ptr;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		client_p = ptr->data;
+
+		if(client_p->localClient == NULL)
+			continue;
+
+		mq->conns[type]++;
+		if(IsFlush(client_p))
+			mq->flushing[type]++;
+
+		rb_histogram_add(&mq->sendq[type], sendq_length(client_p));
+		rb_histogram_add(&mq->recvq[type],
+				client_p->localClient->recvq_end - client_p->localClient->recvq_start);
+	}
+}
+
+/*
+ * metrics_collect_queues
+ *
+ * Walks every local connection and records its sendq and recvq sizes.
+ */
+void
+metrics_collect_queues(struct metrics_queues *mq)
+{
+	memset(mq, 0, sizeof(*mq));
+
+	collect_list(mq, &lclient_list, METRICS_CONN_CLIENT);
+	collect_list(mq, &serv_list, METRICS_CONN_SERVER);
+	collect_list(mq, &unknown_list, METRICS_CONN_UNKNOWN);
+}
+
+/*
+ * metrics_collect_stats
+ *
+ * ServerStats only counts connections once they close; adds the ones
+ * still open, as STATS t shows them.
+ */
+void
+metrics_collect_stats(struct ServerStatistics *sp)
+{
+	struct Client *target_p;
+	rb_dlink_node *ptr;
+
+	memcpy(sp, &ServerStats, sizeof(struct ServerStatistics));
+
+	RB_DLINK_FOREACH(ptr, serv_list.head)
+	{
+		target_p = ptr->data;
+
+		sp->is_sbs += target_p->localClient->sendB;
+		sp->is_sbr += target_p->localClient->receiveB;
+		sp->is_sti += (unsigned long long)(rb_current_time() - target_p->localClient->firsttime);
+		sp->is_sv++;
+	}
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		target_p = ptr->data;
+
+		sp->is_cbs += target_p->localClient->sendB;
+		sp->is_cbr += target_p->localClient->receiveB;
+		sp->is_cti += (unsigned long long)(rb_current_time() - target_p->localClient->firsttime);
+		sp->is_cl++;
+	}
+
+	sp->is_ni += rb_dlink_list_length(&unknown_list);
+}
+
+/*
+ * metrics_take_snapshot
+ *
+ * Fills in everything the binary snapshot carries.
+ */
+void
+metrics_take_snapshot(struct metrics_snapshot *snap)
+{
+	const struct rb_loop_stats *ls = rb_lib_loop_stats();
+	struct ServerStatistics sp;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->magic = METRICS_SNAPSHOT_MAGIC;
+	snap->version = METRICS_SNAPSHOT_VERSION;
+	snap->size = sizeof(*snap);
+	snap->time = rb_current_time();
+	snap->start_time = startup_time;
+
+	snap->conns[METRICS_CONN_CLIENT] = rb_dlink_list_length(&lclient_list);
+	snap->conns[METRICS_CONN_SERVER] = rb_dlink_list_length(&serv_list);
+	snap->conns[METRICS_CONN_UNKNOWN] = rb_dlink_list_length(&unknown_list);
+
+	snap->sent_msgs = me.localClient->sendM;
+	snap->sent_bytes = me.localClient->sendB;
+	snap->recv_msgs = me.localClient->receiveM;
+	snap->recv_bytes = me.localClient->receiveB;
+
+	metrics_collect_stats(&sp);
+	snap->client_conns = sp.is_cl;
+	snap->client_sent_bytes = sp.is_cbs;
+	snap->client_recv_bytes = sp.is_cbr;
+	snap->client_conn_seconds = sp.is_cti;
+	snap->server_conns = sp.is_sv;
+	snap->server_sent_bytes = sp.is_sbs;
+	snap->server_recv_bytes = sp.is_sbr;
+	snap->server_conn_seconds = sp.is_sti;
+	snap->unknown_closes = sp.is_ni;
+
+	snap->accepts = sp.is_ac;
+	snap->refused = sp.is_ref;
+	snap->rejected = sp.is_rej;
+	snap->throttled = sp.is_thr;
+	snap->unknown_commands = sp.is_unco;
+	snap->unknown_prefixes = sp.is_unpf;
+	snap->wrong_direction = sp.is_wrdi;
+	snap->empty_messages = sp.is_empt;
+	snap->numerics_seen = sp.is_num;
+	snap->nick_collisions = sp.is_kill;
+	snap->nick_saves = sp.is_save;
+	snap->auth_successes = sp.is_asuc;
+	snap->auth_fails = sp.is_abad;
+	snap->sasl_successes = sp.is_ssuc;
+	snap->sasl_fails = sp.is_sbad;
+	snap->tgchange_blocked = sp.is_tgch;
+	snap->ratelimit_blocked = sp.is_rl;
+	snap->sendq_blocked = sp.is_sqthr;
+	snap->sendq_shed = sp.is_sqshed;
+
+	snap->sendq_total = sendq_total;
+	snap->sendq_peak = sendq_peak;
+
+	snap->loop_iterations = ls->iterations;
+	snap->loop_wakeups = ls->wakeups;
+	snap->loop_wait_us = ls->wait_us;
+	snap->open_fds = rb_getnumfds();
+	snap->max_fds = rb_getmaxconnect();
+}
+
+static void
+metrics_append(struct metrics_buf *mb, const void *data, size_t len)
+{
+	if(mb->len + len > mb->size)
+	{
+		mb->size = mb->len + len;
+		mb->data = rb_realloc(mb->data, mb->size);
+	}
+
+	memcpy(mb->data + mb->len, data, len);
+	mb->len += len;
+}
+
+static void __attribute__((format(printf, 2, 3)))
+metrics_printf(struct metrics_buf *mb, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	for(;;)
+	{
+		va_start(args, fmt);
+		len = vsnprintf(mb->data + mb->len, mb->size - mb->len, fmt, args);
+		va_end(args);
+
+		if(len < 0)
+			return;
+
+		if(mb->len + len < mb->size)
+			break;
+
+		mb->size = (mb->size + len) * 2;
+		mb->data = rb_realloc(mb->data, mb->size);
+	}
+
+	mb->len += len;
+}
+
+static void
+metrics_header(struct metrics_buf *mb, const char *name, const char *type, const char *help)
+{
+	metrics_printf(mb, "# HELP ircd_%s %s\n# TYPE ircd_%s %s\n", name, help, name, type);
+}
+
+/* scale converts the histogram's units to the metric's, e.g. usec to sec */
+static void
+metrics_histogram(struct metrics_buf *mb, const char *name, const char *label,
+		const struct rb_histogram *hist, double scale)
+{
+	unsigned long long seen = 0;
+	int i, last = -1;
+
+	for(i = 0; i < RB_HISTOGRAM_BUCKETS - 1; i++)
+		if(hist->buckets[i])
+			last = i;
+
+	for(i = 0; i <= last; i++)
+	{
+		seen += hist->buckets[i];
+		metrics_printf(mb, "ircd_%s_bucket{%s%sle=\"%g\"} %llu\n", name,
+				label ? label : "", label ? "," : "",
+				rb_histogram_bucket_max(i) * scale, seen);
+	}
+
+	metrics_printf(mb, "ircd_%s_bucket{%s%sle=\"+Inf\"} %llu\n", name,
+			label ? label : "", label ? "," : "", hist->count);
+	metrics_printf(mb, "ircd_%s_sum%s%s%s %g\n", name,
+			label ? "{" : "", label ? label : "", label ? "}" : "",
+			hist->sum * scale);
+	metrics_printf(mb, "ircd_%s_count%s%s%s %llu\n", name,
+			label ? "{" : "", label ? label : "", label ? "}" : "",
+			hist->count);
+}
+
+static void
+metrics_queue_histograms(struct metrics_buf *mb, const char *name, const char *help,
+		struct rb_histogram *hists)
+{
+	char label[32];
+	int i;
+
+	metrics_header(mb, name, "histogram", help);
+	for(i = 0; i < METRICS_CONN_LAST; i++)
+	{
+		snprintf(label, sizeof label, "type=\"%s\"", metrics_conn_type_name[i]);
+		metrics_histogram(mb, name, label, &hists[i], 1);
+	}
+}
+
+static void
+metrics_render(struct metrics_buf *mb)
+{
+	const struct rb_loop_stats *ls = rb_lib_loop_stats();
+	struct metrics_queues mq;
+	int i;
+
+	metrics_header(mb, "loop_iterations_total", "counter", "Event loop iterations.");
+	metrics_printf(mb, "ircd_loop_iterations_total %llu\n", ls->iterations);
+	metrics_header(mb, "loop_wakeups_total", "counter", "Event loop iterations that returned I/O events.");
+	metrics_printf(mb, "ircd_loop_wakeups_total %llu\n", ls->wakeups);
+	metrics_header(mb, "loop_wait_seconds_total", "counter", "Time spent blocked waiting for I/O events.");
+	metrics_printf(mb, "ircd_loop_wait_seconds_total %g\n", ls->wait_us / 1e6);
+
+	metrics_header(mb, "loop_iteration_seconds", "histogram", "Duration of whole event loop iterations.");
+	metrics_histogram(mb, "loop_iteration_seconds", NULL, &ls->iteration, 1e-6);
+	metrics_header(mb, "loop_busy_seconds", "histogram", "Time per iteration spent not waiting (loop lag).");
+	metrics_histogram(mb, "loop_busy_seconds", NULL, &ls->busy, 1e-6);
+	metrics_header(mb, "loop_handler_seconds", "histogram", "Time per iteration spent in I/O handlers.");
+	metrics_histogram(mb, "loop_handler_seconds", NULL, &ls->handlers, 1e-6);
+	metrics_header(mb, "loop_timer_seconds", "histogram", "Time per iteration spent in timed events.");
+	metrics_histogram(mb, "loop_timer_seconds", NULL, &ls->timers, 1e-6);
+	metrics_header(mb, "loop_events", "histogram", "I/O events returned per wakeup.");
+	metrics_histogram(mb, "loop_events", NULL, &ls->events, 1);
+
+	metrics_header(mb, "open_fds", "gauge", "Open file descriptors.");
+	metrics_printf(mb, "ircd_open_fds %d\n", rb_getnumfds());
+	metrics_header(mb, "max_fds", "gauge", "File descriptor limit.");
+	metrics_printf(mb, "ircd_max_fds %d\n", rb_getmaxconnect());
+
+	metrics_collect_queues(&mq);
+
+	metrics_header(mb, "connections", "gauge", "Local connections.");
+	for(i = 0; i < METRICS_CONN_LAST; i++)
+		metrics_printf(mb, "ircd_connections{type=\"%s\"} %u\n",
+				metrics_conn_type_name[i], mq.conns[i]);
+	metrics_header(mb, "connections_flushing", "gauge", "Local connections waiting for their socket to become writable.");
+	for(i = 0; i < METRICS_CONN_LAST; i++)
+		metrics_printf(mb, "ircd_connections_flushing{type=\"%s\"} %u\n",
+				metrics_conn_type_name[i], mq.flushing[i]);
+
+	metrics_queue_histograms(mb, "sendq_bytes", "Bytes queued to send, per connection.", mq.sendq);
+	metrics_queue_histograms(mb, "recvq_bytes", "Bytes received but not yet parsed, per connection.", mq.recvq);
+
+	metrics_header(mb, "sendq_total_bytes", "gauge", "Bytes queued to send, over all local connections.");
+	metrics_printf(mb, "ircd_sendq_total_bytes %lu\n", sendq_total);
+	metrics_header(mb, "sendq_shed_clients_total", "counter", "Clients dropped for going over sendq_hard_limit.");
+	metrics_printf(mb, "ircd_sendq_shed_clients_total %u\n", ServerStats.is_sqshed);
+}
+
+static void
+metrics_snapshot_render(struct metrics_buf *mb)
+{
+	struct metrics_snapshot snap;
+
+	metrics_take_snapshot(&snap);
+	metrics_append(mb, &snap, sizeof(snap));
+}
+
+static void
+metrics_conn_close(struct metrics_conn *conn)
+{
+	rb_close(conn->F);
+	rb_free(conn->buf.data);
+	rb_free(conn);
+}
+
+static void
+metrics_timeout(rb_fde_t *F, void *data)
+{
+	metrics_conn_close(data);
+}
+
+static void
+metrics_write(rb_fde_t *F, void *data)
+{
+	struct metrics_conn *conn = data;
+	ssize_t len;
+
+	while(conn->written < conn->buf.len)
+	{
+		len = rb_write(F, conn->buf.data + conn->written, conn->buf.len - conn->written);
+		if(len <= 0)
+		{
+			if(len < 0 && rb_ignore_errno(errno))
+			{
+				rb_setselect(F, RB_SELECT_WRITE, metrics_write, conn);
+				return;
+			}
+			break;
+		}
+		conn->written += len;
+	}
+
+	metrics_conn_close(conn);
+}
+
+static void
+metrics_accept(rb_fde_t *F, int status, struct sockaddr *addr, rb_socklen_t len, void *data)
+{
+	struct metrics_socket *ms = data;
+	struct metrics_conn *conn;
+
+	if(status != RB_OK)
+	{
+		rb_close(F);
+		return;
+	}
+
+	conn = rb_malloc(sizeof(struct metrics_conn));
+	conn->F = F;
+	ms->render(&conn->buf);
+
+	rb_settimeout(F, METRICS_TIMEOUT, metrics_timeout, conn);
+	metrics_write(F, conn);
+}
+
+/* only ever remove a socket: the path comes from the config and may be wrong */
+static void
+metrics_unlink(const char *path)
+{
+	struct stat sb;
+
+	if(lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+		unlink(path);
+}
+
+static void
+metrics_close(struct metrics_socket *ms)
+{
+	if(ms->F == NULL)
+		return;
+
+	rb_close(ms->F);
+	metrics_unlink(ms->path);
+	ms->F = NULL;
+	rb_free(ms->path);
+	ms->path = NULL;
+}
+
+static void
+metrics_open(struct metrics_socket *ms, const char *path)
+{
+	struct sockaddr_un addr;
+	rb_fde_t *F;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+	{
+		ilog(L_MAIN, "%s path %s is too long", ms->name, path);
+		return;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	rb_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	F = rb_socket(AF_UNIX, SOCK_STREAM, 0, ms->name);
+	if(F == NULL)
+	{
+		ilog(L_MAIN, "Unable to create %s: %s", ms->name, strerror(errno));
+		return;
+	}
+
+	/* a stale socket from a previous run would make bind() fail */
+	metrics_unlink(path);
+
+	if(bind(rb_get_fd(F), (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			chmod(path, 0600) < 0 || rb_listen(F, 8, 0) < 0)
+	{
+		ilog(L_MAIN, "Unable to listen on %s %s: %s", ms->name, path, strerror(errno));
+		rb_close(F);
+		return;
+	}
+
+	ms->F = F;
+	ms->path = rb_strdup(path);
+	rb_accept_tcp(F, NULL, metrics_accept, ms);
+}
+
+static void
+metrics_update_socket(struct metrics_socket *ms, const char *path)
+{
+	if(path != NULL && *path == '\0')
+		path = NULL;
+
+	if(path != NULL && ms->path != NULL && !strcmp(path, ms->path))
+		return;
+
+	metrics_close(ms);
+
+	if(path != NULL)
+		metrics_open(ms, path);
+}
+
+/*
+ * metrics_update_config
+ *
+ * (Re)opens the metrics sockets after the config has been read, if
+ * their paths changed.
+ */
+void
+metrics_update_config(void)
+{
+	metrics_update_socket(&metrics_text, ConfigFileEntry.metrics_socket);
+	metrics_update_socket(&metrics_binary, ConfigFileEntry.metrics_snapshot_socket);
+}
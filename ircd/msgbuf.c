@@ -474,6 +474,50 @@ msgbuf_unparse_fmt(char *buf, size_t buflen, const struct MsgBuf *head, unsigned
 	return res;
 }
 
+const char *msgtag_names[MAXTAGNAMES] = {
+	[MSGTAG_NONE] = "",
+	[MSGTAG_TIME] = "time",
+	[MSGTAG_MSGID] = "msgid",
+	[MSGTAG_ACCOUNT] = "account",
+};
+static int msgtag_count = MSGTAG_BUILTIN_COUNT;
+
+int
+msgtag_intern(const char *name)
+{
+	for (int i = MSGTAG_NONE + 1; i < msgtag_count; i++)
+	{
+		if (!strcmp(msgtag_names[i], name))
+			return i;
+	}
+
+	if (msgtag_count == MAXTAGNAMES)
+		return MSGTAG_NONE;
+
+	/* names are never freed, modules may hold on to their index */
+	msgtag_names[msgtag_count] = rb_strdup(name);
+	return msgtag_count++;
+}
+
+/*
+ * msgbuf_get_tag_idx - like msgbuf_get_tag(), but tags appended by index
+ * are matched without comparing their keys; only those parsed off the
+ * wire or appended by name need a string comparison
+ */
+const char *
+msgbuf_get_tag_idx(const struct MsgBuf *buf, int idx)
+{
+	for (size_t i = 0; i < buf->n_tags; i++)
+	{
+		const struct MsgTag *tag = &buf->tags[i];
+
+		if (tag->idx != idx && (tag->idx != MSGTAG_NONE || strcmp(tag->key, msgtag_names[idx])))
+			continue;
+		return tag->value != NULL ? tag->value : "";
+	}
+	return NULL;
+}
+
 const char *
 msgbuf_get_tag(const struct MsgBuf *buf, const char *name)
 {
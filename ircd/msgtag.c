@@ -0,0 +1,178 @@
+/*
+ * Comet: a slightly advanced ircd
+ * msgtag.c: values for tags added to outgoing messages
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "msgtag.h"
+#include "client.h"
+#include "channel.h"
+
+/* write val as exactly width decimal digits */
+static char *
+put_digits(char *p, unsigned long val, int width)
+{
+	for (int i = width - 1; i >= 0; i--)
+	{
+		p[i] = '0' + val % 10;
+		val /= 10;
+	}
+	return p + width;
+}
+
+static char *
+put_string(char *p, const char *str)
+{
+	size_t len = strlen(str);
+
+	memcpy(p, str, len);
+	return p + len;
+}
+
+/*
+ * msgtag_server_time - the time for a server-time tag
+ *
+ * The date and time of day are only formatted when the second changes;
+ * the milliseconds are filled in when they do.
+ */
+const char *
+msgtag_server_time(void)
+{
+	static char buf[MSGTAG_TIME_LEN + 1];
+	static time_t last_sec = -1;
+	static long last_msec = -1;
+	const struct timeval *tv = rb_current_time_tv();
+	long msec = tv->tv_usec / 1000;
+
+	if (tv->tv_sec != last_sec)
+	{
+		if (strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S.", gmtime(&tv->tv_sec)) == 0)
+			return NULL;
+		last_sec = tv->tv_sec;
+		last_msec = -1;
+	}
+
+	if (msec != last_msec)
+	{
+		put_digits(buf + MSGTAG_TIME_LEN - 4, msec, 3);
+		buf[MSGTAG_TIME_LEN - 1] = 'Z';
+		buf[MSGTAG_TIME_LEN] = '\0';
+		last_msec = msec;
+	}
+
+	return buf;
+}
+
+/*
+ * msgtag_msgid - a new message id for a message from source to target
+ *
+ * Format version 1 contains the following (in order):
+ * 1. The character '1'
+ * 2. Current seconds since epoch (10 characters)
+ * 3. Current milliseconds value for current time (3 characters)
+ * 4. Counter value (6 characters)
+ * 5. Client UID (9 characters)
+ * 6. Base64-encoded channel name if target is a channel (variable number
+ *    of characters), empty string if target is not a channel.
+ *
+ * The first three only change with the clock and are kept between
+ * calls, as is the encoding of the last channel seen.
+ */
+const char *
+msgtag_msgid(const struct Client *source, const char *target)
+{
+	static char buf[BUFSIZE];
+	static char last_chan[CHANNELLEN + 2];
+	static char last_encoded[(CHANNELLEN + 2) * 4 / 3 + 4];
+	static time_t prev_ts = 0;
+	static unsigned short prev_ms = 0;
+	static unsigned short ctr;
+	static bool prefix_valid;
+	const struct timeval *tv = rb_current_time_tv();
+	time_t ts = tv->tv_sec;
+	unsigned short ms = tv->tv_usec / 1000;
+	char *p;
+
+	/* (re-)initialize counter if the timestamp changed so it is less useful
+	 * to determine exactly how many messages are sent over time */
+	if (ts > prev_ts)
+	{
+		prev_ts = ts;
+		prev_ms = ms;
+		rb_get_random(&ctr, sizeof(ctr));
+		/* clear top bit to allow for overflow */
+		ctr &= 0x7fff;
+		prefix_valid = false;
+	}
+	else if (ms > prev_ms)
+	{
+		prev_ms = ms;
+		prefix_valid = false;
+	}
+
+	/* handle unlikely overflow case to keep message ids in correctly-sortable order and to avoid dupes */
+	if (++ctr == 0)
+	{
+		prev_ms++;
+		if (prev_ms == 1000)
+		{
+			prev_ts++;
+			prev_ms = 0;
+		}
+		prefix_valid = false;
+	}
+
+	if (!prefix_valid)
+	{
+		buf[0] = MSGTAG_MSGID_FORMAT + '0';
+		p = put_digits(buf + 1, (unsigned)prev_ts, 10);
+		put_digits(p, prev_ms, 3);
+		prefix_valid = true;
+	}
+
+	p = put_digits(buf + 14, ctr, 6);
+	p = put_string(p, source->id);
+
+	if (IsChannelName(target) || IsChannelName(target + 1))
+	{
+		size_t len = strlen(target);
+
+		if (len < sizeof(last_chan))
+		{
+			if (strcmp(target, last_chan))
+			{
+				unsigned char *encoded = rb_base64_encode((const unsigned char *)target, len);
+
+				rb_strlcpy(last_chan, target, sizeof(last_chan));
+				rb_strlcpy(last_encoded, (const char *)encoded, sizeof(last_encoded));
+				rb_free(encoded);
+			}
+			p = put_string(p, last_encoded);
+		}
+		else
+		{
+			unsigned char *encoded = rb_base64_encode((const unsigned char *)target, len);
+
+			rb_strlcpy(p, (const char *)encoded, sizeof(buf) - (p - buf));
+			rb_free(encoded);
+		}
+	}
+	*p = '\0';
+
+	return buf;
+}
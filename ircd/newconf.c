@@ -37,6 +37,7 @@
 #define CF_TYPE(x) ((x) & CF_MTYPE)
 
 static int yy_defer_accept = 1;
+static int yy_inline_tls = 0;
 
 struct TopConf *conf_cur_block;
 static char *conf_cur_block_name = NULL;
@@ -365,6 +366,7 @@ static struct mode_table connect_table[] = {
 	{ "sctp",	SERVER_SCTP		},
 	{ "ssl",	SERVER_SSL		},
 	{ "no-export",	SERVER_NO_EXPORT	},
+	{ "compressed",	SERVER_COMPRESSED	},
 	{ NULL,		0			},
 };
 
@@ -879,6 +881,30 @@ conf_set_class_sendq(void *data)
 	yy_class->max_sendq = *(unsigned int *) data;
 }
 
+static void
+conf_set_class_rcvbuf(void *data)
+{
+	yy_class->rcvbuf = *(unsigned int *) data;
+}
+
+static void
+conf_set_class_sndbuf(void *data)
+{
+	yy_class->sndbuf = *(unsigned int *) data;
+}
+
+static void
+conf_set_class_notsent_lowat(void *data)
+{
+	yy_class->notsent_lowat = *(unsigned int *) data;
+}
+
+static void
+conf_set_class_cork_burst(void *data)
+{
+	yy_class->cork_burst = *(unsigned int *) data;
+}
+
 static char *listener_address[2];
 
 static int
@@ -889,6 +915,7 @@ conf_begin_listen(struct TopConf *tc)
 		listener_address[i] = NULL;
 	}
 	yy_defer_accept = 0;
+	yy_inline_tls = 0;
 	return 0;
 }
 
@@ -900,6 +927,7 @@ conf_end_listen(struct TopConf *tc)
 		listener_address[i] = NULL;
 	}
 	yy_defer_accept = 0;
+	yy_inline_tls = 0;
 	return 0;
 }
 
@@ -909,10 +937,19 @@ conf_set_listen_defer_accept(void *data)
 	yy_defer_accept = *(unsigned int *) data;
 }
 
+static void
+conf_set_listen_inline_tls(void *data)
+{
+	yy_inline_tls = *(unsigned int *) data;
+}
+
 static void
 conf_set_listen_port_both(void *data, int ssl, int sctp)
 {
 	conf_parm_t *args = data;
+
+	if(ssl && !sctp)
+		ssl = yy_inline_tls ? LISTENER_SSL_INLINE : LISTENER_SSL_SSLD;
 	for (; args; args = args->next)
 	{
 		if(CF_TYPE(args->type) != CF_INT)
@@ -1446,6 +1483,20 @@ conf_set_connect_aftype(void *data)
 		conf_report_error("connect::aftype '%s' is unknown.", aft);
 }
 
+static void
+conf_set_connect_compression_level(void *data)
+{
+	int level = *(unsigned int *) data;
+
+	if(level < 1 || level > 9)
+	{
+		conf_report_error("connect::compression_level %d is out of range (1-9).", level);
+		return;
+	}
+
+	yy_server->compression_level = level;
+}
+
 static void
 conf_set_connect_flags(void *data)
 {
@@ -2331,6 +2382,77 @@ conf_set_opm_scan_ports_httpsconnect(void *data)
 	conf_set_opm_scan_ports_all(data, "opm::httpsconnect_ports", "httpsconnect");
 }
 
+static struct AdmissionPolicy *yy_admission = NULL;
+
+static int
+conf_begin_admission(struct TopConf *tc)
+{
+	if(conf_cur_block_name == NULL)
+	{
+		conf_report_error("admission block has no provider name -- ignoring.");
+		yy_admission = NULL;
+		return 0;
+	}
+
+	if((yy_admission = find_admission_policy(conf_cur_block_name)) == NULL)
+		conf_report_error("admission block for unknown provider %s -- ignoring.",
+				conf_cur_block_name);
+
+	return 0;
+}
+
+static int
+conf_end_admission(struct TopConf *tc)
+{
+	if(yy_admission != NULL)
+		set_authd_admission(yy_admission);
+
+	yy_admission = NULL;
+	return 0;
+}
+
+static void
+conf_set_admission_policy(void *data)
+{
+	const char *policy = data;
+
+	if(yy_admission == NULL)
+		return;
+
+	if(!rb_strcasecmp(policy, "required"))
+		yy_admission->advisory = false;
+	else if(!rb_strcasecmp(policy, "advisory"))
+	{
+		if(!yy_admission->may_advise)
+		{
+			conf_report_error("admission::policy for %s cannot be advisory, "
+					"clients need its answer to register.", yy_admission->provider);
+			return;
+		}
+
+		yy_admission->advisory = true;
+	}
+	else
+		conf_report_error("admission::policy %s is unknown, use required or advisory.", policy);
+}
+
+static void
+conf_set_admission_deadline(void *data)
+{
+	int deadline = *(int *)data;
+
+	if(yy_admission == NULL)
+		return;
+
+	if(deadline < 0 || deadline > 60)
+	{
+		conf_report_error("admission::deadline value %d is bogus, ignoring", deadline);
+		return;
+	}
+
+	yy_admission->deadline = deadline;
+}
+
 /* public functions */
 
 
@@ -2649,6 +2771,10 @@ static struct ConfEntry conf_class_table[] =
 	{ "max_number", 	CF_INT,  conf_set_class_max_number,		0, NULL },
 	{ "max_autoconn",	CF_INT,  conf_set_class_max_autoconn,		0, NULL },
 	{ "sendq", 		CF_TIME, conf_set_class_sendq,			0, NULL },
+	{ "rcvbuf",		CF_TIME, conf_set_class_rcvbuf,			0, NULL },
+	{ "sndbuf",		CF_TIME, conf_set_class_sndbuf,			0, NULL },
+	{ "notsent_lowat",	CF_TIME, conf_set_class_notsent_lowat,		0, NULL },
+	{ "cork_burst",		CF_YESNO, conf_set_class_cork_burst,		0, NULL },
 	{ "\0",	0, NULL, 0, NULL }
 };
 
@@ -2678,6 +2804,7 @@ static struct ConfEntry conf_connect_table[] =
 	{ "port",	CF_INT,     conf_set_connect_port,	0, NULL },
 	{ "aftype",	CF_STRING,  conf_set_connect_aftype,	0, NULL },
 	{ "class",	CF_QSTRING, conf_set_connect_class,	0, NULL },
+	{ "compression_level",	CF_INT, conf_set_connect_compression_level,	0, NULL },
 	{ "\0",	0, NULL, 0, NULL }
 };
 
@@ -2714,7 +2841,13 @@ static struct ConfEntry conf_general_table[] =
 	{ "caller_id_wait",	CF_TIME,  NULL, 0, &ConfigFileEntry.caller_id_wait	},
 	{ "client_exit",	CF_YESNO, NULL, 0, &ConfigFileEntry.client_exit		},
 	{ "collision_fnc",	CF_YESNO, NULL, 0, &ConfigFileEntry.collision_fnc	},
+	{ "command_profiling",	CF_YESNO, NULL, 0, &ConfigFileEntry.command_profiling	},
+	{ "metrics_socket",	CF_QSTRING, NULL, PATH_MAX, &ConfigFileEntry.metrics_socket	},
+	{ "metrics_snapshot_socket", CF_QSTRING, NULL, PATH_MAX, &ConfigFileEntry.metrics_snapshot_socket },
 	{ "resv_fnc",		CF_YESNO, NULL, 0, &ConfigFileEntry.resv_fnc		},
+	{ "sendq_soft_limit",	CF_TIME,  NULL, 0, &ConfigFileEntry.sendq_soft_limit	},
+	{ "sendq_hard_limit",	CF_TIME,  NULL, 0, &ConfigFileEntry.sendq_hard_limit	},
+	{ "write_combine",	CF_TIME,  NULL, 0, &ConfigFileEntry.write_combine	},
 	{ "post_registration_delay", CF_TIME, NULL, 0, &ConfigFileEntry.post_registration_delay	},
 	{ "connect_timeout",	CF_TIME,  NULL, 0, &ConfigFileEntry.connect_timeout	},
 	{ "default_floodcount", CF_INT,   NULL, 0, &ConfigFileEntry.default_floodcount	},
@@ -2842,6 +2975,7 @@ newconf_init()
 
 	add_top_conf("listen", conf_begin_listen, conf_end_listen, NULL);
 	add_conf_item("listen", "defer_accept", CF_YESNO, conf_set_listen_defer_accept);
+	add_conf_item("listen", "inline_tls", CF_YESNO, conf_set_listen_inline_tls);
 	add_conf_item("listen", "port", CF_INT | CF_FLIST, conf_set_listen_port);
 	add_conf_item("listen", "sslport", CF_INT | CF_FLIST, conf_set_listen_sslport);
 	add_conf_item("listen", "sctp_port", CF_INT | CF_FLIST, conf_set_listen_sctp_port);
@@ -2897,4 +3031,8 @@ newconf_init()
 	add_conf_item("opm", "socks5_ports", CF_INT | CF_FLIST, conf_set_opm_scan_ports_socks5);
 	add_conf_item("opm", "httpconnect_ports", CF_INT | CF_FLIST, conf_set_opm_scan_ports_httpconnect);
 	add_conf_item("opm", "httpsconnect_ports", CF_INT | CF_FLIST, conf_set_opm_scan_ports_httpsconnect);
+
+	add_top_conf("admission", conf_begin_admission, conf_end_admission, NULL);
+	add_conf_item("admission", "policy", CF_STRING, conf_set_admission_policy);
+	add_conf_item("admission", "deadline", CF_TIME, conf_set_admission_deadline);
 }
@@ -0,0 +1,375 @@
+/*
+ *  comet: an advanced Internet Relay Chat Daemon(ircd).
+ *  numeric.c: Pre-parsed numeric reply formats.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * Every numeric format in messages.h is split at startup into literal
+ * runs and typed argument slots.  When a reply is sent with the format
+ * its numeric was compiled from, either through sendto_one_numeric()
+ * or as a whole ":%s NNN ..." line through sendto_one(),
+ * format_numeric() copies the runs and converts the arguments itself
+ * instead of handing the format to vsnprintf() to parse again.  Any
+ * other format, and any format using a conversion not handled here,
+ * goes to vsnprintf().
+ */
+
+#include "stdinc.h"
+#include "numeric.h"
+
+enum numeric_conv
+{
+	NCONV_END,
+	NCONV_NONE,
+	NCONV_STR,
+	NCONV_CHAR,
+	NCONV_INT,
+	NCONV_UINT,
+	NCONV_HEX,
+	NCONV_HEX_UPPER,
+};
+
+enum numeric_len
+{
+	NLEN_INT,
+	NLEN_LONG,
+	NLEN_LLONG,
+};
+
+/* a literal run, then the argument that follows it */
+struct numeric_slot
+{
+	const char *lit;
+	unsigned short litlen;
+	unsigned char conv;
+	unsigned char len;
+	unsigned char width;
+	bool zero;
+};
+
+struct numeric_template
+{
+	const char *pattern;
+	struct numeric_slot slot[];
+};
+
+#define N(n)	{ n, form_str(n) }
+
+static const struct
+{
+	int numeric;
+	const char *pattern;
+} numeric_formats[] = {
+	N(1), N(2), N(3), N(4), N(5), N(8), N(10), N(15), N(17), N(43),
+	N(200), N(201), N(202), N(203), N(204), N(205), N(206), N(208), N(209),
+	N(212), N(213), N(215), N(216), N(217), N(218), N(219), N(220), N(221),
+	N(225), N(241), N(242), N(243), N(244), N(247), N(248), N(250), N(251),
+	N(252), N(253), N(254), N(255), N(256), N(257), N(258), N(259), N(262),
+	N(263), N(265), N(266), N(270), N(276), N(281), N(282),
+	N(301), N(302), N(303), N(305), N(306), N(310), N(311), N(312), N(313),
+	N(314), N(315), N(317), N(318), N(319), N(320), N(321), N(322), N(323),
+	N(324), N(325), N(329), N(330), N(331), N(332), N(333), N(338), N(341),
+	N(346), N(347), N(348), N(349), N(351), N(352), N(353), N(360), N(362),
+	N(363), N(364), N(365), N(366), N(367), N(368), N(369), N(371), N(372),
+	N(374), N(375), N(376), N(378), N(381), N(382), N(386), N(391),
+	N(401), N(402), N(403), N(404), N(405), N(406), N(407), N(409), N(410),
+	N(411), N(412), N(413), N(414), N(415), N(416), N(417), N(421), N(422),
+	N(431), N(432), N(433), N(435), N(436), N(437), N(438), N(440), N(441),
+	N(442), N(443), N(451), N(456), N(457), N(458), N(461), N(462), N(464),
+	N(465), N(470), N(471), N(472), N(473), N(474), N(475), N(477), N(478),
+	N(479), N(480), N(481), N(482), N(483), N(484), N(486), N(489), N(491),
+	N(492), N(494), N(501), N(502), N(504), N(513), N(517), N(524),
+	N(670), N(671), N(691),
+	N(702), N(703), N(704), N(705), N(706), N(707), N(708), N(709), N(710),
+	N(711), N(712), N(713), N(714), N(715), N(716), N(717), N(718), N(720),
+	N(721), N(722), N(723), N(725), N(726), N(727), N(728), N(729), N(730),
+	N(731), N(732), N(733), N(734), N(740), N(741), N(742), N(743), N(750),
+	N(751),
+	N(900), N(901), N(902), N(903), N(904), N(905), N(906), N(907), N(908),
+};
+
+#undef N
+
+static struct numeric_template *numeric_templates[ERR_LAST_ERR_MSG + 1];
+
+/* compile_numeric()
+ *
+ * inputs	- format string
+ * outputs	- its template, or NULL if it uses a conversion that
+ *		  format_numeric() leaves to vsnprintf()
+ */
+static struct numeric_template *
+compile_numeric(const char *pattern)
+{
+	struct numeric_template *tmpl;
+	struct numeric_slot slot[64];
+	const char *p = pattern, *lit = pattern;
+	size_t n = 0;
+
+	for(;;)
+	{
+		struct numeric_slot *s;
+
+		if(*p != '%' && *p != '\0')
+		{
+			p++;
+			continue;
+		}
+
+		if(n == ARRAY_SIZE(slot) || p - lit > USHRT_MAX)
+			return NULL;
+
+		s = &slot[n++];
+		memset(s, 0, sizeof(*s));
+		s->lit = lit;
+		s->litlen = p - lit;
+
+		if(*p == '\0')
+		{
+			s->conv = NCONV_END;
+			break;
+		}
+
+		p++;
+		if(*p == '%')
+		{
+			/* the run ends with the first %, the second is skipped */
+			s->litlen++;
+			s->conv = NCONV_NONE;
+			lit = ++p;
+			continue;
+		}
+
+		if(*p == '0')
+		{
+			s->zero = true;
+			p++;
+		}
+		while(isdigit((unsigned char)*p))
+		{
+			if(s->width >= 10)
+				return NULL;
+			s->width = s->width * 10 + (*p++ - '0');
+		}
+
+		if(*p == 'l')
+		{
+			s->len = NLEN_LONG;
+			if(*++p == 'l')
+			{
+				s->len = NLEN_LLONG;
+				p++;
+			}
+		}
+
+		switch(*p)
+		{
+		case 's':
+			s->conv = NCONV_STR;
+			break;
+		case 'c':
+			s->conv = NCONV_CHAR;
+			break;
+		case 'd':
+		case 'i':
+			s->conv = NCONV_INT;
+			break;
+		case 'u':
+			s->conv = NCONV_UINT;
+			break;
+		case 'x':
+			s->conv = NCONV_HEX;
+			break;
+		case 'X':
+			s->conv = NCONV_HEX_UPPER;
+			break;
+		default:
+			return NULL;
+		}
+
+		if((s->conv == NCONV_STR || s->conv == NCONV_CHAR) &&
+				(s->len != NLEN_INT || s->width || s->zero))
+			return NULL;
+
+		lit = ++p;
+	}
+
+	tmpl = rb_malloc(sizeof(*tmpl) + n * sizeof(tmpl->slot[0]));
+	tmpl->pattern = pattern;
+	memcpy(tmpl->slot, slot, n * sizeof(tmpl->slot[0]));
+	return tmpl;
+}
+
+void
+init_numerics(void)
+{
+	for(size_t i = 0; i < ARRAY_SIZE(numeric_formats); i++)
+		numeric_templates[numeric_formats[i].numeric] =
+			compile_numeric(numeric_formats[i].pattern);
+}
+
+static char *
+put_str(char *p, char *end, const char *s, size_t len)
+{
+	if(len > (size_t)(end - p))
+		len = end - p;
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static char *
+put_num(char *p, char *end, const struct numeric_slot *s,
+	unsigned long long value, bool negative)
+{
+	char digits[sizeof(value) * 3 + 1];
+	const char *hex = s->conv == NCONV_HEX_UPPER ? "0123456789ABCDEF" : "0123456789abcdef";
+	unsigned int base = s->conv == NCONV_HEX || s->conv == NCONV_HEX_UPPER ? 16 : 10;
+	char *d = digits + sizeof(digits);
+	size_t len, pad;
+
+	do
+	{
+		*--d = hex[value % base];
+		value /= base;
+	} while(value != 0);
+
+	len = digits + sizeof(digits) - d + negative;
+	pad = s->width > len ? s->width - len : 0;
+
+	if(!s->zero)
+		for(; pad > 0 && p < end; pad--)
+			*p++ = ' ';
+	if(negative && p < end)
+		*p++ = '-';
+	for(; pad > 0 && p < end; pad--)
+		*p++ = '0';
+
+	return put_str(p, end, d, digits + sizeof(digits) - d);
+}
+
+/* the numeric a whole reply line like ":%s 352 %s ..." is for, or -1 */
+static int
+pattern_numeric(const char *pattern)
+{
+	if(pattern[0] != ':' || pattern[1] != '%' || pattern[2] != 's' || pattern[3] != ' ' ||
+			!isdigit((unsigned char)pattern[4]) || !isdigit((unsigned char)pattern[5]) ||
+			!isdigit((unsigned char)pattern[6]) || pattern[7] != ' ')
+		return -1;
+
+	return (pattern[4] - '0') * 100 + (pattern[5] - '0') * 10 + (pattern[6] - '0');
+}
+
+/* format_numeric()
+ *
+ * inputs	- buffer and its size, numeric (-1 to take it from a
+ *		  whole line format), format and arguments
+ * outputs	- length of the formatted text, which is truncated to
+ *		  fit the buffer and always terminated
+ * side effects - formats from the numeric's template when it was
+ *		  compiled from this format, otherwise with vsnprintf()
+ */
+size_t
+format_numeric(char *buf, size_t size, int numeric, const char *pattern, va_list args)
+{
+	const struct numeric_template *tmpl = NULL;
+	const struct numeric_slot *s;
+	char *p = buf, *end;
+
+	if(size == 0)
+		return 0;
+
+	if(numeric < 0)
+		numeric = pattern_numeric(pattern);
+	if(numeric >= 0 && numeric <= ERR_LAST_ERR_MSG)
+		tmpl = numeric_templates[numeric];
+
+	/* modules have their own copy of the string */
+	if(tmpl == NULL || (tmpl->pattern != pattern && strcmp(tmpl->pattern, pattern)))
+	{
+		int len = vsnprintf(buf, size, pattern, args);
+
+		if(len < 0)
+		{
+			buf[0] = '\0';
+			return 0;
+		}
+		return (size_t)len >= size ? size - 1 : (size_t)len;
+	}
+
+	end = buf + size - 1;
+
+	for(s = tmpl->slot; ; s++)
+	{
+		p = put_str(p, end, s->lit, s->litlen);
+
+		switch(s->conv)
+		{
+		case NCONV_END:
+			goto done;
+		case NCONV_NONE:
+			break;
+		case NCONV_STR:
+		{
+			const char *str = va_arg(args, const char *);
+
+			if(str == NULL)
+				str = "(null)";
+			p = put_str(p, end, str, strlen(str));
+			break;
+		}
+		case NCONV_CHAR:
+			if(p < end)
+				*p++ = (char)va_arg(args, int);
+			else
+				(void)va_arg(args, int);
+			break;
+		case NCONV_INT:
+		{
+			long long value;
+
+			if(s->len == NLEN_LLONG)
+				value = va_arg(args, long long);
+			else if(s->len == NLEN_LONG)
+				value = va_arg(args, long);
+			else
+				value = va_arg(args, int);
+
+			p = put_num(p, end, s, value < 0 ? -(unsigned long long)value : (unsigned long long)value, value < 0);
+			break;
+		}
+		default:
+		{
+			unsigned long long value;
+
+			if(s->len == NLEN_LLONG)
+				value = va_arg(args, unsigned long long);
+			else if(s->len == NLEN_LONG)
+				value = va_arg(args, unsigned long);
+			else
+				value = va_arg(args, unsigned int);
+
+			p = put_num(p, end, s, value, false);
+			break;
+		}
+		}
+	}
+
+done:
+	*p = '\0';
+	return p - buf;
+}
@@ -33,9 +33,244 @@
 #include "send.h"
 #include "s_assert.h"
 #include "s_newconf.h"
+#include "zlink.h"
 
 static char readBuf[READBUF_SIZE];
+static bool readBuf_busy;
+static char zreadBuf[READBUF_SIZE];
 static void client_dopacket(struct Client *client_p, char *buffer, size_t length);
+static bool inflate_packet(struct Client *client_p);
+
+/*
+ * Input is read straight into readBuf and its lines are parsed there, in
+ * place.  Whatever is left over afterwards (a partial line, or lines held
+ * back by flood control) is moved to the client's own recvq, and further
+ * reads for that client go directly after it until it has been drained.
+ */
+
+static inline bool
+is_eol(char c)
+{
+	return c == '\r' || c == '\n';
+}
+
+/*
+ * recvq_next_line - find the next complete line in a client's recvq
+ *
+ * The line is terminated in place and removed from the recvq.  Empty
+ * lines are skipped, and lines longer than LINEBUF_SIZE are truncated.
+ * Returns NULL if there is no complete line.
+ */
+char *
+recvq_next_line(struct LocalUser *lc, int *len)
+{
+	char *line, *eol;
+	unsigned int avail;
+
+	for(;;)
+	{
+		if(lc->recvq_start == lc->recvq_end)
+			return NULL;
+
+		line = lc->recvq + lc->recvq_start;
+		avail = lc->recvq_end - lc->recvq_start;
+
+		if(lc->recvq_overflow)
+		{
+			eol = rb_linebuf_find_eol(line, avail);
+			if(eol == NULL)
+			{
+				lc->recvq_start = lc->recvq_end;
+				return NULL;
+			}
+
+			lc->recvq_start += eol - line;
+			if(lc->recvq_start < lc->recvq_scanned)
+				lc->recvq_lines--;
+			lc->recvq_overflow = false;
+			continue;
+		}
+
+		/* skip the rest of the previous line's CR LF, and empty lines */
+		while(avail > 0 && is_eol(*line))
+		{
+			line++;
+			avail--;
+			lc->recvq_start++;
+		}
+
+		if(avail == 0)
+			return NULL;
+
+		eol = rb_linebuf_find_eol(line, avail > LINEBUF_SIZE ? LINEBUF_SIZE + 1 : avail);
+		if(eol == NULL)
+		{
+			if(avail <= LINEBUF_SIZE)
+				return NULL;
+
+			eol = line + LINEBUF_SIZE;
+			lc->recvq_overflow = true;
+		}
+		else if((unsigned int)(eol - lc->recvq) < lc->recvq_scanned)
+			lc->recvq_lines--;
+
+		*eol = '\0';
+		*len = eol - line;
+		lc->recvq_start += *len + 1;
+		return line;
+	}
+}
+
+/*
+ * recvq_count_lines - count the complete lines in a client's recvq
+ *
+ * A line is counted at the first CR or LF after its text; only data not
+ * counted before is scanned.
+ */
+unsigned int
+recvq_count_lines(struct LocalUser *lc)
+{
+	char *start = lc->recvq + lc->recvq_start;
+	char *end = lc->recvq + lc->recvq_end;
+	char *ch;
+
+	if(lc->recvq_scanned > lc->recvq_start)
+		ch = lc->recvq + lc->recvq_scanned;
+	else
+		ch = start;
+
+	while(ch < end && (ch = rb_linebuf_find_eol(ch, end - ch)) != NULL)
+	{
+		if(ch > start && !is_eol(ch[-1]))
+			lc->recvq_lines++;
+		ch++;
+	}
+
+	lc->recvq_scanned = lc->recvq_end;
+	return lc->recvq_lines;
+}
+
+/*
+ * recvq_release - give up an empty recvq, still discarding the rest of
+ * an overlong line if that is what it ended in
+ */
+static void
+recvq_release(struct LocalUser *lc)
+{
+	bool overflow = lc->recvq_overflow;
+
+	discard_recvq(lc);
+	lc->recvq_overflow = overflow;
+}
+
+/*
+ * recvq_retain - keep what is left of a client's recvq once it has been
+ * parsed, moving it out of readBuf if need be
+ */
+void
+recvq_retain(struct LocalUser *lc)
+{
+	unsigned int len;
+	char *buf;
+
+	/* don't keep the LF of a CR LF that ended the last line on its own */
+	while(!lc->recvq_overflow && lc->recvq_start < lc->recvq_end &&
+			is_eol(lc->recvq[lc->recvq_start]))
+		lc->recvq_start++;
+
+	len = lc->recvq_end - lc->recvq_start;
+	if(len == 0)
+	{
+		recvq_release(lc);
+		return;
+	}
+
+	if(lc->recvq_size != 0)
+		return;
+
+	buf = rb_malloc(len + READBUF_SIZE);
+	memcpy(buf, lc->recvq + lc->recvq_start, len);
+
+	lc->recvq = buf;
+	lc->recvq_size = len + READBUF_SIZE;
+	lc->recvq_scanned = lc->recvq_scanned > lc->recvq_start ? lc->recvq_scanned - lc->recvq_start : 0;
+	lc->recvq_start = 0;
+	lc->recvq_end = len;
+}
+
+/*
+ * recvq_reserve - returns where the next READBUF_SIZE bytes for this
+ * client should be read to
+ */
+char *
+recvq_reserve(struct LocalUser *lc)
+{
+	unsigned int len;
+
+	if(lc->recvq_start == lc->recvq_end && !readBuf_busy)
+	{
+		recvq_release(lc);
+		lc->recvq = readBuf;
+		return readBuf;
+	}
+
+	recvq_retain(lc);
+
+	if(lc->recvq_start > 0)
+	{
+		len = lc->recvq_end - lc->recvq_start;
+		memmove(lc->recvq, lc->recvq + lc->recvq_start, len);
+		lc->recvq_scanned = lc->recvq_scanned > lc->recvq_start ? lc->recvq_scanned - lc->recvq_start : 0;
+		lc->recvq_start = 0;
+		lc->recvq_end = len;
+	}
+
+	if(lc->recvq_size - lc->recvq_end < READBUF_SIZE)
+	{
+		lc->recvq_size = lc->recvq_end + READBUF_SIZE;
+		lc->recvq = rb_realloc(lc->recvq, lc->recvq_size);
+	}
+
+	return lc->recvq + lc->recvq_end;
+}
+
+/*
+ * discard_recvq - throw away any unparsed input from a client
+ */
+void
+discard_recvq(struct LocalUser *lc)
+{
+	if(lc->recvq_size != 0)
+		rb_free(lc->recvq);
+
+	lc->recvq = NULL;
+	lc->recvq_size = 0;
+	lc->recvq_start = lc->recvq_end = 0;
+	lc->recvq_scanned = lc->recvq_lines = 0;
+	lc->recvq_overflow = false;
+}
+
+/*
+ * zlink_starting - the line just parsed (their SERVER line, or ours
+ * being accepted) turned on compression, and what is left of the recvq
+ * has to be inflated before it can be parsed
+ */
+static inline bool
+zlink_starting(struct LocalUser *lc)
+{
+	return lc->zlink != NULL && !zlink_inflating(lc->zlink);
+}
+
+static void
+recvq_start_inflate(struct LocalUser *lc)
+{
+	zlink_set_pending(lc->zlink, lc->recvq + lc->recvq_start, lc->recvq_end - lc->recvq_start);
+	zlink_set_inflating(lc->zlink);
+
+	lc->recvq_end = lc->recvq_start;
+	lc->recvq_scanned = lc->recvq_start;
+	lc->recvq_lines = 0;
+}
 
 /*
  * parse_client_queued - parse client queued messages
@@ -43,6 +278,8 @@ static void client_dopacket(struct Client *client_p, char *buffer, size_t length
 static void
 parse_client_queued(struct Client *client_p)
 {
+	struct LocalUser *lc = client_p->localClient;
+	char *line;
 	int dolen = 0;
 	int allow_read;
 
@@ -57,19 +294,19 @@ parse_client_queued(struct Client *client_p)
 			if(client_p->localClient->sent_parsed >= allow_read)
 				break;
 
-			dolen = rb_linebuf_get(&client_p->localClient->
-					    buf_recvq, readBuf, READBUF_SIZE,
-					    LINEBUF_COMPLETE, LINEBUF_PARSED);
+			line = recvq_next_line(lc, &dolen);
 
-			if(dolen <= 0 || IsDead(client_p))
+			if(line == NULL || IsDead(client_p))
 				break;
 
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 			client_p->localClient->sent_parsed++;
 
 			/* He's dead cap'n */
 			if(IsAnyDead(client_p))
 				return;
+			if(zlink_starting(lc))
+				recvq_start_inflate(lc);
 			/* if theyve dropped out of the unknown state, break and move
 			 * to the parsing for their appropriate status.  --fl
 			 */
@@ -90,13 +327,34 @@ parse_client_queued(struct Client *client_p)
 			client_p->localClient->sent_parsed = allow_read;
 	}
 
-	if(IsAnyServer(client_p) || IsExemptFlood(client_p))
+	if(IsServer(client_p) && !HasSentEob(client_p))
 	{
-		while (!IsAnyDead(client_p) && (dolen = rb_linebuf_get(&client_p->localClient->buf_recvq,
-					   readBuf, READBUF_SIZE, LINEBUF_COMPLETE,
-					   LINEBUF_PARSED)) > 0)
+		struct timespec start, end;
+
+		/* a burst mostly makes local clients see JOINs and MODEs;
+		 * queue them and write to each client once per read
+		 */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		send_defer_begin();
+
+		while (!IsAnyDead(client_p) && (line = recvq_next_line(lc, &dolen)) != NULL)
 		{
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
+			lc->burst_lines++;
+		}
+
+		send_defer_end();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		lc->burst_usec += (end.tv_sec - start.tv_sec) * 1000000 +
+			(end.tv_nsec - start.tv_nsec) / 1000;
+	}
+	else if(IsAnyServer(client_p) || IsExemptFlood(client_p))
+	{
+		while (!IsAnyDead(client_p) && (line = recvq_next_line(lc, &dolen)) != NULL)
+		{
+			client_dopacket(client_p, line, dolen);
+			if(zlink_starting(lc))
+				recvq_start_inflate(lc);
 		}
 	}
 	else if(IsClient(client_p))
@@ -140,14 +398,12 @@ parse_client_queued(struct Client *client_p)
 			if (rb_current_time() < client_p->localClient->firsttime + ConfigFileEntry.post_registration_delay)
 				break;
 
-			dolen = rb_linebuf_get(&client_p->localClient->
-					    buf_recvq, readBuf, READBUF_SIZE,
-					    LINEBUF_COMPLETE, LINEBUF_PARSED);
+			line = recvq_next_line(lc, &dolen);
 
-			if(!dolen)
+			if(line == NULL)
 				break;
 
-			client_dopacket(client_p, readBuf, dolen);
+			client_dopacket(client_p, line, dolen);
 			if(IsAnyDead(client_p))
 				return;
 
@@ -228,7 +484,112 @@ flood_recalc(void *unused)
 			client_p->localClient->sent_parsed = 0;
 
 		parse_client_queued(client_p);
+
+		/* a line held back until now started compression */
+		if(!IsAnyDead(client_p) && client_p->localClient->zlink != NULL &&
+				zlink_input_pending(client_p->localClient->zlink))
+			inflate_packet(client_p);
+	}
+}
+
+/*
+ * read_packet_tls_write - a TLS read on an inline TLS connection had to
+ * write first and now can.  This replaced any pending send_queued_write(),
+ * so flush the sendq too, then read again.  Should send_queued() replace
+ * this handler first, send_queued_write() does the read instead.
+ */
+static void
+read_packet_tls_write(rb_fde_t *F, void *data)
+{
+	struct Client *client_p = data;
+
+	if(IsAnyDead(client_p))
+		return;
+
+	ClearFlush(client_p);
+	send_queued(client_p);
+	ClearReadWantsWrite(client_p);
+	read_packet(F, data);
+}
+
+/*
+ * parse_packet - parse the length bytes just added to a client's recvq
+ *
+ * Returns false if the client is gone.
+ */
+static bool
+parse_packet(struct Client *client_p, int length)
+{
+	struct LocalUser *lc = client_p->localClient;
+	bool in_readbuf;
+
+	lc->recvq_end += length;
+
+	/* Attempt to parse what we have, in place.  Everyone it sends
+	 * to is written to once afterwards, so a read of many lines
+	 * is one TLS record per recipient rather than one per line.
+	 */
+	in_readbuf = lc->recvq == readBuf;
+	readBuf_busy = in_readbuf;
+	send_defer_begin();
+	parse_client_queued(client_p);
+	send_defer_end();
+	if(in_readbuf)
+		readBuf_busy = false;
+
+	if(IsAnyDead(client_p))
+	{
+		discard_recvq(lc);
+		return false;
+	}
+
+	/* Check to make sure we're not flooding */
+	if(!IsAnyServer(client_p) && lc->recvq_start != lc->recvq_end &&
+	   (recvq_count_lines(lc) > (unsigned int)ConfigFileEntry.client_flood_max_lines ||
+	    lc->recvq_end - lc->recvq_start >
+			(unsigned int)ConfigFileEntry.client_flood_max_lines * (LINEBUF_SIZE + CRLF_LEN)))
+	{
+		if(!(ConfigFileEntry.no_oper_flood && IsOperGeneral(client_p)))
+		{
+			discard_recvq(lc);
+			exit_client(client_p, client_p, client_p, "Excess Flood");
+			return false;
+		}
+	}
+
+	recvq_retain(lc);
+	return true;
+}
+
+/*
+ * inflate_packet - inflate the input given to a compressed link's
+ * zlink, and parse it a READBUF_SIZE at a time
+ *
+ * Returns false if the client is gone.
+ */
+static bool
+inflate_packet(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+	char reason[BUFSIZE];
+	int length;
+
+	while((length = zlink_inflate(lc->zlink, recvq_reserve(lc), READBUF_SIZE)) > 0)
+	{
+		if(!parse_packet(client_p, length))
+			return false;
+	}
+
+	if(length < 0)
+	{
+		snprintf(reason, sizeof(reason), "Decompression error: %s",
+				zlink_error(lc->zlink));
+		discard_recvq(lc);
+		exit_client(client_p, client_p, &me, reason);
+		return false;
 	}
+
+	return true;
 }
 
 /*
@@ -238,24 +599,35 @@ void
 read_packet(rb_fde_t * F, void *data)
 {
 	struct Client *client_p = data;
+	struct LocalUser *lc;
+	bool compressed;
 	int length = 0;
-	int binary = 0;
 
 	while(1)
 	{
 		if(IsAnyDead(client_p))
 			return;
 
+		lc = client_p->localClient;
+		compressed = lc->zlink != NULL && zlink_inflating(lc->zlink);
+
 		/*
 		 * Read some data. We *used to* do anti-flood protection here, but
 		 * I personally think it makes the code too hairy to make sane.
 		 *     -- adrian
 		 */
-		length = rb_read(client_p->localClient->F, readBuf, READBUF_SIZE);
+		length = rb_read(lc->F, compressed ? zreadBuf : recvq_reserve(lc), READBUF_SIZE);
 
 		if(length < 0)
 		{
-			if(rb_ignore_errno(errno))
+			if(length == RB_RW_SSL_NEED_WRITE)
+			{
+				/* nothing reads until the socket is writable */
+				SetReadWantsWrite(client_p);
+				rb_setselect(client_p->localClient->F,
+						RB_SELECT_WRITE, read_packet_tls_write, client_p);
+			}
+			else if(rb_ignore_errno(errno))
 				rb_setselect(client_p->localClient->F,
 						RB_SELECT_READ, read_packet, client_p);
 			else
@@ -272,6 +644,13 @@ read_packet(rb_fde_t * F, void *data)
 			client_p->localClient->lasttime = rb_current_time();
 		client_p->flags &= ~FLAGS_PINGSENT;
 
+		/* a TLS write may have been waiting for this read */
+		if(IsFlush(client_p) && rb_fd_ssl(lc->F))
+		{
+			ClearFlush(client_p);
+			send_queued(client_p);
+		}
+
 		if (client_p->flags & FLAGS_PINGWARN)
 		{
 			/*
@@ -288,40 +667,26 @@ read_packet(rb_fde_t * F, void *data)
 				log_client_name(client_p, HIDE_IP));
 		}
 
-
-		/*
-		 * Before we even think of parsing what we just read, stick
-		 * it on the end of the receive queue and do it when its
-		 * turn comes around.
-		 */
-		if(IsHandshake(client_p) || IsUnknown(client_p))
-			binary = 1;
-
-		(void) rb_linebuf_parse(&client_p->localClient->buf_recvq, readBuf, length, binary);
-
-		if(IsAnyDead(client_p))
-			return;
-
-		/* Attempt to parse what we have */
-		parse_client_queued(client_p);
-
-		if(IsAnyDead(client_p))
-			return;
-
-		/* Check to make sure we're not flooding */
-		if(!IsAnyServer(client_p) &&
-		   (rb_linebuf_alloclen(&client_p->localClient->buf_recvq) > ConfigFileEntry.client_flood_max_lines))
+		if(compressed)
 		{
-			if(!(ConfigFileEntry.no_oper_flood && IsOperGeneral(client_p)))
-			{
-				exit_client(client_p, client_p, client_p, "Excess Flood");
+			zlink_input(lc->zlink, zreadBuf, length);
+			if(!inflate_packet(client_p))
+				return;
+		}
+		else
+		{
+			if(!parse_packet(client_p, length))
+				return;
+
+			/* the rest of this read came after compression started */
+			if(lc->zlink != NULL && zlink_input_pending(lc->zlink) &&
+					!inflate_packet(client_p))
 				return;
-			}
 		}
 
 		/* bail if short read, but not for SCTP as it returns data in packets */
-		if (length < READBUF_SIZE && !(rb_get_type(client_p->localClient->F) & RB_FD_SCTP)) {
-			rb_setselect(client_p->localClient->F, RB_SELECT_READ, read_packet, client_p);
+		if (length < READBUF_SIZE && !(rb_get_type(lc->F) & RB_FD_SCTP)) {
+			rb_setselect(lc->F, RB_SELECT_READ, read_packet, client_p);
 			return;
 		}
 	}
@@ -359,20 +724,7 @@ client_dopacket(struct Client *client_p, char *buffer, size_t length)
 	 * Update bytes received
 	 */
 	client_p->localClient->receiveB += length;
-
-	if(client_p->localClient->receiveB > 1023)
-	{
-		client_p->localClient->receiveK += (client_p->localClient->receiveB >> 10);
-		client_p->localClient->receiveB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
-	}
-
 	me.localClient->receiveB += length;
 
-	if(me.localClient->receiveB > 1023)
-	{
-		me.localClient->receiveK += (me.localClient->receiveB >> 10);
-		me.localClient->receiveB &= 0x03ff;
-	}
-
 	parse(client_p, buffer, buffer + length);
 }
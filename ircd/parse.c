@@ -53,6 +53,7 @@ static void remove_unknown(struct Client *, const char *, char *);
 static void do_numeric(int, struct Client *, struct Client *, int, const char **);
 
 static int handle_command(struct Message *, struct MsgBuf *, struct Client *, struct Client *);
+static void profile_command(struct Message *, HandlerType, const struct timespec *);
 
 static char buffer[1024];
 
@@ -264,6 +265,7 @@ handle_command(struct Message *mptr, struct MsgBuf *msgbuf_p, struct Client *cli
 {
 	struct MessageEntry ehandler;
 	MessageHandler handler = 0;
+	HandlerType htype;
 	char squitreason[80];
 
 	if(IsAnyDead(client_p))
@@ -274,7 +276,8 @@ handle_command(struct Message *mptr, struct MsgBuf *msgbuf_p, struct Client *cli
 
 	mptr->count++;
 
-	ehandler = mptr->handlers[from->handler];
+	htype = from->handler;
+	ehandler = mptr->handlers[htype];
 	handler = ehandler.handler;
 
 	/* check right amount of params is passed... --is */
@@ -307,10 +310,55 @@ handle_command(struct Message *mptr, struct MsgBuf *msgbuf_p, struct Client *cli
 		return (-1);
 	}
 
-	(*handler) (msgbuf_p, client_p, from, msgbuf_p->n_para, msgbuf_p->para);
+	if(ConfigFileEntry.command_profiling)
+	{
+		struct timespec start;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		(*handler) (msgbuf_p, client_p, from, msgbuf_p->n_para, msgbuf_p->para);
+		profile_command(mptr, htype, &start);
+	}
+	else
+		(*handler) (msgbuf_p, client_p, from, msgbuf_p->n_para, msgbuf_p->para);
+
 	return (1);
 }
 
+/*
+ * profile_command
+ *
+ * inputs	- pointer to message block
+ *		- handler type that was run
+ *		- time the handler was started
+ * output	- none
+ * side effects	- handler timings are added to the command's profile
+ */
+static void
+profile_command(struct Message *mptr, HandlerType htype, const struct timespec *start)
+{
+	struct MessageProfile *prof;
+	struct timespec end;
+	unsigned long long ns, us;
+	int bucket;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (end.tv_sec - start->tv_sec) * 1000000000ULL + end.tv_nsec - start->tv_nsec;
+
+	if(mptr->profile == NULL)
+		mptr->profile = rb_malloc(sizeof(struct MessageProfile) * LAST_HANDLER_TYPE);
+
+	prof = &mptr->profile[htype];
+	prof->calls++;
+	prof->total_ns += ns;
+	if(ns > prof->max_ns)
+		prof->max_ns = ns;
+
+	for(bucket = 0, us = ns / 1000; us && bucket < MSG_PROFILE_BUCKETS - 1; us >>= 1)
+		bucket++;
+
+	prof->hist[bucket]++;
+}
+
 void
 handle_encap(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 	     const char *command, int parc, const char *parv[])
@@ -331,7 +379,16 @@ handle_encap(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *so
 	   (ehandler.min_para && EmptyString(parv[ehandler.min_para - 1])))
 		return;
 
-	(*handler) (msgbuf_p, client_p, source_p, parc, parv);
+	if(ConfigFileEntry.command_profiling)
+	{
+		struct timespec start;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		(*handler) (msgbuf_p, client_p, source_p, parc, parv);
+		profile_command(mptr, ENCAP_HANDLER, &start);
+	}
+	else
+		(*handler) (msgbuf_p, client_p, source_p, parc, parv);
 }
 
 /*
@@ -373,6 +430,7 @@ mod_add_cmd(struct Message *msg)
 	msg->count = 0;
 	msg->rcount = 0;
 	msg->bytes = 0;
+	msg->profile = NULL;
 
 	rb_dictionary_add(cmd_dict, msg->cmd, msg);
 }
@@ -394,6 +452,9 @@ mod_del_cmd(struct Message *msg)
 		ilog(L_MAIN, "Delete command: %s not found", msg->cmd);
 		s_assert(0);
 	}
+
+	rb_free(msg->profile);
+	msg->profile = NULL;
 }
 
 /* cancel_clients()
@@ -23,9 +23,11 @@
 
 #include "stdinc.h"
 #include "s_conf.h"
+#include "s_newconf.h"
 #include "s_stats.h"
 #include "ratelimit.h"
 #include "s_assert.h"
+#include "send.h"
 
 /*
  * ratelimit_client(struct Client *client_p, int penalty)
@@ -110,6 +112,35 @@ int ratelimit_client_who(struct Client *client_p, unsigned int penalty)
 	return ratelimit_client(client_p, penalty);
 }
 
+/*
+ * ratelimit_client_bulk(struct Client *client_p)
+ *
+ * Holds back commands with a lot of output while more than
+ * sendq_soft_limit bytes are queued to local connections.
+ *
+ * Inputs:
+ *   - the client executing the command
+ *
+ * Outputs:
+ *   - 1 if the command should be allowed to execute
+ *   - 0 if the command should not execute
+ *     The caller should return RPL_LOAD2HI
+ *
+ * Side effects:
+ *   - none; opers are never held back
+ */
+int ratelimit_client_bulk(struct Client *client_p)
+{
+	s_assert(client_p);
+	s_assert(MyClient(client_p));
+
+	if (!sendq_pressure() || IsOperGeneral(client_p))
+		return 1;
+
+	ServerStats.is_sqthr++;
+	return 0;
+}
+
 /*
  * credit_client_join(struct Client *client_p)
  *
@@ -53,6 +53,7 @@
 #include "s_assert.h"
 #include "authproc.h"
 #include "supported.h"
+#include "metrics.h"
 
 struct config_server_hide ConfigServerHide;
 
@@ -777,6 +778,12 @@ set_default_conf(void)
 	ConfigFileEntry.away_interval = 30;
 	ConfigFileEntry.tls_ciphers_oper_only = false;
 	ConfigFileEntry.oper_secure_only = false;
+	ConfigFileEntry.command_profiling = false;
+	ConfigFileEntry.metrics_socket = NULL;
+	ConfigFileEntry.metrics_snapshot_socket = NULL;
+	ConfigFileEntry.sendq_soft_limit = 0;
+	ConfigFileEntry.sendq_hard_limit = 0;
+	ConfigFileEntry.write_combine = 1024;
 
 	ConfigFileEntry.oper_umodes = UMODE_LOCOPS | UMODE_SERVNOTICE |
 		UMODE_OPERWALL | UMODE_WALLOP;
@@ -914,6 +921,9 @@ validate_conf(void)
 	if (ConfigFileEntry.sasl_service == NULL)
 		ConfigFileEntry.sasl_service = rb_strdup("SaslServ");
 
+	if (!testing_conf)
+		metrics_update_config();
+
 	/* RFC 1459 says 1 message per 2 seconds on average and bursts of
 	 * 5 messages are acceptable, so allow at least that.
 	 */
@@ -1542,6 +1552,10 @@ clear_out_old_conf(void)
 	ConfigFileEntry.kline_reason = NULL;
 	rb_free(ConfigFileEntry.sasl_service);
 	ConfigFileEntry.sasl_service = NULL;
+	rb_free(ConfigFileEntry.metrics_socket);
+	ConfigFileEntry.metrics_socket = NULL;
+	rb_free(ConfigFileEntry.metrics_snapshot_socket);
+	ConfigFileEntry.metrics_snapshot_socket = NULL;
 	rb_free(ConfigFileEntry.drain_reason);
 	ConfigFileEntry.drain_reason = NULL;
 	rb_free(ConfigFileEntry.sasl_only_client_message);
@@ -1605,6 +1619,7 @@ clear_out_old_conf(void)
 	}
 
 	del_dnsbl_entry_all();
+	reset_authd_admission();
 
 	/* OK, that should be everything... */
 }
@@ -89,6 +89,7 @@ unsigned int CAP_BAN;
 unsigned int CAP_MLOCK;
 unsigned int CAP_EBMASK;
 unsigned int CAP_STAG;
+unsigned int CAP_ZIP;
 
 unsigned int CLICAP_MULTI_PREFIX;
 unsigned int CLICAP_ACCOUNT_NOTIFY;
@@ -99,6 +100,7 @@ unsigned int CLICAP_CAP_NOTIFY;
 unsigned int CLICAP_CHGHOST;
 unsigned int CLICAP_ECHO_MESSAGE;
 unsigned int CLICAP_MESSAGE_TAGS;
+unsigned int CLICAP_BATCH;
 
 /*
  * initialize our builtin capability table. --nenolod
@@ -133,6 +135,7 @@ init_builtin_capabs(void)
 	CAP_MLOCK = capability_put(serv_capindex, "MLOCK", NULL);
 	CAP_EBMASK = capability_put(serv_capindex, "EBMASK", NULL);
 	CAP_STAG = capability_put(serv_capindex, "STAG", NULL);
+	CAP_ZIP = capability_put(serv_capindex, "ZLIB", NULL);
 
 	capability_require(serv_capindex, "QS");
 	capability_require(serv_capindex, "EX");
@@ -150,6 +153,7 @@ init_builtin_capabs(void)
 	CLICAP_CHGHOST = capability_put(cli_capindex, "chghost", &high_priority);
 	CLICAP_ECHO_MESSAGE = capability_put(cli_capindex, "echo-message", NULL);
 	CLICAP_MESSAGE_TAGS = capability_put(cli_capindex, "message-tags", NULL);
+	CLICAP_BATCH = capability_put(cli_capindex, "batch", NULL);
 }
 
 static CNCB serv_connect_callback;
@@ -453,6 +457,10 @@ check_server(const char *name, struct Client *client_p)
 	if(!ServerConfTb(server_p))
 		ClearCap(client_p, CAP_TB);
 
+	/* and likewise compression */
+	if(!ServerConfCompressed(server_p))
+		ClearCap(client_p, CAP_ZIP);
+
 	return 0;
 }
 
@@ -806,7 +814,8 @@ server_estab(struct Client *client_p)
 
 		/* pass info to new server */
 		send_capabilities(client_p, default_server_capabs | CAP_MASK
-				  | (ServerConfTb(server_p) ? CAP_TB : 0));
+				  | (ServerConfTb(server_p) ? CAP_TB : 0)
+				  | (ServerConfCompressed(server_p) ? CAP_ZIP : 0));
 
 		sendto_one(client_p, "SERVER %s 1 :%s%s",
 			   me.name,
@@ -814,8 +823,14 @@ server_estab(struct Client *client_p)
 			   (me.info[0]) ? (me.info) : "IRCers United");
 	}
 
-	if(!rb_set_buffers(client_p->localClient->F, READBUF_SIZE))
-		ilog_error("rb_set_buffers failed for server");
+	/* everything after our SERVER line is compressed, if both
+	 * ends asked for it
+	 */
+	if(IsCapable(client_p, CAP_ZIP) &&
+			!send_start_zlink(client_p, server_p->compression_level))
+		return exit_client(client_p, client_p, client_p, "Compression failed");
+
+	set_class_sockopts(client_p, server_p->class);
 
 	client_p->servptr = &me;
 
@@ -907,6 +922,10 @@ server_estab(struct Client *client_p)
 		}
 	}
 
+	/* hold back partial frames until the burst is written */
+	if(CorkBurst(server_p->class))
+		send_cork(client_p);
+
 	/*
 	 ** Pass on my client information to the new server
 	 **
@@ -965,6 +984,7 @@ server_estab(struct Client *client_p)
 
 	free_pre_client(client_p);
 
+	/* uncorked by send_queued() once this has all been written */
 	send_pop_queue(client_p);
 
 	return 0;
@@ -1129,10 +1149,7 @@ serv_connect(struct server_conf *server_p, struct Client *by)
 	 *   -- adrian
 	 */
 
-	if(!rb_set_buffers(client_p->localClient->F, READBUF_SIZE))
-	{
-		ilog_error("setting the buffer size for a server connection");
-	}
+	set_class_sockopts(client_p, server_p->class);
 
 	/*
 	 * Attach config entries to client here rather than in
@@ -1322,7 +1339,8 @@ serv_connect_callback(rb_fde_t *F, int status, void *data)
 
 	/* pass my info to the new server */
 	send_capabilities(client_p, default_server_capabs | CAP_MASK
-			  | (ServerConfTb(server_p) ? CAP_TB : 0));
+			  | (ServerConfTb(server_p) ? CAP_TB : 0)
+			  | (ServerConfCompressed(server_p) ? CAP_ZIP : 0));
 
 	sendto_one(client_p, "SERVER %s 1 :%s%s",
 		   me.name,
@@ -188,35 +188,35 @@ show_lusers(struct Client *source_p)
 			   Count.totalrestartcount);
 }
 
-/* check if we should exit a client due to authd decision
- * inputs	- client server, client connecting
+/* act on an authd rejection
+ * inputs	- client server, client, rejection cause, data and reason
  * outputs	- true if exited, false if not
- * side effects	- messages/exits client if authd rejected and not exempt
+ * side effects	- messages/exits client if not exempt; also used by
+ *		  authproc.c when an advisory check rejects a client
+ *		  that has already registered
  */
-static bool
-authd_check(struct Client *client_p, struct Client *source_p)
+bool
+authd_check_reject(struct Client *client_p, struct Client *source_p,
+		   char cause, char *data, const char *reason_template)
 {
 	struct ConfItem *aconf = source_p->localClient->att_conf;
 	rb_dlink_list varlist = { NULL, NULL, 0 };
 	bool reject = false;
 	char *reason;
 
-	if(source_p->preClient->auth.accepted == true)
-		return reject;
-
 	substitution_append_var(&varlist, "nick", source_p->name);
 	substitution_append_var(&varlist, "ip", source_p->sockhost);
 	substitution_append_var(&varlist, "host", source_p->host);
-	substitution_append_var(&varlist, "dnsbl-host", source_p->preClient->auth.data);
+	substitution_append_var(&varlist, "dnsbl-host", data);
 	substitution_append_var(&varlist, "network-name", ServerInfo.network_name);
-	reason = substitution_parse(source_p->preClient->auth.reason, &varlist);
+	reason = substitution_parse(reason_template, &varlist);
 
-	switch(source_p->preClient->auth.cause)
+	switch(cause)
 	{
 	case 'B':	/* DNSBL */
 		{
 			struct DNSBLEntry *entry;
-			char *dnsbl_name = source_p->preClient->auth.data;
+			char *dnsbl_name = data;
 
 			if(dnsbl_stats != NULL)
 				if((entry = rb_dictionary_retrieve(dnsbl_stats, dnsbl_name)) != NULL)
@@ -247,7 +247,7 @@ authd_check(struct Client *client_p, struct Client *source_p)
 		break;
 	case 'O':	/* OPM */
 		{
-			char *proxy = source_p->preClient->auth.data;
+			char *proxy = data;
 			char *port = strrchr(proxy, ':');
 
 			if(port == NULL)
@@ -321,6 +321,22 @@ authd_check(struct Client *client_p, struct Client *source_p)
 	return reject;
 }
 
+/* check if we should exit a client due to authd decision
+ * inputs	- client server, client connecting
+ * outputs	- true if exited, false if not
+ * side effects	- messages/exits client if authd rejected and not exempt
+ */
+static bool
+authd_check(struct Client *client_p, struct Client *source_p)
+{
+	struct AuthClient *auth = &source_p->preClient->auth;
+
+	if(auth->accepted == true)
+		return false;
+
+	return authd_check_reject(client_p, source_p, auth->cause, auth->data, auth->reason);
+}
+
 /*
 ** register_local_user
 **      This function is called when both NICK and USER messages
@@ -714,6 +730,8 @@ register_local_user(struct Client *client_p, struct Client *source_p)
 	else
 		source_p->localClient->targets_free = TGCHANGE_INITIAL;
 
+	set_class_sockopts(source_p, ClassPtr(aconf));
+
 	monitor_signon(source_p);
 	user_welcome(source_p);
 
@@ -1713,13 +1731,21 @@ change_nick_user_host(struct Client *target_p,	const char *nick, const char *use
 bool
 has_common_channel(struct Client *source_p, struct Client *target_p)
 {
-        rb_dlink_node *ps, *pt;
-        struct membership *ms, *mt;
-        struct Channel *chptr;
+        rb_dlink_node *ptr;
+        struct membership *msptr;
+
+        /* walk the shorter list, looking up memberships in the other */
+        if (rb_dlink_list_length(&source_p->user->channel) > rb_dlink_list_length(&target_p->user->channel))
+        {
+                struct Client *tmp = source_p;
+                source_p = target_p;
+                target_p = tmp;
+        }
 
-        ITER_COMM_CHANNELS(ps, pt, source_p->user->channel.head, target_p->user->channel.head, ms, mt, chptr)
+        RB_DLINK_FOREACH(ptr, source_p->user->channel.head)
         {
-                if (ms != NULL && mt != NULL)
+                msptr = ptr->data;
+                if (find_channel_membership(msptr->chptr, target_p) != NULL)
                         return true;
         }
 
@@ -38,15 +38,34 @@
 #include "logger.h"
 #include "hook.h"
 #include "monitor.h"
+#include "packet.h"
 #include "msgbuf.h"
+#include "s_stats.h"
+#include "zlink.h"
 
 #define CLIENT_CAP_MASK(x)	(MyClient((x)) ? (x)->localClient->caps : \
 		((x)->from == &me || ((x)->from && (x)->from->localClient->caps & CAP_STAG)) ? (unsigned)-1 : 0)
 
 static void send_queued_write(rb_fde_t *F, void *data);
+static void send_defer_flush(void);
 
 unsigned long current_serial = 0L;
 
+/* while nonzero, send_linebuf() queues without writing and remembers
+ * the client on deferred_flush_list for send_defer_end()
+ */
+static int send_deferred;
+static rb_dlink_list deferred_flush_list;
+
+/* bytes queued in every local connection's sendq, and the most there
+ * has been
+ */
+unsigned long sendq_total;
+unsigned long sendq_peak;
+
+static void sendq_shed(void);
+static buf_head_t *sendq_classify(struct Client *, buf_head_t *);
+
 struct Client *remote_rehash_oper_p;
 
 /* send_linebuf()
@@ -67,7 +86,7 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 	if(!MyConnect(to) || IsIOError(to))
 		return 0;
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > get_sendq(to))
+	if(sendq_length(to) > get_sendq(to))
 	{
 		dead_link(to, 1);
 
@@ -76,12 +95,12 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
 					     "Max SendQ limit exceeded for %s: %u > %lu",
 					     to->name,
-					     rb_linebuf_len(&to->localClient->buf_sendq),
+					     sendq_length(to),
 					     get_sendq(to));
 
 			ilog(L_SERVER, "Max SendQ limit exceeded for %s: %u > %lu",
 			     log_client_name(to, SHOW_IP),
-			     rb_linebuf_len(&to->localClient->buf_sendq),
+			     sendq_length(to),
 			     get_sendq(to));
 		}
 
@@ -89,10 +108,21 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 	}
 	else
 	{
+		buf_head_t *sendq = sendq_classify(to, linebuf);
+		unsigned int len = rb_linebuf_len(sendq);
+
 		/* just attach the linebuf to the sendq instead of
 		 * generating a new one
 		 */
-		rb_linebuf_attach(&to->localClient->buf_sendq, linebuf);
+		rb_linebuf_attach(sendq, linebuf);
+
+		sendq_total += rb_linebuf_len(sendq) - len;
+		if(sendq_total > sendq_peak)
+			sendq_peak = sendq_total;
+
+		if(ConfigFileEntry.sendq_hard_limit > 0 &&
+				sendq_total > (unsigned long)ConfigFileEntry.sendq_hard_limit)
+			sendq_shed();
 	}
 
 	/*
@@ -102,11 +132,90 @@ send_linebuf(struct Client *to, buf_head_t *linebuf)
 	 */
 	to->localClient->sendM += 1;
 	me.localClient->sendM += 1;
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+	if(send_deferred)
+	{
+		if(!IsDeferredFlush(to))
+		{
+			SetDeferredFlush(to);
+			rb_dlinkAddAlloc(to, &deferred_flush_list);
+		}
+	}
+	else if(sendq_length(to) > 0)
 		send_queued(to);
 	return 0;
 }
 
+/* send_defer_begin()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - messages are only queued until the matching
+ *		  send_defer_end(), so a client sent many of them in a row
+ *		  gets one write instead of one per message
+ */
+void
+send_defer_begin(void)
+{
+	send_deferred++;
+}
+
+/* send_defer_end()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - when the outermost deferral ends, every client
+ *		  queued to meanwhile is flushed
+ */
+void
+send_defer_end(void)
+{
+	s_assert(send_deferred > 0);
+	if(--send_deferred > 0)
+		return;
+
+	send_defer_flush();
+}
+
+/* send_defer_flush()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - every client queued to since the deferral began or
+ *		  was last flushed is written to now, without ending it
+ */
+static void
+send_defer_flush(void)
+{
+	struct Client *to;
+	rb_dlink_node *ptr, *next_ptr;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, deferred_flush_list.head)
+	{
+		to = ptr->data;
+		ClearDeferredFlush(to);
+		rb_dlinkDestroy(ptr, &deferred_flush_list);
+
+		if(!IsIOError(to) && sendq_length(to) > 0)
+			send_queued(to);
+	}
+}
+
+/* send_defer_forget()
+ *
+ * inputs	- client about to be freed
+ * outputs	-
+ * side effects - client is no longer waiting for a deferred flush
+ */
+void
+send_defer_forget(struct Client *client_p)
+{
+	if(client_p->localClient == NULL || !IsDeferredFlush(client_p))
+		return;
+
+	ClearDeferredFlush(client_p);
+	rb_dlinkFindDestroy(client_p, &deferred_flush_list);
+}
+
 /* send_msgbuf()
  *
  * inputs - client to send to, msgbuf
@@ -128,6 +237,387 @@ send_msgbuf(struct Client *target_p, struct MsgBuf *msgbuf)
 	return val;
 }
 
+/* discard_sendq()
+ *
+ * inputs	- local client
+ * outputs	-
+ * side effects - everything still queued to the client is thrown away
+ */
+void
+discard_sendq(struct Client *client_p)
+{
+	sendq_total -= sendq_length(client_p);
+	rb_linebuf_donebuf(&client_p->localClient->buf_sendq);
+	rb_linebuf_donebuf(&client_p->localClient->buf_sendq_control);
+	rb_linebuf_donebuf(&client_p->localClient->buf_sendq_bulk);
+}
+
+/* sendq_length()
+ *
+ * inputs	- local client
+ * outputs	- bytes queued to it, in all its sendqs
+ * side effects -
+ */
+unsigned int
+sendq_length(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+
+	return rb_linebuf_len(&lc->buf_sendq) + rb_linebuf_len(&lc->buf_sendq_control) +
+		rb_linebuf_len(&lc->buf_sendq_bulk);
+}
+
+static bool
+is_command(const char *cmd, const char *name, size_t len)
+{
+	return strncmp(cmd, name, len) == 0 && cmd[len] == ' ';
+}
+
+/* sendq_classify()
+ *
+ * inputs	- client, line about to be queued to it
+ * outputs	- the sendq to queue it in
+ * side effects -
+ *
+ * On a server link, our keepalive PINGs go ahead of everything, so a
+ * link busy with a burst doesn't look dead to the other side, and
+ * messages go behind state changes.  Nothing else may overtake what
+ * was queued before it: a KILL or SQUIT ahead of the burst introducing
+ * its target would desync the network, and a message ahead of it would
+ * come from or go to someone the other side hasn't heard of yet.  So a
+ * QUIT, KILL or SQUIT waits for the messages queued before it, which
+ * may come from what it removes, and everything after it waits too
+ * until they have gone.  The same goes for state changes once the
+ * messages have waited for SENDQ_BULK_WAIT bytes, so they can't be held
+ * back for ever.
+ */
+static buf_head_t *
+sendq_classify(struct Client *to, buf_head_t *linebuf)
+{
+	struct LocalUser *lc = to->localClient;
+	const char *cmd, *p;
+
+	if(!IsServer(to) || linebuf->list.head == NULL)
+		return &lc->buf_sendq;
+
+	cmd = ((buf_line_t *)linebuf->list.head->data)->buf;
+	if(*cmd == '@' && (p = strchr(cmd, ' ')) != NULL)
+		cmd = p + 1;
+
+	/* only the keepalive from check_pings(); a PING with a
+	 * destination ends a burst, and stays in order
+	 */
+	if(strncmp(cmd, "PING :", 6) == 0)
+		return &lc->buf_sendq_control;
+
+	if(*cmd == ':' && (p = strchr(cmd, ' ')) != NULL)
+		cmd = p + 1;
+
+	if(rb_linebuf_len(&lc->buf_sendq_bulk) == 0)
+		lc->sendq_barrier = false;
+
+	if(is_command(cmd, "PRIVMSG", 7) || is_command(cmd, "NOTICE", 6) ||
+			is_command(cmd, "TAGMSG", 6))
+		return &lc->buf_sendq_bulk;
+
+	if(rb_linebuf_len(&lc->buf_sendq_bulk) > 0 &&
+			(lc->sendq_barrier || lc->sendq_bulk_wait >= SENDQ_BULK_WAIT ||
+			 is_command(cmd, "QUIT", 4) || is_command(cmd, "KILL", 4) ||
+			 is_command(cmd, "SQUIT", 5)))
+	{
+		lc->sendq_barrier = true;
+		return &lc->buf_sendq_bulk;
+	}
+
+	return &lc->buf_sendq;
+}
+
+/* sendq_next()
+ *
+ * inputs	- local client
+ * outputs	- the sendq to write from next, or NULL if they're empty
+ * side effects -
+ *
+ * A line partly written is always finished first.  Then keepalives go
+ * before state changes before messages.  Messages never go ahead of a
+ * state change, which was queued before them; sendq_classify() stops
+ * more state changes going ahead once they have waited long enough.
+ */
+buf_head_t *
+sendq_next(struct LocalUser *lc)
+{
+	if(lc->buf_sendq_control.writeofs != 0)
+		return &lc->buf_sendq_control;
+	if(lc->buf_sendq.writeofs != 0)
+		return &lc->buf_sendq;
+	if(lc->buf_sendq_bulk.writeofs != 0)
+		return &lc->buf_sendq_bulk;
+
+	if(rb_linebuf_len(&lc->buf_sendq_control) > 0)
+		return &lc->buf_sendq_control;
+
+	if(rb_linebuf_len(&lc->buf_sendq_bulk) > 0 && rb_linebuf_len(&lc->buf_sendq) == 0)
+	{
+		lc->sendq_bulk_wait = 0;
+		return &lc->buf_sendq_bulk;
+	}
+
+	if(rb_linebuf_len(&lc->buf_sendq) > 0)
+		return &lc->buf_sendq;
+
+	return NULL;
+}
+
+static void
+sendq_written(struct LocalUser *lc, buf_head_t *sendq, int len)
+{
+	if(sendq != &lc->buf_sendq_bulk && rb_linebuf_len(&lc->buf_sendq_bulk) > 0)
+		lc->sendq_bulk_wait += len;
+}
+
+/* sendq_pressure()
+ *
+ * inputs	-
+ * outputs	- true if more is queued in sendqs than sendq_soft_limit
+ * side effects -
+ */
+bool
+sendq_pressure(void)
+{
+	return ConfigFileEntry.sendq_soft_limit > 0 &&
+		sendq_total > (unsigned long)ConfigFileEntry.sendq_soft_limit;
+}
+
+/* sendq_largest()
+ *
+ * inputs	- array to fill, its size
+ * outputs	- number of clients put in the array
+ * side effects - the local users and unregistered connections with
+ *		  the largest sendqs are put in the array, largest first
+ */
+int
+sendq_largest(struct Client **clients, int max)
+{
+	struct Client *client_p;
+	rb_dlink_node *ptr;
+	rb_dlink_list *lists[] = { &lclient_list, &unknown_list, NULL };
+	unsigned int len;
+	int i, j, count = 0;
+
+	if(max <= 0)
+		return 0;
+
+	/* one pass, keeping the array sorted as clients are put in it */
+	for(i = 0; lists[i] != NULL; i++)
+	{
+		RB_DLINK_FOREACH(ptr, lists[i]->head)
+		{
+			client_p = ptr->data;
+			if(client_p->localClient == NULL || IsIOError(client_p))
+				continue;
+
+			len = sendq_length(client_p);
+			if(len == 0 || (count == max && len <= sendq_length(clients[max - 1])))
+				continue;
+
+			j = count < max ? count++ : max - 1;
+			for(; j > 0 && sendq_length(clients[j - 1]) < len; j--)
+				clients[j] = clients[j - 1];
+			clients[j] = client_p;
+		}
+	}
+
+	return count;
+}
+
+/* sendq_user_bytes()
+ *
+ * inputs	-
+ * outputs	- bytes queued to everything but the local servers
+ * side effects -
+ */
+static unsigned long
+sendq_user_bytes(void)
+{
+	unsigned long servers = 0;
+	rb_dlink_node *ptr;
+
+	/* there are only ever a few servers, and a connection can become
+	 * one with its sendq full, so their share is counted as needed
+	 */
+	RB_DLINK_FOREACH(ptr, serv_list.head)
+		servers += sendq_length(ptr->data);
+
+	return sendq_total > servers ? sendq_total - servers : 0;
+}
+
+/* sendq_shed()
+ *
+ * inputs	-
+ * outputs	-
+ * side effects - the clients with the largest sendqs are dropped until
+ *		  what is queued to them is back under sendq_hard_limit;
+ *		  servers are left alone and don't count towards it
+ */
+static void
+sendq_shed(void)
+{
+	static bool shedding;
+	struct Client *victims[32];
+	unsigned long limit = ConfigFileEntry.sendq_hard_limit;
+	unsigned long before;
+	int count, dropped = 0, i;
+
+	if(shedding)
+		return;
+
+	before = sendq_user_bytes();
+	if(before <= limit)
+		return;
+	shedding = true;
+
+	while(sendq_user_bytes() > limit)
+	{
+		count = sendq_largest(victims, sizeof(victims) / sizeof(victims[0]));
+		if(count == 0)
+			break;
+
+		for(i = 0; i < count && sendq_user_bytes() > limit; i++)
+		{
+			ilog(L_MAIN, "Dropping %s with %u bytes of sendq: sendq memory over hard limit",
+					log_client_name(victims[i], HIDE_IP),
+					sendq_length(victims[i]));
+			dead_link(victims[i], 1);
+			discard_sendq(victims[i]);
+			dropped++;
+		}
+	}
+
+	ServerStats.is_sqshed += dropped;
+	shedding = false;
+
+	if(dropped > 0)
+		sendto_realops_snomask(SNO_GENERAL, L_ALL,
+				"Sendq memory over hard limit (%lu > %lu bytes), dropped %d clients",
+				before, limit, dropped);
+}
+
+static void
+count_sent(struct Client *to, int len)
+{
+	to->localClient->sendB += len;
+	me.localClient->sendB += len;
+}
+
+/* the sendq is empty: let the kernel send what it held back */
+static void
+send_uncork(struct Client *to)
+{
+	if(to->localClient->localflags & LFLAGS_CORK)
+	{
+		to->localClient->localflags &= ~LFLAGS_CORK;
+		rb_set_cork(to->localClient->F, 0);
+	}
+}
+
+/* send_queued_zlink()
+ *
+ * inputs	- compressed server link to send to
+ * outputs	- as much of its sendq as it takes
+ * side effects - only ZLINK_BACKLOG is compressed ahead of the socket,
+ *		  the rest stays in the sendq where the limits see it
+ */
+static void
+send_queued_zlink(struct Client *to)
+{
+	struct LocalUser *lc = to->localClient;
+	rawbuf_head_t *zsendq = zlink_sendq(lc->zlink);
+	char line[LINEBUF_SIZE + CRLF_LEN + 1];
+	unsigned int len = sendq_length(to);
+	buf_head_t *sendq;
+	int retlen, n;
+
+	do
+	{
+		while(rb_rawbuf_length(zsendq) < ZLINK_BACKLOG &&
+				(sendq = sendq_next(lc)) != NULL &&
+				(n = rb_linebuf_get(sendq, line, sizeof(line),
+					LINEBUF_COMPLETE, LINEBUF_RAW)) > 0)
+		{
+			zlink_deflate(lc->zlink, line, n);
+			sendq_written(lc, sendq, n);
+		}
+
+		zlink_deflate_flush(lc->zlink);
+
+		while((retlen = rb_rawbuf_flush(zsendq, lc->F)) > 0)
+		{
+			ClearFlush(to);
+			count_sent(to, retlen);
+		}
+	}
+	while(rb_rawbuf_length(zsendq) == 0 && sendq_length(to) > 0);
+
+	sendq_total -= len - sendq_length(to);
+
+	if(retlen == RB_RW_SSL_NEED_READ)
+	{
+		SetFlush(to);
+		return;
+	}
+
+	if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
+	{
+		dead_link(to, 0);
+		return;
+	}
+
+	if(rb_rawbuf_length(zsendq) > 0)
+	{
+		SetFlush(to);
+		rb_setselect(lc->F, RB_SELECT_WRITE, send_queued_write, to);
+	}
+	else
+	{
+		ClearFlush(to);
+		send_uncork(to);
+	}
+}
+
+/* send_start_zlink()
+ *
+ * inputs	- local server, compression level
+ * outputs	- false if compression couldn't be set up
+ * side effects - everything sent to the server from now on is
+ *		  compressed; what was queued before goes out as it is
+ */
+bool
+send_start_zlink(struct Client *client_p, int level)
+{
+	struct LocalUser *lc = client_p->localClient;
+	char line[LINEBUF_SIZE + CRLF_LEN + 1];
+	unsigned int len = rb_linebuf_len(&lc->buf_sendq);
+	int ofs, n;
+
+	lc->zlink = zlink_new(level);
+	if(lc->zlink == NULL)
+		return false;
+
+	for(;;)
+	{
+		ofs = lc->buf_sendq.writeofs;
+		n = rb_linebuf_get(&lc->buf_sendq, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_RAW);
+		if(n <= 0)
+			break;
+
+		zlink_append(lc->zlink, line + ofs, n - ofs);
+		lc->buf_sendq.writeofs = 0;
+	}
+
+	sendq_total -= len - rb_linebuf_len(&lc->buf_sendq);
+	return true;
+}
+
 /* send_queued_write()
  *
  * inputs	- fd to have queue sent, client we're sending to
@@ -151,26 +641,35 @@ send_queued(struct Client *to)
 	if(IsFlush(to))
 		return;
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq))
+	if(to->localClient->zlink != NULL)
 	{
-		while ((retlen =
-			rb_linebuf_flush(F, &to->localClient->buf_sendq)) > 0)
+		send_queued_zlink(to);
+		return;
+	}
+
+	if(sendq_length(to))
+	{
+		unsigned int len = sendq_length(to);
+		buf_head_t *sendq;
+
+		while ((sendq = sendq_next(to->localClient)) != NULL &&
+			(retlen = rb_linebuf_flush(F, sendq)) > 0)
 		{
 			/* We have some data written .. update counters */
 			ClearFlush(to);
+			count_sent(to, retlen);
+			sendq_written(to->localClient, sendq, retlen);
+		}
 
-			to->localClient->sendB += retlen;
-			me.localClient->sendB += retlen;
-			if(to->localClient->sendB > 1023)
-			{
-				to->localClient->sendK += (to->localClient->sendB >> 10);
-				to->localClient->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
-			}
-			else if(me.localClient->sendB > 1023)
-			{
-				me.localClient->sendK += (me.localClient->sendB >> 10);
-				me.localClient->sendB &= 0x03ff;
-			}
+		sendq_total -= len - sendq_length(to);
+
+		/* an inline TLS write waiting on the peer, read_packet()
+		 * tries again once something arrives
+		 */
+		if(retlen == RB_RW_SSL_NEED_READ)
+		{
+			SetFlush(to);
+			return;
 		}
 
 		if(retlen == 0 || (retlen < 0 && !rb_ignore_errno(errno)))
@@ -180,14 +679,31 @@ send_queued(struct Client *to)
 		}
 	}
 
-	if(rb_linebuf_len(&to->localClient->buf_sendq))
+	if(sendq_length(to))
 	{
 		SetFlush(to);
 		rb_setselect(to->localClient->F, RB_SELECT_WRITE,
 			       send_queued_write, to);
 	}
 	else
+	{
 		ClearFlush(to);
+		send_uncork(to);
+	}
+}
+
+/* send_cork()
+ *
+ * inputs	- local client
+ * outputs	- none
+ * side effects - the socket holds back partial frames until everything
+ *		  queued to it now and later has been written
+ */
+void
+send_cork(struct Client *to)
+{
+	if(rb_set_cork(to->localClient->F, 1))
+		to->localClient->localflags |= LFLAGS_CORK;
 }
 
 void
@@ -197,7 +713,7 @@ send_pop_queue(struct Client *to)
 		to = to->from;
 	if(!MyConnect(to) || IsIOError(to))
 		return;
-	if(rb_linebuf_len(&to->localClient->buf_sendq) > 0)
+	if(sendq_length(to) > 0)
 		send_queued(to);
 }
 
@@ -213,6 +729,13 @@ send_queued_write(rb_fde_t *F, void *data)
 	struct Client *to = data;
 	ClearFlush(to);
 	send_queued(to);
+
+	/* this replaced read_packet_tls_write(), so do its read too */
+	if(IsReadWantsWrite(to) && !IsAnyDead(to))
+	{
+		ClearReadWantsWrite(to);
+		read_packet(F, to);
+	}
 }
 
 /*
@@ -277,14 +800,17 @@ build_msgbuf(struct MsgBuf *msgbuf, struct Client *from, char *line, size_t n_ta
 
 	for (size_t i = 0; i < n_tags; i++)
 	{
-		if (tags[i].key != NULL)
-			msgbuf_append_tag(msgbuf, tags[i].key, tags[i].value, tags[i].capmask);
+		if (tags[i].key != NULL && msgbuf->n_tags < MAXTAGS)
+			msgbuf->tags[msgbuf->n_tags++] = tags[i];
 	}
 
-	hdata.client = from;
-	hdata.arg1 = msgbuf;
+	if (hook_has_listeners(h_outbound_msgbuf))
+	{
+		hdata.client = from;
+		hdata.arg1 = msgbuf;
 
-	call_hook(h_outbound_msgbuf, &hdata);
+		call_hook(h_outbound_msgbuf, &hdata);
+	}
 
 	/* avoid duplicating params when unparsing */
 	msgbuf->cmd = NULL;
@@ -304,19 +830,63 @@ sendto_one(struct Client *target_p, const char *pattern, ...)
 	struct Client *dest_p = target_p->from;
 	struct MsgBuf msgbuf;
 	char buf[DATALEN + 1];
-	rb_strf_t strings = { .format = pattern, .format_args = &args, .next = NULL };
 
 	if (IsIOError(dest_p))
 		return;
 
+	/* most numerics are sent as whole lines from messages.h */
 	va_start(args, pattern);
-	rb_fsnprint(buf, sizeof(buf), &strings);
+	format_numeric(buf, sizeof(buf), -1, pattern, args);
 	va_end(args);
 
 	build_msgbuf(&msgbuf, &me, buf, 0, NULL);
 	send_msgbuf(target_p, &msgbuf);
 }
 
+/* send_untagged()
+ *
+ * inputs	- local client, line from us to it
+ * outputs	- true if the line would reach the client without message tags
+ * side effects -
+ */
+bool
+send_untagged(struct Client *target_p, const char *line)
+{
+	struct MsgBuf msgbuf;
+	char buf[DATALEN + 1];
+
+	rb_strlcpy(buf, line, sizeof(buf));
+	build_msgbuf(&msgbuf, &me, buf, 0, NULL);
+
+	for (size_t i = 0; i < msgbuf.n_tags; i++)
+	{
+		if (msgbuf.tags[i].capmask & CLIENT_CAP_MASK(target_p))
+			return false;
+	}
+
+	return true;
+}
+
+/* sendto_one_linebuf()
+ *
+ * inputs	- local client, linebuf holding lines from us, number of lines
+ * outputs	-
+ * side effects - linebuf is attached to the client as it is, without
+ *		  message tags; see send_untagged()
+ */
+void
+sendto_one_linebuf(struct Client *target_p, buf_head_t *linebuf, unsigned int lines)
+{
+	if (IsIOError(target_p))
+		return;
+
+	if (send_linebuf(target_p, linebuf) == 0 && lines > 1)
+	{
+		target_p->localClient->sendM += lines - 1;
+		me.localClient->sendM += lines - 1;
+	}
+}
+
 /* sendto_one_prefix()
  *
  * inputs	- client to send to, va_args
@@ -393,6 +963,39 @@ sendto_one_notice(struct Client *target_p, const char *pattern, ...)
 }
 
 
+/* numeric_prefix()
+ *
+ * inputs	- buffer of at least DATALEN + 1, source and target names
+ *		  or IDs, numeric
+ * outputs	- length of ":source NNN target " written to it
+ */
+static size_t
+numeric_prefix(char *buf, const char *from, int numeric, const char *to)
+{
+	size_t fromlen = strnlen(from, HOSTLEN);
+	size_t tolen = strnlen(to, HOSTLEN);
+	char *p = buf;
+
+	if(numeric < 0 || numeric > 999)
+		return snprintf(buf, DATALEN + 1, ":%.*s %d %.*s ",
+				(int)fromlen, from, numeric, (int)tolen, to);
+
+	*p++ = ':';
+	memcpy(p, from, fromlen);
+	p += fromlen;
+	*p++ = ' ';
+	*p++ = '0' + numeric / 100;
+	*p++ = '0' + numeric / 10 % 10;
+	*p++ = '0' + numeric % 10;
+	*p++ = ' ';
+	memcpy(p, to, tolen);
+	p += tolen;
+	*p++ = ' ';
+	*p = '\0';
+
+	return p - buf;
+}
+
 /* sendto_one_numeric()
  *
  * inputs	- client to send to, va_args
@@ -406,7 +1009,6 @@ sendto_one_numeric(struct Client *target_p, int numeric, const char *pattern, ..
 	va_list args;
 	struct MsgBuf msgbuf;
 	char buf[DATALEN + 1];
-	rb_strf_t strings = { .format = pattern, .format_args = &args, .next = NULL };
 	const char *to = get_id(target_p, target_p);
 
 	if (EmptyString(to))
@@ -421,11 +1023,10 @@ sendto_one_numeric(struct Client *target_p, int numeric, const char *pattern, ..
 		return;
 	}
 
-	int used = snprintf(buf, sizeof(buf), ":%s %03d %s ",
-		get_id(&me, target_p), numeric, to);
+	size_t used = numeric_prefix(buf, get_id(&me, target_p), numeric, to);
 
 	va_start(args, pattern);
-	rb_fsnprint(buf + used, sizeof(buf) - used, &strings);
+	format_numeric(buf + used, sizeof(buf) - used, numeric, pattern, args);
 	va_end(args);
 
 	build_msgbuf(&msgbuf, &me, buf, 0, NULL);
@@ -1082,6 +1683,117 @@ sendto_common_channels_local_butone(struct Client *user, int cap, int negcap, co
 	msgbuf_cache_free(&msgbuf_cache);
 }
 
+/* users whose QUITs are queued between writes during a netsplit */
+#define NETSPLIT_QUIT_CHUNK	64
+
+/*
+ * sendto_netsplit_quits()
+ *
+ * inputs	- list of users lost in a netsplit
+ *		- the servers that split, for the batch
+ *		- quit reason
+ * output	- NONE
+ * side effects	- Sends the QUITs of all the users to the local clients
+ *		  sharing a channel with them.  They are written out every
+ *		  NETSPLIT_QUIT_CHUNK users, so a recipient gets few writes
+ *		  but its sendq never has to hold the whole split; clients
+ *		  with the batch capability get the QUITs wrapped in a
+ *		  netsplit BATCH.
+ */
+void
+sendto_netsplit_quits(rb_dlink_list *users, const char *servers, const char *reason)
+{
+	static unsigned long netsplit_id;
+	rb_dlink_list batched = { NULL, NULL, 0 };
+	rb_dlink_node *ptr, *next_ptr;
+	rb_dlink_node *cptr;
+	rb_dlink_node *uptr;
+	struct Client *user;
+	struct Client *target_p;
+	struct membership *msptr;
+	struct MsgBuf msgbuf;
+	struct MsgBuf_cache msgbuf_cache;
+	char batch[16];
+	char buf[DATALEN + 1];
+	struct MsgTag tag = { .key = "batch", .value = batch, .capmask = CLICAP_BATCH };
+	unsigned int queued = 0;
+
+	if(rb_dlink_list_length(users) == 0)
+		return;
+
+	snprintf(batch, sizeof batch, "ns%lx", ++netsplit_id);
+	send_defer_begin();
+
+	/* open the batches of everyone who will see a QUIT */
+	++current_serial;
+	RB_DLINK_FOREACH(ptr, users->head)
+	{
+		user = ptr->data;
+
+		RB_DLINK_FOREACH(cptr, user->user->channel.head)
+		{
+			msptr = cptr->data;
+
+			RB_DLINK_FOREACH(uptr, msptr->chptr->locmembers.head)
+			{
+				target_p = ((struct membership *)uptr->data)->client_p;
+
+				if(IsIOError(target_p) || target_p->serial == current_serial)
+					continue;
+
+				target_p->serial = current_serial;
+
+				if(IsCapable(target_p, CLICAP_BATCH))
+				{
+					rb_dlinkAddAlloc(target_p, &batched);
+					sendto_one(target_p, ":%s BATCH +%s netsplit %s",
+							me.name, batch, servers);
+				}
+			}
+		}
+	}
+
+	RB_DLINK_FOREACH(ptr, users->head)
+	{
+		user = ptr->data;
+
+		snprintf(buf, sizeof buf, ":%s!%s@%s QUIT :%s",
+				user->name, user->username, user->host, reason);
+		build_msgbuf(&msgbuf, user, buf, 1, &tag);
+		msgbuf_cache_init(&msgbuf_cache, &msgbuf, NULL, NULL);
+
+		++current_serial;
+		RB_DLINK_FOREACH(cptr, user->user->channel.head)
+		{
+			msptr = cptr->data;
+
+			RB_DLINK_FOREACH(uptr, msptr->chptr->locmembers.head)
+			{
+				target_p = ((struct membership *)uptr->data)->client_p;
+
+				if(IsIOError(target_p) || target_p->serial == current_serial)
+					continue;
+
+				target_p->serial = current_serial;
+				send_linebuf(target_p, msgbuf_cache_get(&msgbuf_cache, CLIENT_CAP_MASK(target_p), false));
+			}
+		}
+
+		msgbuf_cache_free(&msgbuf_cache);
+
+		if(++queued % NETSPLIT_QUIT_CHUNK == 0)
+			send_defer_flush();
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next_ptr, batched.head)
+	{
+		sendto_one(ptr->data, ":%s BATCH -%s", me.name, batch);
+		rb_dlinkDestroy(ptr, &batched);
+	}
+
+	send_defer_end();
+}
+
 /* sendto_match_internal()
  *
  * inputs	- server not to send to, source, mask, type of mask, capabilities, va_args, tags
@@ -438,29 +438,17 @@ ssl_process_cipher_string(ssl_ctl_t *ctl, ssl_ctl_buf_t *ctl_buf)
 }
 
 
-static void
-ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+/*
+ * set_client_certfp - record a client certificate fingerprint, as
+ * ssld reports it or as an inline TLS listener reads it
+ */
+void
+set_client_certfp(struct Client *client_p, uint32_t certfp_method, const uint8_t *certfp, uint32_t len)
 {
-	struct Client *client_p;
-	uint32_t fd;
-	uint32_t certfp_method;
-	uint32_t len;
-	uint8_t *certfp;
 	char *certfp_string;
 	const char *method_string;
 	int method_len;
 
-	if(ctl_buf->buflen > 13 + RB_SSL_CERTFP_LEN)
-		return;		/* bogus message..drop it.. XXX should warn here */
-
-	fd = buf_to_uint32(&ctl_buf->buf[1]);
-	certfp_method = buf_to_uint32(&ctl_buf->buf[5]);
-	len = buf_to_uint32(&ctl_buf->buf[9]);
-	certfp = (uint8_t *)&ctl_buf->buf[13];
-	client_p = find_cli_connid_hash(fd);
-	if(client_p == NULL)
-		return;
-
 	switch (certfp_method) {
 	case RB_SSL_CERTFP_METH_CERT_SHA1:
 		method_string = CERTFP_PREFIX_CERT_SHA1;
@@ -491,6 +479,29 @@ ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
 	client_p->certfp = certfp_string;
 }
 
+static void
+ssl_process_certfp(ssl_ctl_t * ctl, ssl_ctl_buf_t * ctl_buf)
+{
+	struct Client *client_p;
+	uint32_t fd;
+	uint32_t certfp_method;
+	uint32_t len;
+	uint8_t *certfp;
+
+	if(ctl_buf->buflen > 13 + RB_SSL_CERTFP_LEN)
+		return;		/* bogus message..drop it.. XXX should warn here */
+
+	fd = buf_to_uint32(&ctl_buf->buf[1]);
+	certfp_method = buf_to_uint32(&ctl_buf->buf[5]);
+	len = buf_to_uint32(&ctl_buf->buf[9]);
+	certfp = (uint8_t *)&ctl_buf->buf[13];
+	client_p = find_cli_connid_hash(fd);
+	if(client_p == NULL)
+		return;
+
+	set_client_certfp(client_p, certfp_method, certfp, len);
+}
+
 static void
 ssl_process_cmd_recv(ssl_ctl_t * ctl)
 {
@@ -842,6 +853,100 @@ ssld_foreach_info(void (*func)(void *data, pid_t pid, int cli_count, enum ssld_s
 	}
 }
 
+/*
+ * ssld_foreach_handoff - call func for each ssld that can be handed to
+ * the process replacing us, with its control socket and pipe
+ */
+void
+ssld_foreach_handoff(void (*func)(void *data, rb_fde_t *F, rb_fde_t *P, pid_t pid, bool shutdown, const char *version), void *data)
+{
+	rb_dlink_node *ptr;
+	ssl_ctl_t *ctl;
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ctl = ptr->data;
+		if(ctl->dead)
+			continue;
+		func(data, ctl->F, ctl->P, ctl->pid, ctl->shutdown, ctl->version);
+	}
+}
+
+/*
+ * ssld_handoff_ready - true if no ssld has commands (and the fds that
+ * go with them) still waiting to be written
+ */
+bool
+ssld_handoff_ready(void)
+{
+	rb_dlink_node *ptr;
+	ssl_ctl_t *ctl;
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ctl = ptr->data;
+		if(!ctl->dead && rb_dlink_list_length(&ctl->writeq) > 0)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * ssld_handoff_pid - the pid of a client's ssld, or 0 if the client
+ * can't be handed over because its ssld has died
+ */
+pid_t
+ssld_handoff_pid(ssl_ctl_t *ctl)
+{
+	if(ctl == NULL || ctl->dead)
+		return 0;
+	return ctl->pid;
+}
+
+/*
+ * adopt_ssld - take over an ssld started by the process we replaced.
+ * It goes on as it was; nothing is read from it until the event loop
+ * runs, by when its clients have been restored.
+ */
+void
+adopt_ssld(rb_fde_t *F, rb_fde_t *P, pid_t pid, bool shutdown, const char *version)
+{
+	ssl_ctl_t *ctl;
+
+	ctl = allocate_ssl_daemon(F, P, pid);
+	if(ctl == NULL)
+		return;
+
+	if(shutdown)
+	{
+		ctl->shutdown = 1;
+		ssld_count--;
+	}
+	rb_strlcpy(ctl->version, version, sizeof(ctl->version));
+
+	rb_setselect(ctl->F, RB_SELECT_READ, ssl_read_ctl, ctl);
+	rb_setselect(ctl->P, RB_SELECT_READ, ssl_do_pipe, ctl);
+}
+
+/*
+ * ssld_adopt_client - find the adopted ssld with the given pid and
+ * count a restored client against it
+ */
+ssl_ctl_t *
+ssld_adopt_client(pid_t pid)
+{
+	rb_dlink_node *ptr;
+	ssl_ctl_t *ctl;
+	RB_DLINK_FOREACH(ptr, ssl_daemons.head)
+	{
+		ctl = ptr->data;
+		if(ctl->pid == pid && !ctl->dead)
+		{
+			ctl->cli_count++;
+			return ctl;
+		}
+	}
+	return NULL;
+}
+
 void
 init_ssld(void)
 {
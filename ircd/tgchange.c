@@ -35,17 +35,67 @@
 
 static int add_hashed_target(struct Client *source_p, uint32_t hashv);
 
+#define TARGET_BIT(hashv)	((uint64_t)1 << ((hashv) & 63))
+
+void
+rebuild_target_filter(struct Client *source_p)
+{
+	uint32_t *targets = source_p->localClient->targets;
+	uint64_t filter = 0;
+	int i;
+
+	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+		filter |= TARGET_BIT(targets[i]);
+	source_p->localClient->targets_filter = filter;
+}
+
+/*
+ * find_target - position of hashv in targets[], or -1
+ *
+ * A clear bit in targets_filter answers most misses without looking
+ * through the slots.  Slots never used hold 0, which the filter doesn't
+ * know about until the first rebuild.
+ */
+static int
+find_target(struct Client *source_p, uint32_t hashv)
+{
+	uint32_t *targets = source_p->localClient->targets;
+	int i;
+
+	if(hashv != 0 && !(source_p->localClient->targets_filter & TARGET_BIT(hashv)))
+		return -1;
+
+	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+		if(targets[i] == hashv)
+			return i;
+	return -1;
+}
+
+/* insert hashv at position to, shifting the slots from there up to
+ * (and over) position from along by one
+ */
+static void
+move_target(struct Client *source_p, int from, int to, uint32_t hashv)
+{
+	uint32_t *targets = source_p->localClient->targets;
+
+	if(from > to)
+		memmove(&targets[to + 1], &targets[to], (from - to) * sizeof(targets[0]));
+	targets[to] = hashv;
+	rebuild_target_filter(source_p);
+}
+
 struct Channel *
 find_allowing_channel(struct Client *source_p, struct Client *target_p)
 {
-	rb_dlink_node *ps, *pt;
-	struct membership *ms, *mt;
-	struct Channel *chptr;
+	rb_dlink_node *ptr;
+	struct membership *msptr;
 
-	ITER_COMM_CHANNELS(ps, pt, source_p->user->channel.head, target_p->user->channel.head, ms, mt, chptr)
+	RB_DLINK_FOREACH(ptr, source_p->user->channel.head)
 	{
-		if (ms != NULL && mt != NULL && is_chanop_voiced(ms))
-			return chptr;
+		msptr = ptr->data;
+		if (is_chanop_voiced(msptr) && IsMember(target_p, msptr->chptr))
+			return msptr->chptr;
 	}
 	return NULL;
 }
@@ -86,21 +136,14 @@ add_channel_target(struct Client *source_p, struct Channel *chptr)
 static int
 add_hashed_target(struct Client *source_p, uint32_t hashv)
 {
-	int i, j;
-	uint32_t *targets;
-
-	targets = source_p->localClient->targets;
+	int i;
 
 	/* check for existing target, and move it to the head */
-	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+	if((i = find_target(source_p, hashv)) >= 0)
 	{
-		if(targets[i] == hashv)
-		{
-			for(j = i; j > 0; j--)
-				targets[j] = targets[j - 1];
-			targets[0] = hashv;
-			return 1;
-		}
+		if(i > 0)
+			move_target(source_p, i, 0, hashv);
+		return 1;
 	}
 
 	if(source_p->localClient->targets_free < TGCHANGE_NUM)
@@ -156,44 +199,59 @@ add_hashed_target(struct Client *source_p, uint32_t hashv)
 		SetTGChange(source_p);
 	}
 
-	for(i = TGCHANGE_NUM + TGCHANGE_REPLY - 1; i > 0; i--)
-		targets[i] = targets[i - 1];
-	targets[0] = hashv;
+	move_target(source_p, TGCHANGE_NUM + TGCHANGE_REPLY - 1, 0, hashv);
 	source_p->localClient->targets_free--;
 	return 1;
 }
 
+void
+target_set_clear(struct target_set *set)
+{
+	/* a wrapped generation would match entries left from long ago */
+	if(++set->gen == 0)
+	{
+		memset(set->slot, 0, sizeof(set->slot));
+		set->gen = 1;
+	}
+}
+
+bool
+target_set_add(struct target_set *set, void *ptr)
+{
+	unsigned int i;
+
+	i = ((uintptr_t)ptr >> 4) * 2654435761u;
+	for(i &= TARGET_SET_SIZE - 1; set->slot[i].gen == set->gen; i = (i + 1) & (TARGET_SET_SIZE - 1))
+	{
+		if(set->slot[i].ptr == ptr)
+			return false;
+	}
+
+	set->slot[i].ptr = ptr;
+	set->slot[i].gen = set->gen;
+	return true;
+}
+
 void
 add_reply_target(struct Client *source_p, struct Client *target_p)
 {
-	int i, j;
+	int i;
 	uint32_t hashv;
-	uint32_t *targets;
 
 	/* can msg themselves or services without using any target slots */
 	if(source_p == target_p || IsService(target_p))
 		return;
 
 	hashv = fnv_hash_upper((const unsigned char *)use_id(target_p), 32);
-	targets = source_p->localClient->targets;
 
 	/* check for existing target, and move it to the first reply slot
 	 * if it is in a reply slot
 	 */
-	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+	if((i = find_target(source_p, hashv)) >= 0)
 	{
-		if(targets[i] == hashv)
-		{
-			if(i > TGCHANGE_NUM)
-			{
-				for(j = i; j > TGCHANGE_NUM; j--)
-					targets[j] = targets[j - 1];
-				targets[TGCHANGE_NUM] = hashv;
-			}
-			return;
-		}
+		if(i > TGCHANGE_NUM)
+			move_target(source_p, i, TGCHANGE_NUM, hashv);
+		return;
 	}
-	for(i = TGCHANGE_NUM + TGCHANGE_REPLY - 1; i > TGCHANGE_NUM; i--)
-		targets[i] = targets[i - 1];
-	targets[TGCHANGE_NUM] = hashv;
+	move_target(source_p, TGCHANGE_NUM + TGCHANGE_REPLY - 1, TGCHANGE_NUM, hashv);
 }
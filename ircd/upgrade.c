@@ -0,0 +1,1468 @@
+/*
+ * Comet: a slightly advanced ircd
+ * upgrade.c: restarting into a new binary without dropping connections
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * An upgrade writes what this server knows about its connections and
+ * the network to a snapshot, lets the sockets it is keeping survive
+ * exec and executes the ircd binary again, passing the snapshot's fd in
+ * the environment.  The new process takes over the listeners and ssld
+ * helpers before it reads the conf, so listen{} blocks find their ports
+ * already open and no extra sslds are started, then rebuilds servers,
+ * users and channels once me is set up.  Nothing is sent to anyone; to
+ * the rest of the network the server just went quiet for a moment.
+ *
+ * What can't be carried over is dropped first: connections that have
+ * not registered (authd and bandb start afresh in the new process), and
+ * connections whose TLS or zlib state lives in our own memory.
+ *
+ * The snapshot is only ever read by the binary installed in its place,
+ * on the same machine, so it is a plain dump of native integers and
+ * length-prefixed strings.  Anything using bits assigned at runtime
+ * (modes, capabilities) is saved by name.  If the new process can't
+ * make sense of it, it falls back to an ordinary restart.
+ */
+
+#define _GNU_SOURCE	/* memfd_create() */
+
+#include "stdinc.h"
+#include "upgrade.h"
+#include "capability.h"
+#include "channel.h"
+#include "chmode.h"
+#include "client.h"
+#include "hash.h"
+#include "hostmask.h"
+#include "ircd.h"
+#include "listener.h"
+#include "logger.h"
+#include "monitor.h"
+#include "msg.h"
+#include "packet.h"
+#include "privilege.h"
+#include "restart.h"
+#include "s_conf.h"
+#include "s_newconf.h"
+#include "s_serv.h"
+#include "s_user.h"
+#include "scache.h"
+#include "send.h"
+#include "snomask.h"
+#include "sslproc.h"
+#include "tgchange.h"
+
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
+
+#define UPGRADE_MAGIC	"comet-upgrade"
+#define UPGRADE_VERSION	1
+
+/* longest string or buffer we believe a snapshot about */
+#define UPGRADE_MAX_BUF	(1024 * 1024 * 1024)
+
+/* what each record in the snapshot is */
+#define TAG_LISTENER	'L'
+#define TAG_SSLD	'S'
+#define TAG_HELPERS_END	'H'
+#define TAG_SERVER	'V'
+#define TAG_USER	'U'
+#define TAG_CHANNEL	'C'
+#define TAG_ALLOW	'A'
+#define TAG_END		'E'
+
+extern char * const *myargv;
+
+static FILE *snap;
+static bool snap_failed;
+static int upgrade_fd = -1;
+
+/* from the snapshot's header, for when me is set up */
+static struct timeval stopped;
+static time_t saved_startup_time;
+static struct Counter saved_count;
+static int saved_max_clients, saved_max_connections;
+
+/* restored clients that turned out to have no home here */
+static rb_dlink_list drop_list;
+
+static void
+put_raw(const void *buf, size_t len)
+{
+	if(len > 0 && fwrite(buf, len, 1, snap) != 1)
+		snap_failed = true;
+}
+
+static void
+put_tag(int tag)
+{
+	if(fputc(tag, snap) == EOF)
+		snap_failed = true;
+}
+
+static void
+put_int(int64_t val)
+{
+	put_raw(&val, sizeof(val));
+}
+
+static void
+put_buf(const void *buf, size_t len)
+{
+	put_int(len);
+	put_raw(buf, len);
+}
+
+static void
+put_str(const char *str)
+{
+	if(str == NULL)
+		put_int(-1);
+	else
+		put_buf(str, strlen(str));
+}
+
+static int
+get_tag(void)
+{
+	int tag = fgetc(snap);
+
+	if(tag == EOF)
+		snap_failed = true;
+	return tag;
+}
+
+static int64_t
+get_int(void)
+{
+	int64_t val = 0;
+
+	if(!snap_failed && fread(&val, sizeof(val), 1, snap) != 1)
+		snap_failed = true;
+	return val;
+}
+
+/* a buffer or string, NUL terminated; NULL if NULL was saved */
+static char *
+get_buf(size_t *lenp)
+{
+	int64_t len = get_int();
+	char *buf;
+
+	*lenp = 0;
+	if(snap_failed || len == -1)
+		return NULL;
+
+	if(len < 0 || len > UPGRADE_MAX_BUF)
+	{
+		snap_failed = true;
+		return NULL;
+	}
+
+	buf = rb_malloc(len + 1);
+	if(len > 0 && fread(buf, len, 1, snap) != 1)
+	{
+		snap_failed = true;
+		rb_free(buf);
+		return NULL;
+	}
+
+	*lenp = len;
+	return buf;
+}
+
+static char *
+get_strdup(void)
+{
+	size_t len;
+
+	return get_buf(&len);
+}
+
+static void
+get_str(char *dst, size_t size)
+{
+	char *str = get_strdup();
+
+	rb_strlcpy(dst, str != NULL ? str : "", size);
+	rb_free(str);
+}
+
+static void
+get_fixed(void *dst, size_t size)
+{
+	size_t len;
+	char *buf = get_buf(&len);
+
+	if(buf == NULL || len != size)
+		snap_failed = true;
+	else
+		memcpy(dst, buf, size);
+	rb_free(buf);
+}
+
+/*
+ * Modes and capabilities are bits handed out as modules load, which
+ * may not come out the same in the new binary, so they go by name.
+ * Anonymous capabilities are all made at startup, in the same order.
+ */
+static const char *
+mode_letters(const int *table, unsigned int modes)
+{
+	static char buf[256 + 1];
+	char *p = buf;
+	int i;
+
+	for(i = 1; i < 256; i++)
+		if(table[i] && (modes & table[i]))
+			*p++ = i;
+	*p = '\0';
+
+	return buf;
+}
+
+static unsigned int
+get_mode_letters(const int *table)
+{
+	char *letters = get_strdup();
+	unsigned int modes = 0;
+	const char *p;
+
+	for(p = letters; p != NULL && *p != '\0'; p++)
+		modes |= table[(unsigned char)*p];
+
+	rb_free(letters);
+	return modes;
+}
+
+static void
+put_caps(struct CapabilityIndex *idx, unsigned int caps)
+{
+	struct CapabilityEntry *entry;
+	rb_dictionary_iter iter;
+	unsigned int named = 0;
+
+	RB_DICTIONARY_FOREACH(entry, &iter, idx->cap_dict)
+	{
+		named |= (1 << entry->value);
+		if(caps & (1 << entry->value))
+			put_str(entry->cap);
+	}
+	put_str(NULL);
+	put_int(caps & ~named);
+}
+
+static unsigned int
+get_caps(struct CapabilityIndex *idx)
+{
+	unsigned int caps = 0;
+	char *name;
+
+	while((name = get_strdup()) != NULL)
+	{
+		caps |= capability_get(idx, name, NULL);
+		rb_free(name);
+	}
+
+	return caps | get_int();
+}
+
+/* a sendq as the bytes still to be written; it is split back into lines
+ * as it is read
+ */
+static void
+save_sendq(buf_head_t *bufhead)
+{
+	rb_dlink_node *ptr;
+	buf_line_t *line;
+	int64_t len = 0;
+	int ofs;
+
+	ofs = bufhead->writeofs;
+	RB_DLINK_FOREACH(ptr, bufhead->list.head)
+	{
+		line = ptr->data;
+		len += line->len - ofs;
+		ofs = 0;
+	}
+	put_int(len);
+
+	ofs = bufhead->writeofs;
+	RB_DLINK_FOREACH(ptr, bufhead->list.head)
+	{
+		line = ptr->data;
+		put_raw(line->buf + ofs, line->len - ofs);
+		ofs = 0;
+	}
+}
+
+static void
+restore_sendq(buf_head_t *bufhead)
+{
+	size_t len;
+	char *buf = get_buf(&len);
+
+	if(len > 0)
+	{
+		rb_linebuf_parse(bufhead, buf, len, 1);
+		sendq_total += rb_linebuf_len(bufhead);
+		if(sendq_total > sendq_peak)
+			sendq_peak = sendq_total;
+	}
+	rb_free(buf);
+}
+
+/*
+ * set_all_cloexec - let exec close every fd; the ones the new process
+ * is to have are cleared again as they are saved
+ */
+static void
+set_all_cloexec(void)
+{
+	int fd, flags;
+
+	for(fd = 3; fd < maxconnections; fd++)
+	{
+		flags = fcntl(fd, F_GETFD);
+		if(flags >= 0 && !(flags & FD_CLOEXEC))
+			fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+	}
+}
+
+static int
+create_snapshot(void)
+{
+	char path[PATH_MAX];
+	int fd;
+
+#ifdef HAVE_MEMFD_CREATE
+	fd = memfd_create("ircd upgrade", 0);
+	if(fd >= 0)
+		return fd;
+#endif
+
+	snprintf(path, sizeof(path), "%s/upgrade.XXXXXX", ConfigFileEntry.dpath);
+	fd = mkstemp(path);
+	if(fd >= 0)
+		unlink(path);
+	return fd;
+}
+
+/*
+ * can_hand_over - whether a registered connection can be carried over
+ */
+static bool
+can_hand_over(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+
+	if(lc->F == NULL)
+		return false;
+
+	/* TLS done by the ircd itself, and zlib streams */
+	if(rb_get_type(lc->F) & RB_FD_SSL)
+		return false;
+	if(lc->zlink != NULL)
+		return false;
+
+	if(lc->ssl_ctl != NULL && ssld_handoff_pid(lc->ssl_ctl) == 0)
+		return false;
+
+	return true;
+}
+
+static void
+drop_unhandled(void)
+{
+	rb_dlink_node *ptr, *next;
+	struct Client *client_p;
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, unknown_list.head)
+	{
+		client_p = ptr->data;
+		if(!IsAnyDead(client_p))
+			exit_client(client_p, client_p, &me, "Server upgrading");
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, serv_list.head)
+	{
+		client_p = ptr->data;
+		if(!IsAnyDead(client_p) && !can_hand_over(client_p))
+			exit_client(client_p, client_p, &me, "Server upgrading");
+	}
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, lclient_list.head)
+	{
+		client_p = ptr->data;
+		if(!IsAnyDead(client_p) && !can_hand_over(client_p))
+			exit_client(client_p, client_p, &me, "Server upgrading");
+	}
+}
+
+static void
+flush_all(void)
+{
+	rb_dlink_node *ptr;
+	struct Client *client_p;
+
+	RB_DLINK_FOREACH(ptr, serv_list.head)
+	{
+		client_p = ptr->data;
+		if(!IsAnyDead(client_p))
+			send_queued(client_p);
+	}
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		client_p = ptr->data;
+		if(!IsAnyDead(client_p))
+			send_queued(client_p);
+	}
+
+	exit_aborted_clients(NULL);
+}
+
+static void
+save_header(void)
+{
+	put_str(UPGRADE_MAGIC);
+	put_int(UPGRADE_VERSION);
+	put_int(sizeof(struct rb_sockaddr_storage));
+	put_int(TGCHANGE_NUM + TGCHANGE_REPLY);
+
+	put_int(stopped.tv_sec);
+	put_int(stopped.tv_usec);
+	put_int(startup_time);
+	put_int(Count.max_loc);
+	put_int(Count.max_tot);
+	put_int(Count.totalrestartcount);
+	put_int(MaxClientCount);
+	put_int(MaxConnectionCount);
+}
+
+static void
+save_listener(void *unused, struct Listener *listener)
+{
+	put_tag(TAG_LISTENER);
+	put_int(rb_get_fd(listener->F));
+	put_int(rb_get_type(listener->F));
+	put_buf(listener->addr, sizeof(listener->addr));
+	put_int(listener->ssl);
+	put_int(listener->defer_accept);
+	put_int(listener->sctp);
+
+	rb_clear_cloexec(listener->F);
+}
+
+static void
+save_ssld(void *unused, rb_fde_t *F, rb_fde_t *P, pid_t pid, bool shutdown, const char *version)
+{
+	put_tag(TAG_SSLD);
+	put_int(rb_get_fd(F));
+	put_int(rb_get_fd(P));
+	put_int(pid);
+	put_int(shutdown);
+	put_str(version);
+
+	rb_clear_cloexec(F);
+	rb_clear_cloexec(P);
+}
+
+/* what every server and user has; whether it is ours and where it is
+ * come first, as they are needed to make the client
+ */
+static void
+save_client(struct Client *client_p)
+{
+	put_int(MyConnect(client_p) ? 1 : 0);
+	put_str(use_id(client_p->servptr));
+
+	put_str(client_p->name);
+	put_str(client_p->id);
+	put_str(client_p->username);
+	put_str(client_p->host);
+	put_str(client_p->orighost);
+	put_str(client_p->sockhost);
+	put_str(client_p->info);
+	put_int(client_p->tsinfo);
+	put_int(client_p->flags & ~(FLAGS_MARK | FLAGS_DEAD | FLAGS_IOERROR));
+	put_int(client_p->hopcount);
+	put_int(client_p->first_received_message_time);
+	put_int(client_p->received_number_of_privmsgs);
+	put_int(client_p->flood_noticed);
+	put_int(client_p->large_ctcp_sent);
+	put_str(client_p->certfp);
+}
+
+/* the connection itself, for servers and users alike */
+static void
+save_local(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+	rb_dlink_node *ptr;
+
+	put_int(rb_get_fd(lc->F));
+	put_int(rb_get_type(lc->F));
+	put_int(ssld_handoff_pid(lc->ssl_ctl));
+	put_int(rb_dlink_list_length(&lc->connids));
+	RB_DLINK_FOREACH(ptr, lc->connids.head)
+		put_int(RB_POINTER_TO_UINT(ptr->data));
+	put_buf(&lc->ip, sizeof(lc->ip));
+	put_int(lc->listener != NULL && lc->listener->F != NULL ? rb_get_fd(lc->listener->F) : -1);
+
+	put_int(lc->firsttime);
+	put_int(lc->lasttime);
+	put_int(lc->last);
+	/* a corked socket stays corked across exec, and is uncorked as usual */
+	put_int(lc->localflags & ~(LFLAGS_FLUSH | LFLAGS_DEFERRED | LFLAGS_READWRITE));
+	/* kilobytes and the bytes left over, as version 1 always had them */
+	put_int(lc->sendM);
+	put_int(lc->sendB >> 10);
+	put_int(lc->receiveM);
+	put_int(lc->receiveB >> 10);
+	put_int(lc->sendB & 0x3ff);
+	put_int(lc->receiveB & 0x3ff);
+	put_int(lc->sent_parsed);
+	put_str(lc->cipher_string);
+
+	save_sendq(&lc->buf_sendq_control);
+	save_sendq(&lc->buf_sendq);
+	save_sendq(&lc->buf_sendq_bulk);
+	put_int(lc->sendq_bulk_wait);
+	put_int(lc->sendq_barrier);
+
+	if(lc->recvq != NULL)
+		put_buf(lc->recvq + lc->recvq_start, lc->recvq_end - lc->recvq_start);
+	else
+		put_buf(NULL, 0);
+	put_int(lc->recvq_overflow);
+
+	rb_clear_cloexec(lc->F);
+}
+
+static void
+save_server(struct Client *client_p)
+{
+	put_tag(TAG_SERVER);
+	save_client(client_p);
+
+	put_str(client_p->serv->by);
+	put_caps(serv_capindex, client_p->serv->caps);
+	put_str(client_p->serv->fullcaps);
+
+	if(MyConnect(client_p))
+		save_local(client_p);
+}
+
+static void
+save_user(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+	struct User *user = client_p->user;
+	struct ConfItem *aconf;
+	struct monitor *monptr;
+	rb_dlink_node *ptr;
+	int i;
+
+	put_tag(TAG_USER);
+	save_client(client_p);
+
+	put_str(mode_letters(user_modes, client_p->umodes));
+	put_str(user->suser);
+	put_str(user->away);
+	put_str(user->opername);
+	put_str(user->privset != NULL ? user->privset->name : NULL);
+
+	if(!MyConnect(client_p))
+		return;
+
+	save_local(client_p);
+
+	/* the auth{} block is found again by its masks */
+	aconf = lc->att_conf;
+	put_str(aconf != NULL ? aconf->host : NULL);
+	put_str(aconf != NULL ? aconf->user : NULL);
+
+	put_caps(cli_capindex, lc->caps);
+	put_str(construct_snobuf(client_p->snomask));
+	put_str(lc->mangledhost);
+
+	put_int(lc->last_join_time);
+	put_int(lc->last_leave_time);
+	put_int(lc->join_leave_count);
+	put_int(lc->oper_warn_count_down);
+	put_int(lc->last_caller_id_time);
+	put_int(lc->last_nick_change);
+	put_int(lc->number_of_nick_changes);
+	put_int(lc->next_away);
+	put_int(lc->last_knock);
+	put_int(lc->ratelimit);
+	put_int(lc->join_who_credits);
+
+	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+		put_int(lc->targets[i]);
+	put_int(lc->targets_free);
+	put_int(lc->target_last);
+
+	put_int(rb_dlink_list_length(&lc->monitor_list));
+	RB_DLINK_FOREACH(ptr, lc->monitor_list.head)
+	{
+		monptr = ptr->data;
+		put_str(monptr->name);
+	}
+}
+
+static void
+save_bans(rb_dlink_list *list)
+{
+	rb_dlink_node *ptr;
+	struct Ban *banptr;
+
+	/* tail first, so adding each at the head restores the order */
+	put_int(rb_dlink_list_length(list));
+	RB_DLINK_FOREACH_PREV(ptr, list->tail)
+	{
+		banptr = ptr->data;
+		put_str(banptr->banstr);
+		put_str(banptr->who);
+		put_str(banptr->forward);
+		put_int(banptr->when);
+	}
+}
+
+static void
+save_channel(struct Channel *chptr)
+{
+	struct membership *msptr;
+	rb_dlink_node *ptr;
+
+	put_tag(TAG_CHANNEL);
+	put_str(chptr->chname);
+	put_int(chptr->channelts);
+
+	put_str(mode_letters(chmode_flags, chptr->mode.mode));
+	put_int(chptr->mode.limit);
+	put_str(chptr->mode.key);
+	put_int(chptr->mode.join_num);
+	put_int(chptr->mode.join_time);
+	put_str(chptr->mode.forward);
+	put_str(chptr->mode_lock);
+
+	put_str(chptr->topic);
+	put_str(chptr->topic_info);
+	put_int(chptr->topic_time);
+	put_int(chptr->last_knock);
+
+	save_bans(&chptr->banlist);
+	save_bans(&chptr->exceptlist);
+	save_bans(&chptr->invexlist);
+	save_bans(&chptr->quietlist);
+
+	put_int(rb_dlink_list_length(&chptr->members));
+	RB_DLINK_FOREACH_PREV(ptr, chptr->members.tail)
+	{
+		msptr = ptr->data;
+		put_str(use_id(msptr->client_p));
+		put_int(msptr->flags);
+	}
+
+	put_int(rb_dlink_list_length(&chptr->invites));
+	RB_DLINK_FOREACH(ptr, chptr->invites.head)
+		put_str(use_id((struct Client *)ptr->data));
+}
+
+static void
+save_state(void)
+{
+	struct Client *client_p, *target_p;
+	rb_dlink_node *ptr, *aptr;
+
+	save_header();
+
+	listener_foreach(save_listener, NULL);
+	ssld_foreach_handoff(save_ssld, NULL);
+	put_tag(TAG_HELPERS_END);
+
+	/* oldest first, so every server's uplink is there before it */
+	RB_DLINK_FOREACH(ptr, global_serv_list.head)
+	{
+		client_p = ptr->data;
+		if(!IsMe(client_p))
+			save_server(client_p);
+	}
+
+	RB_DLINK_FOREACH(ptr, global_client_list.head)
+	{
+		client_p = ptr->data;
+		if(IsClient(client_p))
+			save_user(client_p);
+	}
+
+	RB_DLINK_FOREACH_PREV(ptr, global_channel_list.tail)
+		save_channel(ptr->data);
+
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+	{
+		client_p = ptr->data;
+		RB_DLINK_FOREACH(aptr, client_p->localClient->allow_list.head)
+		{
+			target_p = aptr->data;
+			put_tag(TAG_ALLOW);
+			put_str(use_id(client_p));
+			put_str(use_id(target_p));
+		}
+	}
+
+	put_tag(TAG_END);
+}
+
+/*
+ * upgrade_save - write the snapshot of everything to f
+ *
+ * inputs	- stream to write to
+ * outputs	- false if any of it could not be written
+ * side effects - the fds of everything saved are kept open across exec
+ */
+bool
+upgrade_save(FILE *f)
+{
+	bool written;
+
+	snap = f;
+	snap_failed = false;
+	save_state();
+	written = !snap_failed && fflush(f) == 0;
+	snap = NULL;
+
+	return written;
+}
+
+/*
+ * upgrade - hand everything over to a fresh copy of the ircd binary
+ *
+ * inputs	- none
+ * outputs	- only returns if the upgrade failed, with the reason
+ * side effects - connections that can't be handed over are closed, and
+ *		  if all goes well this process is replaced
+ */
+const char *
+upgrade(void)
+{
+	static char errbuf[BUFSIZE];
+	char fdbuf[16];
+	FILE *f;
+	long size;
+	bool written;
+	int fd, wfd;
+
+	if(!ssld_handoff_ready())
+		return "an ssld helper has commands waiting to be sent, try again";
+
+	fd = create_snapshot();
+	if(fd < 0)
+	{
+		snprintf(errbuf, sizeof(errbuf), "cannot create the snapshot: %s", strerror(errno));
+		return errbuf;
+	}
+
+	wfd = dup(fd);
+	f = wfd >= 0 ? fdopen(wfd, "w") : NULL;
+	if(f == NULL)
+	{
+		snprintf(errbuf, sizeof(errbuf), "cannot open the snapshot: %s", strerror(errno));
+		if(wfd >= 0)
+			close(wfd);
+		close(fd);
+		return errbuf;
+	}
+
+	/* from here until the new process is running, nobody is served */
+	rb_set_time();
+	stopped = *rb_current_time_tv();
+
+	exit_aborted_clients(NULL);
+	drop_unhandled();
+	flush_all();
+	flush_all();
+
+	set_all_cloexec();
+	written = upgrade_save(f);
+
+	size = ftell(f);
+	if(fclose(f) != 0)
+		written = false;
+
+	if(!written)
+	{
+		snprintf(errbuf, sizeof(errbuf), "cannot write the snapshot: %s", strerror(errno));
+		close(fd);
+		return errbuf;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	fcntl(fd, F_SETFD, 0);
+	snprintf(fdbuf, sizeof(fdbuf), "%d", fd);
+	rb_setenv(UPGRADE_FD_ENV, fdbuf, 1);
+
+	ilog(L_MAIN, "Upgrading: saved %ld bytes of state, executing %s",
+			size, ircd_paths[IRCD_PATH_IRCD_EXEC]);
+
+	execv(ircd_paths[IRCD_PATH_IRCD_EXEC], (void *)myargv);
+
+	snprintf(errbuf, sizeof(errbuf), "cannot execute %s: %s",
+			ircd_paths[IRCD_PATH_IRCD_EXEC], strerror(errno));
+	unsetenv(UPGRADE_FD_ENV);
+	set_all_cloexec();
+	close(fd);
+	return errbuf;
+}
+
+/*
+ * upgrade_abort - the snapshot can't be used; everything we were handed
+ * is closed by an ordinary restart
+ */
+static void __attribute__((noreturn))
+upgrade_abort(void)
+{
+	ilog(L_MAIN, "Upgrade snapshot is unusable, restarting instead");
+	server_reboot();
+}
+
+/*
+ * upgrade_pending - whether we were started by an upgrade
+ */
+bool
+upgrade_pending(void)
+{
+	const char *fdstr = getenv(UPGRADE_FD_ENV);
+
+	if(fdstr == NULL)
+		return false;
+
+	upgrade_fd = atoi(fdstr);
+	unsetenv(UPGRADE_FD_ENV);
+
+	return upgrade_fd > 2;
+}
+
+static void
+restore_header(void)
+{
+	char *magic = get_strdup();
+
+	if(magic == NULL || strcmp(magic, UPGRADE_MAGIC) ||
+			get_int() != UPGRADE_VERSION ||
+			get_int() != sizeof(struct rb_sockaddr_storage) ||
+			get_int() != TGCHANGE_NUM + TGCHANGE_REPLY)
+		snap_failed = true;
+	rb_free(magic);
+
+	stopped.tv_sec = get_int();
+	stopped.tv_usec = get_int();
+	saved_startup_time = get_int();
+	saved_count.max_loc = get_int();
+	saved_count.max_tot = get_int();
+	saved_count.totalrestartcount = get_int();
+	saved_max_clients = get_int();
+	saved_max_connections = get_int();
+}
+
+static void
+restore_listener(void)
+{
+	struct rb_sockaddr_storage addr[2];
+	int fd, type, ssl, defer_accept;
+	bool sctp;
+
+	fd = get_int();
+	type = get_int();
+	get_fixed(addr, sizeof(addr));
+	ssl = get_int();
+	defer_accept = get_int();
+	sctp = get_int();
+
+	if(!snap_failed)
+		adopt_listener(fd, type, addr, ssl, defer_accept, sctp);
+}
+
+static void
+restore_ssld(void)
+{
+	rb_fde_t *F, *P;
+	int fd, pfd;
+	pid_t pid;
+	bool shutdown;
+	char *version;
+
+	fd = get_int();
+	pfd = get_int();
+	pid = get_int();
+	shutdown = get_int();
+	version = get_strdup();
+
+	if(!snap_failed)
+	{
+		F = rb_open(fd, RB_FD_SOCKET, "SSL/TLS handle passing socket");
+		P = rb_open(pfd, RB_FD_PIPE, "SSL/TLS pipe");
+		rb_set_nb(F);
+		rb_set_nb(P);
+		adopt_ssld(F, P, pid, shutdown, version != NULL ? version : "");
+	}
+	rb_free(version);
+}
+
+/*
+ * upgrade_restore_helpers - take over the listeners and ssld helpers,
+ * before the conf is read and would open its own
+ */
+void
+upgrade_restore_helpers(void)
+{
+	int tag;
+
+	snap = fdopen(upgrade_fd, "r");
+	if(snap == NULL)
+		upgrade_abort();
+	fcntl(upgrade_fd, F_SETFD, FD_CLOEXEC);
+
+	restore_header();
+	while(!snap_failed && (tag = get_tag()) != TAG_HELPERS_END)
+	{
+		switch(tag)
+		{
+		case TAG_LISTENER:
+			restore_listener();
+			break;
+		case TAG_SSLD:
+			restore_ssld();
+			break;
+		default:
+			snap_failed = true;
+			break;
+		}
+	}
+
+	if(snap_failed)
+		upgrade_abort();
+}
+
+static struct Listener *listener_found;
+
+static void
+find_listener_fd(void *data, struct Listener *listener)
+{
+	if(rb_get_fd(listener->F) == *(int *)data)
+		listener_found = listener;
+}
+
+static struct Client *
+restore_client(void)
+{
+	struct Client *client_p, *servptr;
+	char uplink[IDLEN];
+	bool local;
+
+	local = get_int();
+	get_str(uplink, sizeof(uplink));
+
+	servptr = find_id(uplink);
+	if(snap_failed || servptr == NULL || (!IsServer(servptr) && !IsMe(servptr)))
+	{
+		snap_failed = true;
+		return NULL;
+	}
+
+	client_p = make_client(local ? NULL : servptr->from);
+	client_p->servptr = servptr;
+
+	get_str(client_p->name, sizeof(client_p->name));
+	get_str(client_p->id, sizeof(client_p->id));
+	get_str(client_p->username, sizeof(client_p->username));
+	get_str(client_p->host, sizeof(client_p->host));
+	get_str(client_p->orighost, sizeof(client_p->orighost));
+	get_str(client_p->sockhost, sizeof(client_p->sockhost));
+	get_str(client_p->info, sizeof(client_p->info));
+	client_p->tsinfo = get_int();
+	client_p->flags = get_int();
+	client_p->hopcount = get_int();
+	client_p->first_received_message_time = get_int();
+	client_p->received_number_of_privmsgs = get_int();
+	client_p->flood_noticed = get_int();
+	client_p->large_ctcp_sent = get_int();
+	client_p->certfp = get_strdup();
+
+	return client_p;
+}
+
+static void
+restore_local(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+	int fd, type, listener_fd, count;
+	char *recvq;
+	size_t len;
+	pid_t pid;
+	uint32_t id;
+
+	fd = get_int();
+	type = get_int();
+	pid = get_int();
+	for(count = get_int(); count > 0 && !snap_failed; count--)
+	{
+		id = get_int();
+		add_to_cli_connid_hash(client_p, id);
+		rb_dlinkAddAlloc(RB_UINT_TO_POINTER(id), &lc->connids);
+	}
+	get_fixed(&lc->ip, sizeof(lc->ip));
+	listener_fd = get_int();
+
+	lc->firsttime = get_int();
+	lc->lasttime = get_int();
+	lc->last = get_int();
+	lc->localflags = get_int();
+	lc->sendM = get_int();
+	lc->sendB = (uint64_t)get_int() << 10;
+	lc->receiveM = get_int();
+	lc->receiveB = (uint64_t)get_int() << 10;
+	lc->sendB += get_int();
+	lc->receiveB += get_int();
+	lc->sent_parsed = get_int();
+	lc->cipher_string = get_strdup();
+
+	restore_sendq(&lc->buf_sendq_control);
+	restore_sendq(&lc->buf_sendq);
+	restore_sendq(&lc->buf_sendq_bulk);
+	lc->sendq_bulk_wait = get_int();
+	lc->sendq_barrier = get_int();
+
+	recvq = get_buf(&len);
+	if(len > 0)
+	{
+		lc->recvq_size = len + READBUF_SIZE;
+		lc->recvq = rb_realloc(recvq, lc->recvq_size);
+		lc->recvq_end = len;
+	}
+	else
+		rb_free(recvq);
+	lc->recvq_overflow = get_int();
+
+	if(snap_failed)
+		return;
+
+	lc->F = rb_open(fd, type, "Restored connection");
+	if(lc->F == NULL)
+	{
+		snap_failed = true;
+		return;
+	}
+	rb_set_nb(lc->F);
+
+	if(pid != 0 && (lc->ssl_ctl = ssld_adopt_client(pid)) == NULL)
+		rb_dlinkAddAlloc(client_p, &drop_list);
+
+	if(listener_fd >= 0)
+	{
+		listener_found = NULL;
+		listener_foreach(find_listener_fd, &listener_fd);
+		if(listener_found != NULL)
+		{
+			lc->listener = listener_found;
+			lc->listener->ref_count++;
+		}
+	}
+}
+
+static bool
+restore_server(void)
+{
+	struct Client *client_p;
+	struct server_conf *server_p;
+
+	if((client_p = restore_client()) == NULL)
+		return false;
+
+	make_server(client_p);
+	get_str(client_p->serv->by, sizeof(client_p->serv->by));
+	client_p->serv->caps = get_caps(serv_capindex);
+	client_p->serv->fullcaps = get_strdup();
+
+	if(MyConnect(client_p))
+		restore_local(client_p);
+	if(snap_failed)
+		return false;
+
+	SetServer(client_p);
+	rb_dlinkAddTail(client_p, &client_p->node, &global_client_list);
+	rb_dlinkAddTailAlloc(client_p, &global_serv_list);
+	add_to_client_hash(client_p->name, client_p);
+	if(has_id(client_p))
+		add_to_id_hash(client_p->id, client_p);
+	rb_dlinkAdd(client_p, &client_p->lnode, &client_p->servptr->serv->servers);
+	client_p->serv->nameinfo = scache_connect(client_p->name, client_p->info, IsHidden(client_p));
+
+	if(MyConnect(client_p))
+	{
+		rb_dlinkMoveNode(&client_p->localClient->tnode, &unknown_list, &serv_list);
+		free_pre_client(client_p);
+
+		if((server_p = find_server_conf(client_p->name)) != NULL)
+			attach_server_conf(client_p, server_p);
+		else
+			rb_dlinkAddAlloc(client_p, &drop_list);
+	}
+
+	return true;
+}
+
+static void
+restore_local_user(struct Client *client_p)
+{
+	struct LocalUser *lc = client_p->localClient;
+	struct ConfItem *aconf = NULL;
+	struct monitor *monptr;
+	char *host, *user, *snomask, *name;
+	const char *notildeuser;
+	int i, count;
+
+	restore_local(client_p);
+
+	host = get_strdup();
+	user = get_strdup();
+
+	lc->caps = get_caps(cli_capindex);
+	snomask = get_strdup();
+	client_p->snomask = parse_snobuf_to_mask(0, snomask != NULL ? snomask : "");
+	rb_free(snomask);
+	lc->mangledhost = get_strdup();
+
+	lc->last_join_time = get_int();
+	lc->last_leave_time = get_int();
+	lc->join_leave_count = get_int();
+	lc->oper_warn_count_down = get_int();
+	lc->last_caller_id_time = get_int();
+	lc->last_nick_change = get_int();
+	lc->number_of_nick_changes = get_int();
+	lc->next_away = get_int();
+	lc->last_knock = get_int();
+	lc->ratelimit = get_int();
+	lc->join_who_credits = get_int();
+
+	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+		lc->targets[i] = get_int();
+	lc->targets_free = get_int();
+	lc->target_last = get_int();
+	rebuild_target_filter(client_p);
+
+	for(count = get_int(); count > 0 && !snap_failed; count--)
+	{
+		if((name = get_strdup()) == NULL)
+			continue;
+		monptr = find_monitor(name, 1);
+		rb_dlinkAddAlloc(client_p, &monptr->users);
+		rb_dlinkAddAlloc(monptr, &lc->monitor_list);
+		rb_free(name);
+	}
+
+	if(!snap_failed)
+	{
+		/* the block they came in on, or failing that whatever they
+		 * would match now
+		 */
+		if(host != NULL && user != NULL)
+			aconf = find_exact_conf_by_address(host, CONF_CLIENT, user);
+
+		if(aconf == NULL)
+		{
+			notildeuser = client_p->username;
+			if(*notildeuser == '~')
+				notildeuser++;
+			aconf = find_address_conf(client_p->orighost, client_p->sockhost,
+					client_p->username, notildeuser,
+					(struct sockaddr *)&lc->ip, GET_SS_FAMILY(&lc->ip), NULL);
+		}
+
+		if(aconf == NULL || !(aconf->status & CONF_CLIENT) || attach_conf(client_p, aconf) != 0)
+			rb_dlinkAddAlloc(client_p, &drop_list);
+	}
+
+	rb_free(host);
+	rb_free(user);
+}
+
+static bool
+restore_user(void)
+{
+	struct Client *client_p;
+	struct User *user;
+	unsigned int umodes;
+	char *privset;
+
+	if((client_p = restore_client()) == NULL)
+		return false;
+
+	user = make_user(client_p);
+	umodes = get_mode_letters(user_modes);
+	get_str(user->suser, sizeof(user->suser));
+	user->away = get_strdup();
+	user->opername = get_strdup();
+	privset = get_strdup();
+
+	if(MyConnect(client_p))
+		restore_local_user(client_p);
+
+	if(privset != NULL)
+	{
+		user->privset = privilegeset_get(privset);
+		if(user->privset == NULL)
+		{
+			/* as for a remote OPER with a privset we don't know */
+			user->privset = privilegeset_set_new(privset, "", 0);
+			user->privset->status |= CONF_ILLEGAL;
+		}
+		privilegeset_ref(user->privset);
+		rb_free(privset);
+	}
+
+	if(snap_failed)
+		return false;
+
+	client_p->umodes = umodes;
+
+	rb_dlinkAddTail(client_p, &client_p->node, &global_client_list);
+	add_to_client_hash(client_p->name, client_p);
+	add_to_id_hash(client_p->id, client_p);
+	add_to_hostname_hash(client_p->orighost, client_p);
+	rb_dlinkAdd(client_p, &client_p->lnode, &client_p->servptr->serv->users);
+
+	Count.total++;
+	if(IsInvisible(client_p))
+		Count.invisi++;
+	if(IsOper(client_p))
+	{
+		Count.oper++;
+		rb_dlinkAddAlloc(client_p, &oper_list);
+		if(MyConnect(client_p))
+			rb_dlinkAddAlloc(client_p, &local_oper_list);
+	}
+
+	if(MyConnect(client_p))
+	{
+		rb_dlinkMoveNode(&client_p->localClient->tnode, &unknown_list, &lclient_list);
+		SetClient(client_p);
+		free_pre_client(client_p);
+	}
+	else
+		SetRemoteClient(client_p);
+
+	return true;
+}
+
+static void
+restore_bans(rb_dlink_list *list)
+{
+	struct Ban *banptr;
+	char *banstr, *who, *forward;
+	int count;
+
+	for(count = get_int(); count > 0 && !snap_failed; count--)
+	{
+		banstr = get_strdup();
+		who = get_strdup();
+		forward = get_strdup();
+
+		if(banstr != NULL && who != NULL)
+		{
+			banptr = allocate_ban(banstr, who, forward);
+			banptr->when = get_int();
+			rb_dlinkAdd(banptr, &banptr->node, list);
+		}
+		else
+			get_int();
+
+		rb_free(banstr);
+		rb_free(who);
+		rb_free(forward);
+	}
+}
+
+static bool
+restore_channel(void)
+{
+	struct Channel *chptr;
+	struct Client *client_p;
+	char *name, *topic, *topic_info;
+	char id[IDLEN];
+	int count, flags;
+
+	name = get_strdup();
+	if(name == NULL)
+	{
+		snap_failed = true;
+		return false;
+	}
+	chptr = get_or_create_channel(&me, name, NULL);
+	rb_free(name);
+
+	chptr->channelts = get_int();
+	chptr->mode.mode = get_mode_letters(chmode_flags);
+	chptr->mode.limit = get_int();
+	get_str(chptr->mode.key, sizeof(chptr->mode.key));
+	chptr->mode.join_num = get_int();
+	chptr->mode.join_time = get_int();
+	get_str(chptr->mode.forward, sizeof(chptr->mode.forward));
+	chptr->mode_lock = get_strdup();
+
+	topic = get_strdup();
+	topic_info = get_strdup();
+	chptr->topic_time = get_int();
+	if(topic != NULL)
+		set_channel_topic(chptr, topic, topic_info != NULL ? topic_info : "", chptr->topic_time);
+	rb_free(topic);
+	rb_free(topic_info);
+	chptr->last_knock = get_int();
+
+	restore_bans(&chptr->banlist);
+	restore_bans(&chptr->exceptlist);
+	restore_bans(&chptr->invexlist);
+	restore_bans(&chptr->quietlist);
+
+	for(count = get_int(); count > 0 && !snap_failed; count--)
+	{
+		get_str(id, sizeof(id));
+		flags = get_int();
+		if((client_p = find_id(id)) != NULL && IsClient(client_p))
+			add_user_to_channel(chptr, client_p, flags);
+	}
+
+	for(count = get_int(); count > 0 && !snap_failed; count--)
+	{
+		get_str(id, sizeof(id));
+		if((client_p = find_id(id)) != NULL && MyClient(client_p))
+		{
+			rb_dlinkAddAlloc(client_p, &chptr->invites);
+			rb_dlinkAddAlloc(chptr, &client_p->user->invited);
+		}
+	}
+
+	return !snap_failed;
+}
+
+static void
+restore_allow(void)
+{
+	struct Client *client_p, *target_p;
+	char id[IDLEN], target[IDLEN];
+
+	get_str(id, sizeof(id));
+	get_str(target, sizeof(target));
+
+	client_p = find_id(id);
+	target_p = find_id(target);
+	if(client_p != NULL && MyClient(client_p) && target_p != NULL && IsClient(target_p))
+	{
+		rb_dlinkAddAlloc(target_p, &client_p->localClient->allow_list);
+		rb_dlinkAddAlloc(client_p, &target_p->on_allow_list);
+	}
+}
+
+static void
+resume_connections(rb_dlink_list *list)
+{
+	rb_dlink_node *ptr;
+	struct Client *client_p;
+
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		client_p = ptr->data;
+		rb_setselect(client_p->localClient->F, RB_SELECT_READ, read_packet, client_p);
+		if(sendq_length(client_p) > 0)
+			send_queued(client_p);
+	}
+}
+
+/*
+ * upgrade_restore - rebuild servers, users and channels from the
+ * snapshot and pick up where the old process left off
+ */
+void
+upgrade_restore(void)
+{
+	rb_dlink_node *ptr, *next;
+	struct Client *client_p;
+	const struct timeval *now;
+	int servers = 0, users = 0, channels = 0, tag;
+	long size, msec;
+
+	while(!snap_failed && (tag = get_tag()) != TAG_END)
+	{
+		switch(tag)
+		{
+		case TAG_SERVER:
+			servers += restore_server();
+			break;
+		case TAG_USER:
+			users += restore_user();
+			break;
+		case TAG_CHANNEL:
+			channels += restore_channel();
+			break;
+		case TAG_ALLOW:
+			restore_allow();
+			break;
+		default:
+			snap_failed = true;
+			break;
+		}
+	}
+
+	if(snap_failed)
+		upgrade_abort();
+
+	size = ftell(snap);
+	fclose(snap);
+	snap = NULL;
+
+	startup_time = saved_startup_time;
+	Count.max_loc = saved_count.max_loc;
+	Count.max_tot = saved_count.max_tot;
+	Count.totalrestartcount = saved_count.totalrestartcount;
+	MaxClientCount = saved_max_clients;
+	MaxConnectionCount = saved_max_connections;
+
+	resume_connections(&serv_list);
+	resume_connections(&lclient_list);
+
+	RB_DLINK_FOREACH_SAFE(ptr, next, drop_list.head)
+	{
+		client_p = ptr->data;
+		rb_dlinkDestroy(ptr, &drop_list);
+		if(!IsAnyDead(client_p))
+			exit_client(client_p, client_p, &me, "Server upgrading");
+	}
+
+	rb_set_time();
+	now = rb_current_time_tv();
+	msec = (now->tv_sec - stopped.tv_sec) * 1000 + (now->tv_usec - stopped.tv_usec) / 1000;
+
+	ilog(L_MAIN, "Upgrade complete: %d servers, %d users and %d channels restored from %ld bytes, "
+			"serving again %ld ms after stopping", servers, users, channels, size, msec);
+	sendto_realops_snomask(SNO_GENERAL, L_ALL,
+			"Upgrade complete: %d servers, %d users and %d channels restored from %ld bytes, "
+			"serving again %ld ms after stopping", servers, users, channels, size, msec);
+}
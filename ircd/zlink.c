@@ -0,0 +1,374 @@
+/*
+ * Comet: a slightly advanced ircd
+ * zlink.c: compressed server links
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * A link that both ends have configured as compressed, and that both
+ * sent ZLIB in CAPAB for, carries a zlib stream in each direction from
+ * just after each side's SERVER line.  Both streams start with a preset
+ * dictionary of the strings TS6 lines are made of, so even the first
+ * lines of a burst compress well.  Each write is a sync flush, so the
+ * other side can always parse everything it has been sent.
+ */
+
+#include "stdinc.h"
+#include "zlink.h"
+
+#include <zlib.h>
+
+#define ZLINK_CHUNK	16384
+
+/*
+ * The strings bursts and steady traffic are mostly made of.  Matches
+ * nearer the end of the dictionary take fewer bits, so the commonest
+ * strings come last.  Changing it makes links to older servers fail
+ * with a dictionary mismatch, so don't.
+ */
+static const char zlink_dictionary[] =
+	"SVINFO 6 6 0 :\r\n"
+	" ENCAP * GCAP :"
+	" ENCAP * SNOTE "
+	" ENCAP * OPERSPY "
+	" ENCAP * CHGHOST "
+	" ENCAP * REALHOST "
+	" ENCAP * CERTFP :"
+	" ENCAP * IDENTIFIED "
+	" ENCAP * LOGIN "
+	" ENCAP * SU "
+	" ENCAP * RSMSG "
+	" WALLOPS :"
+	" OPERWALL :"
+	" KLINE "
+	" BAN K "
+	" SID "
+	" SERVER "
+	" EOB\r\n"
+	" SQUIT "
+	" KILL "
+	" INVITE "
+	" KNOCK "
+	" TB "
+	" TOPIC "
+	" MLOCK "
+	" BMASK "
+	" b :*!*@"
+	" e :"
+	" I :"
+	" q :"
+	" WHOIS "
+	" PING "
+	" PONG "
+	" PART "
+	" KICK "
+	" AWAY\r\n"
+	" AWAY :"
+	" QUIT :Quit: "
+	" QUIT :Ping timeout: 240 seconds\r\n"
+	" QUIT :Read error: Connection reset by peer\r\n"
+	" NICK "
+	" MODE "
+	" TMODE "
+	" NOTICE "
+	" JOIN "
+	" PRIVMSG #"
+	" EUID "
+	" 1 "
+	" +i "
+	" +iw "
+	" +Zi "
+	" +Ziw "
+	" 0 "
+	" ~"
+	" 255.255.255.255 "
+	" 0.0.0.0 "
+	" * :"
+	" * * :"
+	" SJOIN "
+	" +nt :"
+	" +Cnt :"
+	" +nst :"
+	" +cnt :"
+	" +ntr :"
+	" @+"
+	" @"
+	" :"
+	"\r\n:";
+
+struct zlink
+{
+	z_stream out;
+	z_stream in;
+	rawbuf_head_t *sendq;	/* compressed, waiting to be written */
+	char *pending;		/* compressed input read before we knew */
+	bool inflating;
+	bool unflushed;		/* deflated since the last sync flush */
+	bool inflate_full;	/* the last inflate() may have more to give */
+	bool failed;
+	const char *error;
+	struct zlink_stats stats;
+};
+
+static uLong zlink_dictionary_id;
+
+struct zlink *
+zlink_new(int level)
+{
+	struct zlink *z = rb_malloc(sizeof(struct zlink));
+
+	if(level < 1 || level > 9)
+		level = ZLINK_DEFAULT_LEVEL;
+
+	if(deflateInit(&z->out, level) != Z_OK)
+	{
+		rb_free(z);
+		return NULL;
+	}
+
+	if(inflateInit(&z->in) != Z_OK)
+	{
+		deflateEnd(&z->out);
+		rb_free(z);
+		return NULL;
+	}
+
+	deflateSetDictionary(&z->out, (const Bytef *)zlink_dictionary,
+			sizeof(zlink_dictionary) - 1);
+
+	if(zlink_dictionary_id == 0)
+		zlink_dictionary_id = adler32(adler32(0, NULL, 0),
+				(const Bytef *)zlink_dictionary, sizeof(zlink_dictionary) - 1);
+
+	z->sendq = rb_new_rawbuffer();
+	z->stats.level = level;
+	return z;
+}
+
+void
+zlink_free(struct zlink *z)
+{
+	if(z == NULL)
+		return;
+
+	deflateEnd(&z->out);
+	inflateEnd(&z->in);
+	rb_free_rawbuffer(z->sendq);
+	rb_free(z->pending);
+	rb_free(z);
+}
+
+bool
+zlink_inflating(struct zlink *z)
+{
+	return z->inflating;
+}
+
+void
+zlink_set_inflating(struct zlink *z)
+{
+	z->inflating = true;
+}
+
+/*
+ * zlink_set_pending - keep compressed input that arrived in the same
+ * read as the line that started compression, to be inflated once the
+ * caller can take the output
+ */
+void
+zlink_set_pending(struct zlink *z, const char *buf, unsigned int len)
+{
+	if(len == 0)
+		return;
+
+	z->pending = rb_malloc(len);
+	memcpy(z->pending, buf, len);
+	zlink_input(z, z->pending, len);
+}
+
+bool
+zlink_input_pending(struct zlink *z)
+{
+	return z->pending != NULL;
+}
+
+/*
+ * zlink_input - give zlink_inflate() data to work on; it must stay put
+ * until zlink_inflate() has returned 0
+ */
+void
+zlink_input(struct zlink *z, const char *buf, unsigned int len)
+{
+	z->in.next_in = (Bytef *)buf;
+	z->in.avail_in = len;
+}
+
+/*
+ * zlink_inflate - inflate as much of the input as fits in buf
+ *
+ * Returns the length inflated, 0 once all the input has been used,
+ * or -1 if the stream is broken, with zlink_error() saying why.
+ */
+int
+zlink_inflate(struct zlink *z, char *buf, unsigned int len)
+{
+	unsigned int avail;
+	int ret;
+
+	if(z->failed)
+		return -1;
+
+	/* the CR LF after the line that started it may come separately */
+	while(z->in.total_in == 0 && z->in.avail_in > 0 &&
+			(*z->in.next_in == '\r' || *z->in.next_in == '\n'))
+	{
+		z->in.next_in++;
+		z->in.avail_in--;
+	}
+
+	/* inflate() can use up the input and still have the rest of a
+	 * match to write when it fills the buffer, so keep asking
+	 */
+	while(z->in.avail_in > 0 || z->inflate_full)
+	{
+		avail = z->in.avail_in;
+		z->in.next_out = (Bytef *)buf;
+		z->in.avail_out = len;
+
+		ret = inflate(&z->in, Z_SYNC_FLUSH);
+		z->stats.in += avail - z->in.avail_in;
+		z->inflate_full = z->in.avail_out == 0;
+
+		if(ret == Z_NEED_DICT)
+		{
+			if(z->in.adler != zlink_dictionary_id)
+			{
+				z->error = "dictionary mismatch";
+				z->failed = true;
+				return -1;
+			}
+			inflateSetDictionary(&z->in, (const Bytef *)zlink_dictionary,
+					sizeof(zlink_dictionary) - 1);
+			continue;
+		}
+
+		if(ret == Z_STREAM_END)
+		{
+			z->error = "stream ended";
+			z->failed = true;
+			return -1;
+		}
+
+		if(ret != Z_OK && ret != Z_BUF_ERROR)
+		{
+			z->error = z->in.msg != NULL ? z->in.msg : "inflate failed";
+			z->failed = true;
+			return -1;
+		}
+
+		if(len - z->in.avail_out > 0)
+		{
+			z->stats.in_plain += len - z->in.avail_out;
+			return len - z->in.avail_out;
+		}
+
+		if(avail == z->in.avail_in)
+			break;
+	}
+
+	rb_free(z->pending);
+	z->pending = NULL;
+	return 0;
+}
+
+const char *
+zlink_error(struct zlink *z)
+{
+	return z->error != NULL ? z->error : "unknown error";
+}
+
+static void
+zlink_run_deflate(struct zlink *z, int flush)
+{
+	static unsigned char chunk[ZLINK_CHUNK];
+	unsigned int len;
+
+	do
+	{
+		z->out.next_out = chunk;
+		z->out.avail_out = sizeof(chunk);
+
+		deflate(&z->out, flush);
+
+		len = sizeof(chunk) - z->out.avail_out;
+		if(len > 0)
+		{
+			rb_rawbuf_append(z->sendq, chunk, len);
+			z->stats.out += len;
+		}
+	}
+	while(z->out.avail_out == 0);
+}
+
+/*
+ * zlink_append - queue data to be written as it is, ahead of anything
+ * compressed after it
+ */
+void
+zlink_append(struct zlink *z, const char *buf, unsigned int len)
+{
+	rb_rawbuf_append(z->sendq, (void *)buf, len);
+}
+
+void
+zlink_deflate(struct zlink *z, const char *buf, unsigned int len)
+{
+	z->out.next_in = (Bytef *)buf;
+	z->out.avail_in = len;
+	z->stats.out_plain += len;
+	z->unflushed = true;
+
+	zlink_run_deflate(z, Z_NO_FLUSH);
+}
+
+/*
+ * zlink_deflate_flush - finish off what has been deflated so far, so
+ * the other side can inflate all of it
+ */
+void
+zlink_deflate_flush(struct zlink *z)
+{
+	if(!z->unflushed)
+		return;
+
+	z->out.next_in = NULL;
+	z->out.avail_in = 0;
+	zlink_run_deflate(z, Z_SYNC_FLUSH);
+	z->unflushed = false;
+}
+
+rawbuf_head_t *
+zlink_sendq(struct zlink *z)
+{
+	return z->sendq;
+}
+
+void
+zlink_get_stats(struct zlink *z, struct zlink_stats *stats)
+{
+	*stats = z->stats;
+}
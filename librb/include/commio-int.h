@@ -106,6 +106,7 @@ struct _fde
 	void *ssl;
 	unsigned int handshake_count;
 	unsigned long ssl_errno;
+	size_t ssl_retry_len;	/* length of a combined TLS write to retry */
 };
 
 typedef void (*comm_event_cb_t) (void *);
@@ -154,6 +155,9 @@ int rb_io_sched_event(struct ev_entry *ev, int when);
 void rb_io_unsched_event(struct ev_entry *ev);
 int rb_io_supports_event(void);
 void rb_io_init_event(void);
+void rb_loop_wakeup(int nevents);
+void rb_loop_timer_begin(void);
+void rb_loop_timer_end(void);
 
 /* epoll versions */
 void rb_setselect_epoll(rb_fde_t *F, unsigned int type, PF * handler, void *client_data);
@@ -118,6 +118,21 @@ int rb_set_nb(rb_fde_t *);
 int rb_set_cloexec(rb_fde_t *);
 int rb_clear_cloexec(rb_fde_t *);
 int rb_set_buffers(rb_fde_t *, int);
+int rb_set_sockbufs(rb_fde_t *, int rcvbuf, int sndbuf);
+int rb_set_notsent_lowat(rb_fde_t *, int);
+int rb_set_cork(rb_fde_t *, int);
+
+/* kernel side of a TCP socket, see rb_get_tcp_info() */
+struct rb_tcp_info
+{
+	unsigned int sendq;	/* bytes written but not yet acked */
+	unsigned int recvq;	/* bytes received but not yet read */
+	unsigned int unacked;	/* segments in flight */
+	unsigned int cwnd;	/* congestion window, in segments */
+	unsigned int rtt;	/* smoothed round trip time, in usec */
+};
+
+int rb_get_tcp_info(rb_fde_t *, struct rb_tcp_info *);
 
 int rb_get_sockerr(rb_fde_t *);
 
@@ -153,6 +168,7 @@ int rb_inet_pton(int af, const char *src, void *dst);
 const char *rb_inet_ntop_sock(struct sockaddr *src, char *dst, unsigned int size);
 int rb_inet_pton_sock(const char *src, struct sockaddr_storage *dst);
 int rb_getmaxconnect(void);
+int rb_getnumfds(void);
 int rb_ignore_errno(int);
 
 /* Generic wrappers */
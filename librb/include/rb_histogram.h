@@ -0,0 +1,49 @@
+/*
+ *  librb: a library used by comet and other things
+ *  rb_histogram.h: log-linear histograms for latency and size distributions
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+
+#ifndef RB_LIB_H
+# error "Do not use rb_histogram.h directly"
+#endif
+
+#ifndef INCLUDED_RB_HISTOGRAM_H__
+#define INCLUDED_RB_HISTOGRAM_H__
+
+/* Values 0-3 get a bucket each; above that every power of two is split
+ * into four buckets, so any recorded value is known to within 25%.  The
+ * last bucket also holds everything past 2^24.
+ */
+#define RB_HISTOGRAM_SUBBITS	2
+#define RB_HISTOGRAM_BUCKETS	96
+
+struct rb_histogram
+{
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+	unsigned long long buckets[RB_HISTOGRAM_BUCKETS];
+};
+
+void rb_histogram_add(struct rb_histogram *, unsigned long long value);
+void rb_histogram_reset(struct rb_histogram *);
+unsigned long long rb_histogram_percentile(const struct rb_histogram *, double pct);
+unsigned long long rb_histogram_bucket_max(int bucket);
+
+#endif
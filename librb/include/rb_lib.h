@@ -196,5 +196,21 @@ pid_t rb_getpid(void);
 #include <rb_helper.h>
 #include <rb_rawbuf.h>
 #include <rb_patricia.h>
+#include <rb_histogram.h>
+
+/* event loop health, kept by rb_lib_loop(); times are in microseconds */
+struct rb_loop_stats
+{
+	unsigned long long iterations;
+	unsigned long long wakeups;	/* iterations where the backend returned events */
+	unsigned long long wait_us;	/* total time blocked in the backend */
+	struct rb_histogram iteration;	/* whole iteration, including the wait */
+	struct rb_histogram busy;	/* iteration minus the wait: the loop lag */
+	struct rb_histogram handlers;	/* busy time outside timed events */
+	struct rb_histogram timers;	/* timed events, wherever the backend runs them */
+	struct rb_histogram events;	/* events returned per wakeup */
+};
+
+const struct rb_loop_stats *rb_lib_loop_stats(void);
 
 #endif
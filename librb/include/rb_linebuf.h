@@ -43,6 +43,7 @@ struct _buf_head;
 #define LINEBUF_DATALEN         510     /* RFC1459 message data */
 #define LINEBUF_SIZE            (8191 + 510)
 #define CRLF_LEN                2
+#define LINEBUF_COMBINE_SIZE    16384   /* most copied together per flush */
 
 typedef struct _buf_line
 {
@@ -60,6 +61,7 @@ typedef struct _buf_head
 	int alloclen;		/* Actual allocated data length */
 	int writeofs;		/* offset in the first line for the write */
 	int numlines;		/* number of lines */
+	int combine;		/* copy lines shorter than this together on flush */
 } buf_head_t;
 
 /* they should be functions, but .. */
@@ -76,6 +78,10 @@ void rb_linebuf_put(buf_head_t *, const rb_strf_t *);
 void rb_linebuf_attach(buf_head_t *, buf_head_t *);
 void rb_count_rb_linebuf_memory(size_t *, size_t *);
 int rb_linebuf_flush(rb_fde_t *F, buf_head_t *);
+void rb_linebuf_set_combine(buf_head_t *, int);
+char *rb_linebuf_find_eol(char *, size_t);
+const char *rb_linebuf_eol_scanner(void);
+int rb_linebuf_set_eol_scanner(const char *);
 
 
 #endif
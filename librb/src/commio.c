@@ -29,6 +29,7 @@
 #include <commio-ssl.h>
 #include <event-int.h>
 #include <sys/uio.h>
+#include <sys/ioctl.h>
 #define HAVE_SSL 1
 
 #ifndef MSG_NOSIGNAL
@@ -171,6 +172,15 @@ rb_getmaxconnect(void)
 	return (rb_maxconnections);
 }
 
+/*
+ * rb_getnumfds - return the number of fds currently open
+ */
+int
+rb_getnumfds(void)
+{
+	return number_fd;
+}
+
 /*
  * set_sock_buffers - set send and receive buffers for socket
  *
@@ -191,6 +201,106 @@ rb_set_buffers(rb_fde_t *F, int size)
 	return 1;
 }
 
+/*
+ * rb_set_sockbufs - set send and receive buffers separately
+ *
+ * inputs	- F to set them on
+ *		- rcvbuf, sndbuf sizes, 0 leaves that one to the kernel
+ * output	- 1 if successful, 0 otherwise
+ * side effects - a buffer that is set is no longer autotuned
+ */
+int
+rb_set_sockbufs(rb_fde_t *F, int rcvbuf, int sndbuf)
+{
+	if(F == NULL)
+		return 0;
+	if(rcvbuf > 0 && setsockopt(F->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+		return 0;
+	if(sndbuf > 0 && setsockopt(F->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)))
+		return 0;
+	return 1;
+}
+
+/*
+ * rb_set_notsent_lowat - limit the unsent data the kernel holds
+ *
+ * inputs	- F to set it on, bytes allowed unsent before the
+ *		  socket stops being writable
+ * output	- 1 if successful, 0 otherwise or if unsupported
+ */
+int
+rb_set_notsent_lowat(rb_fde_t *F, int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+	if(F == NULL || !(F->type & RB_FD_SOCKET))
+		return 0;
+	if(setsockopt(F->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes)))
+		return 0;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * rb_set_cork - hold back partial frames
+ *
+ * inputs	- F, and whether to cork (1) or uncork (0) it
+ * output	- 1 if successful, 0 otherwise or if unsupported
+ * side effects - uncorking sends whatever was held back
+ */
+int
+rb_set_cork(rb_fde_t *F, int on)
+{
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+	if(F == NULL || !(F->type & RB_FD_SOCKET))
+		return 0;
+#ifdef TCP_CORK
+	if(setsockopt(F->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)))
+#else
+	if(setsockopt(F->fd, IPPROTO_TCP, TCP_NOPUSH, &on, sizeof(on)))
+#endif
+		return 0;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * rb_get_tcp_info - what the kernel holds for a TCP socket
+ *
+ * inputs	- F, info to fill in
+ * output	- 1 if info was filled in, 0 if it is not a TCP socket
+ *		  or this platform cannot tell
+ */
+int
+rb_get_tcp_info(rb_fde_t *F, struct rb_tcp_info *info)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+	int outq, inq;
+
+	if(F == NULL || !(F->type & RB_FD_SOCKET) || (F->type & RB_FD_SCTP))
+		return 0;
+	if(getsockopt(F->fd, IPPROTO_TCP, TCP_INFO, &ti, &len))
+		return 0;
+	/* TIOCOUTQ and FIONREAD are SIOCOUTQ and SIOCINQ for sockets */
+	if(ioctl(F->fd, TIOCOUTQ, &outq) || ioctl(F->fd, FIONREAD, &inq))
+		return 0;
+
+	info->sendq = outq;
+	info->recvq = inq;
+	info->unacked = ti.tcpi_unacked;
+	info->cwnd = ti.tcpi_snd_cwnd;
+	info->rtt = ti.tcpi_rtt;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
 /*
  * set_non_blocking - Set the client connection into non-blocking mode.
  *
@@ -1267,26 +1377,39 @@ rb_write(rb_fde_t *F, const void *buf, int count)
 }
 
 #ifdef HAVE_SSL
+/*
+ * TLS has no writev, so copy the vector into one buffer and send it as
+ * a single record instead of a record per element.  A write that would
+ * block must be retried with the same buffer and length, so the length
+ * is kept until it goes; the data is still at the head of the caller's
+ * queue and copying it again gives the same bytes.
+ */
+#define RB_SSL_COMBINE_SIZE	16384	/* largest TLS record payload */
+
 static ssize_t
 rb_fake_writev(rb_fde_t *F, const struct rb_iovec *vp, size_t vpcount)
 {
-	ssize_t count = 0;
+	static char combine[RB_SSL_COMBINE_SIZE];
+	size_t len = 0, want, n;
+	ssize_t written;
 
-	while(vpcount-- > 0)
-	{
-		ssize_t written = rb_write(F, vp->iov_base, vp->iov_len);
+	/* an element too big for a record goes out on its own */
+	if(vp->iov_len >= sizeof(combine))
+		return rb_write(F, vp->iov_base, vp->iov_len);
 
-		if(written <= 0)
-		{
-			if(count > 0)
-				return count;
-			else
-				return written;
-		}
-		count += written;
-		vp++;
+	want = F->ssl_retry_len ? F->ssl_retry_len : sizeof(combine);
+	for(; vpcount > 0 && len < want; vpcount--, vp++)
+	{
+		n = vp->iov_len;
+		if(n > want - len)
+			n = want - len;
+		memcpy(combine + len, vp->iov_base, n);
+		len += n;
 	}
-	return (count);
+
+	written = rb_write(F, combine, len);
+	F->ssl_retry_len = written < 0 ? len : 0;
+	return written;
 }
 #endif
 
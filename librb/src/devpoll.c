@@ -219,6 +219,7 @@ rb_select_devpoll(long delay)
 		}
 
 		rb_set_time();
+		rb_loop_wakeup(num);
 		if(num == 0)
 			continue;
 
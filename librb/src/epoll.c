@@ -175,6 +175,7 @@ rb_select_epoll(long delay)
 	/* save errno as rb_set_time() will likely clobber it */
 	o_errno = errno;
 	rb_set_time();
+	rb_loop_wakeup(num);
 	errno = o_errno;
 
 	if(num < 0 && !rb_ignore_errno(o_errno))
@@ -197,7 +197,9 @@ void
 rb_run_one_event(struct ev_entry *ev)
 {
 	rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
+	rb_loop_timer_begin();
 	ev->func(ev->arg);
+	rb_loop_timer_end();
 	if(!ev->frequency)
 	{
 		rb_event_delete(ev);
@@ -238,7 +240,9 @@ rb_event_run(void)
 		if(ev->when <= rb_current_time())
 		{
 			rb_strlcpy(last_event_ran, ev->name, sizeof(last_event_ran));
+			rb_loop_timer_begin();
 			ev->func(ev->arg);
+			rb_loop_timer_end();
 
 			/* event is scheduled more than once */
 			if(ev->frequency)
@@ -0,0 +1,116 @@
+/*
+ *  librb: a library used by comet and other things
+ *  histogram.c: log-linear histograms for latency and size distributions
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ *
+ */
+#include <librb_config.h>
+#include <rb_lib.h>
+
+#define SUBBUCKETS (1 << RB_HISTOGRAM_SUBBITS)
+
+static int
+rb_histogram_bucket(unsigned long long value)
+{
+	int msb = 0;
+	int bucket;
+
+	if(value < SUBBUCKETS)
+		return (int)value;
+
+	for(msb = 0; (value >> msb) > 1; msb++)
+		;
+
+	/* the top SUBBITS below the most significant bit pick the sub-bucket */
+	bucket = (msb - RB_HISTOGRAM_SUBBITS + 1) * SUBBUCKETS +
+		(int)((value >> (msb - RB_HISTOGRAM_SUBBITS)) & (SUBBUCKETS - 1));
+
+	if(bucket >= RB_HISTOGRAM_BUCKETS)
+		bucket = RB_HISTOGRAM_BUCKETS - 1;
+
+	return bucket;
+}
+
+/*
+ * rb_histogram_bucket_max
+ *
+ * Returns the largest value that is counted in the given bucket.
+ */
+unsigned long long
+rb_histogram_bucket_max(int bucket)
+{
+	int msb, sub;
+
+	if(bucket < SUBBUCKETS)
+		return bucket;
+
+	if(bucket >= RB_HISTOGRAM_BUCKETS - 1)
+		return ~0ULL;
+
+	msb = bucket / SUBBUCKETS + RB_HISTOGRAM_SUBBITS - 1;
+	sub = bucket % SUBBUCKETS;
+
+	return ((unsigned long long)(SUBBUCKETS + sub + 1) << (msb - RB_HISTOGRAM_SUBBITS)) - 1;
+}
+
+void
+rb_histogram_add(struct rb_histogram *hist, unsigned long long value)
+{
+	hist->count++;
+	hist->sum += value;
+	if(value > hist->max)
+		hist->max = value;
+	hist->buckets[rb_histogram_bucket(value)]++;
+}
+
+void
+rb_histogram_reset(struct rb_histogram *hist)
+{
+	memset(hist, 0, sizeof(*hist));
+}
+
+/*
+ * rb_histogram_percentile
+ *
+ * Returns an upper bound for the given percentile (0-100) of the
+ * recorded values, accurate to the bucket width.
+ */
+unsigned long long
+rb_histogram_percentile(const struct rb_histogram *hist, double pct)
+{
+	unsigned long long want, seen = 0;
+	int i;
+
+	if(hist->count == 0)
+		return 0;
+
+	want = (unsigned long long)(hist->count * pct / 100.0);
+	if(want == 0)
+		want = 1;
+
+	for(i = 0; i < RB_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if(seen >= want)
+		{
+			unsigned long long bmax = rb_histogram_bucket_max(i);
+			return bmax < hist->max ? bmax : hist->max;
+		}
+	}
+
+	return hist->max;
+}
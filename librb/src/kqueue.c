@@ -239,6 +239,7 @@ rb_select_kqueue(long delay)
 	}
 
 	rb_set_time();
+	rb_loop_wakeup(num);
 
 	if(num == 0)
 		return RB_OK;	/* No error.. */
@@ -116,6 +116,234 @@ rb_linebuf_done_line(buf_head_t * bufhead, buf_line_t * bufline, rb_dlink_node *
 }
 
 
+#define EOL_ONES	0x0101010101010101ULL
+#define EOL_HIGHS	0x8080808080808080ULL
+#define EOL_HASZERO(v)	(((v) - EOL_ONES) & ~(v) & EOL_HIGHS)
+
+/*
+ * CR/LF scanners.  Each returns the offset of the first CR or LF in buf,
+ * or len if there is none; the widest one the CPU supports is picked
+ * the first time rb_linebuf_find_eol() is called.
+ */
+static size_t
+find_eol_byte(const char *buf, size_t len)
+{
+	size_t i;
+
+	for(i = 0; i < len; i++)
+	{
+		if(buf[i] == '\r' || buf[i] == '\n')
+			return i;
+	}
+
+	return len;
+}
+
+/* eight bytes at a time, in a plain 64 bit word */
+static size_t
+find_eol_swar(const char *buf, size_t len)
+{
+	const char *ch = buf;
+	const char *end = buf + len;
+	uint64_t word;
+
+	while(end - ch >= 8)
+	{
+		memcpy(&word, ch, sizeof(word));
+		if(EOL_HASZERO(word ^ (EOL_ONES * '\r')) | EOL_HASZERO(word ^ (EOL_ONES * '\n')))
+			break;
+		ch += 8;
+	}
+
+	return (ch - buf) + find_eol_byte(ch, end - ch);
+}
+
+#if defined(__SSE2__)
+#define HAVE_EOL_SSE2
+#include <emmintrin.h>
+
+static size_t
+find_eol_sse2(const char *buf, size_t len)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const char *ch = buf;
+	const char *end = buf + len;
+	__m128i v;
+	unsigned int mask;
+
+	while(end - ch >= 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)ch);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if(mask != 0)
+			return (ch - buf) + __builtin_ctz(mask);
+		ch += 16;
+	}
+
+	return (ch - buf) + find_eol_swar(ch, end - ch);
+}
+#endif
+
+#if defined(HAVE_EOL_SSE2) && defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_EOL_AVX2
+#include <immintrin.h>
+
+static int
+have_avx2(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static size_t
+find_eol_avx2(const char *buf, size_t len)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	const __m256i lf = _mm256_set1_epi8('\n');
+	const char *ch = buf;
+	const char *end = buf + len;
+	__m256i v;
+	unsigned int mask;
+
+	while(end - ch >= 32)
+	{
+		v = _mm256_loadu_si256((const __m256i *)ch);
+		mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+					_mm256_cmpeq_epi8(v, lf)));
+		if(mask != 0)
+			return (ch - buf) + __builtin_ctz(mask);
+		ch += 32;
+	}
+
+	return (ch - buf) + find_eol_sse2(ch, end - ch);
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_EOL_NEON
+#include <arm_neon.h>
+
+static size_t
+find_eol_neon(const char *buf, size_t len)
+{
+	const uint8x16_t cr = vdupq_n_u8('\r');
+	const uint8x16_t lf = vdupq_n_u8('\n');
+	const char *ch = buf;
+	const char *end = buf + len;
+	uint8x16_t v;
+	uint64_t mask;
+
+	while(end - ch >= 16)
+	{
+		v = vld1q_u8((const uint8_t *)ch);
+		v = vorrq_u8(vceqq_u8(v, cr), vceqq_u8(v, lf));
+		/* narrow each byte of the comparison to a nibble of mask */
+		mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+		if(mask != 0)
+			return (ch - buf) + (__builtin_ctzll(mask) >> 2);
+		ch += 16;
+	}
+
+	return (ch - buf) + find_eol_swar(ch, end - ch);
+}
+#endif
+
+static int
+always(void)
+{
+	return 1;
+}
+
+static const struct
+{
+	const char *name;
+	size_t (*find)(const char *, size_t);
+	int (*supported)(void);
+} eol_scanners[] = {
+	/* best first */
+#ifdef HAVE_EOL_AVX2
+	{ "avx2", find_eol_avx2, have_avx2 },
+#endif
+#ifdef HAVE_EOL_SSE2
+	{ "sse2", find_eol_sse2, always },
+#endif
+#ifdef HAVE_EOL_NEON
+	{ "neon", find_eol_neon, always },
+#endif
+	{ "swar", find_eol_swar, always },
+	{ "byte", find_eol_byte, always },
+	{ NULL, NULL, NULL }
+};
+
+static int eol_scanner = -1;
+
+static void
+eol_scanner_pick(void)
+{
+	for(eol_scanner = 0; !eol_scanners[eol_scanner].supported(); eol_scanner++)
+		;
+}
+
+/*
+ * rb_linebuf_find_eol
+ *
+ * Returns a pointer to the first CR or LF in buf, or NULL if there is
+ * none.
+ */
+char *
+rb_linebuf_find_eol(char *buf, size_t len)
+{
+	size_t off;
+
+	if(rb_unlikely(eol_scanner < 0))
+		eol_scanner_pick();
+
+	off = eol_scanners[eol_scanner].find(buf, len);
+	return off < len ? buf + off : NULL;
+}
+
+/*
+ * rb_linebuf_eol_scanner
+ *
+ * Returns the name of the CR/LF scanner in use.
+ */
+const char *
+rb_linebuf_eol_scanner(void)
+{
+	if(eol_scanner < 0)
+		eol_scanner_pick();
+
+	return eol_scanners[eol_scanner].name;
+}
+
+/*
+ * rb_linebuf_set_eol_scanner
+ *
+ * Selects a CR/LF scanner by name, for tests and benchmarks.  Returns
+ * 0 if there is no such scanner or this CPU can't run it.
+ */
+int
+rb_linebuf_set_eol_scanner(const char *name)
+{
+	int i;
+
+	for(i = 0; eol_scanners[i].name != NULL; i++)
+	{
+		if(strcmp(eol_scanners[i].name, name) == 0)
+		{
+			if(!eol_scanners[i].supported())
+				return 0;
+
+			eol_scanner = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
 /*
  * skip to end of line or the crlfs, return the number of bytes ..
  */
@@ -123,15 +351,15 @@ static inline int
 rb_linebuf_skip_crlf(char *ch, int len)
 {
 	int orig_len = len;
+	char *eol;
 
-	/* First, skip until the first non-CRLF */
-	for(; len; len--, ch++)
-	{
-		if(*ch == '\r')
-			break;
-		else if(*ch == '\n')
-			break;
-	}
+	/* First, skip until the first CRLF */
+	eol = rb_linebuf_find_eol(ch, len);
+	if(eol == NULL)
+		return orig_len;
+
+	len -= eol - ch;
+	ch = eol;
 
 	/* Then, skip until the last CRLF */
 	for(; len; len--, ch++)
@@ -538,133 +766,95 @@ rb_linebuf_put(buf_head_t *bufhead, const rb_strf_t *strings)
 int
 rb_linebuf_flush(rb_fde_t *F, buf_head_t * bufhead)
 {
+	static struct rb_iovec vec[RB_UIO_MAXIOV];
+	static char combine[LINEBUF_COMBINE_SIZE];
 	buf_line_t *bufline;
-	int retval;
+	rb_dlink_node *ptr;
+	char *data;
+	int x = 0, combined = 0;
+	int len, xret, retval;
 
-/*
- * autoconf checks for this..but really just want to use it if we have a
- * native version even if libircd provides a fake version...
- */
-	if(!rb_fd_ssl(F))
+	/* Check we actually have a first buffer, and that it's full */
+	if(bufhead->list.head == NULL ||
+	   !((buf_line_t *)bufhead->list.head->data)->terminated)
 	{
-		rb_dlink_node *ptr;
-		int x = 0, y;
-		int xret;
-		static struct rb_iovec vec[RB_UIO_MAXIOV];
-
-		memset(vec, 0, sizeof(vec));
-		/* Check we actually have a first buffer */
-		if(bufhead->list.head == NULL)
-		{
-			/* nope, so we return none .. */
-			errno = EWOULDBLOCK;
-			return -1;
-		}
-
-		ptr = bufhead->list.head;
+		errno = EWOULDBLOCK;
+		return -1;
+	}
 
+	/*
+	 * Lines shorter than the combine size are copied together so a run
+	 * of them is one iovec, and one record on a TLS connection.  The
+	 * copy only lives for this write; what isn't written stays queued.
+	 */
+	RB_DLINK_FOREACH(ptr, bufhead->list.head)
+	{
 		bufline = ptr->data;
 		if(!bufline->terminated)
-		{
-			errno = EWOULDBLOCK;
-			return -1;
-
-		}
-
-		vec[x].iov_base = bufline->buf + bufhead->writeofs;
-		vec[x++].iov_len = bufline->len - bufhead->writeofs;
-		ptr = ptr->next;
-
-		do
-		{
-			if(ptr == NULL)
-				break;
-
-			bufline = ptr->data;
-			if(!bufline->terminated)
-				break;
-
-			vec[x].iov_base = bufline->buf;
-			vec[x].iov_len = bufline->len;
-			ptr = ptr->next;
-
-		}
-		while(++x < RB_UIO_MAXIOV);
+			break;
 
-		if(x == 0)
+		data = bufline->buf;
+		len = bufline->len;
+		if(ptr == bufhead->list.head)
 		{
-			errno = EWOULDBLOCK;
-			return -1;
+			data += bufhead->writeofs;
+			len -= bufhead->writeofs;
 		}
 
-		xret = retval = rb_writev(F, vec, x);
-		if(retval <= 0)
-			return retval;
-
-		ptr = bufhead->list.head;
-
-		for(y = 0; y < x; y++)
+		if(len < bufhead->combine && combined + len <= LINEBUF_COMBINE_SIZE)
 		{
-			bufline = ptr->data;
-
-			if(xret >= bufline->len - bufhead->writeofs)
+			memcpy(combine + combined, data, len);
+			if(x > 0 && (char *)vec[x - 1].iov_base + vec[x - 1].iov_len == combine + combined)
 			{
-				xret -= bufline->len - bufhead->writeofs;
-				ptr = ptr->next;
-				rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
-				bufhead->writeofs = 0;
-			}
-			else
-			{
-				bufhead->writeofs += xret;
-				break;
+				vec[x - 1].iov_len += len;
+				combined += len;
+				continue;
 			}
+			data = combine + combined;
+			combined += len;
 		}
 
-		return retval;
-	}
-
-	/* this is the non-writev case */
-
-	/* Check we actually have a first buffer */
-	if(bufhead->list.head == NULL)
-	{
-		/* nope, so we return none .. */
-		errno = EWOULDBLOCK;
-		return -1;
-	}
-
-	bufline = bufhead->list.head->data;
-
-	/* And that its actually full .. */
-	if(!bufline->terminated)
-	{
-		errno = EWOULDBLOCK;
-		return -1;
+		if(x == RB_UIO_MAXIOV)
+			break;
+		vec[x].iov_base = data;
+		vec[x++].iov_len = len;
 	}
 
-	/* Now, try writing data */
-	retval = rb_write(F, bufline->buf + bufhead->writeofs, bufline->len - bufhead->writeofs);
-
+	xret = retval = rb_writev(F, vec, x);
 	if(retval <= 0)
 		return retval;
 
-	/* we've got data, so update the write offset */
-	bufhead->writeofs += retval;
-
-	/* if we've written everything *and* the CRLF, deallocate and update
-	   bufhead */
-	if(bufhead->writeofs == bufline->len)
+	while(xret > 0)
 	{
+		bufline = bufhead->list.head->data;
+		len = bufline->len - bufhead->writeofs;
+
+		if(xret < len)
+		{
+			bufhead->writeofs += xret;
+			break;
+		}
+
+		xret -= len;
 		bufhead->writeofs = 0;
-		lrb_assert(bufhead->len >= 0);
 		rb_linebuf_done_line(bufhead, bufline, bufhead->list.head);
 	}
 
-	/* Return line length */
 	return retval;
 }
 
+/*
+ * rb_linebuf_set_combine
+ *
+ * Lines shorter than size are copied together when the buffer is
+ * flushed, rather than each having an iovec of its own.  0 turns it off.
+ */
+void
+rb_linebuf_set_combine(buf_head_t * bufhead, int size)
+{
+	bufhead->combine = size;
+}
+
 
 
 /*
@@ -177,6 +177,7 @@ rb_select_poll(long delay)
 
 	num = poll(pollfd_list.pollfds, pollfd_list.maxindex + 1, delay);
 	rb_set_time();
+	rb_loop_wakeup(num);
 	if(num < 0)
 	{
 		if(!rb_ignore_errno(errno))
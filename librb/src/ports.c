@@ -138,6 +138,7 @@ rb_select_ports(long delay)
 
 	i = port_getn(pe, pelst, pemax, &nget, p);
 	rb_set_time();
+	rb_loop_wakeup(i == -1 ? 0 : (int)nget);
 
 	if(i == -1)
 		return RB_OK;
@@ -135,8 +135,12 @@ rb_rawbuf_flush_writev(rawbuf_head_t * rb, rb_fde_t *F)
 		}
 		else
 		{
-			buf->flushing = 1;
-			rb->written = xret;
+			if(!buf->flushing)
+			{
+				buf->flushing = 1;
+				rb->written = 0;
+			}
+			rb->written += xret;
 			rb->len -= xret;
 			break;
 		}
@@ -148,38 +152,8 @@ rb_rawbuf_flush_writev(rawbuf_head_t * rb, rb_fde_t *F)
 int
 rb_rawbuf_flush(rawbuf_head_t * rb, rb_fde_t *F)
 {
-	rawbuf_t *buf;
-	int retval;
-	if(rb->list.head == NULL)
-	{
-		errno = EAGAIN;
-		return -1;
-	}
-
-	if(!rb_fd_ssl(F))
-		return rb_rawbuf_flush_writev(rb, F);
-
-	buf = rb->list.head->data;
-	if(!buf->flushing)
-	{
-		buf->flushing = 1;
-		rb->written = 0;
-	}
-
-	retval = rb_write(F, buf->data + rb->written, buf->len - rb->written);
-	if(retval <= 0)
-		return retval;
-
-	rb->written += retval;
-	if(rb->written == buf->len)
-	{
-		rb->written = 0;
-		rb_dlinkDelete(&buf->node, &rb->list);
-		rb_bh_free(rawbuf_heap, buf);
-	}
-	rb->len -= retval;
-	lrb_assert(rb->len >= 0);
-	return retval;
+	/* on TLS, rb_writev() sends the buffers as one record */
+	return rb_rawbuf_flush_writev(rb, F);
 }
 
 
@@ -255,7 +229,7 @@ rb_rawbuf_get(rawbuf_head_t * rb, void *data, int len)
 	{
 		rb->written = 0;
 		rb_rawbuf_done(rb, buf);
-		rb->len -= len;
+		rb->len -= cpylen;
 		return cpylen;
 	}
 
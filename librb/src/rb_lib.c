@@ -207,6 +207,101 @@ rb_lib_init(log_cb * ilog, restart_cb * irestart, die_cb * idie, int closeall, i
 	}
 }
 
+static struct rb_loop_stats loop_stats;
+static struct timespec loop_wake;
+static int loop_woke;
+static struct timespec loop_timer_start;
+static unsigned long long loop_timer_us;
+
+static unsigned long long
+rb_timespec_diff_us(const struct timespec *start, const struct timespec *end)
+{
+	long long us = (end->tv_sec - start->tv_sec) * 1000000LL +
+		(end->tv_nsec - start->tv_nsec) / 1000;
+
+	return us > 0 ? (unsigned long long)us : 0;
+}
+
+/*
+ * rb_loop_wakeup
+ *
+ * Called by the io backends as soon as their wait returns, before any
+ * handlers are run, so the loop can tell waiting from working.
+ */
+void
+rb_loop_wakeup(int nevents)
+{
+	clock_gettime(CLOCK_MONOTONIC, &loop_wake);
+	loop_woke = 1;
+
+	if(nevents > 0)
+	{
+		loop_stats.wakeups++;
+		rb_histogram_add(&loop_stats.events, nevents);
+	}
+}
+
+/*
+ * rb_loop_timer_begin/rb_loop_timer_end
+ *
+ * Bracket each timed event as it runs.  With timerfd or kqueue timers
+ * that is inside rb_select() among the fd handlers, so the loop can't
+ * tell the two apart by where it is.
+ */
+void
+rb_loop_timer_begin(void)
+{
+	clock_gettime(CLOCK_MONOTONIC, &loop_timer_start);
+}
+
+void
+rb_loop_timer_end(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	loop_timer_us += rb_timespec_diff_us(&loop_timer_start, &now);
+}
+
+static void
+rb_lib_loop_once(long delay)
+{
+	struct timespec start, handled, end;
+	unsigned long long busy, timers;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	loop_woke = 0;
+	loop_timer_us = 0;
+
+	rb_select(delay);
+
+	clock_gettime(CLOCK_MONOTONIC, &handled);
+
+	/* backends that can't report their wakeup are counted as waiting */
+	if(!loop_woke)
+		loop_wake = handled;
+
+	rb_event_run();
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	busy = rb_timespec_diff_us(&loop_wake, &end);
+	timers = loop_timer_us < busy ? loop_timer_us : busy;
+
+	loop_stats.iterations++;
+	loop_stats.wait_us += rb_timespec_diff_us(&start, &loop_wake);
+	rb_histogram_add(&loop_stats.iteration, rb_timespec_diff_us(&start, &end));
+	rb_histogram_add(&loop_stats.busy, busy);
+	rb_histogram_add(&loop_stats.handlers, busy - timers);
+	rb_histogram_add(&loop_stats.timers, timers);
+}
+
+const struct rb_loop_stats *
+rb_lib_loop_stats(void)
+{
+	return &loop_stats;
+}
+
 void
 rb_lib_loop(long delay)
 {
@@ -216,7 +311,7 @@ rb_lib_loop(long delay)
 	if(rb_io_supports_event())
 	{
 		while(1)
-			rb_select(-1);
+			rb_lib_loop_once(-1);
 	}
 
 
@@ -234,11 +329,10 @@ rb_lib_loop(long delay)
 			}
 			else
 				next = -1;
-			rb_select(next);
+			rb_lib_loop_once(next);
 		}
 		else
-			rb_select(delay);
-		rb_event_run();
+			rb_lib_loop_once(delay);
 	}
 }
 
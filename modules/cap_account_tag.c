@@ -55,7 +55,7 @@ cap_account_tag_process(void *data_)
 	struct MsgBuf *msgbuf = data->arg1;
 
 	if (data->client != NULL && IsPerson(data->client) && *data->client->user->suser)
-		msgbuf_append_tag(msgbuf, "account", data->client->user->suser, CLICAP_ACCOUNT_TAG);
+		msgbuf_append_tag_idx(msgbuf, MSGTAG_ACCOUNT, data->client->user->suser, CLICAP_ACCOUNT_TAG);
 }
 
 DECLARE_MODULE_AV2(cap_account_tag, NULL, NULL, NULL, NULL, cap_account_tag_hfnlist, cap_account_tag_cap_list, NULL, cap_account_tag_desc);
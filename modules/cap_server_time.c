@@ -33,6 +33,7 @@
 #include "numeric.h"
 #include "chmode.h"
 #include "parse.h"
+#include "msgtag.h"
 #include "inline/stringops.h"
 
 static const char cap_server_time_desc[] =
@@ -66,32 +67,23 @@ static void
 cap_server_time_process(void *data_)
 {
 	hook_data *data = data_;
-	static char buf[BUFSIZE];
 	const char *tagged_time;
 	struct MsgBuf *msgbuf = data->arg1;
-	struct timeval tv;
 
-	if (msgbuf_get_tag(msgbuf, "time"))
+	if (msgbuf_get_tag_idx(msgbuf, MSGTAG_TIME))
 		return;
 
-	if (incoming_client != NULL && IsServer(incoming_client) && (tagged_time = msgbuf_get_tag(incoming_message, "time")) != NULL)
+	if (incoming_client != NULL && IsServer(incoming_client) && (tagged_time = msgbuf_get_tag_idx(incoming_message, MSGTAG_TIME)) != NULL)
 	{
-		msgbuf_append_tag(msgbuf, "time", tagged_time, CLICAP_SERVER_TIME);
+		msgbuf_append_tag_idx(msgbuf, MSGTAG_TIME, tagged_time, CLICAP_SERVER_TIME);
 		return;
 	}
 
 	if (data->client != NULL && !IsMe(data->client) && !MyClient(data->client))
 		return;
 
-	if (!rb_gettimeofday(&tv, NULL)) {
-		if (strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S.", gmtime(&tv.tv_sec)) == 0)
-			return;
-
-		if (rb_snprintf_append(buf, sizeof(buf), "%03uZ", (int)tv.tv_usec / 1000) < 0)
-			return;
-
-		msgbuf_append_tag(msgbuf, "time", buf, CLICAP_SERVER_TIME);
-	}
+	if ((tagged_time = msgtag_server_time()) != NULL)
+		msgbuf_append_tag_idx(msgbuf, MSGTAG_TIME, tagged_time, CLICAP_SERVER_TIME);
 }
 
 DECLARE_MODULE_AV2(cap_server_time, NULL, NULL, NULL, NULL, cap_server_time_hfnlist, cap_server_time_cap_list, NULL, cap_server_time_desc);
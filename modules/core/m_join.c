@@ -773,6 +773,11 @@ ms_sjoin(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source
 	pargs = 0;
 	len_uid = 0;
 
+	/* size the membership hash for the whole nick list up front */
+	for(i = 1, p = (char *)s; (p = strchr(p, ' ')) != NULL; p++)
+		i++;
+	reserve_membership_hash(i);
+
 	/* if theres a space, theres going to be more than one nick, change the
 	 * first space to \0, so s is just the first nick, and point p to the
 	 * second nick
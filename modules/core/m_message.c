@@ -144,7 +144,12 @@ static bool flood_attack_client(enum message_type msgtype, struct Client *source
 static struct entity targets[512];
 static int ntargets = 0;
 
-static bool duplicate_ptr(void *);
+/* the pointers in targets[], to find duplicates in constant time;
+ * targets[] is at most half of TARGET_SET_SIZE
+ */
+static struct target_set target_set;
+
+static bool add_entity(struct Client *source_p, const char *name, void *ptr, int type, int flags);
 
 static void msg_channel(enum message_type msgtype,
 			struct Client *client_p,
@@ -359,6 +364,7 @@ build_target_list(enum message_type msgtype, struct Client *client_p,
 	target_list = LOCAL_COPY(nicks_channels);	/* skip strcpy for non-lazyleafs */
 
 	ntargets = 0;
+	target_set_clear(&target_set);
 
 	for(nick = rb_strtok_r(target_list, ",", &p); nick; nick = rb_strtok_r(NULL, ",", &p))
 	{
@@ -376,17 +382,8 @@ build_target_list(enum message_type msgtype, struct Client *client_p,
 
 			if((chptr = find_channel(nick)) != NULL)
 			{
-				if(!duplicate_ptr(chptr))
-				{
-					if(ntargets >= ConfigFileEntry.max_targets)
-					{
-						sendto_one(source_p, form_str(ERR_TOOMANYTARGETS),
-							   me.name, source_p->name, nick);
-						return (1);
-					}
-					targets[ntargets].ptr = (void *) chptr;
-					targets[ntargets++].type = ENTITY_CHANNEL;
-				}
+				if(!add_entity(source_p, nick, chptr, ENTITY_CHANNEL, 0))
+					return (1);
 			}
 
 			/* non existant channel */
@@ -405,18 +402,8 @@ build_target_list(enum message_type msgtype, struct Client *client_p,
 		/* look for a privmsg to another client */
 		if(target_p)
 		{
-			if(!duplicate_ptr(target_p))
-			{
-				if(ntargets >= ConfigFileEntry.max_targets)
-				{
-					sendto_one(source_p, form_str(ERR_TOOMANYTARGETS),
-						   me.name, source_p->name, nick);
-					return (1);
-				}
-				targets[ntargets].ptr = (void *) target_p;
-				targets[ntargets].type = ENTITY_CLIENT;
-				targets[ntargets++].flags = 0;
-			}
+			if(!add_entity(source_p, nick, target_p, ENTITY_CLIENT, 0))
+				return (1);
 			continue;
 		}
 
@@ -465,18 +452,8 @@ build_target_list(enum message_type msgtype, struct Client *client_p,
 					continue;
 				}
 
-				if(!duplicate_ptr(chptr))
-				{
-					if(ntargets >= ConfigFileEntry.max_targets)
-					{
-						sendto_one(source_p, form_str(ERR_TOOMANYTARGETS),
-							   me.name, source_p->name, nick);
-						return (1);
-					}
-					targets[ntargets].ptr = (void *) chptr;
-					targets[ntargets].type = ENTITY_CHANOPS_ON_CHANNEL;
-					targets[ntargets++].flags = type;
-				}
+				if(!add_entity(source_p, nick, chptr, ENTITY_CHANOPS_ON_CHANNEL, type))
+					return (1);
 			}
 			else if(msgtype != MESSAGE_TYPE_NOTICE)
 			{
@@ -492,17 +469,8 @@ build_target_list(enum message_type msgtype, struct Client *client_p,
 			nick++;
 			if((chptr = find_channel(nick)) != NULL)
 			{
-				if(!duplicate_ptr(chptr))
-				{
-					if(ntargets >= ConfigFileEntry.max_targets)
-					{
-						sendto_one(source_p, form_str(ERR_TOOMANYTARGETS),
-							   me.name, source_p->name, nick);
-						return (1);
-					}
-					targets[ntargets].ptr = (void *) chptr;
-					targets[ntargets++].type = ENTITY_CHANNEL_OPMOD;
-				}
+				if(!add_entity(source_p, nick, chptr, ENTITY_CHANNEL_OPMOD, 0))
+					return (1);
 			}
 
 			/* non existant channel */
@@ -540,23 +508,34 @@ build_target_list(enum message_type msgtype, struct Client *client_p,
 }
 
 /*
- * duplicate_ptr
+ * add_entity
  *
- * inputs	- pointer to check
- *		- pointer to table of entities
- *		- number of valid entities so far
- * output	- true if duplicate pointer in table, false if not.
- *		  note, this does the canonize using pointers
- * side effects	- NONE
+ * inputs	- source of the message
+ *		- target name as given, for errors
+ *		- pointer to the channel or client
+ *		- ENTITY_* type and flags for targets[]
+ * output	- false if there are too many targets, true otherwise
+ * side effects	- the target is added to targets[] unless it already
+ *		  is, under any name; source_p is told if it is one
+ *		  target too many
  */
 static bool
-duplicate_ptr(void *ptr)
+add_entity(struct Client *source_p, const char *name, void *ptr, int type, int flags)
 {
-	int i;
-	for(i = 0; i < ntargets; i++)
-		if(targets[i].ptr == ptr)
-			return true;
-	return false;
+	if(!target_set_add(&target_set, ptr))
+		return true;
+
+	if(ntargets >= ConfigFileEntry.max_targets || ntargets >= (int)(sizeof(targets) / sizeof(targets[0])))
+	{
+		sendto_one(source_p, form_str(ERR_TOOMANYTARGETS),
+			   me.name, source_p->name, name);
+		return false;
+	}
+
+	targets[ntargets].ptr = ptr;
+	targets[ntargets].type = type;
+	targets[ntargets++].flags = flags;
+	return true;
 }
 
 /*
@@ -596,19 +575,22 @@ msg_channel(enum message_type msgtype,
 			source_p->localClient->last = rb_current_time();
 	}
 
-	hdata.msgtype = msgtype;
-	hdata.source_p = source_p;
-	hdata.chptr = chptr;
-	hdata.text = text;
-	hdata.approved = 0;
+	if (hook_has_listeners(h_privmsg_channel))
+	{
+		hdata.msgtype = msgtype;
+		hdata.source_p = source_p;
+		hdata.chptr = chptr;
+		hdata.text = text;
+		hdata.approved = 0;
 
-	call_hook(h_privmsg_channel, &hdata);
+		call_hook(h_privmsg_channel, &hdata);
 
-	/* memory buffer address may have changed, update pointer */
-	text = hdata.text;
+		/* memory buffer address may have changed, update pointer */
+		text = hdata.text;
 
-	if (hdata.approved != 0)
-		return;
+		if (hdata.approved != 0)
+			return;
+	}
 
 	/* hook may have reduced the string to nothing. */
 	if (EmptyString(text) && msgtype != MESSAGE_TYPE_TAGMSG)
@@ -684,19 +666,22 @@ msg_channel_opmod(enum message_type msgtype,
 	int cli_cap = msgtype == MESSAGE_TYPE_TAGMSG ? CLICAP_MESSAGE_TAGS : 0;
 	int serv_cap = msgtype == MESSAGE_TYPE_TAGMSG ? CAP_STAG : 0;
 
-	hdata.msgtype = msgtype;
-	hdata.source_p = source_p;
-	hdata.chptr = chptr;
-	hdata.text = text;
-	hdata.approved = 0;
+	if (hook_has_listeners(h_privmsg_channel))
+	{
+		hdata.msgtype = msgtype;
+		hdata.source_p = source_p;
+		hdata.chptr = chptr;
+		hdata.text = text;
+		hdata.approved = 0;
 
-	call_hook(h_privmsg_channel, &hdata);
+		call_hook(h_privmsg_channel, &hdata);
 
-	/* memory buffer address may have changed, update pointer */
-	text = hdata.text;
+		/* memory buffer address may have changed, update pointer */
+		text = hdata.text;
 
-	if (hdata.approved != 0)
-		return;
+		if (hdata.approved != 0)
+			return;
+	}
 
 	/* hook may have reduced the string to nothing. */
 	if (EmptyString(text) && msgtype != MESSAGE_TYPE_TAGMSG)
@@ -776,19 +761,22 @@ msg_channel_flags(enum message_type msgtype, struct Client *client_p,
 			source_p->localClient->last = rb_current_time();
 	}
 
-	hdata.msgtype = msgtype;
-	hdata.source_p = source_p;
-	hdata.chptr = chptr;
-	hdata.text = text;
-	hdata.approved = 0;
+	if (hook_has_listeners(h_privmsg_channel))
+	{
+		hdata.msgtype = msgtype;
+		hdata.source_p = source_p;
+		hdata.chptr = chptr;
+		hdata.text = text;
+		hdata.approved = 0;
 
-	call_hook(h_privmsg_channel, &hdata);
+		call_hook(h_privmsg_channel, &hdata);
 
-	/* memory buffer address may have changed, update pointer */
-	text = hdata.text;
+		/* memory buffer address may have changed, update pointer */
+		text = hdata.text;
 
-	if (hdata.approved != 0)
-		return;
+		if (hdata.approved != 0)
+			return;
+	}
 
 	if (EmptyString(text) && msgtype != MESSAGE_TYPE_TAGMSG)
 	{
@@ -918,19 +906,22 @@ msg_client(enum message_type msgtype,
 		sendto_one_numeric(source_p, RPL_AWAY, form_str(RPL_AWAY),
 				   target_p->name, target_p->user->away);
 
-	hdata.msgtype = msgtype;
-	hdata.source_p = source_p;
-	hdata.target_p = target_p;
-	hdata.text = text;
-	hdata.approved = 0;
+	if (hook_has_listeners(h_privmsg_user))
+	{
+		hdata.msgtype = msgtype;
+		hdata.source_p = source_p;
+		hdata.target_p = target_p;
+		hdata.text = text;
+		hdata.approved = 0;
 
-	call_hook(h_privmsg_user, &hdata);
+		call_hook(h_privmsg_user, &hdata);
 
-	/* buffer location may have changed. */
-	text = hdata.text;
+		/* buffer location may have changed. */
+		text = hdata.text;
 
-	if (hdata.approved != 0)
-		return;
+		if (hdata.approved != 0)
+			return;
+	}
 
 	if (MyClient(target_p))
 	{
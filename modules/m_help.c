@@ -90,9 +90,6 @@ dohelp(struct Client *source_p, int flags, const char *topic)
 {
 	static const char ntopic[] = "index";
 	struct cachefile *hptr;
-	struct cacheline *lineptr;
-	rb_dlink_node *ptr;
-	rb_dlink_node *fptr;
 
 	if(EmptyString(topic))
 		topic = ntopic;
@@ -106,21 +103,5 @@ dohelp(struct Client *source_p, int flags, const char *topic)
 		return;
 	}
 
-	fptr = hptr->contents.head;
-	lineptr = fptr->data;
-
-	/* first line cant be empty */
-	sendto_one(source_p, form_str(RPL_HELPSTART),
-		   me.name, source_p->name, topic, lineptr->data);
-
-	RB_DLINK_FOREACH(ptr, fptr->next)
-	{
-		lineptr = ptr->data;
-
-		sendto_one(source_p, form_str(RPL_HELPTXT),
-			   me.name, source_p->name, topic, lineptr->data);
-	}
-
-	sendto_one(source_p, form_str(RPL_ENDOFHELP),
-		   me.name, source_p->name, topic);
+	send_help(source_p, hptr, topic);
 }
@@ -520,6 +520,36 @@ static struct InfoStruct info_table[] = {
 		"KLINE sets fully propagated bans",
 		INFO_INTBOOL(&ConfigFileEntry.use_propagated_bans),
 	},
+	{
+		"command_profiling",
+		"Time command handlers for STATS j",
+		INFO_INTBOOL_YN(&ConfigFileEntry.command_profiling),
+	},
+	{
+		"metrics_socket",
+		"Unix socket serving event loop and queue metrics",
+		INFO_STRING(&ConfigFileEntry.metrics_socket),
+	},
+	{
+		"metrics_snapshot_socket",
+		"Unix socket serving a binary statistics snapshot",
+		INFO_STRING(&ConfigFileEntry.metrics_snapshot_socket),
+	},
+	{
+		"sendq_soft_limit",
+		"Total sendq above which bulk output is held back",
+		INFO_DECIMAL(&ConfigFileEntry.sendq_soft_limit),
+	},
+	{
+		"sendq_hard_limit",
+		"Total sendq above which the largest sendqs are dropped",
+		INFO_DECIMAL(&ConfigFileEntry.sendq_hard_limit),
+	},
+	{
+		"write_combine",
+		"Lines shorter than this are copied together when writing",
+		INFO_DECIMAL(&ConfigFileEntry.write_combine),
+	},
 	{
 		"max_ratelimit_tokens",
 		"The maximum number of tokens that can be accumulated for executing rate-limited commands",
@@ -348,11 +348,12 @@ static void list_one_channel(struct Client *source_p, struct Channel *chptr,
  * side effects - none
  *
  * When safelisting, we only use half of the SendQ at any
- * given time.
+ * given time, and none while sendq memory is short.
  */
 static bool safelist_sendq_exceeded(struct Client *client_p)
 {
-	return rb_linebuf_len(&client_p->localClient->buf_sendq) > (get_sendq(client_p) / 2);
+	return sendq_length(client_p) > (get_sendq(client_p) / 2) ||
+		sendq_pressure();
 }
 
 /*
@@ -65,16 +65,16 @@ m_motd(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p
 {
 	static time_t last_used = 0;
 
-	if (parc < 2) {
-		/* do nothing */
-	} else if ((last_used + ConfigFileEntry.pace_wait) > rb_current_time() || !ratelimit_client(source_p, 6)) {
+	if (!ratelimit_client_bulk(source_p) || (parc > 1 &&
+			((last_used + ConfigFileEntry.pace_wait) > rb_current_time() ||
+			 !ratelimit_client(source_p, 6)))) {
 		/* safe enough to give this on a local connect only */
 		sendto_one(source_p, form_str(RPL_LOAD2HI),
 			   me.name, source_p->name, "MOTD");
 		sendto_one(source_p, form_str(RPL_ENDOFMOTD),
 			   me.name, source_p->name);
 		return;
-	} else {
+	} else if (parc > 1) {
 		last_used = rb_current_time();
 	}
 
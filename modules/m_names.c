@@ -36,6 +36,7 @@
 #include "parse.h"
 #include "modules.h"
 #include "s_newconf.h"
+#include "ratelimit.h"
 
 static const char names_desc[] = "Provides the NAMES command to view users on a channel";
 
@@ -81,6 +82,15 @@ m_names(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_
 			return;
 		}
 
+		if(!ratelimit_client_bulk(source_p))
+		{
+			sendto_one(source_p, form_str(RPL_LOAD2HI),
+				   me.name, source_p->name, "NAMES");
+			sendto_one(source_p, form_str(RPL_ENDOFNAMES),
+				   me.name, source_p->name, p);
+			return;
+		}
+
 		if((chptr = find_channel(p)) != NULL)
 			channel_member_names(chptr, source_p, 1);
 		else
@@ -91,7 +101,8 @@ m_names(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_
 	{
 		if(!IsOperGeneral(source_p))
 		{
-			if((last_used + ConfigFileEntry.pace_wait) > rb_current_time())
+			if((last_used + ConfigFileEntry.pace_wait) > rb_current_time() ||
+					!ratelimit_client_bulk(source_p))
 			{
 				sendto_one(source_p, form_str(RPL_LOAD2HI),
 					   me.name, source_p->name, "NAMES");
@@ -140,8 +151,8 @@ names_global(struct Client *source_p)
 	/* Second, do all clients in one big sweep */
 	RB_DLINK_FOREACH(ptr, global_client_list.head)
 	{
-		rb_dlink_node *ps, *pt;
-		struct membership *ms, *mt;
+		rb_dlink_node *pt;
+		struct membership *mt;
 
 		target_p = ptr->data;
 		dont_show = false;
@@ -156,11 +167,12 @@ names_global(struct Client *source_p)
 		 * both were missed out above.  if the target is on a
 		 * common channel with source, its already been shown.
 		 */
-		ITER_COMM_CHANNELS(ps, pt, source_p->user->channel.head, target_p->user->channel.head, ms, mt, chptr)
+		RB_DLINK_FOREACH(pt, target_p->user->channel.head)
 		{
-			if (!mt) continue;
+			mt = pt->data;
+			chptr = mt->chptr;
 
-			if (PubChannel(chptr) || SecretChannel(chptr) || ms)
+			if (PubChannel(chptr) || SecretChannel(chptr) || IsMember(source_p, chptr))
 			{
 				dont_show = true;
 				break;
@@ -88,9 +88,12 @@ ms_pong(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_
 	{
 		if(MyConnect(source_p))
 			sendto_realops_snomask(SNO_GENERAL, L_NETWIDE,
-					     "End of burst (emulated) from %s (%d seconds)",
+					     "End of burst (emulated) from %s (%d seconds, %u lines processed in %lu.%03lu seconds)",
 					     source_p->name,
-					     (signed int) (rb_current_time() - source_p->localClient->firsttime));
+					     (signed int) (rb_current_time() - source_p->localClient->firsttime),
+					     source_p->localClient->burst_lines,
+					     source_p->localClient->burst_usec / 1000000,
+					     source_p->localClient->burst_usec / 1000 % 1000);
 		SetEob(source_p);
 		eob_count++;
 		call_hook(h_server_eob, source_p);
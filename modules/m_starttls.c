@@ -25,6 +25,7 @@
 #include "ircd.h"
 #include "numeric.h"
 #include "send.h"
+#include "packet.h"
 #include "msg.h"
 #include "modules.h"
 #include "sslproc.h"
@@ -94,7 +95,7 @@ mr_starttls(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *sou
 	s_assert(client_p->localClient != NULL);
 
 	/* clear out any remaining plaintext lines */
-	rb_linebuf_donebuf(&client_p->localClient->buf_recvq);
+	discard_recvq(client_p->localClient);
 
 	sendto_one_numeric(client_p, RPL_STARTTLS, form_str(RPL_STARTTLS));
 	send_queued(client_p);
@@ -46,6 +46,8 @@
 #include "whowas.h"
 #include "rb_radixtree.h"
 #include "sslproc.h"
+#include "metrics.h"
+#include "zlink.h"
 #include "s_assert.h"
 
 static const char stats_desc[] =
@@ -70,7 +72,7 @@ mapi_hlist_av1 stats_hlist[] = {
 
 DECLARE_MODULE_AV2(stats, NULL, NULL, stats_clist, stats_hlist, NULL, NULL, NULL, stats_desc);
 
-const char *Lformat = "%s %d %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" :%"PRId64" %"PRId64" %s";
+const char *Lformat = "%s %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" :%"PRId64" %"PRId64" %s%s";
 
 static void stats_l_list(struct Client *s, const char *, bool, bool, rb_dlink_list *, char,
 				bool (*check_fn)(struct Client *source_p, struct Client *target_p));
@@ -100,11 +102,14 @@ static void stats_tdeny(struct Client *);
 static void stats_deny(struct Client *);
 static void stats_exempt(struct Client *);
 static void stats_events(struct Client *);
+static void stats_hooks(struct Client *);
 static void stats_prop_klines(struct Client *);
 static void stats_auth(struct Client *);
 static void stats_tklines(struct Client *);
 static void stats_klines(struct Client *);
 static void stats_messages(struct Client *);
+static void stats_cmdprof(struct Client *);
+static void stats_cmdprof_raw(struct Client *);
 static void stats_dnsbl(struct Client *);
 static void stats_oper(struct Client *);
 static void stats_privset(struct Client *);
@@ -125,6 +130,7 @@ static void stats_memory(struct Client *);
 static void stats_servlinks(struct Client *);
 static void stats_ltrace(struct Client *, int, const char **);
 static void stats_comm(struct Client *);
+static void stats_loop(struct Client *);
 static void stats_capability(struct Client *);
 
 #define HANDLER_NORM(fn, admin, priv) \
@@ -154,8 +160,11 @@ static struct stats_cmd stats_cmd_table[256] = {
 	['f'] = HANDLER_NORM(stats_comm,	true,	NULL),
 	['F'] = HANDLER_NORM(stats_comm,	true,	NULL),
 	['g'] = HANDLER_NORM(stats_prop_klines,	false,	"oper:general"),
+	['H'] = HANDLER_NORM(stats_hooks,	true,	NULL),
 	['i'] = HANDLER_NORM(stats_auth,	false,	NULL),
 	['I'] = HANDLER_NORM(stats_auth,	false,	NULL),
+	['j'] = HANDLER_NORM(stats_cmdprof,	false,	"oper:general"),
+	['J'] = HANDLER_NORM(stats_cmdprof_raw,	false,	"oper:general"),
 	['k'] = HANDLER_NORM(stats_tklines,	false,	NULL),
 	['K'] = HANDLER_NORM(stats_klines,	false,	NULL),
 	['l'] = HANDLER_PARV(stats_ltrace,	false,	NULL),
@@ -178,6 +187,7 @@ static struct stats_cmd stats_cmd_table[256] = {
 	['u'] = HANDLER_NORM(stats_uptime,	false,	NULL),
 	['v'] = HANDLER_NORM(stats_servers,	false,	NULL),
 	['V'] = HANDLER_NORM(stats_servers,	false,	NULL),
+	['W'] = HANDLER_NORM(stats_loop,	false,	"oper:general"),
 	['x'] = HANDLER_NORM(stats_tgecos,	false,	"oper:general"),
 	['X'] = HANDLER_NORM(stats_gecos,	false,	"oper:general"),
 	['y'] = HANDLER_NORM(stats_class,	false,	NULL),
@@ -284,6 +294,11 @@ stats_dns_servers (struct Client *source_p)
 	{
 		sendto_one_numeric(source_p, RPL_STATSDEBUG, "A :%s", (char *)n->data);
 	}
+
+	RB_DLINK_FOREACH(n, authd_timings.head)
+	{
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "A :authd %s", (char *)n->data);
+	}
 }
 
 static void
@@ -313,6 +328,7 @@ stats_hash(struct Client *source_p)
 
 	rb_dictionary_stats_walk(stats_hash_cb, source_p);
 	rb_radixtree_stats_walk(stats_hash_cb, source_p);
+	membership_hash_stats(stats_hash_cb, source_p);
 }
 
 static void
@@ -347,6 +363,8 @@ stats_connect(struct Client *source_p)
 				*s++ = 'A';
 			if(ServerConfSCTP(server_p))
 				*s++ = 'M';
+			if(ServerConfCompressed(server_p))
+				*s++ = 'Z';
 			if(ServerConfSSL(server_p))
 				*s++ = 'S';
 			if(ServerConfTb(server_p))
@@ -495,6 +513,33 @@ stats_events (struct Client *source_p)
 	rb_dump_events(stats_events_cb, source_p);
 }
 
+static void
+stats_hooks(struct Client *source_p)
+{
+	hook *h;
+	int i;
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "H :%-30s %-9s %-12s %-12s %s",
+			"NAME", "LISTENERS", "CALLS", "TOTAL USEC", "AVG NSEC");
+
+	for(i = 0; i < max_hooks; i++)
+	{
+		h = &hooks[i];
+
+		if(h->name == NULL || (h->nfns == 0 && h->calls == 0))
+			continue;
+
+		/* hooks are only timed while command_profiling is on */
+		if(!ConfigFileEntry.command_profiling || h->timed == 0)
+			sendto_one_numeric(source_p, RPL_STATSDEBUG, "H :%-30s %-9d %-12lu %-12s %s",
+					h->name, h->nfns, h->calls, "-", "-");
+		else
+			sendto_one_numeric(source_p, RPL_STATSDEBUG, "H :%-30s %-9d %-12lu %-12llu %llu",
+					h->name, h->nfns, h->calls, h->nsec / 1000,
+					h->nsec / h->timed);
+	}
+}
+
 static void
 stats_prop_klines(struct Client *source_p)
 {
@@ -721,6 +766,83 @@ stats_messages(struct Client *source_p)
 	}
 }
 
+static const char *handler_type_name[LAST_HANDLER_TYPE] = {
+	"unregistered", "client", "remote", "server", "encap", "oper"
+};
+
+static void
+stats_cmdprof(struct Client *source_p)
+{
+	rb_dictionary_iter iter;
+	struct Message *msg;
+	struct MessageProfile *prof;
+	int i;
+
+	if(!ConfigFileEntry.command_profiling)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"j :command_profiling is disabled, showing previous results");
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "j :%-16s %-12s %-10s %-12s %-8s %s",
+			"COMMAND", "HANDLER", "CALLS", "TOTAL USEC", "AVG USEC", "MAX USEC");
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict)
+	{
+		if(msg->profile == NULL)
+			continue;
+
+		for(i = 0; i < LAST_HANDLER_TYPE; i++)
+		{
+			prof = &msg->profile[i];
+
+			if(prof->calls == 0)
+				continue;
+
+			sendto_one_numeric(source_p, RPL_STATSDEBUG,
+					"j :%-16s %-12s %-10lu %-12llu %-8llu %llu",
+					msg->cmd, handler_type_name[i], prof->calls,
+					prof->total_ns / 1000,
+					prof->total_ns / prof->calls / 1000,
+					prof->max_ns / 1000);
+		}
+	}
+}
+
+/* one line per command and handler type:
+ *   command handler calls total_ns max_ns bucket0,bucket1,...
+ * see MSG_PROFILE_BUCKETS for the bucket boundaries
+ */
+static void
+stats_cmdprof_raw(struct Client *source_p)
+{
+	char buf[BUFSIZE];
+	rb_dictionary_iter iter;
+	struct Message *msg;
+	struct MessageProfile *prof;
+	int i, j;
+
+	RB_DICTIONARY_FOREACH(msg, &iter, cmd_dict)
+	{
+		if(msg->profile == NULL)
+			continue;
+
+		for(i = 0; i < LAST_HANDLER_TYPE; i++)
+		{
+			prof = &msg->profile[i];
+
+			if(prof->calls == 0)
+				continue;
+
+			buf[0] = '\0';
+			for(j = 0; j < MSG_PROFILE_BUCKETS; j++)
+				rb_snprintf_append(buf, sizeof buf, "%s%lu", j ? "," : "", prof->hist[j]);
+
+			sendto_one_numeric(source_p, RPL_STATSDEBUG, "J :%s %s %lu %llu %llu %s",
+					msg->cmd, handler_type_name[i], prof->calls,
+					prof->total_ns, prof->max_ns, buf);
+		}
+	}
+}
+
 static void
 stats_dnsbl(struct Client *source_p)
 {
@@ -732,9 +854,14 @@ stats_dnsbl(struct Client *source_p)
 
 	RB_DICTIONARY_FOREACH(entry, &iter, dnsbl_stats)
 	{
+		unsigned int lookups = entry->cache_hits + entry->coalesced + entry->queries;
+
 		/* use RPL_STATSDEBUG for now -- jilles */
-		sendto_one_numeric(source_p, RPL_STATSDEBUG, "n :%d %s",
-				entry->hits, entry->host);
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				"n :%d %s (%u lookups, %u%% cached, %u%% coalesced)",
+				entry->hits, entry->host, lookups,
+				lookups ? entry->cache_hits * 100 / lookups : 0,
+				lookups ? entry->coalesced * 100 / lookups : 0);
 	}
 }
 
@@ -976,36 +1103,9 @@ stats_usage (struct Client *source_p)
 static void
 stats_tstats (struct Client *source_p)
 {
-	struct Client *target_p;
 	struct ServerStatistics sp;
-	rb_dlink_node *ptr;
-
-	memcpy(&sp, &ServerStats, sizeof(struct ServerStatistics));
-
-	RB_DLINK_FOREACH(ptr, serv_list.head)
-	{
-		target_p = ptr->data;
-
-		sp.is_sbs += target_p->localClient->sendB;
-		sp.is_sbr += target_p->localClient->receiveB;
-		sp.is_sti += (unsigned long long)(rb_current_time() - target_p->localClient->firsttime);
-		sp.is_sv++;
-	}
-
-	RB_DLINK_FOREACH(ptr, lclient_list.head)
-	{
-		target_p = ptr->data;
-
-		sp.is_cbs += target_p->localClient->sendB;
-		sp.is_cbr += target_p->localClient->receiveB;
-		sp.is_cti += (unsigned long long)(rb_current_time() - target_p->localClient->firsttime);
-		sp.is_cl++;
-	}
 
-	RB_DLINK_FOREACH(ptr, unknown_list.head)
-	{
-		sp.is_ni++;
-	}
+	metrics_collect_stats(&sp);
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :accepts %u refused %u", sp.is_ac, sp.is_ref);
@@ -1033,6 +1133,9 @@ stats_tstats (struct Client *source_p)
 			   sp.is_tgch, rb_dlink_list_length(&tgchange_list));
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :ratelimit blocked commands %u", sp.is_rl);
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			   "T :sendq memory blocked commands %u dropped clients %u",
+			   sp.is_sqthr, sp.is_sqshed);
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
 			   "T :auth successes %u fails %u",
 			   sp.is_asuc, sp.is_abad);
@@ -1115,7 +1218,7 @@ stats_servers (struct Client *source_p)
 				   target_p->name,
 				   (target_p->serv->by[0] ? target_p->serv->by : "Remote."),
 				   (int) (rb_current_time() - target_p->localClient->lasttime),
-				   (int) rb_linebuf_len (&target_p->localClient->buf_sendq),
+				   (int) sendq_length(target_p),
 				   days, (days == 1) ? "" : "s", hours, minutes,
 				   (int) seconds);
 	}
@@ -1395,8 +1498,9 @@ stats_memory (struct Client *source_p)
 static void
 stats_servlinks (struct Client *source_p)
 {
-	static char Sformat[] = ":%s %d %s %s %d %"PRIu32" %"PRIu32" %"PRIu32" %"PRIu32" :%"PRId64" %"PRId64" %s";
-	long uptime, sendK, receiveK;
+	static char Sformat[] = ":%s %d %s %s %d %"PRIu64" %"PRIu64" %"PRIu64" %"PRIu64" :%"PRId64" %"PRId64" %s";
+	long uptime;
+	uint64_t sendK, receiveK;
 	struct Client *target_p;
 	rb_dlink_node *ptr;
 	int j = 0;
@@ -1417,21 +1521,42 @@ stats_servlinks (struct Client *source_p)
 		target_p = ptr->data;
 
 		j++;
-		sendK += target_p->localClient->sendK;
-		receiveK += target_p->localClient->receiveK;
+		sendK += target_p->localClient->sendB >> 10;
+		receiveK += target_p->localClient->receiveB >> 10;
 
 		sendto_one(source_p, Sformat,
 			get_id(&me, source_p), RPL_STATSLINKINFO, get_id(source_p, source_p),
 			target_p->name,
-			rb_linebuf_len(&target_p->localClient->buf_sendq),
+			sendq_length(target_p),
 			target_p->localClient->sendM,
-			target_p->localClient->sendK,
+			target_p->localClient->sendB >> 10,
 			target_p->localClient->receiveM,
-			target_p->localClient->receiveK,
+			target_p->localClient->receiveB >> 10,
 			(int64_t)(rb_current_time() - target_p->localClient->firsttime),
 			(int64_t)((rb_current_time() > target_p->localClient->lasttime) ?
 			 (rb_current_time() - target_p->localClient->lasttime) : 0),
 			IsOperGeneral (source_p) ? show_capabilities (target_p) : "TS");
+
+		sendto_one_numeric(source_p, RPL_STATSDEBUG,
+				   "? :%s sendq: %u control, %u state, %u bulk",
+				   target_p->name,
+				   rb_linebuf_len(&target_p->localClient->buf_sendq_control),
+				   rb_linebuf_len(&target_p->localClient->buf_sendq),
+				   rb_linebuf_len(&target_p->localClient->buf_sendq_bulk));
+
+		if(target_p->localClient->zlink != NULL)
+		{
+			struct zlink_stats zs;
+
+			zlink_get_stats(target_p->localClient->zlink, &zs);
+			sendto_one_numeric(source_p, RPL_STATSDEBUG,
+					   "? :%s zlib level %d: sent %llu bytes as %llu (%.1f%%), received %llu as %llu (%.1f%%)",
+					   target_p->name, zs.level,
+					   zs.out_plain, zs.out,
+					   zs.out_plain ? 100.0 * zs.out / zs.out_plain : 100.0,
+					   zs.in_plain, zs.in,
+					   zs.in_plain ? 100.0 * zs.in / zs.in_plain : 100.0);
+		}
 	}
 
 	sendto_one_numeric(source_p, RPL_STATSDEBUG,
@@ -1447,15 +1572,17 @@ stats_servlinks (struct Client *source_p)
 			   buf, _GMKs (receiveK));
 
 	uptime = (rb_current_time() - startup_time);
+	sendK = me.localClient->sendB >> 10;
+	receiveK = me.localClient->receiveB >> 10;
 	snprintf(buf, sizeof buf, "%7.2f %s (%4.1f K/s)",
-			   _GMKv (me.localClient->sendK),
-			   _GMKs (me.localClient->sendK),
-			   (float) ((float) me.localClient->sendK / (float) uptime));
+			   _GMKv (sendK),
+			   _GMKs (sendK),
+			   (float) ((float) sendK / (float) uptime));
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "? :Server send: %s", buf);
 	snprintf(buf, sizeof buf, "%7.2f %s (%4.1f K/s)",
-			   _GMKv (me.localClient->receiveK),
-			   _GMKs (me.localClient->receiveK),
-			   (float) ((float) me.localClient->receiveK / (float) uptime));
+			   _GMKv (receiveK),
+			   _GMKs (receiveK),
+			   (float) ((float) receiveK / (float) uptime));
 	sendto_one_numeric(source_p, RPL_STATSDEBUG, "? :Server recv: %s", buf);
 }
 
@@ -1593,6 +1720,23 @@ stats_l_list(struct Client *source_p, const char *name, bool doall, bool wilds,
 	}
 }
 
+/* what the kernel holds for the connection, so opers can tell a
+ * backed up sendq from a slow network
+ */
+static const char *
+stats_l_kernel(struct Client *source_p, struct Client *target_p)
+{
+	static char buf[128];
+	struct rb_tcp_info info;
+
+	if(!IsOperGeneral(source_p) || !rb_get_tcp_info(target_p->localClient->F, &info))
+		return "";
+
+	snprintf(buf, sizeof(buf), " tcp:sendq=%u,recvq=%u,unacked=%u,cwnd=%u,rtt=%uus",
+			info.sendq, info.recvq, info.unacked, info.cwnd, info.rtt);
+	return buf;
+}
+
 void
 stats_l_client(struct Client *source_p, struct Client *target_p,
 		char statchar)
@@ -1601,15 +1745,16 @@ stats_l_client(struct Client *source_p, struct Client *target_p,
 	{
 		sendto_one_numeric(source_p, RPL_STATSLINKINFO, Lformat,
 				target_p->name,
-				rb_linebuf_len(&target_p->localClient->buf_sendq),
+				sendq_length(target_p),
 				target_p->localClient->sendM,
-				target_p->localClient->sendK,
+				target_p->localClient->sendB >> 10,
 				target_p->localClient->receiveM,
-				target_p->localClient->receiveK,
+				target_p->localClient->receiveB >> 10,
 				(int64_t)(rb_current_time() - target_p->localClient->firsttime),
 				(int64_t)((rb_current_time() > target_p->localClient->lasttime) ?
 				 (rb_current_time() - target_p->localClient->lasttime) : 0),
-				IsOperGeneral(source_p) ? show_capabilities(target_p) : "-");
+				IsOperGeneral(source_p) ? show_capabilities(target_p) : "-",
+				stats_l_kernel(source_p, target_p));
 	}
 
 	else
@@ -1628,15 +1773,15 @@ stats_l_client(struct Client *source_p, struct Client *target_p,
 				     get_client_name(target_p, SHOW_IP) :
 				     get_client_name(target_p, HIDE_IP)) :
 				    get_client_name(target_p, MASK_IP),
-				    hdata_showidle.approved ? rb_linebuf_len(&target_p->localClient->buf_sendq) : 0,
-				    hdata_showidle.approved ? target_p->localClient->sendM : (uint32_t)0,
-				    hdata_showidle.approved ? target_p->localClient->sendK : (uint32_t)0,
-				    hdata_showidle.approved ? target_p->localClient->receiveM : (uint32_t)0,
-				    hdata_showidle.approved ? target_p->localClient->receiveK : (uint32_t)0,
+				    hdata_showidle.approved ? sendq_length(target_p) : 0,
+				    hdata_showidle.approved ? target_p->localClient->sendM : (uint64_t)0,
+				    hdata_showidle.approved ? target_p->localClient->sendB >> 10 : (uint64_t)0,
+				    hdata_showidle.approved ? target_p->localClient->receiveM : (uint64_t)0,
+				    hdata_showidle.approved ? target_p->localClient->receiveB >> 10 : (uint64_t)0,
 				    (int64_t)(rb_current_time() - target_p->localClient->firsttime),
 				    (int64_t)((rb_current_time() > target_p->localClient->lasttime) && hdata_showidle.approved ?
 				     (rb_current_time() - target_p->localClient->lasttime) : 0),
-				    "-");
+				    "-", hdata_showidle.approved ? stats_l_kernel(source_p, target_p) : "");
 	}
 }
 
@@ -1652,3 +1797,76 @@ stats_comm(struct Client *source_p)
 {
 	rb_dump_fd(rb_dump_fd_callback, source_p);
 }
+
+static void
+stats_loop_histogram(struct Client *source_p, const char *name, const struct rb_histogram *hist)
+{
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "W :%-16s %-10llu %-8llu %-8llu %-8llu %-8llu %llu",
+			name, hist->count,
+			hist->count ? hist->sum / hist->count : 0,
+			rb_histogram_percentile(hist, 50),
+			rb_histogram_percentile(hist, 90),
+			rb_histogram_percentile(hist, 99),
+			hist->max);
+}
+
+static void
+stats_sendq_memory(struct Client *source_p)
+{
+	struct Client *largest[10];
+	int count, i;
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			"W :Sendq memory %lu bytes (peak %lu), soft limit %d, hard limit %d%s",
+			sendq_total, sendq_peak,
+			ConfigFileEntry.sendq_soft_limit, ConfigFileEntry.sendq_hard_limit,
+			sendq_pressure() ? ", holding back bulk output" : "");
+
+	count = sendq_largest(largest, sizeof(largest) / sizeof(largest[0]));
+	for(i = 0; i < count; i++)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "W :Sendq %u bytes, %u lines: %s",
+				sendq_length(largest[i]),
+				rb_linebuf_numlines(&largest[i]->localClient->buf_sendq) +
+				rb_linebuf_numlines(&largest[i]->localClient->buf_sendq_control) +
+				rb_linebuf_numlines(&largest[i]->localClient->buf_sendq_bulk),
+				get_client_name(largest[i], HIDE_IP));
+}
+
+static void
+stats_loop(struct Client *source_p)
+{
+	const struct rb_loop_stats *ls = rb_lib_loop_stats();
+	struct metrics_queues mq;
+	char name[32];
+	int i;
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG,
+			"W :Loop %llu iterations, %llu wakeups, %llu ms waiting, %d/%d fds open",
+			ls->iterations, ls->wakeups, ls->wait_us / 1000,
+			rb_getnumfds(), rb_getmaxconnect());
+
+	sendto_one_numeric(source_p, RPL_STATSDEBUG, "W :%-16s %-10s %-8s %-8s %-8s %-8s %s",
+			"NAME", "COUNT", "AVG", "P50", "P90", "P99", "MAX");
+
+	stats_loop_histogram(source_p, "iteration usec", &ls->iteration);
+	stats_loop_histogram(source_p, "busy usec", &ls->busy);
+	stats_loop_histogram(source_p, "handlers usec", &ls->handlers);
+	stats_loop_histogram(source_p, "timers usec", &ls->timers);
+	stats_loop_histogram(source_p, "events/wakeup", &ls->events);
+
+	metrics_collect_queues(&mq);
+
+	for(i = 0; i < METRICS_CONN_LAST; i++)
+	{
+		snprintf(name, sizeof name, "sendq %s", metrics_conn_type_name[i]);
+		stats_loop_histogram(source_p, name, &mq.sendq[i]);
+		snprintf(name, sizeof name, "recvq %s", metrics_conn_type_name[i]);
+		stats_loop_histogram(source_p, name, &mq.recvq[i]);
+	}
+
+	for(i = 0; i < METRICS_CONN_LAST; i++)
+		sendto_one_numeric(source_p, RPL_STATSDEBUG, "W :%u %s connections, %u blocked on write",
+				mq.conns[i], metrics_conn_type_name[i], mq.flushing[i]);
+
+	stats_sendq_memory(source_p);
+}
@@ -0,0 +1,117 @@
+/*
+ * Comet: a slightly advanced ircd
+ * m_upgrade.c: Re-runs the ircd binary without dropping connections.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include "stdinc.h"
+#include "client.h"
+#include "match.h"
+#include "ircd.h"
+#include "numeric.h"
+#include "s_conf.h"
+#include "s_newconf.h"
+#include "upgrade.h"
+#include "logger.h"
+#include "send.h"
+#include "msg.h"
+#include "parse.h"
+#include "modules.h"
+#include "hash.h"
+
+static const char upgrade_desc[] = "Provides the UPGRADE command to restart the server without dropping connections";
+
+static void mo_upgrade(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
+static void me_upgrade(struct MsgBuf *, struct Client *, struct Client *, int, const char **);
+static void do_upgrade(struct Client *source_p, const char *servername);
+
+struct Message upgrade_msgtab = {
+	"UPGRADE", 0, 0, 0, 0,
+	{mg_unreg, mg_not_oper, mg_ignore, mg_ignore, {me_upgrade, 1}, {mo_upgrade, 0}}
+};
+
+mapi_clist_av1 upgrade_clist[] = { &upgrade_msgtab, NULL };
+
+DECLARE_MODULE_AV2(upgrade, NULL, NULL, upgrade_clist, NULL, NULL, NULL, NULL, upgrade_desc);
+
+/*
+ * mo_upgrade
+ */
+static void
+mo_upgrade(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p, int parc, const char *parv[])
+{
+	if(!IsOperDie(source_p))
+	{
+		sendto_one(source_p, form_str(ERR_NOPRIVS),
+			   me.name, source_p->name, "die");
+		return;
+	}
+
+	if(parc < 2 || EmptyString(parv[1]))
+	{
+		sendto_one_notice(source_p, ":Need server name /upgrade %s", me.name);
+		return;
+	}
+
+	if(parc > 2)
+	{
+		/* Remote upgrade. Pass it along. */
+		struct Client *server_p = find_server(NULL, parv[2]);
+		if (!server_p)
+		{
+			sendto_one_numeric(source_p, ERR_NOSUCHSERVER, form_str(ERR_NOSUCHSERVER), parv[2]);
+			return;
+		}
+
+		if (!IsMe(server_p))
+		{
+			sendto_one(server_p, ":%s ENCAP %s UPGRADE %s", source_p->name, parv[2], parv[1]);
+			return;
+		}
+	}
+
+	do_upgrade(source_p, parv[1]);
+}
+
+static void
+me_upgrade(struct MsgBuf *msgbuf_p __unused, struct Client *client_p __unused, struct Client *source_p, int parc, const char *parv[])
+{
+	do_upgrade(source_p, parv[1]);
+}
+
+static void
+do_upgrade(struct Client *source_p, const char *servername)
+{
+	const char *error;
+
+	if(irccmp(servername, me.name))
+	{
+		sendto_one_notice(source_p, ":Mismatch on /upgrade %s", me.name);
+		return;
+	}
+
+	sendto_realops_snomask(SNO_GENERAL, L_ALL, "Upgrading server (requested by %s)",
+			get_oper_name(source_p));
+	ilog(L_MAIN, "Server UPGRADE by %s", get_oper_name(source_p));
+
+	/* only comes back if it didn't work */
+	error = upgrade();
+
+	sendto_one_notice(source_p, ":Upgrade failed: %s", error);
+	sendto_realops_snomask(SNO_GENERAL, L_ALL, "Upgrade failed: %s", error);
+	ilog(L_MAIN, "Upgrade failed: %s", error);
+}
@@ -166,6 +166,8 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 		if(source_p->user == NULL)
 			return;
 
+		/* the first channel by name, not by when it was joined */
+		sort_user_channels(source_p);
 		if((lp = source_p->user->channel.head) != NULL)
 		{
 			msptr = lp->data;
@@ -198,7 +200,8 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 
 		if(chptr != NULL)
 		{
-			if (!IsOperGeneral(source_p) && !ratelimit_client_who(source_p, rb_dlink_list_length(&chptr->members)/50))
+			if (!IsOperGeneral(source_p) && (!ratelimit_client_bulk(source_p) ||
+					!ratelimit_client_who(source_p, rb_dlink_list_length(&chptr->members)/50)))
 			{
 				sendto_one(source_p, form_str(RPL_LOAD2HI),
 						me.name, source_p->name, "WHO");
@@ -229,6 +232,7 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 		int isinvis = 0;
 
 		isinvis = IsInvisible(target_p);
+		sort_user_channels(target_p);
 		RB_DLINK_FOREACH(lp, target_p->user->channel.head)
 		{
 			msptr = lp->data;
@@ -262,7 +266,8 @@ m_who(struct MsgBuf *msgbuf_p, struct Client *client_p, struct Client *source_p,
 	/* it has to be a global who at this point, limit it */
 	if(!IsOperGeneral(source_p))
 	{
-		if((last_used + ConfigFileEntry.pace_wait) > rb_current_time() || !ratelimit_client(source_p, 1))
+		if((last_used + ConfigFileEntry.pace_wait) > rb_current_time() ||
+				!ratelimit_client_bulk(source_p) || !ratelimit_client(source_p, 1))
 		{
 			sendto_one(source_p, form_str(RPL_LOAD2HI),
 					me.name, source_p->name, "WHO");
@@ -256,17 +256,20 @@ single_whois(struct Client *source_p, struct Client *target_p, int operspy)
 	if (!IsService(target_p))
 	{
 		hook_data_channel_visibility hdata_vis;
-		rb_dlink_node *ps, *pt;
+		rb_dlink_node *pt;
 		struct Channel *chptr;
 		struct membership *ms, *mt;
 
 		hdata_vis.client = source_p;
 		hdata_vis.target = target_p;
 
-		ITER_COMM_CHANNELS(ps, pt, source_p->user->channel.head, target_p->user->channel.head, ms, mt, chptr)
+		sort_user_channels(target_p);
+
+		RB_DLINK_FOREACH(pt, target_p->user->channel.head)
 		{
-			if (mt == NULL)
-				continue;
+			mt = pt->data;
+			chptr = mt->chptr;
+			ms = find_channel_membership(chptr, source_p);
 
 			hdata_vis.chptr = chptr;
 			hdata_vis.clientms = ms;
@@ -0,0 +1,233 @@
+/*
+ *  authproc1.c: Test clients admitted while advisory authd checks run
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "authproc.h"
+#include "class.h"
+#include "client.h"
+#include "s_conf.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define ADMITTED_NICK "admitted"
+
+/* a client authd has been asked about, with a socket to talk to it */
+static struct Client *
+auth_client(struct Client *client_p, rb_fde_t **peer)
+{
+	rb_fde_t *F;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F, peer, "authproc test") < 0)
+		return NULL;
+	client_p->localClient->F = F;
+	authd_initiate_client(client_p, false);
+	return client_p;
+}
+
+/* the auth {} block a registered client has; it goes when they do */
+static void
+registered(struct Client *client_p)
+{
+	struct ConfItem *aconf = make_conf();
+
+	aconf->status = CONF_CLIENT | CONF_ILLEGAL;
+	aconf->c_class = make_class();
+	MaxUsers(aconf->c_class) = -1;
+	aconf->clients = 1;
+	client_p->localClient->att_conf = aconf;
+	free_pre_client(client_p);
+}
+
+/* what authd says, as parse_authd_reply() would have read it */
+static void
+authd_says(const char *fmt, ...)
+{
+	char line[BUFSIZE];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	authd_parse_line(line);
+}
+
+static void
+admit_late_reject_unregistered(void)
+{
+	struct Client *client_p;
+	rb_fde_t *peer;
+	uint32_t cid;
+
+	if((client_p = auth_client(make_local_unknown(), &peer)) == NULL)
+	{
+		skip("no socketpair");
+		return;
+	}
+	cid = client_p->preClient->auth.cid;
+	ok(cid != 0, MSG);
+
+	authd_says("A %x ~user admitted.test B", cid);
+	is_int(cid, client_p->localClient->authd_cid, MSG);
+	is_bool(true, client_p->preClient->auth.accepted, MSG);
+	is_string("admitted.test", client_p->host, MSG);
+
+	/* registering is refused from now on */
+	authd_says("R %x B ~user admitted.test dnsbl.test :Listed in ${dnsbl-host}", cid);
+	is_int(0, client_p->localClient->authd_cid, MSG);
+	is_bool(false, client_p->preClient->auth.accepted, MSG);
+	is_int('B', client_p->preClient->auth.cause, MSG);
+	is_string("dnsbl.test", client_p->preClient->auth.data, MSG);
+	is_bool(false, IsAnyDead(client_p), MSG);
+
+	/* and a second answer for the same client is ignored */
+	authd_says("A %x ~user admitted.test", cid);
+	is_bool(false, client_p->preClient->auth.accepted, MSG);
+
+	remove_local_person(client_p);
+	rb_close(peer);
+}
+
+static void
+admit_late_reject_registered(void)
+{
+	struct Client *client_p;
+	rb_fde_t *peer;
+	uint32_t cid;
+
+	if((client_p = auth_client(make_local_person_nick(ADMITTED_NICK), &peer)) == NULL)
+	{
+		skip("no socketpair");
+		return;
+	}
+	cid = client_p->preClient->auth.cid;
+
+	authd_says("A %x ~user admitted.test B", cid);
+	is_int(cid, client_p->localClient->authd_cid, MSG);
+	registered(client_p);
+
+	authd_says("R %x B ~user admitted.test dnsbl.test :Listed in ${dnsbl-host}", cid);
+	is_int(0, client_p->localClient->authd_cid, MSG);
+	is_bool(true, IsAnyDead(client_p), MSG);
+
+	rb_close(peer);
+}
+
+/* plain accept after the advisory checks pass */
+static void
+admit_accept(void)
+{
+	struct Client *client_p;
+	rb_fde_t *peer;
+	uint32_t cid;
+
+	if((client_p = auth_client(make_local_person_nick(ADMITTED_NICK), &peer)) == NULL)
+	{
+		skip("no socketpair");
+		return;
+	}
+	cid = client_p->preClient->auth.cid;
+
+	authd_says("A %x ~user admitted.test B", cid);
+	is_int(cid, client_p->localClient->authd_cid, MSG);
+	authd_says("A %x ~user admitted.test", cid);
+	is_int(0, client_p->localClient->authd_cid, MSG);
+	is_bool(false, IsAnyDead(client_p), MSG);
+
+	remove_local_person(client_p);
+	rb_close(peer);
+}
+
+/* the client leaves in the same read that admits it */
+static void
+admit_exit(void)
+{
+	struct Client *client_p;
+	rb_fde_t *peer;
+	uint32_t cid;
+
+	if((client_p = auth_client(make_local_person_nick(ADMITTED_NICK), &peer)) == NULL)
+	{
+		skip("no socketpair");
+		return;
+	}
+	cid = client_p->preClient->auth.cid;
+
+	if(!ok(rb_write(peer, "QUIT :bye\r\n", 11) == 11, MSG))
+		return;
+	authd_says("A %x ~user admitted.test B", cid);
+	is_bool(true, IsAnyDead(client_p), MSG);
+	is_int(0, client_p->localClient->authd_cid, MSG);
+
+	/* so a late reject doesn't find it */
+	authd_says("R %x B ~user admitted.test dnsbl.test :Listed in ${dnsbl-host}", cid);
+	is_int(0, client_p->localClient->authd_cid, MSG);
+
+	rb_close(peer);
+}
+
+/* one that is already on its way out isn't admitted at all */
+static void
+admit_dead(void)
+{
+	struct Client *client_p;
+	rb_fde_t *peer;
+	uint32_t cid;
+
+	if((client_p = auth_client(make_local_person_nick(ADMITTED_NICK), &peer)) == NULL)
+	{
+		skip("no socketpair");
+		return;
+	}
+	cid = client_p->preClient->auth.cid;
+
+	client_p->flags |= FLAGS_DEAD;
+	authd_says("A %x ~user admitted.test B", cid);
+	is_int(0, client_p->localClient->authd_cid, MSG);
+
+	client_p->flags &= ~FLAGS_DEAD;
+	remove_local_person(client_p);
+	rb_close(peer);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	admit_late_reject_unregistered();
+	admit_late_reject_registered();
+	admit_accept();
+	admit_exit();
+	admit_dead();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
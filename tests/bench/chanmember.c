@@ -0,0 +1,148 @@
+/*
+ *  chanmember.c: Benchmark channel membership lookups
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include <stdinc.h>
+#include <time.h>
+#include <channel.h>
+#include <hash.h>
+
+#include "client_util.h"
+#include "ircd_util.h"
+#include "tap/basic.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define SERVICE_CHANNELS	10000
+#define BIG_CHANNELS		100
+#define BIG_MEMBERS		500
+#define LOOKUPS			1000000
+
+static struct Client *service;
+static struct Client *members[BIG_MEMBERS];
+static struct Channel *channels[SERVICE_CHANNELS];
+
+static double
+elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/* the lookup find_channel_membership() used to do, for comparison */
+static struct membership *
+find_membership_walk(struct Channel *chptr, struct Client *client_p)
+{
+	rb_dlink_node *ptr;
+
+	if(rb_dlink_list_length(&chptr->members) < rb_dlink_list_length(&client_p->user->channel))
+	{
+		RB_DLINK_FOREACH(ptr, chptr->members.head)
+			if(((struct membership *)ptr->data)->client_p == client_p)
+				return ptr->data;
+	}
+	else
+	{
+		RB_DLINK_FOREACH(ptr, client_p->user->channel.head)
+			if(((struct membership *)ptr->data)->chptr == chptr)
+				return ptr->data;
+	}
+
+	return NULL;
+}
+
+/* a service in every channel, and the first channels are big */
+static void
+setup(void)
+{
+	char name[CHANNELLEN];
+	char nick[NICKLEN];
+	bool isnew;
+	int i, j;
+
+	service = make_local_person_nick("service");
+
+	for(i = 0; i < SERVICE_CHANNELS; i++)
+	{
+		snprintf(name, sizeof name, "#chan%d", i);
+		channels[i] = get_or_create_channel(service, name, &isnew);
+		add_user_to_channel(channels[i], service, CHFL_CHANOP);
+	}
+
+	for(i = 0; i < BIG_MEMBERS; i++)
+	{
+		snprintf(nick, sizeof nick, "member%d", i);
+		members[i] = make_local_person_nick(nick);
+		for(j = 0; j < BIG_CHANNELS; j++)
+			add_user_to_channel(channels[j], members[i], CHFL_PEON);
+	}
+}
+
+static void
+teardown(void)
+{
+	int i;
+
+	remove_user_from_channels(service);
+	for(i = 0; i < BIG_MEMBERS; i++)
+		remove_local_person(members[i]);
+	remove_local_person(service);
+}
+
+static double
+bench(struct membership *(*find)(struct Channel *, struct Client *), int nchannels, int count)
+{
+	struct timespec start, end;
+	unsigned int seed = 1;
+	int i, found = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		found += find(channels[(seed >> 8) % nchannels], service) != NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	is_int(count, found, MSG);
+	return elapsed_ns(&start, &end) / count;
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	setup();
+
+	/* the list walk costs the shorter of the two lists, so do fewer */
+	diag("any channel: hash %.1f ns/lookup, list walk %.1f ns/lookup",
+			bench(find_channel_membership, SERVICE_CHANNELS, LOOKUPS),
+			bench(find_membership_walk, SERVICE_CHANNELS, LOOKUPS / 100));
+	diag("big channel: hash %.1f ns/lookup, list walk %.1f ns/lookup",
+			bench(find_channel_membership, BIG_CHANNELS, LOOKUPS),
+			bench(find_membership_walk, BIG_CHANNELS, LOOKUPS / 100));
+
+	teardown();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
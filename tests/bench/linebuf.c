@@ -0,0 +1,115 @@
+/*
+ *  linebuf.c: Benchmark the rb_linebuf end of line scanners
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define STREAM_SIZE	(1024 * 1024)
+#define BENCH_ROUNDS	200
+
+/* every scanner the library might have; "byte" is the original loop */
+static const char *scanners[] = { "byte", "swar", "sse2", "avx2", "neon", NULL };
+
+static char stream[STREAM_SIZE];
+static int stream_len;
+
+/* burst-like traffic: random lines of up to 500 bytes */
+static void
+make_stream(void)
+{
+	unsigned int seed = 1;
+	int i, len;
+
+	stream_len = 0;
+	while(stream_len < STREAM_SIZE - 600)
+	{
+		seed = seed * 1103515245 + 12345;
+		len = (seed >> 8) % 500;
+		for(i = 0; i < len; i++)
+			stream[stream_len++] = 'a' + i % 26;
+		stream[stream_len++] = '\r';
+		stream[stream_len++] = '\n';
+	}
+}
+
+/* every line end in the stream, BENCH_ROUNDS times over */
+static int
+scan(void)
+{
+	char *ch, *end_ch;
+	int i, lines = 0;
+
+	for(i = 0; i < BENCH_ROUNDS; i++)
+	{
+		ch = stream;
+		end_ch = stream + stream_len;
+		while(ch < end_ch && (ch = rb_linebuf_find_eol(ch, end_ch - ch)) != NULL)
+		{
+			lines++;
+			ch++;
+		}
+	}
+
+	return lines / BENCH_ROUNDS;
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	double ns;
+	int i, lines, ref = -1;
+
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	diag("the library uses the %s scanner", rb_linebuf_eol_scanner());
+	make_stream();
+
+	for(i = 0; scanners[i] != NULL; i++)
+	{
+		if(!rb_linebuf_set_eol_scanner(scanners[i]))
+		{
+			diag("%s scanner not available", scanners[i]);
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		lines = scan();
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		if(ref < 0)
+			ref = lines;
+		is_int(ref, lines, MSG);
+
+		ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+		diag("%s: %.2f GB/s (%d line ends)", scanners[i],
+				(double)stream_len * BENCH_ROUNDS / ns, lines);
+	}
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ *  numeric.c: Benchmark formatting numerics from their templates
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include <stdinc.h>
+#include <time.h>
+#include <numeric.h>
+#include <send.h>
+
+#include "client_util.h"
+#include "ircd_util.h"
+#include "tap/basic.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define REPLIES		200000
+
+static double
+elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static size_t
+fmt_numeric(char *buf, size_t size, const char *pattern, ...)
+{
+	va_list args;
+	size_t len;
+
+	va_start(args, pattern);
+	len = format_numeric(buf, size, -1, pattern, args);
+	va_end(args);
+	return len;
+}
+
+/* what every reply used to go through, for comparison */
+static size_t
+fmt_printf(char *buf, size_t size, const char *pattern, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, pattern);
+	len = vsnprintf(buf, size, pattern, args);
+	va_end(args);
+	return (size_t)len >= size ? size - 1 : (size_t)len;
+}
+
+static double
+bench_whoreply(size_t (*fmt)(char *, size_t, const char *, ...), int count)
+{
+	struct timespec start, end;
+	char buf[BUFSIZE];
+	size_t total = 0;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < count; i++)
+		total += fmt(buf, sizeof(buf), form_str(RPL_WHOREPLY), TEST_ME_NAME, TEST_NICK, TEST_CHANNEL,
+				TEST_USERNAME, TEST_HOSTNAME, TEST_ME_NAME, TEST_REMOTE_NICK, "H@", i % 10, TEST_REALNAME);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ok(total > 0, MSG);
+	return elapsed_ns(&start, &end) / count;
+}
+
+/* the whole of sendto_one(), tags and sendq included */
+static double
+bench_sendto_one(int count)
+{
+	struct Client *user = make_local_person();
+	struct timespec start, end;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < count; i++)
+	{
+		sendto_one(user, form_str(RPL_WHOREPLY), TEST_ME_NAME, TEST_NICK, TEST_CHANNEL,
+				TEST_USERNAME, TEST_HOSTNAME, TEST_ME_NAME, TEST_REMOTE_NICK, "H@", i % 10, TEST_REALNAME);
+		discard_sendq(user);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	is_int(0, sendq_length(user), MSG);
+	remove_local_person(user);
+	return elapsed_ns(&start, &end) / count;
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	/* warm up both before timing either */
+	bench_whoreply(fmt_numeric, REPLIES / 10);
+	bench_whoreply(fmt_printf, REPLIES / 10);
+
+	diag("RPL_WHOREPLY: template %.1f ns, vsnprintf %.1f ns",
+			bench_whoreply(fmt_numeric, REPLIES),
+			bench_whoreply(fmt_printf, REPLIES));
+	diag("RPL_WHOREPLY: whole sendto_one %.1f ns", bench_sendto_one(REPLIES));
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ *  cache1.c: Test sending cached MOTD and help files
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "cache.h"
+#include "capability.h"
+#include "numeric.h"
+#include "s_conf.h"
+#include "s_serv.h"
+#include "send.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define TEST_MOTD "cache1.motd"
+
+static unsigned int CAP_SERVER_TIME;
+
+static char expected[64 * 1024];
+static char sent[64 * 1024];
+
+static void
+write_file(const char *filename, const char *contents)
+{
+	FILE *f = fopen(filename, "w");
+
+	if(!ok(f != NULL, MSG))
+		return;
+	fputs(contents, f);
+	fclose(f);
+}
+
+/* lines as sendto_one() would have queued them */
+static void
+expect(const char *pattern, ...)
+{
+	char line[DATALEN + 1];
+	va_list args;
+
+	va_start(args, pattern);
+	vsnprintf(line, sizeof(line), pattern, args);
+	va_end(args);
+
+	rb_strlcat(expected, line, sizeof(expected));
+	rb_strlcat(expected, "\r\n", sizeof(expected));
+}
+
+/* everything queued for the client, and how many linebuf lines it took */
+static unsigned int
+drain(struct Client *client)
+{
+	char buf[LINEBUF_SIZE + CRLF_LEN + 1];
+	buf_head_t *sendq;
+	size_t len = 0;
+	unsigned int chunks = 0;
+	int ret;
+
+	while((sendq = sendq_next(client->localClient)) != NULL &&
+			(ret = rb_linebuf_get(sendq, buf, sizeof(buf), LINEBUF_COMPLETE, LINEBUF_RAW)) > 0)
+	{
+		if(len + ret >= sizeof(sent))
+			break;
+		memcpy(sent + len, buf, ret);
+		len += ret;
+		chunks++;
+	}
+
+	sent[len] = '\0';
+	return chunks;
+}
+
+static void
+load_motd(const char *contents)
+{
+	write_file(TEST_MOTD, contents);
+	cache_user_motd();
+}
+
+static void
+expect_motd(struct Client *client, const char **lines, size_t count)
+{
+	expected[0] = '\0';
+	expect(form_str(RPL_MOTDSTART), me.name, client->name, me.name);
+	for(size_t i = 0; i < count; i++)
+		expect(form_str(RPL_MOTD), me.name, client->name, lines[i]);
+	expect(form_str(RPL_ENDOFMOTD), me.name, client->name);
+}
+
+static void
+motd1(void)
+{
+	static const char *lines[] = { "first line", " ", "second        line" };
+	struct Client *user1 = make_local_person_nick("user1");
+	struct Client *user2 = make_local_person_nick("someone_else");
+
+	load_motd("first line\n\nsecond\tline\n");
+
+	/* the whole MOTD fits in one linebuf line */
+	send_user_motd(user1);
+	is_int(1, drain(user1), MSG);
+	expect_motd(user1, lines, ARRAY_SIZE(lines));
+	is_string(expected, sent, MSG);
+
+	/* the next client gets the same render with its own nick */
+	send_user_motd(user2);
+	is_int(1, drain(user2), MSG);
+	expect_motd(user2, lines, ARRAY_SIZE(lines));
+	is_string(expected, sent, MSG);
+
+	remove_local_person(user1);
+	remove_local_person(user2);
+}
+
+static void
+motd_long(void)
+{
+	static char text[100][BUFSIZE];
+	static char file[100 * BUFSIZE];
+	const char *lines[100];
+	struct Client *user = make_local_person_nick("user1");
+	unsigned int chunks;
+
+	file[0] = '\0';
+	for(size_t i = 0; i < ARRAY_SIZE(text); i++)
+	{
+		/* the last one is too long for a line and gets cut down */
+		memset(text[i], 'a' + i % 26, i == ARRAY_SIZE(text) - 1 ? 505 : 300);
+		lines[i] = text[i];
+		rb_strlcat(file, text[i], sizeof(file));
+		rb_strlcat(file, "\n", sizeof(file));
+	}
+	load_motd(file);
+
+	send_user_motd(user);
+	chunks = drain(user);
+	ok(chunks > 1, MSG);
+	ok(chunks < ARRAY_SIZE(lines) / 4, MSG);
+	expect_motd(user, lines, ARRAY_SIZE(lines));
+	is_string(expected, sent, MSG);
+
+	remove_local_person(user);
+}
+
+static void
+motd_tags(void)
+{
+	static const char *lines[] = { "one", "two" };
+	struct Client *user = make_local_person_nick("user1");
+	char *p;
+	unsigned int count = 0;
+
+	load_motd("one\ntwo\n");
+
+	/* a client wanting message tags gets them on every line */
+	user->localClient->caps |= CAP_SERVER_TIME;
+	send_user_motd(user);
+	is_int(ARRAY_SIZE(lines) + 2, drain(user), MSG);
+
+	for(p = sent; *p != '\0'; p = strstr(p, "\r\n") + 2)
+	{
+		ok(!strncmp(p, "@time=", 6), MSG);
+		count++;
+	}
+	is_int(ARRAY_SIZE(lines) + 2, count, MSG);
+
+	user->localClient->caps &= ~CAP_SERVER_TIME;
+	send_user_motd(user);
+	is_int(1, drain(user), MSG);
+	expect_motd(user, lines, ARRAY_SIZE(lines));
+	is_string(expected, sent, MSG);
+
+	remove_local_person(user);
+}
+
+static void
+motd_rehash(void)
+{
+	static const char *before[] = { "before" };
+	static const char *after[] = { "after", "rehash" };
+	struct Client *user = make_local_person_nick("user1");
+
+	load_motd("before\n");
+	send_user_motd(user);
+	drain(user);
+	expect_motd(user, before, ARRAY_SIZE(before));
+	is_string(expected, sent, MSG);
+
+	load_motd("after\nrehash\n");
+	send_user_motd(user);
+	drain(user);
+	expect_motd(user, after, ARRAY_SIZE(after));
+	is_string(expected, sent, MSG);
+
+	remove_local_person(user);
+}
+
+static void
+oper_motd1(void)
+{
+	struct cachefile *saved = oper_motd;
+	struct Client *user = make_local_person_nick("user1");
+
+	write_file(TEST_MOTD, "for opers\n");
+	oper_motd = cache_file(TEST_MOTD, "opers.motd", 0);
+
+	send_oper_motd(user);
+	is_int(1, drain(user), MSG);
+	expected[0] = '\0';
+	expect(form_str(RPL_OMOTDSTART), me.name, user->name);
+	expect(form_str(RPL_OMOTD), me.name, user->name, "for opers");
+	expect(form_str(RPL_ENDOFOMOTD), me.name, user->name);
+	is_string(expected, sent, MSG);
+
+	free_cachefile(oper_motd);
+	oper_motd = saved;
+	remove_local_person(user);
+}
+
+static void
+expect_help(struct Client *client, const char *topic)
+{
+	expected[0] = '\0';
+	expect(form_str(RPL_HELPSTART), me.name, client->name, topic, "HELP topic");
+	expect(form_str(RPL_HELPTXT), me.name, client->name, topic, " ");
+	expect(form_str(RPL_HELPTXT), me.name, client->name, topic, "Some text.");
+	expect(form_str(RPL_ENDOFHELP), me.name, client->name, topic);
+}
+
+static void
+help1(void)
+{
+	struct Client *user = make_local_person_nick("user1");
+	struct cachefile *hptr;
+
+	write_file(TEST_MOTD, "HELP topic\n\nSome text.\n");
+	hptr = cache_file(TEST_MOTD, "topic", HELP_USER);
+
+	send_help(user, hptr, "topic");
+	is_int(1, drain(user), MSG);
+	expect_help(user, "topic");
+	is_string(expected, sent, MSG);
+
+	/* the topic is echoed as it was asked for */
+	send_help(user, hptr, "TOPIC");
+	is_int(4, drain(user), MSG);
+	expect_help(user, "TOPIC");
+	is_string(expected, sent, MSG);
+
+	free_cachefile(hptr);
+	remove_local_person(user);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *motd_path;
+
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	CAP_SERVER_TIME = capability_get(cli_capindex, "server-time", NULL);
+	ok(CAP_SERVER_TIME != 0, MSG);
+
+	motd_path = ircd_paths[IRCD_PATH_IRCD_MOTD];
+	ircd_paths[IRCD_PATH_IRCD_MOTD] = TEST_MOTD;
+
+	motd1();
+	motd_long();
+	motd_tags();
+	motd_rehash();
+	oper_motd1();
+	help1();
+
+	unlink(TEST_MOTD);
+	ircd_paths[IRCD_PATH_IRCD_MOTD] = motd_path;
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ *  chanmember1.c: Test channel membership lookups
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+#include <stdinc.h>
+#include <channel.h>
+#include <hash.h>
+
+#include "client_util.h"
+#include "ircd_util.h"
+#include "tap/basic.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define SERVICE_CHANNELS	10000
+#define BIG_CHANNELS		100
+#define BIG_MEMBERS		500
+
+static struct Client *service;
+static struct Client *user;
+static struct Client *members[BIG_MEMBERS];
+static struct Channel *channels[SERVICE_CHANNELS];
+
+static void
+setup(void)
+{
+	char name[CHANNELLEN];
+	char nick[NICKLEN];
+	bool isnew;
+	int i, j;
+
+	service = make_local_person_nick("service");
+	user = make_local_person_nick("user");
+
+	for(i = 0; i < SERVICE_CHANNELS; i++)
+	{
+		snprintf(name, sizeof name, "#chan%d", i);
+		channels[i] = get_or_create_channel(service, name, &isnew);
+		add_user_to_channel(channels[i], service, CHFL_CHANOP);
+	}
+
+	/* the first channels are big, the user is in every tenth channel */
+	for(i = 0; i < BIG_MEMBERS; i++)
+	{
+		snprintf(nick, sizeof nick, "member%d", i);
+		members[i] = make_local_person_nick(nick);
+		for(j = 0; j < BIG_CHANNELS; j++)
+			add_user_to_channel(channels[j], members[i], CHFL_PEON);
+	}
+
+	for(i = 0; i < SERVICE_CHANNELS; i += 10)
+		add_user_to_channel(channels[i], user, CHFL_PEON);
+}
+
+static void
+lookups(void)
+{
+	struct membership *msptr;
+	int i, good;
+
+	good = 1;
+	for(i = 0; i < SERVICE_CHANNELS; i++)
+	{
+		msptr = find_channel_membership(channels[i], service);
+		if(msptr == NULL || msptr->chptr != channels[i] || msptr->client_p != service ||
+				!is_chanop(msptr))
+			good = 0;
+	}
+	ok(good, MSG);
+
+	good = 1;
+	for(i = 0; i < SERVICE_CHANNELS; i++)
+	{
+		msptr = find_channel_membership(channels[i], user);
+		if((msptr != NULL) != (i % 10 == 0) || (msptr != NULL && msptr->client_p != user))
+			good = 0;
+	}
+	ok(good, MSG);
+
+	good = 1;
+	for(i = 0; i < BIG_MEMBERS; i++)
+	{
+		if(find_channel_membership(channels[0], members[i]) == NULL ||
+				find_channel_membership(channels[BIG_CHANNELS - 1], members[i]) == NULL ||
+				find_channel_membership(channels[BIG_CHANNELS], members[i]) != NULL)
+			good = 0;
+	}
+	ok(good, MSG);
+
+	is_bool(true, IsMember(service, channels[SERVICE_CHANNELS - 1]), MSG);
+	is_bool(false, IsMember(members[0], channels[SERVICE_CHANNELS - 1]), MSG);
+}
+
+static void
+ordering(void)
+{
+	struct membership *msptr, *prev = NULL;
+	struct Channel *chptr;
+	rb_dlink_node *ptr;
+	bool isnew;
+	int good = 1;
+
+	/* #chan10 sorts before #chan2, so joining in numeric order leaves
+	 * the list out of order until someone asks for it sorted
+	 */
+	is_bool(true, service->user->channel_unsorted, MSG);
+	sort_user_channels(service);
+	is_bool(false, service->user->channel_unsorted, MSG);
+	is_int(SERVICE_CHANNELS, rb_dlink_list_length(&service->user->channel), MSG);
+
+	RB_DLINK_FOREACH(ptr, service->user->channel.head)
+	{
+		msptr = ptr->data;
+		if(prev != NULL && irccmp(prev->chptr->chname, msptr->chptr->chname) >= 0)
+			good = 0;
+		prev = msptr;
+	}
+	ok(good, MSG);
+	is_string("#chan0", ((struct membership *)service->user->channel.head->data)->chptr->chname, MSG);
+	is_string("#chan9999", ((struct membership *)service->user->channel.tail->data)->chptr->chname, MSG);
+
+	/* joins in order don't disturb it, and neither do parts */
+	chptr = get_or_create_channel(service, "#zzz", &isnew);
+	add_user_to_channel(chptr, service, CHFL_CHANOP);
+	is_bool(false, service->user->channel_unsorted, MSG);
+	remove_user_from_channel(find_channel_membership(chptr, service));
+	is_bool(false, service->user->channel_unsorted, MSG);
+}
+
+/* WHO shows the first channel by name, whatever order they were joined in */
+static void
+who_first_channel(void)
+{
+	struct Client *joiner, *asker;
+	bool isnew;
+
+	joiner = make_local_person_nick("joiner");
+	asker = make_local_person_nick("asker");
+	add_user_to_channel(get_or_create_channel(joiner, "#zb", &isnew), joiner, CHFL_PEON);
+	add_user_to_channel(get_or_create_channel(joiner, "#za", &isnew), joiner, CHFL_PEON);
+	is_bool(true, joiner->user->channel_unsorted, MSG);
+
+	client_util_parse(asker, "WHO joiner");
+	is_client_sendq_one(":" TEST_ME_NAME " 352 asker #za " TEST_USERNAME " " TEST_HOSTNAME " "
+			TEST_ME_NAME " joiner H :0 " TEST_REALNAME CRLF, asker, MSG);
+	is_client_sendq(":" TEST_ME_NAME " 315 asker joiner :End of /WHO list." CRLF, asker, MSG);
+
+	client_util_parse(joiner, "WHO *");
+	is_client_sendq_one(":" TEST_ME_NAME " 352 joiner #za " TEST_USERNAME " " TEST_HOSTNAME " "
+			TEST_ME_NAME " joiner H :0 " TEST_REALNAME CRLF, joiner, MSG);
+	is_client_sendq(":" TEST_ME_NAME " 315 joiner * :End of /WHO list." CRLF, joiner, MSG);
+
+	remove_user_from_channels(joiner);
+	remove_local_person(joiner);
+	remove_local_person(asker);
+}
+
+static void
+removal(void)
+{
+	struct membership *msptr;
+	int i, good;
+
+	remove_user_from_channels(user);
+	good = 1;
+	for(i = 0; i < SERVICE_CHANNELS; i += 10)
+		if(find_channel_membership(channels[i], user) != NULL)
+			good = 0;
+	ok(good, MSG);
+
+	for(i = 0; i < BIG_MEMBERS; i += 2)
+		remove_user_from_channel(find_channel_membership(channels[0], members[i]));
+	good = 1;
+	for(i = 0; i < BIG_MEMBERS; i++)
+		if((find_channel_membership(channels[0], members[i]) != NULL) != (i % 2 == 1))
+			good = 0;
+	ok(good, MSG);
+
+	/* parting the last member destroys the channel, so forget it */
+	for(i = 1; i < SERVICE_CHANNELS / 2; i++)
+	{
+		msptr = find_channel_membership(channels[i], service);
+		remove_user_from_channel(msptr);
+		channels[i] = NULL;
+	}
+	good = 1;
+	for(i = SERVICE_CHANNELS / 2; i < SERVICE_CHANNELS; i++)
+	{
+		msptr = find_channel_membership(channels[i], service);
+		if(msptr == NULL || msptr->chptr != channels[i])
+			good = 0;
+	}
+	ok(good, MSG);
+	is_bool(true, IsMember(service, channels[0]), MSG);
+
+	remove_user_from_channels(service);
+	for(i = 0; i < BIG_MEMBERS; i++)
+		remove_local_person(members[i]);
+	remove_local_person(service);
+	remove_local_person(user);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	setup();
+	lookups();
+	ordering();
+	who_first_channel();
+	removal();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
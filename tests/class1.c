@@ -0,0 +1,226 @@
+/*
+ *  class1.c: Test the socket options set from a class
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "class.h"
+#include "send.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static int
+get_opt(rb_fde_t *F, int level, int name)
+{
+	int val = -1;
+	socklen_t len = sizeof(val);
+
+	if(getsockopt(rb_get_fd(F), level, name, &val, &len))
+		return -1;
+	return val;
+}
+
+/* a loopback TCP connection: our end in *F, the peer's fd returned */
+static int
+tcp_pair(rb_fde_t **F)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int lfd, cfd = -1, afd = -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+			getsockname(lfd, (struct sockaddr *)&addr, &len) == 0 &&
+			listen(lfd, 1) == 0 &&
+			(cfd = socket(AF_INET, SOCK_STREAM, 0)) >= 0 &&
+			connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+		afd = accept(lfd, NULL, NULL);
+	close(lfd);
+
+	if(afd < 0)
+	{
+		if(cfd >= 0)
+			close(cfd);
+		return -1;
+	}
+
+	*F = rb_open(afd, RB_FD_SOCKET, "class test");
+	rb_set_nb(*F);
+	fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+	return cfd;
+}
+
+static void
+fill(rb_fde_t *F)
+{
+	char junk[4096];
+
+	memset(junk, 'x', sizeof(junk));
+	while(write(rb_get_fd(F), junk, sizeof(junk)) > 0)
+		;
+	while(write(rb_get_fd(F), junk, 1) > 0)
+		;
+}
+
+static void
+drain(int fd)
+{
+	char junk[4096];
+
+	while(read(fd, junk, sizeof(junk)) > 0)
+		;
+}
+
+static void
+class_options(void)
+{
+	struct Class *tuned = find_class("tuned");
+	struct Class *plain = find_class("plain");
+
+	ok(tuned != default_class, MSG);
+	is_int(32 * 1024, SndBuf(tuned), MSG);
+	is_int(8 * 1024, RcvBuf(tuned), MSG);
+	is_int(16 * 1024, NotsentLowat(tuned), MSG);
+	ok(CorkBurst(tuned), MSG);
+
+	ok(plain != default_class, MSG);
+	is_int(0, SndBuf(plain), MSG);
+	is_int(0, RcvBuf(plain), MSG);
+	is_int(0, NotsentLowat(plain), MSG);
+	ok(!CorkBurst(plain), MSG);
+}
+
+static void
+sockbufs(void)
+{
+	struct Client *client = make_local_person_nick("buffers");
+	rb_fde_t *F, *peer;
+	int sndbuf, rcvbuf;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F, &peer, "class test") < 0)
+	{
+		skip_block(5, "no socketpair");
+		remove_local_person(client);
+		return;
+	}
+	client->localClient->F = F;
+
+	/* a class that sets nothing leaves the kernel's sizes alone */
+	sndbuf = get_opt(F, SOL_SOCKET, SO_SNDBUF);
+	rcvbuf = get_opt(F, SOL_SOCKET, SO_RCVBUF);
+	set_class_sockopts(client, find_class("plain"));
+	is_int(sndbuf, get_opt(F, SOL_SOCKET, SO_SNDBUF), MSG);
+	is_int(rcvbuf, get_opt(F, SOL_SOCKET, SO_RCVBUF), MSG);
+
+	/* the kernel may round them up, but never gives less */
+	set_class_sockopts(client, find_class("tuned"));
+	ok(get_opt(F, SOL_SOCKET, SO_SNDBUF) >= 32 * 1024, MSG);
+	ok(get_opt(F, SOL_SOCKET, SO_RCVBUF) >= 8 * 1024, MSG);
+
+	/* not TCP, so it can't be corked */
+	send_cork(client);
+	ok(!(client->localClient->localflags & LFLAGS_CORK), MSG);
+
+	remove_local_person(client);
+	rb_close(peer);
+}
+
+static void
+cork_burst(void)
+{
+	struct Client *client = make_local_person_nick("corked");
+	rb_fde_t *F;
+	int peer, i;
+
+	if((peer = tcp_pair(&F)) < 0)
+	{
+		skip_block(8, "no loopback TCP");
+		remove_local_person(client);
+		return;
+	}
+	client->localClient->F = F;
+
+	set_class_sockopts(client, find_class("tuned"));
+#ifdef TCP_NOTSENT_LOWAT
+	is_int(16 * 1024, get_opt(F, IPPROTO_TCP, TCP_NOTSENT_LOWAT), MSG);
+#else
+	skip("no TCP_NOTSENT_LOWAT");
+#endif
+
+	send_cork(client);
+	ok(client->localClient->localflags & LFLAGS_CORK, MSG);
+#ifdef TCP_CORK
+	is_int(1, get_opt(F, IPPROTO_TCP, TCP_CORK), MSG);
+#else
+	skip("no TCP_CORK");
+#endif
+
+	/* stays corked while anything is still queued */
+	fill(F);
+	sendto_one(client, ":%s NOTICE %s :burst", me.name, client->name);
+	ok(sendq_length(client) > 0, MSG);
+	ok(client->localClient->localflags & LFLAGS_CORK, MSG);
+
+	/* what the write callback does as the peer reads */
+	for(i = 0; i < 1000 && sendq_length(client) > 0; i++)
+	{
+		drain(peer);
+		ClearFlush(client);
+		send_queued(client);
+	}
+	is_int(0, sendq_length(client), MSG);
+	ok(!(client->localClient->localflags & LFLAGS_CORK), MSG);
+#ifdef TCP_CORK
+	is_int(0, get_opt(F, IPPROTO_TCP, TCP_CORK), MSG);
+#else
+	skip("no TCP_CORK");
+#endif
+
+	remove_local_person(client);
+	close(peer);
+}
+
+int main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	class_options();
+	sockbufs();
+	cork_burst();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
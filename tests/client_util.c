@@ -29,6 +29,7 @@
 #include "s_newconf.h"
 #include "parse.h"
 #include "listener.h"
+#include "send.h"
 
 #define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
 
@@ -163,7 +164,7 @@ struct Client *make_remote_person_full(struct Client *server, const char *nick,
 	SetRemoteClient(client);
 
 	client->servptr = server;
-	rb_dlinkAdd(server, &server->lnode, &server->servptr->serv->users);
+	rb_dlinkAdd(client, &client->lnode, &server->serv->users);
 
 	rb_inet_pton_sock(ip, &addr);
 	rb_strlcpy(client->name, nick, sizeof(client->name));
@@ -203,11 +204,13 @@ char *get_client_sendq(const struct Client *client)
 {
 	static char buf[EXT_BUFSIZE + sizeof(CRLF)];
 
-	if (rb_linebuf_len(&client->localClient->buf_sendq)) {
+	buf_head_t *sendq = sendq_next(client->localClient);
+
+	if (sendq != NULL) {
 		int ret;
 
 		memset(buf, 0, sizeof(buf));
-		ret = rb_linebuf_get(&client->localClient->buf_sendq, buf, sizeof(buf), 0, 1);
+		ret = rb_linebuf_get(sendq, buf, sizeof(buf), 0, 1);
 
 		if (ok(ret > 0, MSG)) {
 			return buf;
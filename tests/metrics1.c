@@ -0,0 +1,208 @@
+/*
+ *  metrics1.c: Test traffic counters and the metrics snapshot
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "metrics.h"
+#include "s_conf.h"
+#include "s_stats.h"
+#include "send.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+/* more than 32 bits, and not a whole number of kilobytes */
+#define BIG_COUNT	((5ULL << 32) + 1000)
+
+static void
+snapshot_header(void)
+{
+	struct metrics_snapshot snap;
+
+	metrics_take_snapshot(&snap);
+	is_int(METRICS_SNAPSHOT_MAGIC, snap.magic, MSG);
+	is_int(METRICS_SNAPSHOT_VERSION, snap.version, MSG);
+	is_int(sizeof(snap), snap.size, MSG);
+	ok(snap.time >= snap.start_time, MSG);
+}
+
+static void
+snapshot_conns(void)
+{
+	struct metrics_snapshot before, after;
+	struct Client *user;
+
+	metrics_take_snapshot(&before);
+	user = make_local_person();
+	metrics_take_snapshot(&after);
+
+	is_int(before.conns[METRICS_CONN_CLIENT] + 1, after.conns[METRICS_CONN_CLIENT], MSG);
+	is_int(before.client_conns + 1, after.client_conns, MSG);
+
+	remove_local_person(user);
+	metrics_take_snapshot(&after);
+
+	/* gone from the open connections, still counted as seen */
+	is_int(before.conns[METRICS_CONN_CLIENT], after.conns[METRICS_CONN_CLIENT], MSG);
+	is_int(before.client_conns + 1, after.client_conns, MSG);
+}
+
+static void
+snapshot_bytes(void)
+{
+	struct metrics_snapshot before, after;
+	struct Client *user;
+
+	metrics_take_snapshot(&before);
+
+	user = make_local_person();
+	user->localClient->sendB += BIG_COUNT;
+	user->localClient->receiveB += BIG_COUNT / 2;
+
+	metrics_take_snapshot(&after);
+	ok(after.client_sent_bytes - before.client_sent_bytes == BIG_COUNT, MSG);
+	ok(after.client_recv_bytes - before.client_recv_bytes == BIG_COUNT / 2, MSG);
+
+	/* closing the connection moves its counts into ServerStats whole */
+	remove_local_person(user);
+	metrics_take_snapshot(&after);
+	ok(after.client_sent_bytes - before.client_sent_bytes == BIG_COUNT, MSG);
+	ok(after.client_recv_bytes - before.client_recv_bytes == BIG_COUNT / 2, MSG);
+	ok(ServerStats.is_cbs >= BIG_COUNT, MSG);
+}
+
+static void
+snapshot_stats(void)
+{
+	struct metrics_snapshot snap;
+	struct ServerStatistics sp;
+
+	ServerStats.is_unco += 3;
+	ServerStats.is_sqshed += 2;
+
+	metrics_take_snapshot(&snap);
+	metrics_collect_stats(&sp);
+	is_int(sp.is_unco, snap.unknown_commands, MSG);
+	is_int(sp.is_sqshed, snap.sendq_shed, MSG);
+	ok(snap.unknown_commands >= 3, MSG);
+	is_int(sendq_total, snap.sendq_total, MSG);
+}
+
+/* connect and run the event loop until the server has written it all */
+static ssize_t
+read_socket(const char *path, void *buf, size_t size)
+{
+	struct sockaddr_un addr;
+	ssize_t len, total = 0;
+	int fd, i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	rb_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	for(i = 0; i < 100; i++)
+	{
+		rb_select(10);
+		len = recv(fd, (char *)buf + total, size - total, MSG_DONTWAIT);
+		if(len == 0)
+			break;
+		if(len > 0)
+			total += len;
+		else if(!rb_ignore_errno(errno))
+			break;
+	}
+
+	close(fd);
+	return total;
+}
+
+static void
+snapshot_socket(void)
+{
+	struct metrics_snapshot snap, now;
+	char path[BUFSIZE];
+	char buf[sizeof(snap) + 64];
+	ssize_t len;
+	struct Client *user;
+
+	snprintf(path, sizeof(path), "%s.sock", __FILE__);
+	rb_free(ConfigFileEntry.metrics_snapshot_socket);
+	ConfigFileEntry.metrics_snapshot_socket = rb_strdup(path);
+	metrics_update_config();
+
+	user = make_local_person();
+	user->localClient->sendB += BIG_COUNT;
+
+	len = read_socket(path, buf, sizeof(buf));
+	metrics_take_snapshot(&now);
+
+	/* exactly one snapshot, then the server closes it */
+	is_int(sizeof(snap), len, MSG);
+	memcpy(&snap, buf, sizeof(snap));
+	is_int(METRICS_SNAPSHOT_MAGIC, snap.magic, MSG);
+	is_int(METRICS_SNAPSHOT_VERSION, snap.version, MSG);
+	is_int(sizeof(snap), snap.size, MSG);
+	is_int(now.conns[METRICS_CONN_CLIENT], snap.conns[METRICS_CONN_CLIENT], MSG);
+	is_int(now.conns[METRICS_CONN_SERVER], snap.conns[METRICS_CONN_SERVER], MSG);
+	is_int(now.conns[METRICS_CONN_UNKNOWN], snap.conns[METRICS_CONN_UNKNOWN], MSG);
+	ok(snap.client_sent_bytes == now.client_sent_bytes, MSG);
+	ok(snap.client_sent_bytes >= BIG_COUNT, MSG);
+
+	remove_local_person(user);
+
+	/* taken away again, the socket is removed */
+	rb_free(ConfigFileEntry.metrics_snapshot_socket);
+	ConfigFileEntry.metrics_snapshot_socket = NULL;
+	metrics_update_config();
+	ok(access(path, F_OK) < 0, MSG);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	snapshot_header();
+	snapshot_conns();
+	snapshot_bytes();
+	snapshot_stats();
+	snapshot_socket();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
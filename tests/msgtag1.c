@@ -0,0 +1,127 @@
+/*
+ *  msgtag1.c: Test values for outgoing message tags
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "msgbuf.h"
+#include "msgtag.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+struct Client me;
+
+static void
+intern1(void)
+{
+	int idx = msgtag_intern("example.com/tag");
+
+	ok(idx > MSGTAG_ACCOUNT, MSG);
+	is_int(idx, msgtag_intern("example.com/tag"), MSG);
+	is_int(MSGTAG_TIME, msgtag_intern("time"), MSG);
+	is_int(MSGTAG_MSGID, msgtag_intern("msgid"), MSG);
+	is_string("example.com/tag", msgtag_names[idx], MSG);
+}
+
+static void
+get_tag_idx1(void)
+{
+	struct MsgBuf msgbuf;
+
+	msgbuf_init(&msgbuf);
+	msgbuf_append_tag(&msgbuf, "account", "someone", 0);
+	msgbuf_append_tag_idx(&msgbuf, MSGTAG_TIME, "2000-01-01T00:00:00.000Z", 0);
+
+	/* appended by name or by index, either way finds it */
+	is_string("someone", msgbuf_get_tag_idx(&msgbuf, MSGTAG_ACCOUNT), MSG);
+	is_string("2000-01-01T00:00:00.000Z", msgbuf_get_tag_idx(&msgbuf, MSGTAG_TIME), MSG);
+	is_string("2000-01-01T00:00:00.000Z", msgbuf_get_tag(&msgbuf, "time"), MSG);
+	ok(msgbuf_get_tag_idx(&msgbuf, MSGTAG_MSGID) == NULL, MSG);
+}
+
+static void
+server_time1(void)
+{
+	char expected[MSGTAG_TIME_LEN + 1];
+	const struct timeval *tv;
+	const char *value;
+
+	rb_set_time();
+	tv = rb_current_time_tv();
+	strftime(expected, sizeof(expected), "%Y-%m-%dT%H:%M:%S", gmtime(&tv->tv_sec));
+	snprintf(expected + strlen(expected), sizeof(expected) - strlen(expected),
+			".%03ldZ", (long)tv->tv_usec / 1000);
+
+	value = msgtag_server_time();
+	is_string(expected, value, MSG);
+
+	/* the same tick gives the same value */
+	is_string(expected, msgtag_server_time(), MSG);
+}
+
+static void
+msgid1(void)
+{
+	struct Client client;
+	char first[BUFSIZE], expected[BUFSIZE];
+	const char *value;
+
+	memset(&client, 0, sizeof(client));
+	strcpy(client.id, "0AAAAAAAB");
+
+	rb_set_time();
+	value = msgtag_msgid(&client, "#channel");
+	rb_strlcpy(first, value, sizeof(first));
+
+	/* 1, seconds, milliseconds, counter, uid, base64 channel */
+	is_int(1 + 10 + 3 + 6 + 9 + strlen("I2NoYW5uZWw="), strlen(first), MSG);
+	is_int('1', first[0], MSG);
+	snprintf(expected, sizeof(expected), "%010u", (unsigned)rb_current_time());
+	ok(!strncmp(first + 1, expected, 10), MSG);
+	ok(!strncmp(first + 20, "0AAAAAAABI2NoYW5uZWw=", 21), MSG);
+
+	/* ids sort in the order they were made, and a user target has no suffix */
+	value = msgtag_msgid(&client, "someone");
+	is_int(1 + 10 + 3 + 6 + 9, strlen(value), MSG);
+	ok(strncmp(first, value, 20) < 0, MSG);
+	is_string("0AAAAAAAB", value + 20, MSG);
+
+	value = msgtag_msgid(&client, "@#other");
+	ok(!strcmp(value + 29, "QCNvdGhlcg=="), MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	memset(&me, 0, sizeof(me));
+	strcpy(me.name, "me.name.");
+
+	plan_lazy();
+
+	intern1();
+	get_tag_idx1();
+	server_time1();
+	msgid1();
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ *  netsplit1.c: Test the QUITs sent to local clients for a netsplit
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "class.h"
+#include "hash.h"
+#include "packet.h"
+#include "send.h"
+#include "s_serv.h"
+#include "s_conf.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define SPLIT_REASON TEST_ME_NAME " " TEST_SERVER_NAME
+
+#define BIG_SPLIT_USERS	1500
+#define SMALL_SENDQ	16384
+
+static void
+netsplit_quits(void)
+{
+	struct Client *server, *server3;
+	struct Client *r1, *r2, *r3;
+	struct Client *plain, *batcher, *bystander;
+	struct Channel *chan_a, *chan_b, *chan_c;
+	bool isnew;
+
+	ConfigServerHide.flatten_links = 0;
+
+	server = make_remote_server(&me);
+	server3 = make_remote_server_name(&me, TEST_SERVER3_NAME);
+	r1 = make_remote_person_nick(server, "r1");
+	r2 = make_remote_person_nick(server, "r2");
+	r3 = make_remote_person_nick(server3, "r3");
+
+	plain = make_local_person_nick("plain");
+	batcher = make_local_person_nick("batcher");
+	batcher->localClient->caps |= CLICAP_BATCH;
+	bystander = make_local_person_nick("bystander");
+
+	chan_a = get_or_create_channel(plain, "#a", &isnew);
+	chan_b = get_or_create_channel(plain, "#b", &isnew);
+	chan_c = get_or_create_channel(plain, "#c", &isnew);
+
+	add_user_to_channel(chan_a, plain, CHFL_PEON);
+	add_user_to_channel(chan_a, batcher, CHFL_PEON);
+	add_user_to_channel(chan_a, r1, CHFL_PEON);
+	add_user_to_channel(chan_a, r2, CHFL_PEON);
+	add_user_to_channel(chan_b, batcher, CHFL_PEON);
+	add_user_to_channel(chan_b, r2, CHFL_PEON);
+	add_user_to_channel(chan_b, r3, CHFL_PEON);
+	add_user_to_channel(chan_c, bystander, CHFL_PEON);
+	add_user_to_channel(chan_c, r3, CHFL_PEON);
+
+	remove_remote_server(server);
+
+	/* one QUIT per user, even for users sharing several channels */
+	is_client_sendq_one(":r1" TEST_ID_SUFFIX " QUIT :" SPLIT_REASON CRLF, plain, MSG);
+	is_client_sendq(":r2" TEST_ID_SUFFIX " QUIT :" SPLIT_REASON CRLF, plain, MSG);
+
+	is_client_sendq_one(":" TEST_ME_NAME " BATCH +ns1 netsplit " SPLIT_REASON CRLF, batcher, MSG);
+	is_client_sendq_one("@batch=ns1 :r1" TEST_ID_SUFFIX " QUIT :" SPLIT_REASON CRLF, batcher, MSG);
+	is_client_sendq_one("@batch=ns1 :r2" TEST_ID_SUFFIX " QUIT :" SPLIT_REASON CRLF, batcher, MSG);
+	is_client_sendq(":" TEST_ME_NAME " BATCH -ns1" CRLF, batcher, MSG);
+
+	is_client_sendq_empty(bystander, MSG);
+
+	is_int(2, rb_dlink_list_length(&chan_a->members), MSG);
+	is_int(2, rb_dlink_list_length(&chan_b->members), MSG);
+	is_bool(true, IsMember(r3, chan_b), MSG);
+	is_int(2, rb_dlink_list_length(&r3->user->channel), MSG);
+
+	remove_remote_server(server3);
+	remove_local_person(plain);
+	remove_local_person(batcher);
+	remove_local_person(bystander);
+}
+
+/* a split far bigger than the sendq of someone who sees all of it */
+static void
+big_split(void)
+{
+	struct Client *server, *reader;
+	struct Channel *chan;
+	struct ConfItem *aconf;
+	rb_fde_t *F, *peer;
+	char nick[NICKLEN];
+	char *out, *p;
+	int i, n, outlen = 0, quits = 0;
+	bool isnew;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F, &peer, "netsplit test") < 0)
+	{
+		skip("no socketpair");
+		return;
+	}
+
+	server = make_remote_server(&me);
+	reader = make_local_person_nick("reader");
+	reader->localClient->F = F;
+
+	aconf = make_conf();
+	aconf->status = CONF_CLIENT;
+	aconf->c_class = make_class();
+	MaxSendq(aconf->c_class) = SMALL_SENDQ;
+	reader->localClient->att_conf = aconf;
+
+	chan = get_or_create_channel(reader, "#big", &isnew);
+	add_user_to_channel(chan, reader, CHFL_PEON);
+	for(i = 0; i < BIG_SPLIT_USERS; i++)
+	{
+		snprintf(nick, sizeof nick, "split%d", i);
+		add_user_to_channel(chan, make_remote_person_nick(server, nick), CHFL_PEON);
+	}
+
+	remove_remote_server(server);
+
+	is_bool(false, IsAnyDead(reader), MSG);
+	is_int(1, rb_dlink_list_length(&chan->members), MSG);
+
+	out = rb_malloc(BIG_SPLIT_USERS * 100);
+	while((n = rb_read(peer, out + outlen, BIG_SPLIT_USERS * 100 - 1 - outlen)) > 0)
+		outlen += n;
+	out[outlen] = '\0';
+	for(p = out; (p = strstr(p, " QUIT :" SPLIT_REASON CRLF)) != NULL; p++)
+		quits++;
+	is_int(BIG_SPLIT_USERS, quits, MSG);
+	rb_free(out);
+
+	reader->localClient->att_conf = NULL;
+	free_class(aconf->c_class);
+	free_conf(aconf);
+	remove_local_person(reader);
+	rb_close(peer);
+}
+
+/* a link that SQUITs itself while part of a line is held in its recvq */
+static void
+squit_partial_line(void)
+{
+	struct Client *server, *server2;
+	rb_fde_t *F, *peer;
+	char buf[BUFSIZE];
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F, &peer, "netsplit test") < 0)
+	{
+		skip_block(3, "no socketpair");
+		return;
+	}
+
+#ifdef M_PERTURB
+	/* so that anything read from freed memory is garbage */
+	mallopt(M_PERTURB, 'Z');
+#endif
+
+	server = make_remote_server(&me);
+	server2 = make_remote_server_name(&me, TEST_SERVER2_NAME);
+	server->localClient->F = F;
+
+	/* the first half is kept in a recvq of its own */
+	rb_write(peer, "SQUIT ", 6);
+	read_packet(F, server);
+	is_bool(false, IsAnyDead(server), MSG);
+	ok(server->localClient->recvq_size != 0, MSG);
+
+	/* the comment is in that recvq, and outlives closing the link */
+	rb_write(peer, TEST_SERVER_NAME " :going away" CRLF, strlen(TEST_SERVER_NAME " :going away" CRLF));
+	read_packet(F, server);
+	snprintf(buf, sizeof(buf), "SQUIT %s :going away" CRLF, TEST_SERVER_NAME);
+	is_client_sendq(buf, server2, MSG);
+
+#ifdef M_PERTURB
+	mallopt(M_PERTURB, 0);
+#endif
+
+	remove_remote_server(server2);
+	rb_close(peer);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	netsplit_quits();
+	big_split();
+	squit_partial_line();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ *  rb_linebuf1.c: Test rb_linebuf line splitting
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+#define SCANNER_MSG(name) "%s:%d (%s) %s", __FILE__, __LINE__, __FUNCTION__, (name)
+
+#define STREAM_SIZE	(1024 * 1024)
+#define FLUSH_LINES	5000
+
+/* every scanner the library might have; "byte" is the original loop */
+static const char *scanners[] = { "byte", "swar", "sse2", "avx2", "neon", NULL };
+
+static char stream[STREAM_SIZE];
+static int stream_len;
+static unsigned int seed;
+
+static unsigned int
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void
+append(const char *data, int len)
+{
+	if(stream_len + len > STREAM_SIZE)
+		len = STREAM_SIZE - stream_len;
+	memcpy(stream + stream_len, data, len);
+	stream_len += len;
+}
+
+static void
+append_text(int len)
+{
+	char buf[4 * LINEBUF_SIZE];
+	int i;
+
+	for(i = 0; i < len; i++)
+		buf[i] = 'a' + next_random() % 26;
+	append(buf, len);
+}
+
+/* lines around every limit, ended every way a peer might end them,
+ * then burst-like traffic
+ */
+static void
+make_stream(void)
+{
+	static const char *endings[] = { "\r\n", "\n", "\r", "\r\n\r\n", "\n\r", "\r\r\n" };
+	static const int sizes[] = {
+		0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 510, 511, 512,
+		LINEBUF_SIZE - 2, LINEBUF_SIZE - 1, LINEBUF_SIZE, LINEBUF_SIZE + 1,
+		LINEBUF_SIZE + 2, 2 * LINEBUF_SIZE + 3
+	};
+	int i, j;
+
+	seed = 1;
+	stream_len = 0;
+
+	for(i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		for(j = 0; j < (int)(sizeof(endings) / sizeof(endings[0])); j++)
+		{
+			append_text(sizes[i]);
+			append(endings[j], strlen(endings[j]));
+		}
+	}
+
+	while(stream_len < STREAM_SIZE - 600)
+	{
+		append_text(next_random() % 500);
+		append("\r\n", 2);
+	}
+
+	/* and a partial line */
+	append_text(100);
+}
+
+/* split the stream in random sized reads, and return every line joined */
+static char *
+split_stream(int raw, unsigned int chunk_seed, int *outlen)
+{
+	buf_head_t bufhead;
+	char line[LINEBUF_SIZE + CRLF_LEN + 1];
+	char *out = rb_malloc(2 * STREAM_SIZE);
+	int pos = 0, len, n;
+
+	rb_linebuf_newbuf(&bufhead);
+	seed = chunk_seed;
+	*outlen = 0;
+
+	while(pos < stream_len)
+	{
+		len = 1 + next_random() % (chunk_seed == 0 ? 1 : 4096);
+		if(len > stream_len - pos)
+			len = stream_len - pos;
+		rb_linebuf_parse(&bufhead, stream + pos, len, raw);
+		pos += len;
+
+		while((n = rb_linebuf_get(&bufhead, line, sizeof(line), LINEBUF_COMPLETE, raw)) > 0)
+		{
+			memcpy(out + *outlen, line, n);
+			*outlen += n;
+			out[(*outlen)++] = '|';
+		}
+	}
+
+	/* the partial line that's left */
+	n = rb_linebuf_get(&bufhead, line, sizeof(line), LINEBUF_PARTIAL, raw);
+	memcpy(out + *outlen, line, n);
+	*outlen += n;
+
+	rb_linebuf_donebuf(&bufhead);
+	return out;
+}
+
+static void
+find_eol(const char *name)
+{
+	char buf[256];
+	char *ref, *got;
+	int good = 1;
+	int off, len, i, pos;
+
+	for(i = 0; i < 20000; i++)
+	{
+		off = next_random() % 64;
+		len = next_random() % 160;
+		memset(buf, 'x', sizeof(buf));
+
+		/* sometimes nothing, sometimes an EOL anywhere, even just past the end */
+		if(i % 3 != 0)
+		{
+			pos = next_random() % (len + 2);
+			buf[off + pos] = (i % 2) ? '\r' : '\n';
+			if(i % 5 == 0 && pos + 1 < len)
+				buf[off + pos + 1 + next_random() % (len - pos - 1)] = '\n';
+		}
+
+		rb_linebuf_set_eol_scanner("byte");
+		ref = rb_linebuf_find_eol(buf + off, len);
+		rb_linebuf_set_eol_scanner(name);
+		got = rb_linebuf_find_eol(buf + off, len);
+
+		if(got != ref)
+			good = 0;
+	}
+
+	ok(good, SCANNER_MSG(name));
+}
+
+static void
+equivalence(void)
+{
+	char *ref[2][2], *got;
+	int reflen[2][2], gotlen;
+	int raw, chunking, i;
+
+	make_stream();
+
+	rb_linebuf_set_eol_scanner("byte");
+	for(raw = 0; raw < 2; raw++)
+		for(chunking = 0; chunking < 2; chunking++)
+			ref[raw][chunking] = split_stream(raw, chunking, &reflen[raw][chunking]);
+
+	for(i = 0; scanners[i] != NULL; i++)
+	{
+		if(!rb_linebuf_set_eol_scanner(scanners[i]))
+		{
+			diag("%s scanner not available", scanners[i]);
+			continue;
+		}
+
+		find_eol(scanners[i]);
+
+		for(raw = 0; raw < 2; raw++)
+		{
+			for(chunking = 0; chunking < 2; chunking++)
+			{
+				rb_linebuf_set_eol_scanner(scanners[i]);
+				got = split_stream(raw, chunking, &gotlen);
+				ok(gotlen == reflen[raw][chunking] &&
+						memcmp(got, ref[raw][chunking], gotlen) == 0,
+						SCANNER_MSG(scanners[i]));
+				rb_free(got);
+			}
+		}
+	}
+
+	for(raw = 0; raw < 2; raw++)
+		for(chunking = 0; chunking < 2; chunking++)
+			rb_free(ref[raw][chunking]);
+}
+
+static void
+truncation(void)
+{
+	buf_head_t bufhead;
+	char line[LINEBUF_SIZE + CRLF_LEN + 1];
+	char data[LINEBUF_SIZE + 100];
+
+	/* an overlong line is cut at LINEBUF_SIZE and the rest is dropped */
+	rb_linebuf_newbuf(&bufhead);
+	memset(data, 'a', sizeof(data));
+	memcpy(data + sizeof(data) - 7, "\r\nnext\n", 7);
+	rb_linebuf_parse(&bufhead, data, sizeof(data), 0);
+
+	is_int(LINEBUF_SIZE, rb_linebuf_get(&bufhead, line, sizeof(line), LINEBUF_COMPLETE, 0), MSG);
+	is_int(4, rb_linebuf_get(&bufhead, line, sizeof(line), LINEBUF_COMPLETE, 0), MSG);
+	is_string("next", line, MSG);
+	is_int(0, rb_linebuf_get(&bufhead, line, sizeof(line), LINEBUF_COMPLETE, 0), MSG);
+	rb_linebuf_donebuf(&bufhead);
+}
+
+/* queue short lines with the odd long or shared one, write them through
+ * a socket that fills up, and check what comes out
+ */
+static int
+flush_lines(int combine)
+{
+	buf_head_t bufhead, shared;
+	rb_strf_t strings = { .length = LINEBUF_SIZE };
+	rb_fde_t *F1, *F2;
+	char line[LINEBUF_SIZE + 1];
+	char *out = rb_malloc(STREAM_SIZE);
+	int i, len, n, outlen = 0, good;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F1, &F2, "flush test") < 0)
+	{
+		rb_free(out);
+		return 0;
+	}
+
+	rb_linebuf_newbuf(&bufhead);
+	rb_linebuf_newbuf(&shared);
+	rb_linebuf_set_combine(&bufhead, combine);
+
+	seed = 1;
+	stream_len = 0;
+	for(i = 0; i < FLUSH_LINES; i++)
+	{
+		len = 40 + next_random() % 40;
+		if(i % 50 == 0)
+			len = 1000 + next_random() % (LINEBUF_SIZE - 1000);
+		memset(line, 'a' + i % 26, len);
+		line[len] = '\0';
+
+		strings.format = line;
+		if(i % 7 == 0)
+		{
+			rb_linebuf_put(&shared, &strings);
+			rb_linebuf_attach(&bufhead, &shared);
+			rb_linebuf_donebuf(&shared);
+		}
+		else
+			rb_linebuf_put(&bufhead, &strings);
+
+		append(line, len);
+		append("\r\n", 2);
+	}
+
+	while(rb_linebuf_len(&bufhead) > 0)
+	{
+		while(rb_linebuf_flush(F1, &bufhead) > 0)
+			;
+		while((n = rb_read(F2, out + outlen, STREAM_SIZE - outlen)) > 0)
+			outlen += n;
+	}
+
+	good = outlen == stream_len && memcmp(out, stream, outlen) == 0;
+
+	rb_linebuf_donebuf(&bufhead);
+	rb_close(F1);
+	rb_close(F2);
+	rb_free(out);
+	return good;
+}
+
+static void
+flush(void)
+{
+	ok(flush_lines(0), MSG);
+	ok(flush_lines(1024), MSG);
+	ok(flush_lines(LINEBUF_SIZE + CRLF_LEN + 1), MSG);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	diag("using the %s scanner", rb_linebuf_eol_scanner());
+
+	equivalence();
+	truncation();
+	flush();
+
+	return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ *  recvq1.c: Test splitting a client's input into lines
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "client.h"
+#include "packet.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static char data[READBUF_SIZE + 1];
+
+/* what read_packet() does with the bytes of one read */
+static void
+feed_len(struct LocalUser *lc, const char *buf, size_t len)
+{
+	char *p = recvq_reserve(lc);
+
+	memcpy(p, buf, len);
+	lc->recvq_end += len;
+}
+
+static void
+feed(struct LocalUser *lc, const char *buf)
+{
+	feed_len(lc, buf, strlen(buf));
+}
+
+static const char *
+next_line(struct LocalUser *lc)
+{
+	int len;
+	char *line = recvq_next_line(lc, &len);
+
+	if(line != NULL && (size_t)len != strlen(line))
+		return "(length mismatch)";
+	return line;
+}
+
+static void
+line_endings(void)
+{
+	struct LocalUser lc;
+
+	memset(&lc, 0, sizeof(lc));
+
+	feed(&lc, "CR\rLF\nCRLF\r\nLFCR\n\r\r\n\nLAST\r\n");
+	is_string("CR", next_line(&lc), MSG);
+	is_string("LF", next_line(&lc), MSG);
+	is_string("CRLF", next_line(&lc), MSG);
+	is_string("LFCR", next_line(&lc), MSG);
+	is_string("LAST", next_line(&lc), MSG);
+	ok(next_line(&lc) == NULL, MSG);
+
+	/* nothing is kept once everything has been parsed */
+	recvq_retain(&lc);
+	ok(lc.recvq == NULL, MSG);
+	is_int(0, lc.recvq_size, MSG);
+
+	discard_recvq(&lc);
+}
+
+static void
+partial_lines(void)
+{
+	struct LocalUser lc;
+
+	memset(&lc, 0, sizeof(lc));
+
+	/* a partial line is moved out of the shared read buffer */
+	feed(&lc, "FIRST\r\nPRIV");
+	is_string("FIRST", next_line(&lc), MSG);
+	ok(next_line(&lc) == NULL, MSG);
+	recvq_retain(&lc);
+	ok(lc.recvq_size >= READBUF_SIZE, MSG);
+	is_int(4, lc.recvq_end - lc.recvq_start, MSG);
+
+	feed(&lc, "MSG #test :hello\r");
+	is_string("PRIVMSG #test :hello", next_line(&lc), MSG);
+	ok(next_line(&lc) == NULL, MSG);
+	recvq_retain(&lc);
+
+	/* the LF of a CR LF split across reads doesn't make an empty line */
+	feed(&lc, "\nNEXT\r\n");
+	is_string("NEXT", next_line(&lc), MSG);
+	ok(next_line(&lc) == NULL, MSG);
+	recvq_retain(&lc);
+	ok(lc.recvq == NULL, MSG);
+
+	discard_recvq(&lc);
+}
+
+static void
+overlong_lines(void)
+{
+	struct LocalUser lc;
+	const char *line;
+	size_t len;
+
+	memset(&lc, 0, sizeof(lc));
+
+	/* truncated, and the rest of it is dropped */
+	memset(data, 'a', LINEBUF_SIZE + 100);
+	len = LINEBUF_SIZE + 100;
+	memcpy(data + len, "\r\nNEXT\r\n", 8);
+	feed_len(&lc, data, len + 8);
+
+	line = next_line(&lc);
+	ok(line != NULL, MSG);
+	is_int(LINEBUF_SIZE, line != NULL ? strlen(line) : 0, MSG);
+	is_string("NEXT", next_line(&lc), MSG);
+	ok(!lc.recvq_overflow, MSG);
+	ok(next_line(&lc) == NULL, MSG);
+	recvq_retain(&lc);
+
+	/* the rest of it is in the following reads */
+	memset(data, 'b', LINEBUF_SIZE + 10);
+	feed_len(&lc, data, LINEBUF_SIZE + 10);
+	line = next_line(&lc);
+	is_int(LINEBUF_SIZE, line != NULL ? strlen(line) : 0, MSG);
+	ok(lc.recvq_overflow, MSG);
+	ok(next_line(&lc) == NULL, MSG);
+	is_int(0, lc.recvq_end - lc.recvq_start, MSG);
+	recvq_retain(&lc);
+
+	feed(&lc, "bbbbbbbb");
+	ok(next_line(&lc) == NULL, MSG);
+	ok(lc.recvq_overflow, MSG);
+	recvq_retain(&lc);
+
+	feed(&lc, "bbbb\r\nAFTER\r\n");
+	is_string("AFTER", next_line(&lc), MSG);
+	ok(!lc.recvq_overflow, MSG);
+	ok(next_line(&lc) == NULL, MSG);
+
+	discard_recvq(&lc);
+}
+
+static void
+flood_count(void)
+{
+	struct LocalUser lc;
+
+	memset(&lc, 0, sizeof(lc));
+
+	feed(&lc, "A\r\nB\nC\r\r\nD");
+	is_int(3, recvq_count_lines(&lc), MSG);
+	is_int(3, recvq_count_lines(&lc), MSG);
+
+	/* parsing a counted line takes it off */
+	is_string("A", next_line(&lc), MSG);
+	is_int(2, recvq_count_lines(&lc), MSG);
+	recvq_retain(&lc);
+	is_int(2, recvq_count_lines(&lc), MSG);
+
+	/* only the new data is scanned, and D is counted once */
+	feed(&lc, "\r");
+	is_int(3, recvq_count_lines(&lc), MSG);
+	feed(&lc, "\nE\n");
+	is_int(4, recvq_count_lines(&lc), MSG);
+
+	is_string("B", next_line(&lc), MSG);
+	is_string("C", next_line(&lc), MSG);
+	is_string("D", next_line(&lc), MSG);
+	is_int(1, recvq_count_lines(&lc), MSG);
+	is_string("E", next_line(&lc), MSG);
+	ok(next_line(&lc) == NULL, MSG);
+	is_int(0, recvq_count_lines(&lc), MSG);
+
+	discard_recvq(&lc);
+}
+
+static void
+growth(void)
+{
+	struct LocalUser lc;
+	char expect[16];
+	const char *line;
+	int i, n, reads = 3;
+	int per_read = READBUF_SIZE / 8;
+
+	memset(&lc, 0, sizeof(lc));
+
+	/* lines held back by flood control pile up over several reads */
+	for(n = 0; n < reads; n++)
+	{
+		for(i = 0; i < per_read; i++)
+			snprintf(data + i * 8, 9, "L%05d\r\n", n * per_read + i);
+		feed_len(&lc, data, READBUF_SIZE);
+		recvq_retain(&lc);
+	}
+
+	is_int(READBUF_SIZE * reads, lc.recvq_end - lc.recvq_start, MSG);
+	ok(lc.recvq_size >= lc.recvq_end, MSG);
+	is_int(per_read * reads, recvq_count_lines(&lc), MSG);
+
+	/* what has been parsed is dropped before the buffer grows */
+	for(i = 0; i < per_read; i++)
+		next_line(&lc);
+	recvq_reserve(&lc);
+	is_int(0, lc.recvq_start, MSG);
+	is_int(READBUF_SIZE * (reads - 1), lc.recvq_end, MSG);
+	ok(lc.recvq_size - lc.recvq_end >= READBUF_SIZE, MSG);
+	is_int(per_read * (reads - 1), recvq_count_lines(&lc), MSG);
+
+	for(i = per_read; i < per_read * reads; i++)
+	{
+		snprintf(expect, sizeof(expect), "L%05d", i);
+		line = next_line(&lc);
+		if(line == NULL || strcmp(line, expect))
+			break;
+	}
+	is_int(per_read * reads, i, MSG);
+	ok(next_line(&lc) == NULL, MSG);
+
+	discard_recvq(&lc);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	line_endings();
+	partial_lines();
+	overlong_lines();
+	flood_count();
+	growth();
+
+	return 0;
+}
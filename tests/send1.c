@@ -30,6 +30,7 @@
 #include "s_serv.h"
 #include "monitor.h"
 #include "s_conf.h"
+#include "numeric.h"
 
 #define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
 
@@ -497,6 +498,78 @@ static void sendto_one_numeric1__tags(void)
 	standard_free();
 }
 
+static size_t fmt_numeric(char *buf, size_t size, int numeric, const char *pattern, ...)
+{
+	va_list args;
+	size_t len;
+
+	va_start(args, pattern);
+	len = format_numeric(buf, size, numeric, pattern, args);
+	va_end(args);
+	return len;
+}
+
+static size_t fmt_printf(char *buf, size_t size, int numeric, const char *pattern, ...)
+{
+	va_list args;
+	int len;
+
+	va_start(args, pattern);
+	len = vsnprintf(buf, size, pattern, args);
+	va_end(args);
+	return (size_t)len >= size ? size - 1 : (size_t)len;
+}
+
+#define is_numeric(numeric, pattern, ...) do { \
+		char expected[BUFSIZE], actual[BUFSIZE]; \
+		size_t len = fmt_printf(expected, sizeof(expected), numeric, pattern, __VA_ARGS__); \
+		is_int(len, fmt_numeric(actual, sizeof(actual), numeric, pattern, __VA_ARGS__), MSG); \
+		is_string(expected, actual, MSG); \
+	} while (0)
+
+static void format_numeric1(void)
+{
+	char buf[BUFSIZE];
+
+	is_numeric(RPL_WHOISUSER, form_str(RPL_WHOISUSER), "nick", "user", "host", "real name");
+	is_numeric(RPL_STATSUPTIME, form_str(RPL_STATSUPTIME), 12, 3, 4, 5);
+	is_numeric(RPL_ENDOFSTATS, form_str(RPL_ENDOFSTATS), 'l');
+	is_numeric(RPL_STATSCOMMANDS, form_str(RPL_STATSCOMMANDS), "PRIVMSG", 4000000000U, 123456789UL, 0U);
+
+	// Whole lines, numeric taken from the format
+	is_numeric(-1, form_str(RPL_WHOREPLY), "me.test", "nick", "#chan", "user", "host", "me.test", "them", "H@", 0, "real name");
+	is_numeric(-1, form_str(RPL_CREATIONTIME), "me.test", "nick", "#chan", -1500000000LL);
+	is_numeric(-1, form_str(ERR_NEEDREGGEDNICK), "me.test", "nick", "#chan", "nickserv");
+	is_numeric(-1, form_str(RPL_MODLIST), "me.test", "nick", "m_test", 0xdeadbeefUL, "", "", "1.0", "Test");
+	is_numeric(-1, form_str(ERR_WRONGPONG), "me.test", "nick", 0xc0ffeeU);
+
+	// Formats that are not the numeric's own go to vsnprintf
+	is_numeric(RPL_WHOISUSER, "%s!%s@%s %-5s|", "nick", "user", "host", "x");
+	is_numeric(RPL_STATSDEBUG, "A :%s %5.1f", "x", 1.5);
+	is_numeric(-1, "PRIVMSG %s :%s", "nick", "text");
+
+	is_numeric(RPL_WHOISUSER, form_str(RPL_WHOISUSER), "nick", (char *)NULL, "host", "real name");
+
+	// Truncated like snprintf
+	is_int(9, fmt_numeric(buf, 10, RPL_WHOISUSER, form_str(RPL_WHOISUSER), "nick", "user", "host", "real name"), MSG);
+	is_string("nick user", buf, MSG);
+	is_int(4, fmt_numeric(buf, 5, RPL_STATSUPTIME, form_str(RPL_STATSUPTIME), 12345, 3, 4, 5), MSG);
+	is_string(":Ser", buf, MSG);
+}
+
+static void sendto_one_numeric2(void)
+{
+	standard_init();
+
+	sendto_one_numeric(user, RPL_WHOISUSER, form_str(RPL_WHOISUSER), TEST_NICK, TEST_USERNAME, TEST_HOSTNAME, TEST_REALNAME);
+	is_client_sendq(":" TEST_ME_NAME " 311 " TEST_NICK " " TEST_NICK " " TEST_USERNAME " " TEST_HOSTNAME " * :" TEST_REALNAME CRLF, user, MSG);
+
+	sendto_one(user, form_str(RPL_WHOREPLY), TEST_ME_NAME, TEST_NICK, TEST_CHANNEL, TEST_USERNAME, TEST_HOSTNAME, TEST_ME_NAME, TEST_NICK, "H@", 0, TEST_REALNAME);
+	is_client_sendq(":" TEST_ME_NAME " 352 " TEST_NICK " " TEST_CHANNEL " " TEST_USERNAME " " TEST_HOSTNAME " " TEST_ME_NAME " " TEST_NICK " H@ :0 " TEST_REALNAME CRLF, user, MSG);
+
+	standard_free();
+}
+
 static void sendto_server1(void)
 {
 	standard_init();
@@ -5050,6 +5123,8 @@ int main(int argc, char *argv[])
 	sendto_one_notice1__tags();
 	sendto_one_numeric1();
 	sendto_one_numeric1__tags();
+	format_numeric1();
+	sendto_one_numeric2();
 	sendto_server1();
 	sendto_server1__tags();
 
@@ -0,0 +1,339 @@
+/*
+ *  sendq1.c: Test sendq memory accounting and limits
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "class.h"
+#include "send.h"
+#include "s_conf.h"
+#include "s_stats.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+static void
+fill_sendq(struct Client *client, int lines)
+{
+	while(lines-- > 0)
+		sendto_one(client, ":%s NOTICE %s :%0400d", me.name, client->name, lines);
+}
+
+static unsigned int
+sendq_len(struct Client *client)
+{
+	return rb_linebuf_len(&client->localClient->buf_sendq);
+}
+
+static void
+accounting(void)
+{
+	struct Client *user = make_local_person();
+	unsigned long before = sendq_total;
+
+	fill_sendq(user, 3);
+	ok(sendq_len(user) > 1200, MSG);
+	is_int(before + sendq_len(user), sendq_total, MSG);
+	ok(sendq_peak >= sendq_total, MSG);
+
+	discard_sendq(user);
+	is_int(0, sendq_len(user), MSG);
+	is_int(before, sendq_total, MSG);
+
+	/* whatever is still queued when a client goes is forgotten too */
+	fill_sendq(user, 2);
+	remove_local_person(user);
+	is_int(before, sendq_total, MSG);
+}
+
+static void
+hard_limit(void)
+{
+	struct Client *small = make_local_person_nick("small");
+	struct Client *large = make_local_person_nick("large");
+	struct Client *medium = make_local_person_nick("medium");
+	unsigned int shed = ServerStats.is_sqshed;
+
+	fill_sendq(small, 2);
+	fill_sendq(large, 6);
+	fill_sendq(medium, 4);
+
+	/* one more line goes over, dropping the largest sendq is enough */
+	ConfigFileEntry.sendq_hard_limit = sendq_total + 10;
+	fill_sendq(small, 1);
+
+	ok(IsDead(large), MSG);
+	is_int(0, sendq_len(large), MSG);
+	ok(!IsDead(small), MSG);
+	ok(!IsDead(medium), MSG);
+	is_int(shed + 1, ServerStats.is_sqshed, MSG);
+	ok(sendq_total <= (unsigned long)ConfigFileEntry.sendq_hard_limit, MSG);
+
+	/* going far over drops more, largest first */
+	ConfigFileEntry.sendq_hard_limit = sendq_len(small);
+	sendto_one(small, ":%s NOTICE small :hi", me.name);
+	ok(IsDead(medium), MSG);
+	ok(IsDead(small), MSG);
+	is_int(shed + 3, ServerStats.is_sqshed, MSG);
+
+	ConfigFileEntry.sendq_hard_limit = 0;
+}
+
+static void
+largest(void)
+{
+	struct Client *clients[5];
+	struct Client *largest[3];
+	char nick[NICKLEN];
+	int i;
+
+	for(i = 0; i < 5; i++)
+	{
+		snprintf(nick, sizeof nick, "sized%d", i);
+		clients[i] = make_local_person_nick(nick);
+	}
+
+	/* out of order, and one that stays empty */
+	fill_sendq(clients[0], 2);
+	fill_sendq(clients[1], 5);
+	fill_sendq(clients[3], 1);
+	fill_sendq(clients[4], 3);
+
+	is_int(3, sendq_largest(largest, 3), MSG);
+	ok(largest[0] == clients[1], MSG);
+	ok(largest[1] == clients[4], MSG);
+	ok(largest[2] == clients[0], MSG);
+
+	is_int(4, sendq_largest(largest, 5), MSG);
+	is_int(0, sendq_largest(largest, 0), MSG);
+
+	for(i = 0; i < 5; i++)
+		remove_local_person(clients[i]);
+}
+
+static void
+servers_exempt(void)
+{
+	struct Client *server = make_remote_server(&me);
+	struct Client *user = make_local_person_nick("user");
+	unsigned int shed = ServerStats.is_sqshed;
+	int i;
+
+	for(i = 0; i < 20; i++)
+		sendto_one(server, ":1AA PRIVMSG #a :%0400d", i);
+	fill_sendq(user, 2);
+
+	/* what the server has queued doesn't put the user over */
+	ConfigFileEntry.sendq_hard_limit = sendq_len(user) + 500;
+	ok(sendq_total > (unsigned long)ConfigFileEntry.sendq_hard_limit, MSG);
+	fill_sendq(user, 1);
+	ok(!IsDead(user), MSG);
+	is_int(shed, ServerStats.is_sqshed, MSG);
+
+	/* but the user's own sendq does */
+	fill_sendq(user, 1);
+	ok(IsDead(user), MSG);
+	ok(!IsDead(server), MSG);
+	is_int(shed + 1, ServerStats.is_sqshed, MSG);
+
+	ConfigFileEntry.sendq_hard_limit = 0;
+	discard_sendq(server);
+	remove_remote_server(server);
+	remove_local_person(user);
+}
+
+static void
+soft_limit(void)
+{
+	struct Client *user = make_local_person();
+	struct Client *big = make_local_person_nick("big");
+
+	fill_sendq(big, 4);
+	ConfigFileEntry.sendq_soft_limit = sendq_total - 1;
+	ok(sendq_pressure(), MSG);
+
+	client_util_parse(user, "NAMES " TEST_CHANNEL CRLF);
+	is_client_sendq_one(":me.test 263 " TEST_NICK " NAMES :This command could not be completed because it has been used recently, and is rate-limited." CRLF, user, MSG);
+	is_client_sendq(":me.test 366 " TEST_NICK " " TEST_CHANNEL " :End of /NAMES list." CRLF, user, MSG);
+
+	client_util_parse(user, "MOTD" CRLF);
+	is_client_sendq_one(":me.test 263 " TEST_NICK " MOTD :This command could not be completed because it has been used recently, and is rate-limited." CRLF, user, MSG);
+	is_client_sendq(":me.test 376 " TEST_NICK " :End of /MOTD command." CRLF, user, MSG);
+
+	/* once the sendq has gone, so has the pressure */
+	discard_sendq(big);
+	ok(!sendq_pressure(), MSG);
+
+	client_util_parse(user, "NAMES " TEST_CHANNEL CRLF);
+	is_client_sendq(":me.test 366 " TEST_NICK " " TEST_CHANNEL " :End of /NAMES list." CRLF, user, MSG);
+
+	ConfigFileEntry.sendq_soft_limit = 0;
+	remove_local_person(user);
+	remove_local_person(big);
+}
+
+static void
+server_order(void)
+{
+	struct Client *server = make_remote_server(&me);
+
+	sendto_one(server, ":1AA PRIVMSG #a :one");
+	sendto_one(server, ":1AA TMODE 1 #a +n");
+	sendto_one(server, "PING :me.test");
+	is_int(20, sendq_len(server), MSG);
+	is_int(57, sendq_length(server), MSG);
+
+	/* keepalives first, messages after state */
+	is_client_sendq_one("PING :me.test" CRLF, server, MSG);
+	is_client_sendq_one(":1AA TMODE 1 #a +n" CRLF, server, MSG);
+	is_client_sendq(":1AA PRIVMSG #a :one" CRLF, server, MSG);
+
+	/* a KILL waits for the messages before it, and so does what follows */
+	sendto_one(server, ":1AA PRIVMSG #a :two");
+	sendto_one(server, ":1AA KILL 1AAAAAAAB :bye");
+	sendto_one(server, ":1AA SJOIN 1 #a + :1AAAAAAAB");
+	sendto_one(server, "PING :me.test");
+	is_client_sendq_one("PING :me.test" CRLF, server, MSG);
+	is_client_sendq_one(":1AA PRIVMSG #a :two" CRLF, server, MSG);
+	is_client_sendq_one(":1AA KILL 1AAAAAAAB :bye" CRLF, server, MSG);
+	is_client_sendq(":1AA SJOIN 1 #a + :1AAAAAAAB" CRLF, server, MSG);
+
+	/* and once they have gone, state overtakes messages again */
+	sendto_one(server, ":1AA NOTICE #a :three");
+	sendto_one(server, "@time=x :1AA TOPIC #a :t");
+	sendto_one(server, ":1AA PING 1AA 2BB");
+	is_client_sendq_one("@time=x :1AA TOPIC #a :t" CRLF, server, MSG);
+	is_client_sendq_one(":1AA PING 1AA 2BB" CRLF, server, MSG);
+	is_client_sendq(":1AA NOTICE #a :three" CRLF, server, MSG);
+
+	remove_remote_server(server);
+}
+
+/* messages that have waited behind a burst for SENDQ_BULK_WAIT bytes */
+static void
+burst_order(void)
+{
+	struct Client *server = make_remote_server(&me);
+	char buf[512];
+	int i;
+
+	sendto_one(server, ":1AA EUID burst 1 1 +i ~u h 0 1AAAAAAAB * * :b");
+	sendto_one(server, ":1AA SJOIN 1 #a + :1AAAAAAAB");
+	for(i = 0; i < 300; i++)
+		sendto_one(server, ":1AAAAAAAB PRIVMSG #a :%0300d", i);
+	ok(sendq_length(server) > SENDQ_BULK_WAIT, MSG);
+
+	/* the rest of the burst still goes first, and state after it waits */
+	server->localClient->sendq_bulk_wait = SENDQ_BULK_WAIT;
+	sendto_one(server, ":1AA TMODE 1 #a +n");
+	is_client_sendq_one(":1AA EUID burst 1 1 +i ~u h 0 1AAAAAAAB * * :b" CRLF, server, MSG);
+	is_client_sendq_one(":1AA SJOIN 1 #a + :1AAAAAAAB" CRLF, server, MSG);
+	for(i = 0; i < 300; i++)
+	{
+		snprintf(buf, sizeof(buf), ":1AAAAAAAB PRIVMSG #a :%0300d" CRLF, i);
+		if(strcmp(buf, get_client_sendq(server)) != 0)
+			break;
+	}
+	is_int(300, i, MSG);
+	is_client_sendq(":1AA TMODE 1 #a +n" CRLF, server, MSG);
+
+	remove_remote_server(server);
+}
+
+/* a TLS read that had to wait for a write, with a sendq waiting too */
+static void
+read_wants_write(void)
+{
+	struct Client *user = make_local_person_nick("tls");
+	struct ConfItem *aconf;
+	rb_fde_t *F, *peer;
+	char junk[4096], *out;
+	int i, n, outlen = 0;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F, &peer, "sendq test") < 0)
+	{
+		skip_block(2, "no socketpair");
+		remove_local_person(user);
+		return;
+	}
+	user->localClient->F = F;
+
+	/* the event loop may check everyone for klines, which needs this */
+	aconf = make_conf();
+	aconf->status = CONF_CLIENT;
+	aconf->c_class = make_class();
+	user->localClient->att_conf = aconf;
+
+	/* what is queued now waits for send_queued_write() */
+	memset(junk, 'x', sizeof(junk));
+	while(rb_write(F, junk, sizeof(junk)) > 0)
+		;
+	sendto_one(user, ":%s NOTICE %s :queued", me.name, user->name);
+	ok(sendq_length(user) > 0, MSG);
+
+	/* read_packet() got RB_RW_SSL_NEED_WRITE and armed the write
+	 * handler, which send_queued() has since replaced
+	 */
+	SetReadWantsWrite(user);
+	rb_write(peer, "PING :hello\r\n", 13);
+
+	out = rb_malloc(1024 * 1024);
+	for(i = 0; i < 100 && strstr(out, "PONG") == NULL; i++)
+	{
+		while((n = rb_read(peer, out + outlen, 1024 * 1024 - 1 - outlen)) > 0)
+			outlen += n;
+		out[outlen] = '\0';
+		rb_select(10);
+	}
+	ok(strstr(out, ":" TEST_ME_NAME " PONG " TEST_ME_NAME " :hello" CRLF) != NULL, MSG);
+	rb_free(out);
+
+	user->localClient->att_conf = NULL;
+	free_class(aconf->c_class);
+	free_conf(aconf);
+	remove_local_person(user);
+	rb_close(peer);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	/* first, while every client here can go through the event loop */
+	read_wants_write();
+	accounting();
+	hard_limit();
+	largest();
+	servers_exempt();
+	soft_limit();
+	server_order();
+	burst_order();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *  tgchange1.c: Test target deduplication and target change limits
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "hash.h"
+#include "numeric.h"
+#include "s_conf.h"
+#include "tgchange.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define ALICE_PREFIX ":alice" TEST_ID_SUFFIX
+
+static struct target_set set;
+
+static void
+target_set_dups(void)
+{
+	static char objs[TARGET_SET_SIZE / 2][64];
+	int i, added = 0;
+
+	target_set_clear(&set);
+	is_bool(true, target_set_add(&set, &objs[0]), MSG);
+	is_bool(false, target_set_add(&set, &objs[0]), MSG);
+	is_bool(true, target_set_add(&set, &objs[1]), MSG);
+	is_bool(false, target_set_add(&set, &objs[1]), MSG);
+
+	/* clearing empties it */
+	target_set_clear(&set);
+	is_bool(true, target_set_add(&set, &objs[0]), MSG);
+
+	/* as full as it is allowed to get, every pointer once */
+	target_set_clear(&set);
+	for(i = 0; i < TARGET_SET_SIZE / 2; i++)
+		added += target_set_add(&set, &objs[i]);
+	is_int(TARGET_SET_SIZE / 2, added, MSG);
+	for(i = 0; i < TARGET_SET_SIZE / 2; i++)
+		added -= !target_set_add(&set, &objs[i]);
+	is_int(0, added, MSG);
+}
+
+static void
+target_set_wrap(void)
+{
+	static char a, b;
+
+	target_set_clear(&set);
+	target_set_add(&set, &a);
+
+	/* an entry left from the first generation, seen again as the
+	 * generation comes round
+	 */
+	set.gen = UINT_MAX;
+	target_set_add(&set, &b);
+	target_set_clear(&set);
+	ok(set.gen != 0, MSG);
+	is_bool(true, target_set_add(&set, &a), MSG);
+	is_bool(true, target_set_add(&set, &b), MSG);
+	is_bool(false, target_set_add(&set, &b), MSG);
+}
+
+static void
+privmsg_dups(void)
+{
+	struct Client *alice, *bob, *extra[MAX_TARGETS_DEFAULT];
+	struct Channel *chan;
+	char nick[NICKLEN], expect[BUFSIZE];
+	bool isnew;
+	int i;
+
+	alice = make_local_person_nick("alice");
+	bob = make_local_person_nick("bob");
+	alice->localClient->targets_free = TGCHANGE_NUM;
+
+	/* any number of names for the same target use up one of each */
+	client_util_parse(alice, "PRIVMSG bob,BOB,bob,Bob,bOB,boB :hi");
+	is_client_sendq(ALICE_PREFIX " PRIVMSG bob :hi" CRLF, bob, MSG);
+	is_client_sendq_empty(alice, MSG);
+	is_int(TGCHANGE_NUM - 1, alice->localClient->targets_free, MSG);
+
+	chan = get_or_create_channel(alice, "#a", &isnew);
+	add_user_to_channel(chan, alice, CHFL_PEON);
+	add_user_to_channel(chan, bob, CHFL_PEON);
+	client_util_parse(alice, "PRIVMSG #a,#A,bob,#a :hi");
+	is_client_sendq_one(ALICE_PREFIX " PRIVMSG #a :hi" CRLF, bob, MSG);
+	is_client_sendq(ALICE_PREFIX " PRIVMSG bob :hi" CRLF, bob, MSG);
+	is_client_sendq_empty(alice, MSG);
+
+	/* one target more than max_targets is refused, the ones before
+	 * it are sent
+	 */
+	for(i = 0; i < MAX_TARGETS_DEFAULT; i++)
+	{
+		snprintf(nick, sizeof(nick), "extra%d", i);
+		extra[i] = make_local_person_nick(nick);
+	}
+	client_util_parse(alice, "PRIVMSG extra0,extra1,extra2,bob,extra3 :hi");
+	is_client_sendq(":" TEST_ME_NAME " 407 alice extra3 :Too many recipients." CRLF, alice, MSG);
+	is_client_sendq(ALICE_PREFIX " PRIVMSG bob :hi" CRLF, bob, MSG);
+	is_client_sendq_empty(extra[3], MSG);
+	for(i = 0; i < MAX_TARGETS_DEFAULT - 1; i++)
+	{
+		snprintf(expect, sizeof(expect), ALICE_PREFIX " PRIVMSG extra%d :hi" CRLF, i);
+		is_client_sendq(expect, extra[i], MSG);
+	}
+	for(i = 0; i < MAX_TARGETS_DEFAULT; i++)
+		remove_local_person(extra[i]);
+
+	remove_local_person(bob);
+	remove_local_person(alice);
+}
+
+static uint32_t
+target_hash(struct Client *target_p)
+{
+	return fnv_hash_upper((const unsigned char *)use_id(target_p), 32);
+}
+
+/* targets_filter has the bit of every target, and only those */
+static bool
+filter_matches(struct Client *client_p)
+{
+	uint64_t filter = 0;
+	int i;
+
+	for(i = 0; i < TGCHANGE_NUM + TGCHANGE_REPLY; i++)
+		filter |= (uint64_t)1 << (client_p->localClient->targets[i] & 63);
+	return filter == client_p->localClient->targets_filter;
+}
+
+static void
+tgchange_limits(void)
+{
+	struct Client *server, *alice, *r[TGCHANGE_NUM + 3];
+	char nick[NICKLEN];
+	int i, allowed = 0;
+
+	server = make_remote_server(&me);
+	for(i = 0; i < TGCHANGE_NUM + 3; i++)
+	{
+		snprintf(nick, sizeof(nick), "r%d", i);
+		r[i] = make_remote_person_nick(server, nick);
+	}
+	alice = make_local_person_nick("alice");
+	alice->localClient->targets_free = TGCHANGE_NUM;
+
+	for(i = 0; i < TGCHANGE_NUM; i++)
+		allowed += add_target(alice, r[i]);
+	is_int(TGCHANGE_NUM, allowed, MSG);
+	is_int(0, alice->localClient->targets_free, MSG);
+	ok(filter_matches(alice), MSG);
+
+	/* a new target is refused, one already used is not */
+	is_int(0, add_target(alice, r[TGCHANGE_NUM]), MSG);
+	is_bool(true, IsTGExcessive(alice), MSG);
+	is_int(1, add_target(alice, r[0]), MSG);
+	ok(alice->localClient->targets[0] == target_hash(r[0]), MSG);
+	is_int(1, add_target(alice, r[0]), MSG);
+	ok(filter_matches(alice), MSG);
+
+	/* someone who messaged alice can be answered */
+	add_reply_target(alice, r[TGCHANGE_NUM + 1]);
+	ok(alice->localClient->targets[TGCHANGE_NUM] == target_hash(r[TGCHANGE_NUM + 1]), MSG);
+	ok(filter_matches(alice), MSG);
+	is_int(1, add_target(alice, r[TGCHANGE_NUM + 1]), MSG);
+	is_int(0, alice->localClient->targets_free, MSG);
+
+	/* a minute frees a slot */
+	alice->localClient->target_last -= 60;
+	is_int(1, add_target(alice, r[TGCHANGE_NUM]), MSG);
+	is_int(0, alice->localClient->targets_free, MSG);
+	is_int(0, add_target(alice, r[TGCHANGE_NUM + 2]), MSG);
+	ok(filter_matches(alice), MSG);
+
+	/* targets set directly, as a restart restores them, are found
+	 * once the filter is rebuilt
+	 */
+	memset(alice->localClient->targets, 0, sizeof(alice->localClient->targets));
+	alice->localClient->targets[3] = target_hash(r[5]);
+	alice->localClient->targets[TGCHANGE_NUM + 2] = target_hash(r[6]);
+	alice->localClient->targets_filter = 0;
+	alice->localClient->target_last = rb_current_time();
+	rebuild_target_filter(alice);
+	ok(filter_matches(alice), MSG);
+	is_int(1, add_target(alice, r[5]), MSG);
+	is_int(1, add_target(alice, r[6]), MSG);
+	is_int(0, add_target(alice, r[7]), MSG);
+
+	remove_local_person(alice);
+	remove_remote_server(server);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan_lazy();
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	target_set_dups();
+	target_set_wrap();
+	privmsg_dups();
+	tgchange_limits();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
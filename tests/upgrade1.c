@@ -0,0 +1,393 @@
+/*
+ *  upgrade1.c: Test saving and restoring state across an upgrade
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "tap/basic.h"
+
+#include "ircd_util.h"
+#include "client_util.h"
+
+#include "channel.h"
+#include "hash.h"
+#include "packet.h"
+#include "send.h"
+#include "s_conf.h"
+#include "s_serv.h"
+#include "sslproc.h"
+#include "upgrade.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define ALICE_ID TEST_ME_ID "AAAAAA"
+#define BOB_ID TEST_ME_ID "AAAAAB"
+#define CAROL_ID TEST_SERVER_ID "AAAAAC"
+
+#define PLAN 56
+
+/* the bytes a sendq still has to write, as the snapshot has them */
+static char *
+queued_text(buf_head_t *bufhead)
+{
+	rb_dlink_node *ptr;
+	buf_line_t *line;
+	char *text = rb_malloc(rb_linebuf_len(bufhead) + 1);
+	size_t len = 0;
+	int ofs = bufhead->writeofs;
+
+	RB_DLINK_FOREACH(ptr, bufhead->list.head)
+	{
+		line = ptr->data;
+		memcpy(text + len, line->buf + ofs, line->len - ofs);
+		len += line->len - ofs;
+		ofs = 0;
+	}
+	text[len] = '\0';
+	return text;
+}
+
+static char *
+ban_text(rb_dlink_list *list)
+{
+	static char buf[BUFSIZE];
+	rb_dlink_node *ptr;
+	struct Ban *banptr;
+
+	buf[0] = '\0';
+	RB_DLINK_FOREACH(ptr, list->head)
+	{
+		banptr = ptr->data;
+		rb_snprintf_append(buf, sizeof(buf), "%s %s %s %ld;", banptr->banstr, banptr->who,
+				banptr->forward != NULL ? banptr->forward : "-", (long)banptr->when);
+	}
+	return buf;
+}
+
+/* nothing more can be written, so whatever is queued stays queued */
+static void
+fill(rb_fde_t *F)
+{
+	char junk[4096];
+
+	memset(junk, 'x', sizeof(junk));
+	while(write(rb_get_fd(F), junk, sizeof(junk)) > 0)
+		;
+	while(write(rb_get_fd(F), junk, 1) > 0)
+		;
+}
+
+/* what registering would have done for the snapshot to find them */
+static void
+register_user(struct Client *client_p, const char *id)
+{
+	rb_strlcpy(client_p->id, id, sizeof(client_p->id));
+	add_to_id_hash(client_p->id, client_p);
+	rb_dlinkAddTail(client_p, &client_p->node, &global_client_list);
+	Count.total++;
+}
+
+static struct Client *
+attach(struct Client *client_p, rb_fde_t **peer)
+{
+	rb_fde_t *F;
+
+	if(rb_socketpair(AF_UNIX, SOCK_STREAM, 0, &F, peer, "upgrade test") < 0)
+		return NULL;
+	client_p->localClient->F = F;
+	return client_p;
+}
+
+/* the ssld helpers' sockets, which the snapshot hands over too */
+static int helper_fds[8];
+static int helper_count;
+
+static void
+find_helper(void *unused, rb_fde_t *F, rb_fde_t *P, pid_t pid, bool shutdown, const char *version)
+{
+	if(helper_count + 2 > (int)ARRAY_SIZE(helper_fds))
+		return;
+	helper_fds[helper_count++] = rb_get_fd(F);
+	helper_fds[helper_count++] = rb_get_fd(P);
+}
+
+static unsigned long
+all_queued(void)
+{
+	rb_dlink_node *ptr;
+	unsigned long queued = 0;
+
+	RB_DLINK_FOREACH(ptr, serv_list.head)
+		queued += sendq_length(ptr->data);
+	RB_DLINK_FOREACH(ptr, lclient_list.head)
+		queued += sendq_length(ptr->data);
+	return queued;
+}
+
+static void
+round_trip(void)
+{
+	struct Client *server, *alice, *bob, *carol;
+	struct Channel *chan;
+	struct membership *msptr;
+	struct Ban *banptr;
+	rb_fde_t *peer[3];
+	int fds[3], saved[3], helper_saved[ARRAY_SIZE(helper_fds)];
+	char *control, *normal, *bulk, *alice_sendq, *text;
+	char bans[4][BUFSIZE];
+	char fdbuf[16];
+	FILE *f;
+	unsigned int alice_flags, alice_umodes, alice_caps, server_caps;
+	unsigned long base = sendq_total;
+	int bulk_wait, barrier, alice_sendm, helpers, ssld_count, i, fd;
+	bool isnew;
+
+	server = make_remote_server_full(&me, TEST_SERVER_NAME, TEST_SERVER_ID);
+	carol = make_remote_person_nick(server, "carol");
+	alice = make_local_person_nick("alice");
+	bob = make_local_person_nick("bob");
+	register_user(carol, CAROL_ID);
+	register_user(alice, ALICE_ID);
+	register_user(bob, BOB_ID);
+
+	if(attach(server, &peer[0]) == NULL ||
+			attach(alice, &peer[1]) == NULL ||
+			attach(bob, &peer[2]) == NULL)
+	{
+		skip_block(PLAN - 1, "no socketpair");
+		return;
+	}
+	fds[0] = rb_get_fd(server->localClient->F);
+	fds[1] = rb_get_fd(alice->localClient->F);
+	fds[2] = rb_get_fd(bob->localClient->F);
+
+	server->serv->caps = CAP_TS6 | CAP_ENCAP;
+
+	alice->umodes |= UMODE_WALLOP | UMODE_DEAF;
+	alice->flags |= FLAGS_EXEMPTFLOOD | FLAGS_IDENTIFIED;
+	alice->localClient->caps = CLICAP_BATCH | CLICAP_AWAY_NOTIFY;
+	/* past 32 bits, with some bytes over a whole kilobyte */
+	alice->localClient->sendB = ((uint64_t)5 << 32) + 1023;
+	alice->localClient->receiveB = ((uint64_t)1 << 40) + 513;
+
+	chan = get_or_create_channel(alice, "#a", &isnew);
+	add_user_to_channel(chan, alice, CHFL_CHANOP);
+	add_user_to_channel(chan, bob, CHFL_VOICE);
+	add_user_to_channel(chan, carol, CHFL_PEON);
+	chan->mode.mode = MODE_SECRET | MODE_TOPICLIMIT | MODE_NOPRIVMSGS;
+	chan->mode.limit = 42;
+	rb_strlcpy(chan->mode.key, "sekrit", sizeof(chan->mode.key));
+	set_channel_topic(chan, "the topic", "alice", 1234);
+
+	banptr = allocate_ban("*!*@bad.test", "alice", NULL);
+	banptr->when = 100;
+	rb_dlinkAdd(banptr, &banptr->node, &chan->banlist);
+	banptr = allocate_ban("*!*@worse.test", "alice", "#elsewhere");
+	banptr->when = 101;
+	rb_dlinkAdd(banptr, &banptr->node, &chan->banlist);
+	banptr = allocate_ban("*!*@good.test", "bob", NULL);
+	rb_dlinkAdd(banptr, &banptr->node, &chan->exceptlist);
+	banptr = allocate_ban("*!*@invited.test", "bob", NULL);
+	rb_dlinkAdd(banptr, &banptr->node, &chan->invexlist);
+	banptr = allocate_ban("*!*@loud.test", "alice", NULL);
+	rb_dlinkAdd(banptr, &banptr->node, &chan->quietlist);
+	rb_strlcpy(bans[0], ban_text(&chan->banlist), sizeof(bans[0]));
+	rb_strlcpy(bans[1], ban_text(&chan->exceptlist), sizeof(bans[1]));
+	rb_strlcpy(bans[2], ban_text(&chan->invexlist), sizeof(bans[2]));
+	rb_strlcpy(bans[3], ban_text(&chan->quietlist), sizeof(bans[3]));
+
+	/* one line in each of the server's sendqs, one queued to alice */
+	fill(server->localClient->F);
+	fill(alice->localClient->F);
+	sendto_one(server, ":%s TMODE 1 #a +n", me.id);
+	sendto_one(server, ":%s PRIVMSG #a :hello", ALICE_ID);
+	sendto_one(server, "PING :%s", me.name);
+	sendto_one(alice, ":%s NOTICE alice :still queued", me.name);
+
+	/* and half a line bob has sent */
+	text = recvq_reserve(bob->localClient);
+	memcpy(text, "PRIVMSG #a :hal", 15);
+	bob->localClient->recvq_end += 15;
+	recvq_retain(bob->localClient);
+
+	control = queued_text(&server->localClient->buf_sendq_control);
+	normal = queued_text(&server->localClient->buf_sendq);
+	bulk = queued_text(&server->localClient->buf_sendq_bulk);
+	alice_sendq = queued_text(&alice->localClient->buf_sendq);
+	is_string("PING :" TEST_ME_NAME CRLF, control, MSG);
+	is_string(":" TEST_ME_ID " TMODE 1 #a +n" CRLF, normal, MSG);
+	is_string(":" ALICE_ID " PRIVMSG #a :hello" CRLF, bulk, MSG);
+	bulk_wait = server->localClient->sendq_bulk_wait;
+	barrier = server->localClient->sendq_barrier;
+	alice_flags = alice->flags;
+	alice_umodes = alice->umodes;
+	alice_caps = alice->localClient->caps;
+	alice_sendm = alice->localClient->sendM;
+	server_caps = server->serv->caps;
+
+	f = tmpfile();
+	if(!ok(f != NULL, MSG))
+		return;
+	ok(upgrade_save(f), MSG);
+
+	/* everything goes, but the connections are held open for the
+	 * restored clients to find
+	 */
+	for(i = 0; i < 3; i++)
+		saved[i] = dup(fds[i]);
+	remove_remote_server(server);
+	remove_local_person(alice);
+	remove_local_person(bob);
+	for(i = 0; i < 3; i++)
+	{
+		dup2(saved[i], fds[i]);
+		close(saved[i]);
+	}
+	ok(find_channel("#a") == NULL, MSG);
+	ok(find_id(CAROL_ID) == NULL, MSG);
+	ok(sendq_total == base, MSG);
+
+	/* and so do the ssld helpers, whose sockets are held open the
+	 * same way
+	 */
+	helpers = get_ssld_count();
+	ssld_foreach_handoff(find_helper, NULL);
+	for(i = 0; i < helper_count; i++)
+		helper_saved[i] = dup(helper_fds[i]);
+	ssld_count = ServerInfo.ssld_count;
+	ServerInfo.ssld_count = 0;
+	restart_ssld();
+	ServerInfo.ssld_count = ssld_count;
+	is_int(0, get_ssld_count(), MSG);
+	for(i = 0; i < helper_count; i++)
+	{
+		dup2(helper_saved[i], helper_fds[i]);
+		close(helper_saved[i]);
+	}
+
+	fd = dup(fileno(f));
+	fclose(f);
+	lseek(fd, 0, SEEK_SET);
+	snprintf(fdbuf, sizeof(fdbuf), "%d", fd);
+	setenv(UPGRADE_FD_ENV, fdbuf, 1);
+	if(!ok(upgrade_pending(), MSG))
+		return;
+	upgrade_restore_helpers();
+	is_int(helpers, get_ssld_count(), MSG);
+	upgrade_restore();
+
+	server = find_server(NULL, TEST_SERVER_NAME);
+	alice = find_named_person("alice");
+	bob = find_named_person("bob");
+	carol = find_named_person("carol");
+	if(!ok(server != NULL && alice != NULL && bob != NULL && carol != NULL, MSG))
+		return;
+
+	is_bool(true, MyConnect(server), MSG);
+	is_int(fds[0], rb_get_fd(server->localClient->F), MSG);
+	is_string(TEST_SERVER_ID, server->id, MSG);
+	is_int(server_caps, server->serv->caps, MSG);
+	is_bool(true, IsClient(carol) && !MyConnect(carol), MSG);
+	ok(carol->servptr == server, MSG);
+	is_string(CAROL_ID, carol->id, MSG);
+
+	is_bool(true, MyClient(alice), MSG);
+	is_int(fds[1], rb_get_fd(alice->localClient->F), MSG);
+	is_string(ALICE_ID, alice->id, MSG);
+	is_int(alice_flags, alice->flags, MSG);
+	is_int(alice_umodes, alice->umodes, MSG);
+	is_int(alice_caps, alice->localClient->caps, MSG);
+	is_int(alice_sendm, alice->localClient->sendM, MSG);
+	ok(alice->localClient->sendB == ((uint64_t)5 << 32) + 1023, MSG);
+	ok(alice->localClient->receiveB == ((uint64_t)1 << 40) + 513, MSG);
+	ok(alice->localClient->att_conf != NULL, MSG);
+
+	text = queued_text(&server->localClient->buf_sendq_control);
+	is_string(control, text, MSG);
+	rb_free(text);
+	text = queued_text(&server->localClient->buf_sendq);
+	is_string(normal, text, MSG);
+	rb_free(text);
+	text = queued_text(&server->localClient->buf_sendq_bulk);
+	is_string(bulk, text, MSG);
+	rb_free(text);
+	is_int(bulk_wait, server->localClient->sendq_bulk_wait, MSG);
+	is_int(barrier, server->localClient->sendq_barrier, MSG);
+	text = queued_text(&alice->localClient->buf_sendq);
+	is_string(alice_sendq, text, MSG);
+	rb_free(text);
+
+	/* what is queued is counted again, and leaves again when sent */
+	ok(sendq_total == base + all_queued(), MSG);
+	ok(sendq_peak >= sendq_total, MSG);
+
+	is_int(15, bob->localClient->recvq_end - bob->localClient->recvq_start, MSG);
+	ok(bob->localClient->recvq != NULL &&
+			!memcmp(bob->localClient->recvq + bob->localClient->recvq_start, "PRIVMSG #a :hal", 15), MSG);
+
+	chan = find_channel("#a");
+	if(ok(chan != NULL, MSG))
+	{
+		is_int(MODE_SECRET | MODE_TOPICLIMIT | MODE_NOPRIVMSGS, chan->mode.mode, MSG);
+		is_int(42, chan->mode.limit, MSG);
+		is_string("sekrit", chan->mode.key, MSG);
+		is_string("the topic", chan->topic, MSG);
+		is_string("alice", chan->topic_info, MSG);
+		is_int(1234, chan->topic_time, MSG);
+		is_string(bans[0], ban_text(&chan->banlist), MSG);
+		is_string(bans[1], ban_text(&chan->exceptlist), MSG);
+		is_string(bans[2], ban_text(&chan->invexlist), MSG);
+		is_string(bans[3], ban_text(&chan->quietlist), MSG);
+
+		is_int(3, rb_dlink_list_length(&chan->members), MSG);
+		msptr = find_channel_membership(chan, alice);
+		is_int(CHFL_CHANOP, msptr != NULL ? msptr->flags : -1, MSG);
+		msptr = find_channel_membership(chan, bob);
+		is_int(CHFL_VOICE, msptr != NULL ? msptr->flags : -1, MSG);
+		msptr = find_channel_membership(chan, carol);
+		is_int(CHFL_PEON, msptr != NULL ? msptr->flags : -1, MSG);
+	}
+
+	remove_remote_server(server);
+	remove_local_person(alice);
+	remove_local_person(bob);
+	ok(sendq_total == base, MSG);
+
+	for(i = 0; i < 3; i++)
+		rb_close(peer[i]);
+	rb_free(control);
+	rb_free(normal);
+	rb_free(bulk);
+	rb_free(alice_sendq);
+}
+
+int
+main(int argc, char *argv[])
+{
+	plan(PLAN);
+
+	ircd_util_init(__FILE__);
+	client_util_init();
+
+	round_trip();
+
+	client_util_free();
+	ircd_util_free();
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ *  zlink1.c: Test compressed server link streams
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "tap/basic.h"
+
+#include "stdinc.h"
+#include "ircd_defs.h"
+#include "zlink.h"
+
+#define MSG "%s:%d (%s)", __FILE__, __LINE__, __FUNCTION__
+
+#define BURST_LINES	3000
+
+static char plain[1024 * 1024];
+static int plain_len;
+
+static void
+make_burst(void)
+{
+	int i;
+
+	plain_len = 0;
+	for(i = 0; i < BURST_LINES; i++)
+	{
+		if(i % 10 == 9)
+			plain_len += sprintf(plain + plain_len,
+					":1AA SJOIN 1700000000 #chan%d +nt :@1AAAAA%03d 1AAAAB%03d\r\n",
+					i, i % 1000, (i * 7) % 1000);
+		else
+			plain_len += sprintf(plain + plain_len,
+					":1AA EUID nick%d 1 1700000000 +i ~user%d host%d.example.net 192.0.2.%d 1AAAA%04d * * :Real Name %d\r\n",
+					i, i, i, i % 256, i, i);
+	}
+}
+
+/* everything in a zlink's sendq */
+static int
+drain_sendq(struct zlink *z, char *buf, int size)
+{
+	int n, len = 0;
+
+	while(rb_rawbuf_length(zlink_sendq(z)) > 0 &&
+			(n = rb_rawbuf_get(zlink_sendq(z), buf + len, size - len)) > 0)
+		len += n;
+	return len;
+}
+
+static int
+inflate_all(struct zlink *z, const char *in, int len, char *out, int size)
+{
+	int n, outlen = 0;
+
+	zlink_input(z, in, len);
+	while((n = zlink_inflate(z, out + outlen, size - outlen > 4096 ? 4096 : size - outlen)) > 0)
+		outlen += n;
+
+	return n < 0 ? -1 : outlen;
+}
+
+static void
+round_trip(void)
+{
+	struct zlink *out = zlink_new(9);
+	struct zlink *in = zlink_new(0);
+	static char compressed[1024 * 1024];
+	static char got[1024 * 1024];
+	struct zlink_stats stats;
+	int clen, glen, pos, chunk, n;
+
+	make_burst();
+
+	/* plain bytes first, as left over from before compression started */
+	zlink_append(out, "SERVER x 1 :y\r\n", 15);
+	ok(drain_sendq(out, compressed, sizeof(compressed)) == 15, MSG);
+
+	for(pos = 0; pos < plain_len; pos += n)
+	{
+		n = strchr(plain + pos, '\n') - (plain + pos) + 1;
+		zlink_deflate(out, plain + pos, n);
+		if(pos % 7 == 0)
+			zlink_deflate_flush(out);
+	}
+	zlink_deflate_flush(out);
+
+	clen = drain_sendq(out, compressed, sizeof(compressed));
+	ok(clen > 0 && clen < plain_len / 4, MSG);
+
+	/* fed in awkward pieces, with the CR LF of the line before it */
+	glen = 0;
+	zlink_input(in, "\n", 1);
+	ok(zlink_inflate(in, got, sizeof(got)) == 0, MSG);
+	for(pos = 0; pos < clen; pos += chunk)
+	{
+		chunk = 1 + (pos * 31) % 997;
+		if(chunk > clen - pos)
+			chunk = clen - pos;
+		n = inflate_all(in, compressed + pos, chunk, got + glen, sizeof(got) - glen);
+		if(n < 0)
+			break;
+		glen += n;
+	}
+
+	is_int(plain_len, glen, MSG);
+	ok(memcmp(plain, got, plain_len) == 0, MSG);
+
+	zlink_get_stats(out, &stats);
+	is_int(9, stats.level, MSG);
+	ok(stats.out_plain == (unsigned long long)plain_len, MSG);
+	ok(stats.out == (unsigned long long)clen, MSG);
+
+	zlink_get_stats(in, &stats);
+	is_int(6, stats.level, MSG);
+	ok(stats.in_plain == (unsigned long long)plain_len, MSG);
+
+	zlink_free(out);
+	zlink_free(in);
+}
+
+/* a few compressed bytes that inflate to far more than one buffer */
+static void
+small_buffers(void)
+{
+	struct zlink *out = zlink_new(9);
+	struct zlink *in = zlink_new(9);
+	struct zlink *ref = zlink_new(9);
+	static char compressed[4096];
+	static char got[65536], want[65536];
+	int clen, n, glen = 0, wlen = 0, i, good = 1;
+
+	for(i = 0; i < 1000; i++)
+		zlink_deflate(out, "PING :aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\r\n", 58);
+	zlink_deflate_flush(out);
+	clen = drain_sendq(out, compressed, sizeof(compressed));
+	ok(clen > 0 && clen < 1000, MSG);
+
+	/* a byte at a time, so some reads end just after a long match;
+	 * whatever that match makes must come out before more is read
+	 */
+	for(i = 0; i < clen; i++)
+	{
+		zlink_input(ref, compressed + i, 1);
+		while((n = zlink_inflate(ref, want + wlen, sizeof(want) - wlen)) > 0)
+			wlen += n;
+
+		zlink_input(in, compressed + i, 1);
+		while((n = zlink_inflate(in, got + glen, 7)) > 0)
+			glen += n;
+
+		if(n < 0 || glen != wlen)
+			good = 0;
+	}
+
+	ok(good, MSG);
+	is_int(58000, glen, MSG);
+	ok(memcmp(got, want, glen) == 0, MSG);
+
+	zlink_free(out);
+	zlink_free(in);
+	zlink_free(ref);
+}
+
+static void
+pending(void)
+{
+	struct zlink *out = zlink_new(1);
+	struct zlink *in = zlink_new(1);
+	char compressed[4096], got[4096];
+	int clen, n, glen = 0;
+
+	zlink_deflate(out, "PING :x\r\n", 9);
+	zlink_deflate_flush(out);
+	clen = drain_sendq(out, compressed, sizeof(compressed));
+
+	zlink_set_pending(in, compressed, clen);
+	ok(zlink_input_pending(in), MSG);
+
+	/* the copy is used, not what it was made from */
+	memset(compressed, 0, sizeof(compressed));
+	while((n = zlink_inflate(in, got + glen, sizeof(got) - glen)) > 0)
+		glen += n;
+
+	is_int(0, n, MSG);
+	is_int(9, glen, MSG);
+	ok(memcmp(got, "PING :x\r\n", 9) == 0, MSG);
+	ok(!zlink_input_pending(in), MSG);
+
+	zlink_free(out);
+	zlink_free(in);
+}
+
+static void
+errors(void)
+{
+	struct zlink *in = zlink_new(6);
+	char compressed[256], got[256];
+	z_stream zs;
+	int clen;
+
+	/* a stream made with some other dictionary */
+	memset(&zs, 0, sizeof(zs));
+	deflateInit(&zs, 6);
+	deflateSetDictionary(&zs, (const Bytef *)"something else", 14);
+	zs.next_in = (Bytef *)"PING :x\r\n";
+	zs.avail_in = 9;
+	zs.next_out = (Bytef *)compressed;
+	zs.avail_out = sizeof(compressed);
+	deflate(&zs, Z_SYNC_FLUSH);
+	clen = sizeof(compressed) - zs.avail_out;
+	deflateEnd(&zs);
+
+	is_int(-1, inflate_all(in, compressed, clen, got, sizeof(got)), MSG);
+	is_string("dictionary mismatch", zlink_error(in), MSG);
+
+	/* and once broken, it stays broken */
+	is_int(-1, inflate_all(in, compressed, clen, got, sizeof(got)), MSG);
+	zlink_free(in);
+
+	/* plain text where compressed data should be */
+	in = zlink_new(6);
+	is_int(-1, inflate_all(in, "PING :x\r\n", 9, got, sizeof(got)), MSG);
+	zlink_free(in);
+}
+
+int main(int argc, char *argv[])
+{
+	rb_lib_init(NULL, NULL, NULL, 0, 1024, DNODE_HEAP_SIZE, FD_HEAP_SIZE);
+	rb_linebuf_init(LINEBUF_HEAP_SIZE);
+	rb_init_rawbuffers(RAWBUF_HEAP_SIZE);
+
+	plan_lazy();
+
+	round_trip();
+	small_buffers();
+	pending();
+	errors();
+
+	return 0;
+}
@@ -0,0 +1,416 @@
+/*
+ *  tlsbench.c: Compare TLS listener modes by message rate and CPU
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ *  USA
+ */
+
+/*
+ * For each TLS port given, connect that many TLS clients to one channel,
+ * have a plain client say things in it, and time how long until every
+ * TLS client has seen every message.  The CPU the ircd and ssld pids
+ * used meanwhile is read from /proc.  Run it against an sslport with
+ * inline_tls and one without to compare the two.
+ *
+ * The sender has to be allowed to flood and all the clients come from
+ * one address, so raise client_flood_*, default_floodcount,
+ * throttle_count and the class's per-ip limits on the test server.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "rb_lib.h"
+
+#define WINDOW		200	/* messages sent per PING */
+#define MAX_PIDS	16
+#define TIME_LIMIT	300
+#define READ_SIZE	16384
+
+struct bconn
+{
+	rb_fde_t *F;
+	buf_head_t recvq;
+	rawbuf_head_t *sendq;
+	char nick[16];
+	int sender;
+	long received;
+};
+
+static struct bconn *receivers;
+static struct bconn sender;
+
+static int nclients = 50;
+static int nmessages = 2000;
+static int plain_port = 6667;
+static const char *host = "127.0.0.1";
+static const char *keyfile;
+static pid_t pids[MAX_PIDS];
+static int npids;
+
+static int round_num;
+static int tls_port;
+static int joined, done, sent;
+static int finished;
+static char channel[32];
+static struct timespec start_time;
+static unsigned long long start_cpu[MAX_PIDS];
+
+static void conn_start(struct bconn *conn, int port, int tls);
+
+static void
+fail(const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static void
+lib_log(const char *str)
+{
+	fprintf(stderr, "librb: %s\n", str);
+}
+
+/* user and system time of a process, in clock ticks */
+static unsigned long long
+process_cpu(pid_t pid)
+{
+	char path[64], buf[1024], *p;
+	unsigned long long utime, stime;
+	FILE *f;
+	size_t len;
+
+	snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+	if((f = fopen(path, "r")) == NULL)
+		return 0;
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = '\0';
+
+	/* skip past the command, which may have spaces in */
+	if((p = strrchr(buf, ')')) == NULL ||
+	   sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+		return 0;
+
+	return utime + stime;
+}
+
+static void
+conn_flush(rb_fde_t *F, void *data)
+{
+	struct bconn *conn = data;
+	int ret = 0;
+
+	while(rb_rawbuf_length(conn->sendq) > 0 && (ret = rb_rawbuf_flush(conn->sendq, F)) > 0)
+		;
+
+	if(ret < 0 && !rb_ignore_errno(errno))
+		fail("%s: write error: %s", conn->nick, strerror(errno));
+
+	if(rb_rawbuf_length(conn->sendq) > 0)
+		rb_setselect(F, RB_SELECT_WRITE, conn_flush, conn);
+}
+
+static void
+conn_send(struct bconn *conn, const char *format, ...)
+{
+	char buf[BUFSIZ];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(buf, sizeof(buf) - 2, format, args);
+	va_end(args);
+
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	rb_rawbuf_append(conn->sendq, buf, len);
+}
+
+static void
+send_window(void)
+{
+	int i;
+
+	for(i = 0; i < WINDOW && sent < nmessages; i++, sent++)
+		conn_send(&sender, "PRIVMSG %s :%d the quick brown fox jumps over the lazy dog", channel, sent);
+
+	/* the PONG says the server has got through this window */
+	if(sent < nmessages)
+		conn_send(&sender, "PING :%d", sent);
+
+	conn_flush(sender.F, &sender);
+}
+
+static void
+finish_round(void)
+{
+	struct timespec end;
+	double secs, cpu_ms;
+	long delivered = (long)nclients * nmessages;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	secs = (end.tv_sec - start_time.tv_sec) + (end.tv_nsec - start_time.tv_nsec) / 1e9;
+
+	printf("port %d: %d TLS clients, %d messages: %ld delivered in %.3f s, %.0f msgs/s\n",
+			tls_port, nclients, nmessages, delivered, secs, delivered / secs);
+
+	for(i = 0; i < npids; i++)
+	{
+		cpu_ms = (process_cpu(pids[i]) - start_cpu[i]) * 1000.0 / sysconf(_SC_CLK_TCK);
+		printf("  pid %d: %.0f ms cpu, %.2f ms per TLS client, %.2f us per message\n",
+				(int)pids[i], cpu_ms, cpu_ms / nclients, cpu_ms * 1000 / delivered);
+	}
+
+	finished = 1;
+}
+
+static void
+handle_line(struct bconn *conn, char *line)
+{
+	char *command;
+	int numeric;
+
+	if(strncmp(line, "PING ", 5) == 0)
+	{
+		conn_send(conn, "PONG %s", line + 5);
+		conn_flush(conn->F, conn);
+		return;
+	}
+
+	if(strncmp(line, "ERROR ", 6) == 0 || strstr(line, "throttled due to flooding") != NULL)
+		fail("%s: %s", conn->nick, line);
+
+	if(*line != ':' || (command = strchr(line, ' ')) == NULL)
+		return;
+	command++;
+
+	numeric = atoi(command);
+	if(numeric == 1)
+	{
+		conn_send(conn, "JOIN %s", channel);
+		conn_flush(conn->F, conn);
+	}
+	else if(numeric >= 400 && numeric < 600)
+		fail("%s: %s", conn->nick, line);
+	else if(strncmp(command, "JOIN ", 5) == 0 &&
+			strncmp(line + 1, conn->nick, strlen(conn->nick)) == 0 &&
+			line[strlen(conn->nick) + 1] == '!')
+	{
+		if(!conn->sender)
+		{
+			/* everyone is listening, start talking */
+			if(++joined == nclients)
+				conn_start(&sender, plain_port, 0);
+			return;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start_time);
+		for(int i = 0; i < npids; i++)
+			start_cpu[i] = process_cpu(pids[i]);
+		send_window();
+	}
+	else if(strncmp(command, "PONG ", 5) == 0 && conn->sender)
+		send_window();
+	else if(strncmp(command, "PRIVMSG ", 8) == 0 && !conn->sender)
+	{
+		if(++conn->received == nmessages && ++done == nclients)
+			finish_round();
+	}
+}
+
+static void
+conn_read(rb_fde_t *F, void *data)
+{
+	struct bconn *conn = data;
+	char buf[READ_SIZE];
+	char line[LINEBUF_SIZE + 1];
+	int length;
+
+	while((length = rb_read(F, buf, sizeof(buf))) > 0)
+	{
+		rb_linebuf_parse(&conn->recvq, buf, length, 1);
+		while(rb_linebuf_get(&conn->recvq, line, sizeof(line), LINEBUF_COMPLETE, LINEBUF_PARSED) > 0)
+		{
+			handle_line(conn, line);
+			if(finished)
+				return;
+		}
+	}
+
+	if(length == 0)
+		fail("%s: server closed the connection", conn->nick);
+	if(length == RB_RW_SSL_NEED_WRITE)
+		rb_setselect(F, RB_SELECT_WRITE, conn_read, conn);
+	else if(rb_ignore_errno(errno))
+		rb_setselect(F, RB_SELECT_READ, conn_read, conn);
+	else
+		fail("%s: read error: %s", conn->nick, strerror(errno));
+}
+
+static void
+conn_connected(rb_fde_t *F, int status, void *data)
+{
+	struct bconn *conn = data;
+
+	if(status != RB_OK)
+		fail("%s: connect: %s", conn->nick, rb_errstr(status));
+
+	conn_send(conn, "NICK %s", conn->nick);
+	conn_send(conn, "USER tlsbench 0 * :tlsbench");
+	conn_flush(F, conn);
+	conn_read(F, conn);
+}
+
+static void
+conn_start(struct bconn *conn, int port, int tls)
+{
+	struct rb_sockaddr_storage addr;
+
+	if(rb_inet_pton_sock(host, &addr) <= 0)
+		fail("bad address %s", host);
+	SET_SS_PORT(&addr, htons(port));
+
+	conn->F = rb_socket(GET_SS_FAMILY(&addr), SOCK_STREAM, 0, "tlsbench");
+	if(conn->F == NULL)
+		fail("socket: %s", strerror(errno));
+
+	rb_linebuf_newbuf(&conn->recvq);
+	conn->sendq = rb_new_rawbuffer();
+
+	if(tls)
+		rb_connect_tcp_ssl(conn->F, (struct sockaddr *)&addr, NULL, conn_connected, conn, 30);
+	else
+		rb_connect_tcp(conn->F, (struct sockaddr *)&addr, NULL, conn_connected, conn, 30);
+}
+
+static void
+conn_close(struct bconn *conn)
+{
+	rb_close(conn->F);
+	rb_linebuf_donebuf(&conn->recvq);
+	rb_free_rawbuffer(conn->sendq);
+	memset(conn, 0, sizeof(*conn));
+}
+
+static void
+run_round(int port)
+{
+	time_t started = time(NULL);
+	int i;
+
+	round_num++;
+	tls_port = port;
+	joined = done = sent = finished = 0;
+	snprintf(channel, sizeof channel, "#tlsbench%d", round_num);
+
+	for(i = 0; i < nclients; i++)
+	{
+		snprintf(receivers[i].nick, sizeof receivers[i].nick, "tb%d_%d", round_num, i);
+		conn_start(&receivers[i], port, 1);
+	}
+
+	snprintf(sender.nick, sizeof sender.nick, "tb%d_sender", round_num);
+	sender.sender = 1;
+
+	while(!finished)
+	{
+		rb_select(250);
+		rb_event_run();
+
+		if(time(NULL) - started > TIME_LIMIT)
+			fail("port %d: gave up after %d seconds, %d joined, %d done",
+					port, TIME_LIMIT, joined, done);
+	}
+
+	for(i = 0; i < nclients; i++)
+		conn_close(&receivers[i]);
+	conn_close(&sender);
+	rb_close_pending_fds();
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: tlsbench [-h host] [-p plainport] [-c clients] [-m messages]\n"
+			"                [-k keyfile] [-P pid]... certfile tlsport...\n"
+			"  certfile is any certificate and key, only to set up TLS with\n"
+			"  -P gives an ircd or ssld pid to measure the CPU of\n");
+	exit(64);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+
+	while((opt = getopt(argc, argv, "h:p:c:m:k:P:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			plain_port = atoi(optarg);
+			break;
+		case 'c':
+			nclients = atoi(optarg);
+			break;
+		case 'm':
+			nmessages = atoi(optarg);
+			break;
+		case 'k':
+			keyfile = optarg;
+			break;
+		case 'P':
+			if(npids < MAX_PIDS)
+				pids[npids++] = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if(argc - optind < 2 || nclients <= 0 || nmessages <= 0)
+		usage();
+
+	signal(SIGPIPE, SIG_IGN);
+
+	rb_lib_init(lib_log, NULL, NULL, 0, nclients + 64, 1024, 1024);
+	rb_linebuf_init(1024);
+	rb_init_rawbuffers(1024);
+	rb_init_prng(NULL, RB_PRNG_DEFAULT);
+
+	if(!rb_supports_ssl())
+		fail("librb was built without TLS support");
+	if(!rb_setup_ssl_server(argv[optind], keyfile, NULL, NULL))
+		fail("could not set up TLS with %s", argv[optind]);
+
+	receivers = rb_malloc(sizeof(struct bconn) * nclients);
+
+	for(optind++; optind < argc; optind++)
+		run_round(atoi(argv[optind]));
+
+	return 0;
+}